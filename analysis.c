@@ -0,0 +1,792 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "analysis.h"
+#include "preprocessor.h"
+#include "passes.h"
+#include "expr.h"
+#include "data.h"
+#include "utils.h"
+#include "errors.h"
+
+#define TOO_MUCH_MEMORY "The input file requires too much memory."
+
+/* "Private" helper functions */
+status parse_analysis_line(analysis *doc, analysis_line *line, int number);
+status collect_line_symbols(analysis_line *line);
+void drop_line_diagnostics(analysis_line *line, status code);
+status add_line_symbol(analysis_line *line, const char *label, Directive dir, int offset);
+status walk_lines(analysis *doc);
+status check_symbols(analysis *doc);
+status check_line_symbols(analysis *doc, const analysis_line *line, int number, int address);
+status check_call_symbols(analysis *doc, int macro, int number, int *address);
+void close_analysis_macro(analysis *doc, int macro, int end);
+status flatten_analysis_macro(analysis *doc, int macro, int depth, int *failed);
+void reset_analysis_macros(analysis *doc);
+status grow_array(void **array, size_t *cap, size_t needed, size_t size);
+long add_analysis_symbol(analysis *doc, const char *label);
+const char *analysis_slot_label(const void *table, size_t slot);
+int has_long_word(const char *text);
+int is_macro_body(const analysis *doc, size_t i);
+void write_visited_diagnostic(const diagnostic *d, int line, void *dest);
+void free_analysis_line(analysis_line *line);
+
+/**
+ * Opens a document for incremental analysis, analysis_update() must be called before the results are used.
+ *
+ * @param doc   The document to initialize, must be released with analysis_close().
+ * @param name  The file name the diagnostics are reported with.
+ * @param text  The contents of the document.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status analysis_open(analysis *doc, const char *name, const char *text) {
+    memset(doc, 0, sizeof(analysis));
+    if (copy_string(&doc->name, name) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+    return analysis_edit(doc, 0, 0, text);
+}
+
+/**
+ * Replaces lines of a document, the first pass runs on the new lines only.
+ *
+ * @param doc       The document.
+ * @param first     The first line to replace, from 0.
+ * @param removed   The number of lines to replace, 0 to insert before first.
+ * @param text      The new lines, separated by '\n' (a final '\n' does not start another line).
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status analysis_edit(analysis *doc, size_t first, size_t removed, const char *text) {
+    const char *p = NULL, *end = NULL;
+    size_t added = 0, i, len;
+    status report = NO_ERROR;
+
+    first = first > doc->count ? doc->count : first;
+    removed = removed > doc->count - first ? doc->count - first : removed;
+    for (p = text; *p; p = *end ? end + 1 : end, added++)
+        end = strchr(p, '\n') ? strchr(p, '\n') : p + strlen(p);
+
+    if (doc->count - removed + added > doc->cap
+        && grow_array((void **)&doc->lines, &doc->cap, doc->count - removed + added, sizeof(analysis_line)) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+
+    for (i = first; i < first + removed; i++)
+        free_analysis_line(&doc->lines[i]);
+    memmove(doc->lines + first + added, doc->lines + first + removed,
+            (doc->count - first - removed) * sizeof(analysis_line));
+    doc->count = doc->count - removed + added;
+    doc->dirty = first < doc->dirty ? first : doc->dirty;
+
+    memset(doc->lines + first, 0, added * sizeof(analysis_line));
+    for (i = first, p = text; i < first + added; i++, p = *end ? end + 1 : end) {
+        end = strchr(p, '\n') ? strchr(p, '\n') : p + strlen(p);
+        len = (size_t)(end - p) - (end > p && end[-1] == '\r'); /* CRLF line endings from an editor */
+        if (report == NO_ERROR && copy_n_string(&doc->lines[i].text, p, len) != NO_ERROR)
+            report = ERR_MEM_ALLOC;
+        if (report == NO_ERROR)
+            report = parse_analysis_line(doc, &doc->lines[i], (int)i + 1);
+    }
+    return report;
+}
+
+/**
+ * Brings a document up to date after edits: recomputes the addresses from the first edited line on,
+ * expanding the macros, and checks the labels of the whole document.
+ *
+ * @param doc The document.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status analysis_update(analysis *doc) {
+    status report = walk_lines(doc);
+
+    if (report == NO_ERROR)
+        report = check_symbols(doc);
+    return report;
+}
+
+/**
+ * Finds a label in the checked labels of a document.
+ *
+ * @param doc   The document, up to date.
+ * @param label The label.
+ * @return The index of the label in doc->symbols, ANALYSIS_NONE if it is not defined, declared or used.
+ */
+int find_analysis_symbol(const analysis *doc, const char *label) {
+    size_t held;
+
+    if (!doc->symbol_index_cap)
+        return ANALYSIS_NONE;
+    held = doc->symbol_index[find_label_slot(doc, doc->symbol_index_cap, label, analysis_slot_label)];
+    return held ? (int)held - 1 : ANALYSIS_NONE;
+}
+
+/**
+ * Reads the label of a slot of the symbol index of a document, see find_label_slot().
+ *
+ * @param table The document.
+ * @param slot  The slot.
+ * @return The label of its symbol, NULL for an empty slot.
+ */
+const char *analysis_slot_label(const void *table, size_t slot) {
+    const analysis *doc = (const analysis *)table;
+
+    return doc->symbol_index[slot] ? doc->symbols[doc->symbol_index[slot] - 1].label : NULL;
+}
+
+/**
+ * Finds a complete macro definition of a document, the first one if there are several (the
+ * preprocessor reports the others). While the addresses are recomputed, only the ones before the
+ * current line are known.
+ *
+ * @param doc   The document, up to date.
+ * @param name  The name of the macro.
+ * @return The index of the macro, ANALYSIS_NONE if there is none.
+ */
+int find_analysis_macro(const analysis *doc, const char *name) {
+    size_t i;
+
+    for (i = 0; i < doc->macros_count; i++)
+        if (doc->macros[i].end != ANALYSIS_NONE && strcmp(doc->macros[i].name, name) == 0)
+            return (int)i;
+    return ANALYSIS_NONE;
+}
+
+/**
+ * Calls a visitor with every diagnostic of a document, with the current line numbers: the ones
+ * of every line, then the ones of the labels. The diagnostic is a copy, its file set to the document.
+ *
+ * @param doc   The document, up to date.
+ * @param visit The visitor.
+ * @param ctx   Passed to the visitor.
+ */
+void visit_analysis_diagnostics(const analysis *doc, diagnostic_visitor visit, void *ctx) {
+    diagnostic d;
+    size_t i, j;
+
+    for (i = 0; i < doc->count; i++) {
+        if (doc->lines[i].call != ANALYSIS_NONE)
+            continue; /* the macro name, not a statement */
+        for (j = 0; j < doc->lines[i].diagnostics_count; j++) {
+            d = doc->lines[i].diagnostics[j];
+            set_diagnostic_line(&d, doc->name, (int)i + 1);
+            visit(&d, (int)i + 1, ctx);
+        }
+    }
+    for (i = 0; i < doc->diagnostics_count; i++) {
+        d = doc->diagnostics[i];
+        set_diagnostic_line(&d, doc->name, diagnostic_line(&d));
+        visit(&d, diagnostic_line(&d), ctx);
+    }
+}
+
+/**
+ * Writes the diagnostics of a document in the format of the assembler, with the current line numbers.
+ *
+ * @param dest  The output stream.
+ * @param doc   The document, up to date.
+ */
+void write_analysis_diagnostics(FILE *dest, const analysis *doc) {
+    visit_analysis_diagnostics(doc, write_visited_diagnostic, dest);
+}
+
+/**
+ * Releases a document.
+ *
+ * @param doc The document.
+ */
+void analysis_close(analysis *doc) {
+    size_t i;
+
+    for (i = 0; i < doc->count; i++)
+        free_analysis_line(&doc->lines[i]);
+    free_diagnostics(doc->diagnostics, doc->diagnostics_count);
+    free(doc->lines);
+    free(doc->macros);
+    free(doc->symbols);
+    free(doc->symbol_index);
+    free(doc->uses);
+    free(doc->name);
+    memset(doc, 0, sizeof(analysis));
+}
+
+/**
+ * Runs the preprocessor checks and the first pass on a line on its own, and keeps what the rest of
+ * the document needs: its size, the labels it defines, declares and uses and its diagnostics.
+ *
+ * @param doc       The document.
+ * @param line      The line, its text set and the rest zeroed.
+ * @param number    The line number the diagnostics are reported with, from 1.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status parse_analysis_line(analysis *doc, analysis_line *line, int number) {
+    char buffer[MAX_BUFFER_LENGTH], word[MAX_BUFFER_LENGTH], called[MAX_BUFFER_LENGTH];
+    char *p = line->text, *next = NULL;
+    size_t len;
+    int max_errors = options.max_errors, is_start;
+    file_context fc;
+    status report = NO_ERROR;
+
+    memset(&fc, 0, sizeof(file_context));
+    fc.file_name = doc->name;
+    fc.lc = number;
+    line->kind = LINE_EMPTY;
+    line->address = line->next_address = ADDRESS_START;
+    line->open_macro = line->call = ANALYSIS_NONE;
+
+    while (isspace(*p))
+        p++;
+    /* Every branch of a conditional block is analyzed, the body of a .rept block once, included files not at all */
+    if (*line->text == ';' || !*p || scan_conditional(p, &next) != COND_NONE || scan_repeat(p, &is_start)
+        || scan_include(p, &next))
+        return NO_ERROR;
+
+    line->kind = LINE_STATEMENT;
+    options.max_errors = 0; /* every line is reported, whatever the others */
+
+    /* The same checks as assembler_preprocessor(), the first pass never sees such a line */
+    if (isdigit(*line->text))
+        handle_error(ERR_LINE_START_DIGIT, &fc);
+    if (strlen(line->text) > MAX_LINE_LENGTH)
+        handle_error(ERR_LINE_TOO_LONG, &fc);
+    else if (has_long_word(p))
+        handle_error(ERR_OPERAND_TOO_LONG, &fc);
+    else if (!isdigit(*line->text)) {
+        next = strcpy(buffer, p);
+        (void) get_word(&next, word, SPACE);
+        if (strcmp(word, MACRO_START) == 0 || strcmp(word, MACRO_END) == 0) {
+            line->kind = *word == *MACRO_END ? LINE_MACRO_END : LINE_MACRO_START;
+            if (line->kind == LINE_MACRO_START && get_word(&next, word, SPACE))
+                report = copy_string(&line->name, word);
+        }
+        else {
+            while (isspace(*next))
+                next++;
+            if (!*next) /* may be a macro call, see walk_lines() */
+                report = copy_string(&line->name, word);
+            else if ((len = strlen(word)) > 1 && word[len - 1] == ':' && get_word(&next, called, SPACE)
+                     && !*next) { /* may be a labelled call, the preprocessor keeps the label */
+                word[len - 1] = '\0';
+                if ((report = copy_string(&line->name, called)) == NO_ERROR)
+                    report = copy_string(&line->label, word);
+            }
+            if (report == NO_ERROR && process_line(&fc, strcpy(buffer, p)) != ERR_MEM_ALLOC)
+                report = collect_line_symbols(line);
+            line->words = next_free_address - ADDRESS_START;
+            line->ic = IC;
+            line->dc = DC;
+            free_global_data_and_symbol();
+        }
+    }
+
+    line->diagnostics_count = take_diagnostics(&line->diagnostics);
+    drop_line_diagnostics(line, ERR_UNKNOWN_CONSTANT);
+    options.max_errors = max_errors;
+    return report == NO_ERROR ? NO_ERROR : ERR_MEM_ALLOC;
+}
+
+/**
+ * Drops the diagnostics of a line that only hold for the line on its own. A constant of a .define
+ * is defined on another line: its use is checked with the labels, by check_symbols().
+ *
+ * @param line The line.
+ * @param code The status code of the diagnostics to drop.
+ */
+void drop_line_diagnostics(analysis_line *line, status code) {
+    size_t i, kept = 0;
+
+    for (i = 0; i < line->diagnostics_count; i++) {
+        if (line->diagnostics[i].code != code)
+            line->diagnostics[kept++] = line->diagnostics[i];
+        else if (line->diagnostics[i].text)
+            free(line->diagnostics[i].text);
+    }
+    line->diagnostics_count = kept;
+}
+
+/**
+ * Collects the labels the first pass has seen on a line, and the constant it defines.
+ * A label that is used but neither defined nor declared on the line is unresolved.
+ *
+ * @param line The line.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status collect_line_symbols(analysis_line *line) {
+    symbol *sym = NULL;
+    status report = NO_ERROR;
+    size_t i;
+
+    for (i = 0; i < symbol_count && report == NO_ERROR; i++) {
+        sym = symbol_table[i];
+        if (!sym->is_missing_info)
+            report = add_line_symbol(line, sym->label, DEFAULT, sym->address_decimal - ADDRESS_START);
+        if (report == NO_ERROR && (sym->sym_dir == ENTRY || sym->sym_dir == EXTERN))
+            report = add_line_symbol(line, sym->label, sym->sym_dir, 0);
+        else if (report == NO_ERROR && sym->is_missing_info)
+            report = add_line_symbol(line, sym->label, USE_DIR, 0);
+    }
+    for (i = 0; i < constants_count && report == NO_ERROR; i++) /* a .define, the rest of the document may use it */
+        report = add_line_symbol(line, constants[i].name, DEFAULT, 0);
+    return report;
+}
+
+/**
+ * Adds a label to the labels of a line.
+ *
+ * @param line      The line.
+ * @param label     The label.
+ * @param dir       DEFAULT for a definition, ENTRY or EXTERN for a declaration, USE_DIR for a use.
+ * @param offset    The words between the start of the line and a definition.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status add_line_symbol(analysis_line *line, const char *label, Directive dir, int offset) {
+    line_symbol *new_symbols = realloc(line->symbols, (line->symbols_count + 1) * sizeof(line_symbol));
+
+    if (!new_symbols)
+        return ERR_MEM_ALLOC;
+    line->symbols = new_symbols;
+    new_symbols[line->symbols_count].dir = dir;
+    new_symbols[line->symbols_count].offset = offset;
+    if (copy_string(&new_symbols[line->symbols_count].label, label) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+    line->symbols_count++;
+    return NO_ERROR;
+}
+
+/**
+ * Recomputes the addresses and macros from the first edited line on. Everything before it is
+ * unchanged: a line only depends on the lines before it.
+ *
+ * @param doc The document.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status walk_lines(analysis *doc) {
+    analysis_line *line = NULL, *prev = NULL;
+    size_t i;
+    int address = ADDRESS_START, ic = 0, dc = 0, open = ANALYSIS_NONE, m;
+
+    while (doc->macros_count && doc->macros[doc->macros_count - 1].start >= (int)doc->dirty)
+        doc->macros_count--;
+    reset_analysis_macros(doc);
+    if (doc->dirty > 0 && doc->dirty <= doc->count) {
+        prev = &doc->lines[doc->dirty - 1];
+        address = prev->next_address;
+        ic = prev->ic_total;
+        dc = prev->dc_total;
+        if ((open = prev->open_macro) != ANALYSIS_NONE)
+            doc->macros[open].end = ANALYSIS_NONE; /* its end may have been edited */
+    }
+
+    for (i = doc->dirty; i < doc->count; i++) {
+        line = &doc->lines[i];
+        line->address = address;
+        line->call = ANALYSIS_NONE;
+        line->call_error = NO_ERROR;
+
+        if (open != ANALYSIS_NONE) {
+            /* Only a macro defined before the body can be called, there is no cycle */
+            if (line->kind == LINE_STATEMENT && line->name && !line->label)
+                line->call = find_analysis_macro(doc, line->name);
+            else if (line->kind == LINE_MACRO_END) {
+                close_analysis_macro(doc, open, (int)i);
+                open = ANALYSIS_NONE;
+            }
+        }
+        else if (line->kind == LINE_MACRO_START && line->name) {
+            if (grow_array((void **)&doc->macros, &doc->macros_cap, doc->macros_count + 1,
+                           sizeof(analysis_macro)) != NO_ERROR)
+                return ERR_MEM_ALLOC;
+            doc->macros[doc->macros_count].name = line->name;
+            doc->macros[doc->macros_count].start = (int)i;
+            doc->macros[doc->macros_count].end = ANALYSIS_NONE;
+            doc->macros[doc->macros_count].first_call = ANALYSIS_NONE;
+            doc->macros[doc->macros_count].flattened = doc->macros[doc->macros_count].expanding = 0;
+            open = (int)doc->macros_count++;
+        }
+        else if (line->kind == LINE_STATEMENT && line->name && (m = find_analysis_macro(doc, line->name)) >= 0) {
+            line->call = m;
+            if (doc->macros[m].first_call == ANALYSIS_NONE)
+                doc->macros[m].first_call = (int)i;
+            /* A failed call adds no words, the preprocessor writes no .am file anyway */
+            if ((line->call_error = flatten_analysis_macro(doc, m, 0, &line->call_error_macro)) == NO_ERROR) {
+                address += doc->macros[m].words;
+                ic += doc->macros[m].ic;
+                dc += doc->macros[m].dc;
+            }
+        }
+        else if (line->kind == LINE_STATEMENT) {
+            address += line->words;
+            ic += line->ic;
+            dc += line->dc;
+        }
+
+        line->open_macro = open;
+        line->next_address = address;
+        line->ic_total = ic;
+        line->dc_total = dc;
+    }
+
+    doc->dirty = doc->count;
+    doc->ic = doc->count ? doc->lines[doc->count - 1].ic_total : 0;
+    doc->dc = doc->count ? doc->lines[doc->count - 1].dc_total : 0;
+    return NO_ERROR;
+}
+
+/**
+ * Closes the definition of a macro, its body is flattened by its first call.
+ *
+ * @param doc   The document.
+ * @param macro The macro.
+ * @param end   The line of its endmcro.
+ */
+void close_analysis_macro(analysis *doc, int macro, int end) {
+    doc->macros[macro].end = end;
+    doc->macros[macro].first_call = ANALYSIS_NONE;
+    doc->macros[macro].flattened = 0;
+}
+
+/**
+ * Resolves the calls of the body of a macro, once, the way flatten_macro() of the preprocessor does:
+ * a body line that holds only the name of a macro defined by then calls it, and the sizes of the
+ * macros it calls, expanded first, are summed into the size of the body.
+ *
+ * @param doc       The document.
+ * @param macro     The macro.
+ * @param depth     The number of calls the macro is expanded within, 0 for a call from the source.
+ * @param failed    Set to the macro of a cycle or of too deep calls.
+ * @return NO_ERROR if successful, ERR_MACRO_CYCLE or ERR_MACRO_TOO_DEEP.
+ */
+status flatten_analysis_macro(analysis *doc, int macro, int depth, int *failed) {
+    analysis_macro *m = &doc->macros[macro];
+    analysis_line *line = NULL;
+    status report = NO_ERROR;
+    int j;
+
+    if (m->flattened)
+        return NO_ERROR;
+    if (m->expanding || depth == MAX_MACRO_DEPTH) {
+        *failed = macro;
+        return m->expanding ? ERR_MACRO_CYCLE : ERR_MACRO_TOO_DEEP;
+    }
+
+    m->expanding = 1;
+    m->words = m->ic = m->dc = 0;
+    for (j = m->start + 1; j < m->end && report == NO_ERROR; j++) {
+        line = &doc->lines[j];
+        if (line->kind != LINE_STATEMENT)
+            continue;
+        line->call = line->name && !line->label ? find_analysis_macro(doc, line->name) : ANALYSIS_NONE;
+        if (line->call == ANALYSIS_NONE) {
+            m->words += line->words;
+            m->ic += line->ic;
+            m->dc += line->dc;
+        }
+        else if ((report = flatten_analysis_macro(doc, line->call, depth + 1, failed)) == NO_ERROR) {
+            m->words += doc->macros[line->call].words;
+            m->ic += doc->macros[line->call].ic;
+            m->dc += doc->macros[line->call].dc;
+        }
+    }
+    m->expanding = 0;
+    m->flattened = report == NO_ERROR;
+    return report;
+}
+
+/**
+ * Forgets how the macros kept by an edit have been flattened, unless their first call is kept too:
+ * the macros their body calls may have been removed, or be defined differently by their next call.
+ *
+ * @param doc The document, its macros from the first edited line on removed.
+ */
+void reset_analysis_macros(analysis *doc) {
+    analysis_macro *m = NULL;
+    size_t i;
+    int j;
+
+    for (i = 0; i < doc->macros_count; i++) {
+        m = &doc->macros[i];
+        if (m->first_call != ANALYSIS_NONE && m->first_call < (int)doc->dirty)
+            continue;
+        m->first_call = ANALYSIS_NONE;
+        m->flattened = 0;
+        for (j = m->start + 1; m->end != ANALYSIS_NONE && j < m->end; j++)
+            if (doc->lines[j].call >= (int)doc->macros_count)
+                doc->lines[j].call = ANALYSIS_NONE;
+    }
+}
+
+/**
+ * Checks the labels of the body of a called macro, the macros it calls expanded.
+ *
+ * @param doc       The document.
+ * @param macro     The macro.
+ * @param number    The line of the call from the source, the labels are defined and used there.
+ * @param address   The address of the first word of the body, advanced past the body.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status check_call_symbols(analysis *doc, int macro, int number, int *address) {
+    const analysis_line *line = NULL;
+    status report = NO_ERROR;
+    int j;
+
+    for (j = doc->macros[macro].start + 1; j < doc->macros[macro].end && report == NO_ERROR; j++) {
+        line = &doc->lines[j];
+        if (line->call != ANALYSIS_NONE)
+            report = check_call_symbols(doc, line->call, number, address);
+        else if (line->kind == LINE_STATEMENT) {
+            report = check_line_symbols(doc, line, number, *address);
+            *address += line->words;
+        }
+    }
+    return report;
+}
+
+/**
+ * Checks the labels of the whole document against each other, the checks of the first pass that
+ * depend on more than one line and the ones of the second pass.
+ *
+ * @param doc The document, its addresses up to date.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status check_symbols(analysis *doc) {
+    analysis_symbol *sym = NULL;
+    analysis_line *line = NULL, label_line;
+    line_symbol label;
+    file_context fc;
+    status report = NO_ERROR;
+    size_t i;
+    int address;
+
+    free_diagnostics(doc->diagnostics, doc->diagnostics_count);
+    doc->diagnostics = NULL;
+    doc->diagnostics_count = doc->symbols_count = doc->uses_count = 0;
+    if (doc->symbol_index)
+        memset(doc->symbol_index, 0, doc->symbol_index_cap * sizeof(size_t));
+    memset(&fc, 0, sizeof(file_context));
+    fc.file_name = doc->name;
+
+    for (i = 0; i < doc->count && report == NO_ERROR; i++) {
+        line = &doc->lines[i];
+        if (line->kind != LINE_STATEMENT || is_macro_body(doc, i))
+            continue;
+        if (line->call == ANALYSIS_NONE) {
+            report = check_line_symbols(doc, line, (int)i, line->address);
+            continue;
+        }
+        if (line->label) { /* defined at the first word of the expansion */
+            memset(&label_line, 0, sizeof(analysis_line));
+            label.label = line->label;
+            label.dir = DEFAULT;
+            label.offset = 0;
+            label_line.symbols = &label;
+            label_line.symbols_count = 1;
+            if ((report = check_line_symbols(doc, &label_line, (int)i, line->address)) != NO_ERROR)
+                break;
+        }
+        if (line->call_error != NO_ERROR) {
+            fc.lc = (int)i + 1;
+            handle_error(line->call_error, &fc, doc->macros[line->call_error_macro].name);
+            continue;
+        }
+        address = line->address; /* the labels of the body are defined and used by the call */
+        report = check_call_symbols(doc, line->call, (int)i, &address);
+    }
+    if (report != NO_ERROR)
+        return report;
+
+    for (i = 0; i < doc->uses_count; i++) {
+        sym = &doc->symbols[doc->uses[i].symbol];
+        if (sym->defined == ANALYSIS_NONE && sym->external == ANALYSIS_NONE) {
+            fc.lc = doc->uses[i].line + 1;
+            handle_error(ERR_LABEL_DOES_NOT_EXIST, &fc, sym->label, fc.lc);
+        }
+    }
+    for (i = 0; i < doc->symbols_count; i++) {
+        sym = &doc->symbols[i];
+        fc.lc = (sym->entry != ANALYSIS_NONE ? sym->entry : sym->external) + 1;
+        if (sym->entry != ANALYSIS_NONE && sym->defined == ANALYSIS_NONE)
+            handle_error(ERR_LABEL_DOES_NOT_EXIST, &fc, sym->label, fc.lc);
+        else if (sym->external != ANALYSIS_NONE && !sym->uses)
+            handle_error(WARN_UNUSED_EXT, &fc, sym->label, fc.lc);
+    }
+    if (doc->count && doc->lines[doc->count - 1].next_address >= MAX_MEMORY_SIZE)
+        handle_error(TERMINATE, TOO_MUCH_MEMORY);
+
+    doc->diagnostics_count = take_diagnostics(&doc->diagnostics);
+    return NO_ERROR;
+}
+
+/**
+ * Checks the labels of a line against the labels of the lines before it.
+ *
+ * @param doc       The document.
+ * @param line      The line, or a line of the body of the macro the line calls.
+ * @param number    The line, from 0.
+ * @param address   The address of the first word of the line.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status check_line_symbols(analysis *doc, const analysis_line *line, int number, int address) {
+    analysis_symbol *sym = NULL;
+    line_symbol *s = NULL;
+    file_context fc;
+    size_t i;
+    long index;
+
+    memset(&fc, 0, sizeof(file_context));
+    fc.file_name = doc->name;
+    fc.lc = number + 1;
+
+    for (i = 0; i < line->symbols_count; i++) {
+        s = &line->symbols[i];
+        if ((index = add_analysis_symbol(doc, s->label)) < 0)
+            return ERR_MEM_ALLOC;
+        sym = &doc->symbols[index];
+
+        if (s->dir == DEFAULT && sym->defined != ANALYSIS_NONE)
+            handle_error(ERR_DUP_LABEL, &fc);
+        else if (s->dir == DEFAULT) {
+            sym->defined = number;
+            sym->address = address + s->offset;
+        }
+        else if ((s->dir == ENTRY && sym->external != ANALYSIS_NONE) || (s->dir == EXTERN && sym->entry != ANALYSIS_NONE))
+            handle_error(ERR_BOTH_DIR, &fc, sym->label);
+        else if ((s->dir == ENTRY && sym->entry != ANALYSIS_NONE) || (s->dir == EXTERN && sym->external != ANALYSIS_NONE))
+            handle_error(ERR_DUPLICATE_DIR, &fc, sym->label, s->dir);
+        else if (s->dir == EXTERN && sym->defined != ANALYSIS_NONE)
+            handle_error(ERR_FORBIDDEN_LABEL_DECLARE, &fc, sym->label);
+        else if (s->dir == ENTRY || s->dir == EXTERN)
+            *(s->dir == ENTRY ? &sym->entry : &sym->external) = number;
+        else {
+            sym->uses++;
+            if (grow_array((void **)&doc->uses, &doc->uses_cap, doc->uses_count + 1, sizeof(analysis_use)) != NO_ERROR)
+                return ERR_MEM_ALLOC;
+            doc->uses[doc->uses_count].symbol = (size_t)index;
+            doc->uses[doc->uses_count++].line = number;
+        }
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Finds a label in the checked labels of a document, adding it if it is not there yet.
+ * The index is rebuilt twice as large once it is half full.
+ *
+ * @param doc   The document.
+ * @param label The label, must outlive the check.
+ * @return The index of the label in doc->symbols, -1 if memory allocation failed.
+ */
+long add_analysis_symbol(analysis *doc, const char *label) {
+    analysis_symbol *sym = NULL;
+    size_t *new_index = NULL;
+    size_t new_cap, j;
+    int found;
+
+    if ((found = find_analysis_symbol(doc, label)) != ANALYSIS_NONE)
+        return found;
+
+    if ((doc->symbols_count + 1) * 2 > doc->symbol_index_cap) {
+        new_cap = doc->symbol_index_cap ? doc->symbol_index_cap * 2 : ANALYSIS_MIN_CAP;
+        if (!(new_index = calloc(new_cap, sizeof(size_t))))
+            return -1;
+        free(doc->symbol_index);
+        doc->symbol_index = new_index;
+        doc->symbol_index_cap = new_cap;
+        for (j = 0; j < doc->symbols_count; j++)
+            doc->symbol_index[find_label_slot(doc, new_cap, doc->symbols[j].label, analysis_slot_label)] = j + 1;
+    }
+    if (grow_array((void **)&doc->symbols, &doc->symbols_cap, doc->symbols_count + 1,
+                   sizeof(analysis_symbol)) != NO_ERROR)
+        return -1;
+
+    sym = &doc->symbols[doc->symbols_count];
+    sym->label = label;
+    sym->defined = sym->entry = sym->external = ANALYSIS_NONE;
+    sym->address = INVALID_ADDRESS;
+    sym->uses = 0;
+    doc->symbol_index[find_label_slot(doc, doc->symbol_index_cap, label, analysis_slot_label)] = ++doc->symbols_count;
+    return (long)doc->symbols_count - 1;
+}
+
+/**
+ * Checks whether a line is part of a macro definition: its body or its end.
+ *
+ * @param doc   The document, its macros up to date.
+ * @param i     The line.
+ * @return 1 if it is, 0 otherwise.
+ */
+int is_macro_body(const analysis *doc, size_t i) {
+    return i > 0 && doc->lines[i - 1].open_macro != ANALYSIS_NONE;
+}
+
+/**
+ * Checks whether a line has a word, outside of a string, too long for the buffers of the first pass.
+ *
+ * @param text The line.
+ * @return 1 if it has, 0 otherwise.
+ */
+int has_long_word(const char *text) {
+    int in_string = 0;
+    size_t len = 0;
+
+    for (; *text; text++) {
+        if (*text == '"')
+            in_string = !in_string;
+        len = in_string || isspace(*text) || *text == ',' ? 0 : len + 1;
+        if (len >= MAX_LABEL_LENGTH)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Makes room for at least needed elements in an array, its capacity grows geometrically.
+ *
+ * @param array     Pointer to the array.
+ * @param cap       Pointer to the capacity of the array.
+ * @param needed    The number of elements needed.
+ * @param size      The size of an element.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status grow_array(void **array, size_t *cap, size_t needed, size_t size) {
+    void *new_array = NULL;
+    size_t new_cap = *cap ? *cap : ANALYSIS_MIN_CAP;
+
+    if (needed <= *cap)
+        return NO_ERROR;
+    while (new_cap < needed)
+        new_cap *= 2;
+    if (!(new_array = realloc(*array, new_cap * size)))
+        return ERR_MEM_ALLOC;
+    *array = new_array;
+    *cap = new_cap;
+    return NO_ERROR;
+}
+
+/**
+ * Releases a line of a document.
+ *
+ * @param line The line.
+ */
+void free_analysis_line(analysis_line *line) {
+    size_t i;
+
+    for (i = 0; i < line->symbols_count; i++)
+        free(line->symbols[i].label);
+    free(line->symbols);
+    free_diagnostics(line->diagnostics, line->diagnostics_count);
+    free(line->name);
+    free(line->label);
+    free(line->text);
+    memset(line, 0, sizeof(analysis_line));
+}
+
+/**
+ * Writes a diagnostic visited by write_analysis_diagnostics().
+ *
+ * @param d     The diagnostic.
+ * @param line  The line it is reported on.
+ * @param dest  The output stream.
+ */
+void write_visited_diagnostic(const diagnostic *d, int line, void *dest) {
+    (void) line; /* already in the message */
+    write_diagnostic((FILE *)dest, d);
+}
@@ -0,0 +1,130 @@
+#ifndef ASSEMBLER_ANALYSIS_H
+#define ASSEMBLER_ANALYSIS_H
+
+#include <stdio.h>
+#include "utils.h"
+#include "errors.h"
+
+#define ANALYSIS_MIN_CAP 64
+#define ANALYSIS_NONE (-1)
+#define USE_DIR 0 /* a line_symbol that uses the label, Directive starts at 1 */
+
+typedef enum {
+    LINE_EMPTY, /* empty line or comment */
+    LINE_STATEMENT,
+    LINE_MACRO_START,
+    LINE_MACRO_END
+} Line_kind;
+
+/* A label a line defines (DEFAULT), declares (ENTRY, EXTERN) or uses (USE_DIR) */
+typedef struct {
+    char *label;
+    Directive dir;
+    int offset; /* of a definition: words between the start of the line and the label */
+} line_symbol;
+
+/*
+ * A line of an analyzed document. The first pass result of the line on its own is kept until the
+ * line is edited, the rest depends on the lines before it and is recomputed by analysis_update().
+ */
+typedef struct {
+    char *text;
+    Line_kind kind;
+    char *name; /* the macro a LINE_MACRO_START defines, or the word a statement may call (optional - NULL) */
+    char *label; /* the label of a statement of two words, "LABEL: name" (optional - NULL) */
+    int words;
+    int ic;
+    int dc;
+    line_symbol *symbols;
+    size_t symbols_count;
+    diagnostic *diagnostics; /* reported by the first pass on the line on its own */
+    size_t diagnostics_count;
+
+    int address; /* of the first word of the line */
+    int next_address; /* address, ic_total and dc_total after the line, its macro expanded */
+    int ic_total;
+    int dc_total;
+    int open_macro; /* macro whose body is still open after the line, ANALYSIS_NONE if none */
+    int call; /* macro the line expands, ANALYSIS_NONE if none, also within a macro body */
+    status call_error; /* of a call from the source: ERR_MACRO_CYCLE, ERR_MACRO_TOO_DEEP or NO_ERROR */
+    int call_error_macro; /* the macro call_error names */
+} analysis_line;
+
+/*
+ * A macro definition, its body is the lines between start and end. As in the preprocessor, the calls
+ * of the body are resolved on the first call from the source, to the macros defined by then.
+ */
+typedef struct {
+    const char *name;
+    int start;
+    int end; /* ANALYSIS_NONE while the definition is open */
+    int first_call; /* line of the first call from the source, ANALYSIS_NONE if none */
+    int flattened; /* the calls of the body are resolved and the sizes below are set */
+    int expanding; /* being flattened, a call of it is a cycle */
+    int words; /* of the body, the macros it calls expanded */
+    int ic;
+    int dc;
+} analysis_macro;
+
+/* The definitions, declarations and uses of a label in the whole document, lines from 0 */
+typedef struct {
+    const char *label;
+    int defined; /* line of the first definition, ANALYSIS_NONE if none */
+    int address; /* of the first definition */
+    int entry; /* line of the .entry declaration, ANALYSIS_NONE if none */
+    int external; /* line of the .extern declaration, ANALYSIS_NONE if none */
+    int uses;
+} analysis_symbol;
+
+/* Called with every diagnostic of a document and the line it is reported on, from 1 */
+typedef void (*diagnostic_visitor)(const diagnostic *d, int line, void *ctx);
+
+/* A use of a label, checked once every label of the document is known */
+typedef struct {
+    size_t symbol;
+    int line;
+} analysis_use;
+
+/*
+ * A source file kept in memory for editor integration. An edit re-runs the first pass on the
+ * edited lines only, analysis_update() then recomputes the addresses from the first edited line
+ * on and checks the labels of the whole document against each other.
+ */
+typedef struct {
+    char *name; /* file name the diagnostics are reported with */
+    analysis_line *lines;
+    size_t count;
+    size_t cap;
+    size_t dirty; /* first line whose address has to be recomputed */
+
+    analysis_macro *macros;
+    size_t macros_count;
+    size_t macros_cap;
+
+    analysis_symbol *symbols; /* in order of first occurrence */
+    size_t symbols_count;
+    size_t symbols_cap;
+    size_t *symbol_index; /* open addressing index of symbols by label, symbol + 1 (0 is empty) */
+    size_t symbol_index_cap;
+    analysis_use *uses;
+    size_t uses_count;
+    size_t uses_cap;
+    diagnostic *diagnostics; /* reported by the checks of the whole document */
+    size_t diagnostics_count;
+
+    int ic;
+    int dc;
+} analysis;
+
+status analysis_open(analysis *doc, const char *name, const char *text);
+status analysis_edit(analysis *doc, size_t first, size_t removed, const char *text);
+status analysis_update(analysis *doc);
+
+int find_analysis_symbol(const analysis *doc, const char *label);
+int find_analysis_macro(const analysis *doc, const char *name);
+
+void visit_analysis_diagnostics(const analysis *doc, diagnostic_visitor visit, void *ctx);
+void write_analysis_diagnostics(FILE *dest, const analysis *doc);
+void analysis_close(analysis *doc);
+
+#endif
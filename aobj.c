@@ -0,0 +1,527 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "aobj.h"
+#include "object.h"
+#include "debuginfo.h"
+#include "utils.h"
+#include "errors.h"
+
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFF
+
+/* "Private" helper functions */
+char *aobj_path(const char *file_name, const char *ext);
+status decode_aobj(const unsigned char *data, size_t len, const char *key, object_module *module, int *offset);
+status decode_words(const unsigned char *data, object_module *module, int *offset);
+status decode_symbols(const unsigned char *data, size_t count, object_module *module, int *offset);
+status decode_uses(const unsigned char *data, size_t count, object_module *module, int *offset);
+status decode_relocations(const unsigned char *data, size_t count, object_module *module, int *offset);
+status link_symbols(object_module *module);
+int write_records(FILE *dest, const object_module *module);
+status write_debug_file(const char *file_name, const object_module *module);
+status write_xref_file(const char *file_name, const object_module *module);
+int put_u16(FILE *dest, unsigned int value);
+unsigned int get_u16(const unsigned char *data);
+
+/**
+ * Writes the .aobj file of a program (see aobj.h).
+ *
+ * @param file_name The name of the program, without extension.
+ * @param key       The key of the source the program has been assembled from, AOBJ_KEY_LEN characters.
+ * @param module    The program, with the state of its first pass (see captured_module).
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_aobj(const char *file_name, const char *key, const object_module *module) {
+    char *path = NULL;
+    FILE *file = NULL;
+    status report;
+
+    if (!(path = aobj_path(file_name, AOBJ_EXT)))
+        return ERR_MEM_ALLOC;
+    if (!(file = fopen(path, "wb"))) {
+        free(path);
+        return ERR_OPEN_FILE;
+    }
+
+    report = write_aobj_to_stream(file, key, module);
+    if (fclose(file) != 0 || report != NO_ERROR) {
+        remove(path); /* a partial file would only be rejected later */
+        report = ERR_OPEN_FILE;
+    }
+    free(path);
+    return report;
+}
+
+/**
+ * Writes a program in the .aobj format (see aobj.h) to a stream.
+ *
+ * @param dest      The stream, opened in binary mode.
+ * @param key       The key of the source the program has been assembled from, AOBJ_KEY_LEN characters.
+ * @param module    The program, with the state of its first pass (see captured_module).
+ * @return NO_ERROR if successful, ERR_OPEN_FILE if the stream could not be written.
+ */
+status write_aobj_to_stream(FILE *dest, const char *key, const object_module *module) {
+    int ok = fwrite(AOBJ_MAGIC, 1, AOBJ_MAGIC_LEN, dest) == AOBJ_MAGIC_LEN && fputc(AOBJ_VERSION, dest) != EOF
+             && fwrite(key, 1, AOBJ_KEY_LEN, dest) == AOBJ_KEY_LEN
+             && put_u16(dest, (unsigned int)module->ic) && put_u16(dest, (unsigned int)module->dc)
+             && put_u16(dest, (unsigned int)module->size) && put_u16(dest, (unsigned int)module->symbols_count)
+             && put_u16(dest, (unsigned int)module->uses_count)
+             && put_u16(dest, (unsigned int)module->relocations_count) && write_records(dest, module);
+
+    return ok && fflush(dest) == 0 ? NO_ERROR : ERR_OPEN_FILE;
+}
+
+/**
+ * Loads the .aobj file of a program. The file is mapped into memory and decoded in place.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param key       The key of the current source (optional - NULL to accept any source).
+ * @param module    The module to fill, must be released with free_object().
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, ERR_OPEN_FILE if there is no .aobj file, FAILURE if it has been
+ * @return assembled from another source, ERR_AOBJ_FILE if it is invalid, or ERR_MEM_ALLOC.
+ */
+status map_aobj(const char *file_name, const char *key, object_module *module, int *offset) {
+    struct stat st;
+    char *path = NULL;
+    void *data = NULL;
+    status report;
+    int fd;
+
+    memset(module, 0, sizeof(object_module));
+    *offset = 0;
+
+    if (!(path = aobj_path(file_name, AOBJ_EXT)))
+        return ERR_MEM_ALLOC;
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return ERR_OPEN_FILE;
+
+    if (fstat(fd, &st) != 0 || st.st_size < AOBJ_HEADER_LEN
+        || (data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return ERR_AOBJ_FILE;
+    }
+    close(fd); /* the mapping stays valid */
+
+    report = read_aobj(data, (size_t)st.st_size, key, module, offset);
+    munmap(data, (size_t)st.st_size);
+    return report;
+}
+
+/**
+ * Decodes a program in the .aobj format that is already in memory, e.g. sent by a --project worker.
+ *
+ * @param data      The contents of the .aobj file.
+ * @param len       Its size.
+ * @param key       The key of the current source (optional - NULL to accept any source).
+ * @param module    The module to fill, must be released with free_object().
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, FAILURE if it has been assembled from another source,
+ * @return ERR_AOBJ_FILE if it is invalid, or ERR_MEM_ALLOC.
+ */
+status read_aobj(const unsigned char *data, size_t len, const char *key, object_module *module, int *offset) {
+    status report;
+
+    memset(module, 0, sizeof(object_module));
+    *offset = 0;
+    if (len < AOBJ_HEADER_LEN)
+        return ERR_AOBJ_FILE;
+    if ((report = decode_aobj(data, len, key, module, offset)) != NO_ERROR)
+        free_object(module);
+    return report;
+}
+
+/**
+ * Writes the outputs of a program the way the assembler does: the .ob file, and the .ent and .ext
+ * files even if they are empty.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The program.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status emit_object(const char *file_name, const object_module *module) {
+    status report = write_object(file_name, module);
+
+    if (report == NO_ERROR && !module->entries_count)
+        report = write_symbols(file_name, ENTRY_EXT, NULL, 0);
+    if (report == NO_ERROR && !module->externals_count)
+        report = write_symbols(file_name, EXTERNAL_EXT, NULL, 0);
+    return report;
+}
+
+/**
+ * Writes the .dbg source map (--debug-info) and the .xref cross-reference (--xref) of a program
+ * loaded from its .aobj file, the same as the second pass writes them.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The program.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status emit_source_maps(const char *file_name, const object_module *module) {
+    status report = NO_ERROR;
+
+    if (options.debug_info)
+        report = write_debug_file(file_name, module);
+    if (report == NO_ERROR && options.xref)
+        report = write_xref_file(file_name, module);
+    return report;
+}
+
+/**
+ * Decodes a mapped .aobj file.
+ *
+ * @param data      The contents of the file.
+ * @param len       The size of the file, at least AOBJ_HEADER_LEN.
+ * @param key       The key of the current source (optional - NULL to accept any source).
+ * @param module    The module to fill.
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, FAILURE for another source, ERR_AOBJ_FILE or ERR_MEM_ALLOC.
+ */
+status decode_aobj(const unsigned char *data, size_t len, const char *key, object_module *module, int *offset) {
+    unsigned int counts[AOBJ_COUNTS_LEN];
+    status report;
+    int i;
+
+    if (memcmp(data, AOBJ_MAGIC, AOBJ_MAGIC_LEN) != 0)
+        return ERR_AOBJ_FILE;
+    *offset = AOBJ_MAGIC_LEN;
+    if (data[*offset] != AOBJ_VERSION)
+        return ERR_AOBJ_FILE;
+    *offset += 1;
+    if (key && memcmp(data + *offset, key, AOBJ_KEY_LEN) != 0)
+        return FAILURE; /* the source has changed since */
+    *offset += AOBJ_KEY_LEN;
+
+    for (i = 0; i < AOBJ_COUNTS_LEN; i++)
+        counts[i] = get_u16(data + *offset + i * 2);
+    module->ic = (int)counts[0];
+    module->dc = (int)counts[1];
+    module->size = (int)counts[2];
+    if (module->size != module->ic + module->dc || ADDRESS_START + module->size > MAX_MEMORY_SIZE
+        || len != AOBJ_HEADER_LEN + counts[2] * AOBJ_WORD_LEN + (size_t)counts[3] * AOBJ_SYMBOL_LEN
+                  + (size_t)counts[4] * AOBJ_USE_LEN + (size_t)counts[5] * AOBJ_RELOCATION_LEN)
+        return ERR_AOBJ_FILE;
+    *offset = AOBJ_HEADER_LEN;
+
+    if ((report = decode_words(data, module, offset)) == NO_ERROR
+        && (report = decode_symbols(data, counts[3], module, offset)) == NO_ERROR
+        && (report = decode_uses(data, counts[4], module, offset)) == NO_ERROR
+        && (report = decode_relocations(data, counts[5], module, offset)) == NO_ERROR)
+        report = link_symbols(module);
+    module->is_relocatable = report == NO_ERROR;
+    return report;
+}
+
+/**
+ * Decodes the word records of a .aobj file.
+ *
+ * @param data      The contents of the file.
+ * @param module    The module, its size is known.
+ * @param offset    The offset of the first record, advanced past the last valid one.
+ * @return NO_ERROR if successful, ERR_AOBJ_FILE for an invalid record.
+ */
+status decode_words(const unsigned char *data, object_module *module, int *offset) {
+    const unsigned char *record = NULL;
+    int i;
+
+    for (i = 0; i < module->size; i++, *offset += AOBJ_WORD_LEN) {
+        record = data + *offset;
+        if (get_u16(record) > WORD_MASK || record[4] > 1)
+            return ERR_AOBJ_FILE;
+        module->words[i] = (unsigned short)get_u16(record);
+        module->lines[i] = (unsigned short)get_u16(record + 2);
+        module->is_data[i] = record[4];
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Decodes the symbol table records of a .aobj file.
+ *
+ * @param data      The contents of the file.
+ * @param count     The number of records.
+ * @param module    The module to fill.
+ * @param offset    The offset of the first record, advanced past the last valid one.
+ * @return NO_ERROR if successful, ERR_AOBJ_FILE for an invalid record, or ERR_MEM_ALLOC.
+ */
+status decode_symbols(const unsigned char *data, size_t count, object_module *module, int *offset) {
+    const unsigned char *record = NULL;
+    module_symbol *sym = NULL;
+
+    if (count && !(module->symbols = malloc(count * sizeof(module_symbol))))
+        return ERR_MEM_ALLOC;
+
+    for (; module->symbols_count < count; module->symbols_count++, *offset += AOBJ_SYMBOL_LEN) {
+        record = data + *offset;
+        sym = &module->symbols[module->symbols_count];
+        if (!memchr(record, '\0', MAX_LABEL_LENGTH) || !*record
+            || get_u16(record + MAX_LABEL_LENGTH) >= MAX_MEMORY_SIZE
+            || record[MAX_LABEL_LENGTH + 4] > (MODULE_SYMBOL_ENTRY | MODULE_SYMBOL_EXTERN))
+            return ERR_AOBJ_FILE;
+        strcpy(sym->label, (const char *)record);
+        sym->address = (int)get_u16(record + MAX_LABEL_LENGTH);
+        sym->line = (int)get_u16(record + MAX_LABEL_LENGTH + 2);
+        sym->flags = record[MAX_LABEL_LENGTH + 4];
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Decodes the symbol use records of a .aobj file.
+ *
+ * @param data      The contents of the file.
+ * @param count     The number of records.
+ * @param module    The module to fill, its symbols are known.
+ * @param offset    The offset of the first record, advanced past the last valid one.
+ * @return NO_ERROR if successful, ERR_AOBJ_FILE for an invalid record, or ERR_MEM_ALLOC.
+ */
+status decode_uses(const unsigned char *data, size_t count, object_module *module, int *offset) {
+    const unsigned char *record = NULL;
+    module_use *use = NULL;
+
+    if (count && !(module->uses = malloc(count * sizeof(module_use))))
+        return ERR_MEM_ALLOC;
+
+    for (; module->uses_count < count; module->uses_count++, *offset += AOBJ_USE_LEN) {
+        record = data + *offset;
+        use = &module->uses[module->uses_count];
+        if (get_u16(record) >= module->symbols_count || get_u16(record + 2) >= MAX_MEMORY_SIZE || record[6] > SLOT_DATA)
+            return ERR_AOBJ_FILE;
+        use->symbol = (int)get_u16(record);
+        use->address = (int)get_u16(record + 2);
+        use->line = (int)get_u16(record + 4);
+        use->slot = record[6];
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Decodes the relocation records of a .aobj file.
+ *
+ * @param data      The contents of the file.
+ * @param count     The number of records.
+ * @param module    The module to fill, its words are known.
+ * @param offset    The offset of the first record, advanced past the last valid one.
+ * @return NO_ERROR if successful, ERR_AOBJ_FILE for an invalid record, or ERR_MEM_ALLOC.
+ */
+status decode_relocations(const unsigned char *data, size_t count, object_module *module, int *offset) {
+    const unsigned char *record = NULL;
+    module_relocation *reloc = NULL;
+    int previous = -1;
+
+    if (count && !(module->relocations = malloc(count * sizeof(module_relocation))))
+        return ERR_MEM_ALLOC;
+
+    for (; module->relocations_count < count; module->relocations_count++, *offset += AOBJ_RELOCATION_LEN) {
+        record = data + *offset;
+        reloc = &module->relocations[module->relocations_count];
+        reloc->offset = (int)get_u16(record);
+        reloc->are = record[2];
+        if (reloc->offset <= previous || reloc->offset >= module->size
+            || (reloc->are != RELOCATABLE && reloc->are != EXTERNAL)
+            || (int)WORD_ARE(module->words[reloc->offset]) != reloc->are)
+            return ERR_AOBJ_FILE;
+        previous = reloc->offset;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Builds the .ent and .ext lists of a decoded module: the symbols declared with .entry, in the
+ * order of the symbol table, and the words that hold the address of an external symbol, in address
+ * order, each one with the label its use names.
+ *
+ * @param module The module.
+ * @return NO_ERROR if successful, ERR_AOBJ_FILE for an external word without a use, or ERR_MEM_ALLOC.
+ */
+status link_symbols(object_module *module) {
+    object_symbol *dest = NULL;
+    size_t i, j;
+
+    if (module->symbols_count && !(module->entries = malloc(module->symbols_count * sizeof(object_symbol))))
+        return ERR_MEM_ALLOC;
+    for (i = 0; i < module->symbols_count; i++) {
+        if (module->symbols[i].flags & MODULE_SYMBOL_ENTRY) {
+            dest = &module->entries[module->entries_count++];
+            strcpy(dest->label, module->symbols[i].label);
+            dest->address = module->symbols[i].address;
+        }
+    }
+
+    if (module->relocations_count
+        && !(module->externals = malloc(module->relocations_count * sizeof(object_symbol))))
+        return ERR_MEM_ALLOC;
+    for (i = 0; i < module->relocations_count; i++) {
+        if (module->relocations[i].are != EXTERNAL)
+            continue;
+        for (j = 0; j < module->uses_count; j++)
+            if (module->uses[j].address == ADDRESS_START + module->relocations[i].offset
+                && module->uses[j].slot != SLOT_DATA
+                && module->symbols[module->uses[j].symbol].flags & MODULE_SYMBOL_EXTERN)
+                break;
+        if (j == module->uses_count)
+            return ERR_AOBJ_FILE;
+        dest = &module->externals[module->externals_count++];
+        strcpy(dest->label, module->symbols[module->uses[j].symbol].label);
+        dest->address = ADDRESS_START + module->relocations[i].offset;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Writes the records of a .aobj file, everything after its header.
+ *
+ * @param dest      The output stream.
+ * @param module    The program.
+ * @return 1 if successful, 0 otherwise.
+ */
+int write_records(FILE *dest, const object_module *module) {
+    char label[MAX_LABEL_LENGTH];
+    const module_symbol *sym = NULL;
+    const module_use *use = NULL;
+    size_t i;
+    int ok = 1;
+
+    for (i = 0; ok && i < (size_t)module->size; i++)
+        ok = put_u16(dest, module->words[i]) && put_u16(dest, module->lines[i])
+             && fputc(module->is_data[i], dest) != EOF;
+
+    for (i = 0; ok && i < module->symbols_count; i++) {
+        sym = &module->symbols[i];
+        memset(label, 0, sizeof(label));
+        strcpy(label, sym->label);
+        ok = fwrite(label, 1, MAX_LABEL_LENGTH, dest) == MAX_LABEL_LENGTH && put_u16(dest, (unsigned int)sym->address)
+             && put_u16(dest, (unsigned int)sym->line) && fputc(sym->flags, dest) != EOF;
+    }
+
+    for (i = 0; ok && i < module->uses_count; i++) {
+        use = &module->uses[i];
+        ok = put_u16(dest, (unsigned int)use->symbol) && put_u16(dest, (unsigned int)use->address)
+             && put_u16(dest, (unsigned int)use->line) && fputc(use->slot, dest) != EOF;
+    }
+
+    for (i = 0; ok && i < module->relocations_count; i++)
+        ok = put_u16(dest, (unsigned int)module->relocations[i].offset)
+             && fputc(module->relocations[i].are, dest) != EOF;
+    return ok;
+}
+
+/**
+ * Writes the .dbg file of a program, see write_debug_to_stream().
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The program.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_debug_file(const char *file_name, const object_module *module) {
+    debug_info info;
+    char *path = NULL;
+    FILE *file = NULL;
+    status report = ERR_MEM_ALLOC;
+    size_t i;
+
+    info.lines = (unsigned short *)module->lines;
+    info.is_data = (unsigned char *)module->is_data;
+    info.size = module->size;
+    info.symbols_count = 0;
+    info.source = aobj_path(file_name, PREPROCESSOR_EXT);
+    info.symbols = malloc((module->symbols_count ? module->symbols_count : 1) * sizeof(debug_symbol));
+    path = aobj_path(file_name, DEBUG_EXT);
+
+    for (i = 0; info.symbols && i < module->symbols_count; i++) {
+        if (module->symbols[i].flags & MODULE_SYMBOL_EXTERN || module->symbols[i].address < ADDRESS_START)
+            continue;
+        strcpy(info.symbols[info.symbols_count].label, module->symbols[i].label);
+        info.symbols[info.symbols_count].address = module->symbols[i].address;
+        info.symbols[info.symbols_count].line = module->symbols[i].line;
+        info.symbols[info.symbols_count++].is_entry = (module->symbols[i].flags & MODULE_SYMBOL_ENTRY) != 0;
+    }
+
+    if (info.source && info.symbols && path) {
+        report = ERR_OPEN_FILE;
+        if ((file = fopen(path, FILE_MODE_WRITE_PLUS))) {
+            report = write_debug_info(file, &info) == NO_ERROR ? NO_ERROR : ERR_OPEN_FILE;
+            if (fclose(file) != 0)
+                report = ERR_OPEN_FILE;
+        }
+    }
+
+    free(info.source);
+    free(info.symbols);
+    free(path);
+    return report;
+}
+
+/**
+ * Writes the .xref file of a program, see write_xref_to_stream().
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The program.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_xref_file(const char *file_name, const object_module *module) {
+    const module_use *use = NULL;
+    char *path = NULL;
+    FILE *file = NULL;
+    size_t i;
+    int ok;
+
+    if (!(path = aobj_path(file_name, XREF_EXT)))
+        return ERR_MEM_ALLOC;
+    file = fopen(path, FILE_MODE_WRITE_PLUS);
+    free(path);
+    if (!file)
+        return ERR_OPEN_FILE;
+
+    for (i = 0, ok = 1; ok && i < module->uses_count; i++) {
+        use = &module->uses[i];
+        ok = fprintf(file, XREF_LINE_FORMAT, module->symbols[use->symbol].label, use->line, use->address,
+                     operand_slot_names[use->slot]) >= 0;
+    }
+    return fclose(file) == 0 && ok ? NO_ERROR : ERR_OPEN_FILE;
+}
+
+/**
+ * Builds the path of a file of a program.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param ext       The extension, including the dot.
+ * @return The allocated path, or NULL if memory allocation failed.
+ */
+char *aobj_path(const char *file_name, const char *ext) {
+    char *path = malloc(strlen(file_name) + strlen(ext) + 1);
+
+    if (path)
+        strcat(strcpy(path, file_name), ext);
+    return path;
+}
+
+/**
+ * Writes an unsigned 16-bit little endian number.
+ *
+ * @param dest  The output stream.
+ * @param value The number.
+ * @return 1 if successful, 0 otherwise.
+ */
+int put_u16(FILE *dest, unsigned int value) {
+    return fputc((int)(value & BYTE_MASK), dest) != EOF && fputc((int)((value >> BYTE_BITS) & BYTE_MASK), dest) != EOF;
+}
+
+/**
+ * Reads an unsigned 16-bit little endian number.
+ *
+ * @param data The two bytes of the number.
+ * @return The number.
+ */
+unsigned int get_u16(const unsigned char *data) {
+    return (unsigned int)data[0] | ((unsigned int)data[1] << BYTE_BITS);
+}
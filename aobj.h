@@ -0,0 +1,39 @@
+#ifndef ASSEMBLER_AOBJ_H
+#define ASSEMBLER_AOBJ_H
+
+#include "object.h"
+#include "utils.h"
+#include "errors.h"
+
+/*
+ * .aobj file, the state of a program after the first pass, all the numbers are unsigned 16-bit little endian:
+ *   "AOBJ", version (1 byte)
+ *   key of the source it has been assembled from (AOBJ_KEY_LEN bytes, see source_key())
+ *   instruction count, data count, number of words, of symbols, of symbol uses, of relocations
+ *   every word, in address order from ADDRESS_START: word, source line, is data (1 byte)
+ *   the symbol table: label (MAX_LABEL_LENGTH bytes, null padded), address, line, flags (1 byte, see module_symbol)
+ *   the uses of the labels: index of the symbol, address of the word, line, Operand_slot (1 byte)
+ *   the words that hold an address, in address order: index of the word, A,R,E (1 byte, see module_relocation)
+ * The records have a fixed size, so a mapped file is decoded in place, without parsing. The .ent and
+ * .ext lists are not stored, they follow from the symbol table and the relocations.
+ */
+#define AOBJ_EXT ".aobj"
+#define AOBJ_MAGIC "AOBJ"
+#define AOBJ_MAGIC_LEN 4
+#define AOBJ_VERSION 2
+#define AOBJ_KEY_LEN 16 /* CACHE_KEY_LEN without the '\0' */
+#define AOBJ_COUNTS_LEN 6
+#define AOBJ_HEADER_LEN (AOBJ_MAGIC_LEN + 1 + AOBJ_KEY_LEN + AOBJ_COUNTS_LEN * 2)
+#define AOBJ_WORD_LEN 5
+#define AOBJ_SYMBOL_LEN (MAX_LABEL_LENGTH + 5)
+#define AOBJ_USE_LEN 7
+#define AOBJ_RELOCATION_LEN 3
+
+status write_aobj(const char *file_name, const char *key, const object_module *module);
+status write_aobj_to_stream(FILE *dest, const char *key, const object_module *module);
+status map_aobj(const char *file_name, const char *key, object_module *module, int *offset);
+status read_aobj(const unsigned char *data, size_t len, const char *key, object_module *module, int *offset);
+status emit_object(const char *file_name, const object_module *module);
+status emit_source_maps(const char *file_name, const object_module *module);
+
+#endif
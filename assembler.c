@@ -1,9 +1,18 @@
+#define _XOPEN_SOURCE 700
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "assembler.h"
 #include "errors.h"
 #include "utils.h"
 #include "preprocessor.h"
 #include "passes.h"
+#include "cache.h"
+#include "server.h"
+#include "project.h"
+#include "aobj.h"
+#include "lsp.h"
 
 
 #define HANDLE_STATUS(file, code) if ((code) == ERR_MEM_ALLOC) { \
@@ -12,36 +21,183 @@
     return ERR_MEM_ALLOC; \
     }
 
-#define CHECK_ERROR_CONTINUE(report, file) \
+#define CHECK_ERROR_RETURN(report, file) \
     if ((report) != NO_ERROR) {      \
     handle_error(ERR_FOUND_ASSEMBLER, (file));\
-        continue;                    \
+        return FAILURE;              \
     }
 
 status preprocess_file(const char* file_name, file_context** dest , int index, int max);
+status reemit_aobj(const char *file_name);
+status store_aobj(const char *file_name, const object_module *module);
+int is_valid_define(const char *def);
 
 int main(int argc, char *argv[]) {
-    int i;
+    char *lib_path = NULL;
+    int i, files = 0;
     status report;
-    file_context *dest_am = NULL;
 
-    if (argc == 1) {
+    /* Options may appear anywhere, file names are packed to the front of argv */
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (parse_option(argc, argv, &i) != NO_ERROR) {
+            flush_diagnostics();
+            exit(FAILURE);
+        }
+    }
+
+    /* Absolute for the server, which assembles in a directory of its own, mapped before it forks its workers */
+    if (options.macro_lib && (lib_path = realpath(options.macro_lib, NULL)))
+        options.macro_lib = lib_path;
+    if (options.macro_lib && use_macro_library(options.macro_lib) != NO_ERROR) {
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    if (options.serve_path) {
+        report = serve(options.serve_path, options.workers);
+        flush_diagnostics();
+        exit(report == NO_ERROR ? 0 : FAILURE);
+    }
+
+    if (options.lsp) {
+        report = serve_lsp(stdin, stdout);
+        flush_diagnostics();
+        exit(report == NO_ERROR ? 0 : FAILURE);
+    }
+
+    if (!files) {
         handle_error(FAILURE);
+        flush_diagnostics();
         exit(FAILURE);
     }
 
-    for (i = 1; i < argc; i++) {
-        report = preprocess_file(argv[i], &dest_am, i, argc - 1);
-        CHECK_ERROR_CONTINUE(report, argv[i]);
-        if (assembler_first_pass(&dest_am) != NO_ERROR)
-            handle_error(ERR_FOUND_ASSEMBLER, argv[i]);
-        else
-            handle_progress(NO_ERROR, argv[i]);
+    if (options.project) {
+        report = assemble_project(argv + 1, files, options.project, options.workers);
+        flush_diagnostics();
+        exit(report == NO_ERROR ? 0 : FAILURE);
     }
 
+    for (i = 1; i <= files; i++) {
+        (void) assemble_file(argv[i], i, files);
+        flush_diagnostics();
+    }
+
+    free_include_cache();
+    (void) use_macro_library(NULL);
+    free(lib_path);
     return 0;
 }
 
+/**
+ * Assembles a single source file: cache lookup, preprocessing, first and second pass.
+ * Diagnostics are buffered, the caller is responsible for flushing them.
+ *
+ * @param file_name     The name of the source file, without the .as extension.
+ * @param index         The index of the file being processed.
+ * @param max           The total number of files to be processed.
+ *
+ * @return NO_ERROR if the output file(s) have been generated (or restored from the cache),
+ * @return FAILURE otherwise.
+ */
+status assemble_file(const char *file_name, int index, int max) {
+    static object_module module;
+    char key[CACHE_KEY_LEN] = "";
+    status report;
+    file_context *dest_am = NULL;
+
+    if (options.from_aobj && !options.check_only && reemit_aobj(file_name) == NO_ERROR) {
+        handle_progress(AOBJ_HIT, file_name);
+        return NO_ERROR;
+    }
+    /* An entry stored with --aobj has the .aobj file too, see cache_key() */
+    if (options.cache_dir && !options.check_only && cache_key(file_name, key) == NO_ERROR
+        && cache_restore(file_name, key) == NO_ERROR) {
+        handle_progress(CACHE_HIT, file_name);
+        return NO_ERROR;
+    }
+    report = preprocess_file(file_name, &dest_am, index, max);
+    CHECK_ERROR_RETURN(report, file_name);
+
+    memset(&module, 0, sizeof(object_module));
+    captured_module = options.write_aobj || options.project ? &module : NULL;
+    report = assembler_first_pass(&dest_am);
+    captured_module = NULL;
+    if (report != NO_ERROR) {
+        free_object(&module);
+        handle_error(ERR_FOUND_ASSEMBLER, file_name);
+        return FAILURE;
+    }
+
+    handle_progress(options.check_only ? CHECK_OK : NO_ERROR, file_name);
+    if ((options.write_aobj || options.project) && !options.check_only)
+        (void) store_aobj(file_name, &module);
+    free_object(&module);
+    if (options.cache_dir && *key)
+        (void) cache_store(file_name, key);
+    return NO_ERROR;
+}
+
+/**
+ * Parses a single command line option and updates the global options accordingly.
+ *
+ * @param argc      The number of command line arguments.
+ * @param argv      The command line arguments.
+ * @param index     Pointer to the index of the option, advanced past any option argument.
+ *
+ * @return NO_ERROR if the option is valid, or ERR_INVALID_OPTION otherwise.
+ */
+status parse_option(int argc, char *argv[], int *index) {
+    char *opt = argv[*index];
+
+    if (strcmp(opt, "--stream") == 0)
+        options.stream_output = 1;
+    else if (strcmp(opt, "--check") == 0)
+        options.check_only = 1;
+    else if (strcmp(opt, "--debug-info") == 0)
+        options.debug_info = 1;
+    else if (strcmp(opt, "--aobj") == 0)
+        options.write_aobj = 1;
+    else if (strcmp(opt, "--from-aobj") == 0)
+        options.from_aobj = 1;
+    else if (strcmp(opt, "--lsp") == 0)
+        options.lsp = 1;
+    else if (strcmp(opt, "--xref") == 0)
+        options.xref = 1;
+    else if (strcmp(opt, OPTIMIZE_OPTION) == 0)
+        options.optimize = 1;
+    else if (strcmp(opt, PRUNE_OPTION) == 0)
+        options.prune = 1;
+    else if (strncmp(opt, DEFINE_PREFIX, strlen(DEFINE_PREFIX)) == 0 && is_valid_define(opt + strlen(DEFINE_PREFIX))
+             && options.defines_count < MAX_DEFINES)
+        options.defines[options.defines_count++] = opt + strlen(DEFINE_PREFIX);
+    else if (strncmp(opt, INCLUDE_PREFIX, strlen(INCLUDE_PREFIX)) == 0 && opt[strlen(INCLUDE_PREFIX)]
+             && options.include_dirs_count < MAX_INCLUDE_DIRS)
+        options.include_dirs[options.include_dirs_count++] = opt + strlen(INCLUDE_PREFIX);
+    else if (strcmp(opt, "--cache-dir") == 0 && *index + 1 < argc)
+        options.cache_dir = argv[++*index];
+    else if (strcmp(opt, "--cache-size") == 0 && *index + 1 < argc && safe_atoi(argv[*index + 1]) > 0)
+        options.cache_max_size = safe_atoi(argv[++*index]);
+    else if (strcmp(opt, "--max-errors") == 0 && *index + 1 < argc && safe_atoi(argv[*index + 1]) > 0)
+        options.max_errors = safe_atoi(argv[++*index]);
+    else if (strcmp(opt, "--diag-json") == 0 && *index + 1 < argc)
+        options.diag_json = argv[++*index];
+    else if (strcmp(opt, "--macro-lib") == 0 && *index + 1 < argc)
+        options.macro_lib = argv[++*index];
+    else if (strcmp(opt, "--serve") == 0 && *index + 1 < argc)
+        options.serve_path = argv[++*index];
+    else if (strcmp(opt, "--project") == 0 && *index + 1 < argc)
+        options.project = argv[++*index];
+    else if (strcmp(opt, "--workers") == 0 && *index + 1 < argc && safe_atoi(argv[*index + 1]) > 0)
+        options.workers = safe_atoi(argv[++*index]);
+    else {
+        handle_error(ERR_INVALID_OPTION, opt);
+        return ERR_INVALID_OPTION;
+    }
+    return NO_ERROR;
+}
+
 /**
  * Processes the input source file for assembler preprocessing.
  *
@@ -65,7 +221,10 @@ status preprocess_file(const char* file_name, file_context** dest , int index, i
 
     handle_progress(OPEN_FILE, src);
 
-    *dest = create_file_context(file_name, PREPROCESSOR_EXT, FILE_EXT_LEN, FILE_MODE_WRITE_PLUS, &code);
+    if (options.check_only) /* The .am file is only needed by the first pass, keep it off the disk */
+        *dest = create_scratch_context(file_name, PREPROCESSOR_EXT, &code);
+    else
+        *dest = create_file_context(file_name, PREPROCESSOR_EXT, FILE_EXT_LEN, FILE_MODE_WRITE_PLUS, &code);
     HANDLE_STATUS(*dest, code);
     (*dest)->tc = max;
     (*dest)->fc = index;
@@ -79,7 +238,89 @@ status preprocess_file(const char* file_name, file_context** dest , int index, i
         free_file_context(dest);
         return FAILURE;
     } else {
-        handle_progress(PRE_FILE_OK, *dest, index, max);
+        if (!options.check_only) /* the .am file is a scratch stream */
+            handle_progress(PRE_FILE_OK, *dest, index, max);
         return NO_ERROR;
     }
 }
+
+/**
+ * Re-emits the outputs of a source file from its .aobj file, without preprocessing or parsing it:
+ * the .ob, .ent and .ext files, and the .dbg and .xref ones if asked for.
+ * The .aobj file is used only if it has been assembled from the current source.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @return NO_ERROR if the outputs have been written, FAILURE if the file has to be assembled.
+ */
+status reemit_aobj(const char *file_name) {
+    char key[CACHE_KEY_LEN];
+    object_module module;
+    status report;
+    int offset;
+
+    if (source_key(file_name, key) != NO_ERROR)
+        return FAILURE;
+    if ((report = map_aobj(file_name, key, &module, &offset)) == NO_ERROR
+        && (report = emit_object(file_name, &module)) == NO_ERROR)
+        report = emit_source_maps(file_name, &module);
+    free_object(&module);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Writes the .aobj file of a source file that has just been assembled. In --project mode it is
+ * handed over to the worker instead, as the other outputs (see captured_outputs).
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param module    The module captured by the second pass, see captured_module.
+ * @return NO_ERROR if the file has been written, an error status otherwise.
+ */
+status store_aobj(const char *file_name, const object_module *module) {
+    char key[CACHE_KEY_LEN];
+    FILE *stream = NULL;
+    status report;
+
+    if (!module->is_relocatable)
+        return FAILURE; /* nothing has been captured, e.g. an empty image */
+    if ((report = source_key(file_name, key)) != NO_ERROR)
+        return report;
+    if (!options.project)
+        return write_aobj(file_name, key, module);
+
+    if (!(stream = tmpfile()))
+        return ERR_OPEN_FILE;
+    if ((report = write_aobj_to_stream(stream, key, module)) != NO_ERROR) {
+        fclose(stream);
+        return report;
+    }
+    rewind(stream);
+    captured_outputs[CAPTURED_AOBJ] = stream;
+    return NO_ERROR;
+}
+
+/**
+ * Checks the argument of a -D option: a name of letters, digits and underscores that does not
+ * start with a digit, optionally followed by '=' and a decimal value.
+ *
+ * @param def The argument, NAME or NAME=VALUE.
+ * @return 1 if the argument is valid, 0 otherwise.
+ */
+int is_valid_define(const char *def) {
+    const char *p = def;
+
+    if (!isalpha((unsigned char)*p) && *p != '_')
+        return 0;
+    while (isalnum((unsigned char)*p) || *p == '_')
+        p++;
+    if (!*p)
+        return 1;
+    if (*p++ != '=')
+        return 0;
+    if (*p == '-' || *p == '+')
+        p++;
+    if (!isdigit((unsigned char)*p))
+        return 0;
+    while (isdigit((unsigned char)*p))
+        p++;
+    return !*p;
+}
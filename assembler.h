@@ -0,0 +1,10 @@
+#ifndef ASSEMBLER_ASSEMBLER_H
+#define ASSEMBLER_ASSEMBLER_H
+
+#include "errors.h"
+#include "utils.h"
+
+status assemble_file(const char *file_name, int index, int max);
+status parse_option(int argc, char *argv[], int *index);
+
+#endif
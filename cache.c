@@ -0,0 +1,508 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include "cache.h"
+#include "aobj.h"
+#include "data.h"
+#include "preprocessor.h"
+#include "utils.h"
+#include "errors.h"
+
+#define CACHED_NAME "cached"
+
+/* Output files that are stored per entry, restored only if they were produced */
+const char *cache_artifacts[CACHE_ARTIFACTS_LEN] = {
+    PREPROCESSOR_EXT,
+    OBJECT_EXT,
+    ENTRY_EXT,
+    EXTERNAL_EXT,
+    DEBUG_EXT,
+    XREF_EXT,
+    AOBJ_EXT
+};
+
+typedef struct {
+    char *name;
+    long size;
+    time_t last_used;
+} cache_entry;
+
+/* "Private" helper functions */
+status hash_source(const char *file_name, const char *extra, char *key);
+status hash_includes(unsigned long *hash, FILE *fp, const char *including, char ***visited, size_t *count);
+char *join_path(const char *dir, const char *name, const char *ext);
+char *temp_path(const char *path);
+void hash_update(unsigned long *hash, const char *buf, size_t len);
+long entry_size(const char *entry_path);
+void remove_entry(const char *entry_path);
+int compare_last_used(const void *a, const void *b);
+
+/**
+ * Computes the cache key of a source file.
+ * The key is a 64-bit hash (two independent 32-bit hashes) of the assembler version, the
+ * options that add output files (--debug-info, --xref, --aobj), -O and --prune, followed by the contents of the .as file.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param key       Buffer of CACHE_KEY_LEN characters to store the hexadecimal key.
+ * @return NO_ERROR if successful, FAILURE if the source cannot be read, or ERR_MEM_ALLOC.
+ */
+status cache_key(const char *file_name, char *key) {
+    char extra[sizeof(DEBUG_EXT) + sizeof(XREF_EXT) + sizeof(AOBJ_EXT) + sizeof(OPTIMIZE_OPTION) + sizeof(PRUNE_OPTION)] = "";
+
+    if (options.optimize)
+        strcat(extra, OPTIMIZE_OPTION);
+    if (options.prune)
+        strcat(extra, PRUNE_OPTION);
+    if (options.debug_info)
+        strcat(extra, DEBUG_EXT);
+    if (options.xref)
+        strcat(extra, XREF_EXT);
+    if (options.write_aobj)
+        strcat(extra, AOBJ_EXT);
+    return hash_source(file_name, *extra ? extra : NULL, key);
+}
+
+/**
+ * Computes the key of the source a .aobj file has been assembled from, the same as cache_key()
+ * but independent of the output options, the outputs are re-emitted from the .aobj file whatever they are.
+ * -O and --prune are part of it, the program itself is not the same.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param key       Buffer of CACHE_KEY_LEN characters to store the hexadecimal key.
+ * @return NO_ERROR if successful, FAILURE if the source cannot be read, or ERR_MEM_ALLOC.
+ */
+status source_key(const char *file_name, char *key) {
+    char extra[sizeof(OPTIMIZE_OPTION) + sizeof(PRUNE_OPTION)] = "";
+
+    if (options.optimize)
+        strcat(extra, OPTIMIZE_OPTION);
+    if (options.prune)
+        strcat(extra, PRUNE_OPTION);
+    return hash_source(file_name, *extra ? extra : NULL, key);
+}
+
+/**
+ * Hashes the assembler version, an optional extra string, the -D definitions and the contents of
+ * a source file, of the --macro-lib file and of the files the source includes.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param extra     Hashed after the version (optional - NULL).
+ * @param key       Buffer of CACHE_KEY_LEN characters to store the hexadecimal key.
+ * @return NO_ERROR if successful, FAILURE if the source cannot be read, or ERR_MEM_ALLOC.
+ */
+status hash_source(const char *file_name, const char *extra, char *key) {
+    unsigned long hash[2];
+    char buffer[CACHE_COPY_BUFFER];
+    char *path = NULL, **visited = NULL;
+    size_t len, count = 0;
+    int i;
+    FILE *fp = NULL, *lib = NULL;
+    status report;
+
+    if (!(path = join_path(NULL, file_name, ASSEMBLY_EXT)))
+        return ERR_MEM_ALLOC;
+
+    if (!(fp = fopen(path, "rb"))) {
+        free(path);
+        return FAILURE; /* Reported by the preprocessor when the file is opened */
+    }
+
+    hash[0] = FNV_OFFSET_BASIS;
+    hash[1] = DJB_OFFSET_BASIS;
+    hash_update(hash, ASSEMBLER_VERSION, strlen(ASSEMBLER_VERSION) + 1);
+    if (extra)
+        hash_update(hash, extra, strlen(extra) + 1);
+    for (i = 0; i < options.defines_count; i++) /* they select the lines that are assembled */
+        hash_update(hash, options.defines[i], strlen(options.defines[i]) + 1);
+    while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        hash_update(hash, buffer, len);
+    if (options.macro_lib && (lib = fopen(options.macro_lib, "rb"))) { /* its macros are expanded */
+        while ((len = fread(buffer, 1, sizeof(buffer), lib)) > 0)
+            hash_update(hash, buffer, len);
+        fclose(lib);
+    }
+    report = hash_includes(hash, fp, path, &visited, &count);
+    fclose(fp);
+    free(path);
+    while (count)
+        free(visited[--count]);
+    free(visited);
+
+    sprintf(key, "%08lx%08lx", hash[0], hash[1]);
+    return report;
+}
+
+/**
+ * Hashes the paths and contents of the files that a file includes, and of the files they include,
+ * each file once. An .include line within a conditional block is followed whether it is assembled
+ * or not, which can only make a key change more often than needed.
+ *
+ * @param hash      The hash state.
+ * @param fp        The including file.
+ * @param including The path of the including file.
+ * @param visited   The canonical paths of the files hashed so far.
+ * @param count     Their number.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status hash_includes(unsigned long *hash, FILE *fp, const char *including, char ***visited, size_t *count) {
+    char line[MAX_BUFFER_LENGTH], name[MAX_BUFFER_LENGTH], buffer[CACHE_COPY_BUFFER];
+    char *rest = NULL, *path = NULL, **new_visited = NULL;
+    size_t i, len;
+    int line_start = 1, is_line;
+    FILE *inc = NULL;
+    status report = NO_ERROR;
+
+    rewind(fp);
+    while (report == NO_ERROR && fgets(line, sizeof(line), fp)) {
+        is_line = line_start; /* a long line is read in parts, only its first part is a line */
+        line_start = strchr(line, '\n') != NULL;
+        if (!is_line || !scan_include(line, &rest) || include_name(rest, name) != NO_ERROR)
+            continue;
+        if (!(path = resolve_include(including, name, NULL))) {
+            hash_update(hash, name, strlen(name) + 1); /* reported by the preprocessor */
+            continue;
+        }
+        for (i = 0; i < *count && strcmp((*visited)[i], path) != 0; i++)
+            ;
+        if (i < *count || !(inc = fopen(path, "rb"))) {
+            free(path);
+            continue;
+        }
+        if (!(new_visited = realloc(*visited, (*count + 1) * sizeof(char *)))) {
+            free(path);
+            fclose(inc);
+            return ERR_MEM_ALLOC;
+        }
+        *visited = new_visited;
+        (*visited)[(*count)++] = path;
+
+        hash_update(hash, path, strlen(path) + 1);
+        while ((len = fread(buffer, 1, sizeof(buffer), inc)) > 0)
+            hash_update(hash, buffer, len);
+        report = hash_includes(hash, inc, path, visited, count);
+        fclose(inc);
+    }
+    return report;
+}
+
+/**
+ * Restores the outputs of a source file from the cache.
+ * Outputs that are already identical to the cached copy are left untouched, so their
+ * modification time is preserved and dependent build steps are not triggered.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param key       The cache key of the source file.
+ * @return NO_ERROR on a cache hit, FAILURE on a miss or if the entry could not be restored.
+ */
+status cache_restore(const char *file_name, const char *key) {
+    struct stat st;
+    char *entry = NULL, *cached = NULL, *dest = NULL;
+    status report = NO_ERROR;
+    int i;
+
+    if (!(entry = join_path(options.cache_dir, key, "")))
+        return ERR_MEM_ALLOC;
+
+    if (stat(entry, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        free(entry);
+        return FAILURE;
+    }
+
+    for (i = 0; i < CACHE_ARTIFACTS_LEN && report == NO_ERROR; i++) {
+        cached = join_path(entry, CACHED_NAME, cache_artifacts[i]);
+        dest = join_path(NULL, file_name, cache_artifacts[i]);
+
+        if (!cached || !dest)
+            report = ERR_MEM_ALLOC;
+        else if (stat(cached, &st) == 0 && !files_equal(cached, dest))
+            report = copy_file(cached, dest);
+
+        free_strings(AMT_PATHS_2, &cached, &dest);
+    }
+
+    if (report == NO_ERROR)
+        (void) utime(entry, NULL); /* Most recently used, see cache_evict() */
+    free(entry);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Stores the outputs of a successfully assembled source file in the cache.
+ * The entry is assembled in a private temporary directory and published with a single rename(),
+ * so concurrent assembler processes never observe a partial entry.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @param key       The cache key of the source file.
+ * @return NO_ERROR if the entry has been published (or already existed), an error status otherwise.
+ */
+status cache_store(const char *file_name, const char *key) {
+    struct stat st;
+    char *entry = NULL, *tmp = NULL, *src = NULL, *cached = NULL;
+    status report = NO_ERROR;
+    int i;
+
+    if (mkdir(options.cache_dir, 0777) != 0 && errno != EEXIST) {
+        handle_error(WARN_CACHE, options.cache_dir);
+        return FAILURE;
+    }
+
+    entry = join_path(options.cache_dir, key, "");
+    tmp = entry ? temp_path(entry) : NULL;
+    if (!entry || !tmp) {
+        free_strings(AMT_PATHS_2, &entry, &tmp);
+        return ERR_MEM_ALLOC;
+    }
+
+    if (mkdir(tmp, 0777) != 0) {
+        handle_error(WARN_CACHE, options.cache_dir);
+        free_strings(AMT_PATHS_2, &entry, &tmp);
+        return FAILURE;
+    }
+
+    for (i = 0; i < CACHE_ARTIFACTS_LEN && report == NO_ERROR; i++) {
+        src = join_path(NULL, file_name, cache_artifacts[i]);
+        cached = join_path(tmp, CACHED_NAME, cache_artifacts[i]);
+
+        if (!src || !cached)
+            report = ERR_MEM_ALLOC;
+        else if (stat(src, &st) == 0)
+            report = copy_file(src, cached);
+
+        free_strings(AMT_PATHS_2, &src, &cached);
+    }
+
+    if (report != NO_ERROR || rename(tmp, entry) != 0)
+        remove_entry(tmp); /* Failed, or another process published the same entry first */
+    free_strings(AMT_PATHS_2, &entry, &tmp);
+
+    cache_evict(options.cache_max_size ? options.cache_max_size : CACHE_DEFAULT_MAX_SIZE);
+    return report;
+}
+
+/**
+ * Evicts the least recently used entries until the cache fits in max_size bytes.
+ *
+ * @param max_size The maximum size of the cache directory, in bytes.
+ */
+void cache_evict(long max_size) {
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    struct stat st;
+    cache_entry *entries = NULL, *new_entries = NULL;
+    size_t count = 0, cap = 0, i;
+    long total = 0;
+    char *path = NULL;
+
+    if (!(dir = opendir(options.cache_dir)))
+        return;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (*ent->d_name == '.' || strstr(ent->d_name, CACHE_TMP_MARK))
+            continue; /* ".", ".." and entries that are still being published */
+
+        if (!(path = join_path(options.cache_dir, ent->d_name, "")) || stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : CACHE_ARTIFACTS_LEN;
+            if (!(new_entries = realloc(entries, cap * sizeof(cache_entry)))) {
+                free(path);
+                break;
+            }
+            entries = new_entries;
+        }
+        entries[count].name = path;
+        entries[count].size = entry_size(path);
+        entries[count].last_used = st.st_mtime;
+        total += entries[count++].size;
+    }
+    closedir(dir);
+
+    if (total > max_size)
+        qsort(entries, count, sizeof(cache_entry), compare_last_used);
+
+    for (i = 0; i < count; i++) {
+        if (total > max_size) {
+            remove_entry(entries[i].name);
+            total -= entries[i].size;
+        }
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+/**
+ * Copies a file. The destination is written under a temporary name and renamed into place,
+ * so a reader never sees a partially written file.
+ *
+ * @param src_path  The path of the file to copy.
+ * @param dest_path The path of the copy.
+ * @return NO_ERROR if successful, FAILURE or ERR_MEM_ALLOC otherwise.
+ */
+status copy_file(const char *src_path, const char *dest_path) {
+    char buffer[CACHE_COPY_BUFFER];
+    char *tmp = NULL;
+    FILE *src = NULL, *dest = NULL;
+    size_t len;
+    int has_error = 0;
+
+    if (!(tmp = temp_path(dest_path)))
+        return ERR_MEM_ALLOC;
+
+    src = fopen(src_path, "rb");
+    dest = src ? fopen(tmp, "wb") : NULL;
+
+    while (dest && !has_error && (len = fread(buffer, 1, sizeof(buffer), src)) > 0)
+        has_error = fwrite(buffer, 1, len, dest) != len;
+
+    if (src) fclose(src);
+    if (dest && fclose(dest) != 0) has_error = 1;
+
+    if (!src || !dest || has_error || rename(tmp, dest_path) != 0) {
+        remove(tmp);
+        free(tmp);
+        return FAILURE;
+    }
+    free(tmp);
+    return NO_ERROR;
+}
+
+/**
+ * Checks whether two files have identical contents.
+ *
+ * @param path_a The path of the first file.
+ * @param path_b The path of the second file.
+ * @return 1 if both files exist and are identical, 0 otherwise.
+ */
+int files_equal(const char *path_a, const char *path_b) {
+    char buffer_a[CACHE_COPY_BUFFER], buffer_b[CACHE_COPY_BUFFER];
+    struct stat st_a, st_b;
+    FILE *fa = NULL, *fb = NULL;
+    size_t len_a, len_b;
+    int equal;
+
+    if (stat(path_a, &st_a) != 0 || stat(path_b, &st_b) != 0 || st_a.st_size != st_b.st_size)
+        return 0;
+
+    fa = fopen(path_a, "rb");
+    fb = fopen(path_b, "rb");
+    equal = fa && fb;
+
+    while (equal && (len_a = fread(buffer_a, 1, sizeof(buffer_a), fa)) > 0) {
+        len_b = fread(buffer_b, 1, sizeof(buffer_b), fb);
+        equal = len_a == len_b && memcmp(buffer_a, buffer_b, len_a) == 0;
+    }
+
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return equal;
+}
+
+/**
+ * Builds "dir/name+ext", or "name+ext" if dir is NULL.
+ *
+ * @param dir  The directory (optional - NULL).
+ * @param name The file name.
+ * @param ext  The extension to append.
+ * @return A dynamically allocated path, or NULL if memory allocation fails.
+ */
+char *join_path(const char *dir, const char *name, const char *ext) {
+    char *path = malloc((dir ? strlen(dir) + 1 : 0) + strlen(name) + strlen(ext) + 1);
+
+    if (!path) {
+        handle_error(ERR_MEM_ALLOC);
+        return NULL;
+    }
+
+    *path = '\0';
+    if (dir) {
+        strcpy(path, dir);
+        strcat(path, "/");
+    }
+    strcat(path, name);
+    strcat(path, ext);
+    return path;
+}
+
+/**
+ * Builds a temporary path next to the given path, unique to the current process.
+ *
+ * @param path The final path.
+ * @return A dynamically allocated path, or NULL if memory allocation fails.
+ */
+char *temp_path(const char *path) {
+    char suffix[MAX_LABEL_LENGTH];
+
+    sprintf(suffix, "%s%ld", CACHE_TMP_MARK, (long)getpid());
+    return join_path(NULL, path, suffix);
+}
+
+/**
+ * Updates both halves of the cache hash (FNV-1a and djb2) with a buffer.
+ *
+ * @param hash Array of the two 32-bit hash values.
+ * @param buf  The buffer to hash.
+ * @param len  The length of the buffer.
+ */
+void hash_update(unsigned long *hash, const char *buf, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash[0] = ((hash[0] ^ (unsigned char)buf[i]) * FNV_PRIME) & HASH_MASK;
+        hash[1] = ((hash[1] << 5) + hash[1] + (unsigned char)buf[i]) & HASH_MASK;
+    }
+}
+
+/**
+ * Computes the total size of the files of a cache entry.
+ *
+ * @param entry_path The path of the entry directory.
+ * @return The size of the entry, in bytes.
+ */
+long entry_size(const char *entry_path) {
+    struct stat st;
+    char *path = NULL;
+    long size = 0;
+    int i;
+
+    for (i = 0; i < CACHE_ARTIFACTS_LEN; i++) {
+        if ((path = join_path(entry_path, CACHED_NAME, cache_artifacts[i])) && stat(path, &st) == 0)
+            size += (long)st.st_size;
+        free(path);
+    }
+    return size;
+}
+
+/**
+ * Removes a cache entry directory and its files.
+ *
+ * @param entry_path The path of the entry directory.
+ */
+void remove_entry(const char *entry_path) {
+    char *path = NULL;
+    int i;
+
+    for (i = 0; i < CACHE_ARTIFACTS_LEN; i++) {
+        if ((path = join_path(entry_path, CACHED_NAME, cache_artifacts[i])))
+            remove(path);
+        free(path);
+    }
+    rmdir(entry_path);
+}
+
+/**
+ * qsort() comparator ordering cache entries from the least to the most recently used.
+ */
+int compare_last_used(const void *a, const void *b) {
+    time_t ta = ((const cache_entry *)a)->last_used, tb = ((const cache_entry *)b)->last_used;
+    return ta < tb ? -1 : ta > tb;
+}
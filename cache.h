@@ -0,0 +1,28 @@
+#ifndef ASSEMBLER_CACHE_H
+#define ASSEMBLER_CACHE_H
+
+#include "utils.h"
+#include "errors.h"
+
+#define CACHE_KEY_LEN 17 /* 16 hex digits + '\0' */
+#define CACHE_DEFAULT_MAX_SIZE (64L * 1024L * 1024L)
+#define CACHE_TMP_MARK ".tmp"
+#define CACHE_COPY_BUFFER 4096
+#define CACHE_ARTIFACTS_LEN 7
+#define AMT_PATHS_2 2
+
+#define DJB_OFFSET_BASIS 5381UL
+
+extern const char *cache_artifacts[CACHE_ARTIFACTS_LEN];
+
+status cache_key(const char *file_name, char *key);
+status source_key(const char *file_name, char *key);
+status cache_restore(const char *file_name, const char *key);
+status cache_store(const char *file_name, const char *key);
+status copy_file(const char *src_path, const char *dest_path);
+
+int files_equal(const char *path_a, const char *path_b);
+
+void cache_evict(long max_size);
+
+#endif
@@ -0,0 +1,237 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+#include "assembler.h"
+#include "utils.h"
+#include "errors.h"
+
+#define ARG_OPTIONS_LEN 5
+
+/* Assembler options that take an argument, forwarded to the server together with it.
+ * The server keeps its own --macro-lib, the option is only listed so its argument is not taken for a file. */
+static const char *arg_options[ARG_OPTIONS_LEN] = {"--cache-dir", "--cache-size", "--max-errors", "--diag-json",
+                                                   "--macro-lib"};
+
+status request_file(const char *socket_path, const char *file_name, const char *opts);
+char *include_option(const char *dir, size_t len);
+status write_output(const char *file_name, const char *ext, const section *sec);
+int connect_server(const char *socket_path);
+
+/**
+ * Thin client of the assembler server (Assembler --serve).
+ * Usage mirrors the assembler: asclient [--socket PATH] [options] file...
+ * Each file is sent to the server, the output files are written next to the source file
+ * and the messages of the assembler are printed as if it ran locally.
+ */
+int main(int argc, char *argv[]) {
+    const char *socket_path = SERVER_DEFAULT_SOCKET;
+    char *opts = NULL, *dir = NULL;
+    size_t opts_len = 1;
+    int i, j, files = 0;
+
+    for (i = 1; i < argc; i++) { /* a -I directory is forwarded as an absolute path */
+        if (strncmp(argv[i], INCLUDE_PREFIX, strlen(INCLUDE_PREFIX)) == 0 && argv[i][strlen(INCLUDE_PREFIX)]
+            && (dir = include_option(argv[i] + strlen(INCLUDE_PREFIX), strlen(argv[i] + strlen(INCLUDE_PREFIX)))))
+            argv[i] = dir;
+    }
+    for (i = 1; i < argc; i++)
+        opts_len += strlen(argv[i]) + 1;
+    if (!(opts = malloc(opts_len))) {
+        handle_error(ERR_MEM_ALLOC);
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+    *opts = '\0';
+
+    /* Options may appear anywhere, file names are packed to the front of argv */
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else {
+            strcat(strcat(opts, *opts ? " " : ""), argv[i]);
+            for (j = 0; j < ARG_OPTIONS_LEN && i + 1 < argc; j++)
+                if (strcmp(argv[i], arg_options[j]) == 0) {
+                    strcat(strcat(opts, " "), argv[++i]);
+                    break;
+                }
+        }
+    }
+
+    if (!files) {
+        handle_error(FAILURE);
+        flush_diagnostics();
+        free(opts);
+        exit(FAILURE);
+    }
+
+    for (i = 1; i <= files; i++) {
+        (void) request_file(socket_path, argv[i], opts);
+        flush_diagnostics();
+    }
+
+    free(opts);
+    return 0;
+}
+
+/**
+ * Sends a source file to the server and handles the response.
+ *
+ * @param socket_path   The path of the server socket.
+ * @param file_name     The name of the source file, without the .as extension.
+ * @param opts          Space separated assembler options.
+ * @return NO_ERROR if the file has been assembled, FAILURE otherwise.
+ */
+status request_file(const char *socket_path, const char *file_name, const char *opts) {
+    file_context *src = NULL;
+    FILE *in = NULL, *out = NULL;
+    section sec;
+    const char *name = strrchr(file_name, '/') ? strrchr(file_name, '/') + 1 : file_name;
+    char *dir = NULL, *request_opts = NULL;
+    status report = NO_ERROR, result = FAILURE;
+    int fd, in_fd = -1, done = 0;
+
+    src = create_file_context(file_name, ASSEMBLY_EXT, FILE_EXT_LEN, FILE_MODE_READ, &report);
+    if (report != NO_ERROR) {
+        if (report == ERR_MEM_ALLOC) handle_error(ERR_MEM_ALLOC);
+        return FAILURE;
+    }
+
+    /* The server assembles in a directory of its own, an .include is looked up next to the source first */
+    dir = include_option(file_name, name - file_name);
+    if (!(request_opts = malloc(strlen(opts) + (dir ? strlen(dir) : 0) + 2))) {
+        handle_error(ERR_MEM_ALLOC);
+        free(dir);
+        free_file_context(&src);
+        return FAILURE;
+    }
+    sprintf(request_opts, "%s%s%s", dir ? dir : "", dir && *opts ? " " : "", opts);
+    free(dir);
+
+    if ((fd = connect_server(socket_path)) < 0 || !(out = fdopen(fd, "w"))
+        || (in_fd = dup(fd)) < 0 || !(in = fdopen(in_fd, "r"))) {
+        handle_error(ERR_SOCKET, socket_path);
+        if (!out && fd >= 0) close(fd);
+        if (!in && in_fd >= 0) close(in_fd);
+        if (out) fclose(out);
+        free_file_context(&src);
+        free(request_opts);
+        return FAILURE;
+    }
+
+    if (write_section(out, TAG_NAME, name, strlen(name)) != NO_ERROR
+        || write_section(out, TAG_OPTS, request_opts, strlen(request_opts)) != NO_ERROR
+        || write_stream_section(out, TAG_SRC, src->file_ptr) != NO_ERROR
+        || write_section(out, TAG_END, NULL, 0) != NO_ERROR || fflush(out) != 0)
+        report = FAILURE;
+    free_file_context(&src);
+    free(request_opts);
+
+    while (report == NO_ERROR && !done && (report = read_section(in, &sec)) == NO_ERROR) {
+        if (strcmp(sec.tag, TAG_OUT) == 0)
+            fwrite(sec.data ? sec.data : "", 1, sec.len, stdout);
+        else if (strcmp(sec.tag, TAG_ERR) == 0)
+            fwrite(sec.data ? sec.data : "", 1, sec.len, stderr);
+        else if (strcmp(sec.tag, TAG_OB) == 0)
+            report = write_output(file_name, OBJECT_EXT, &sec);
+        else if (strcmp(sec.tag, TAG_ENT) == 0)
+            report = write_output(file_name, ENTRY_EXT, &sec);
+        else if (strcmp(sec.tag, TAG_EXT) == 0)
+            report = write_output(file_name, EXTERNAL_EXT, &sec);
+        else if (strcmp(sec.tag, TAG_DBG) == 0)
+            report = write_output(file_name, DEBUG_EXT, &sec);
+        else if (strcmp(sec.tag, TAG_XREF) == 0)
+            report = write_output(file_name, XREF_EXT, &sec);
+        else if (strcmp(sec.tag, TAG_STAT) == 0)
+            result = sec.data && *sec.data == '0' ? NO_ERROR : FAILURE;
+        else if (strcmp(sec.tag, TAG_END) == 0)
+            done = 1;
+        free(sec.data);
+    }
+
+    if (report != NO_ERROR && report != ERR_OPEN_FILE) /* a file that cannot be opened is already reported */
+        handle_error(report == ERR_MEM_ALLOC ? ERR_MEM_ALLOC : ERR_SOCKET, socket_path);
+    fclose(out);
+    fclose(in);
+    return report == NO_ERROR ? result : FAILURE;
+}
+
+/**
+ * Builds the -I option of a directory as an absolute path, the server does not share the
+ * working directory of the client.
+ *
+ * @param dir   The directory, not necessarily terminated, the working directory if empty.
+ * @param len   The length of the directory.
+ * @return The allocated option, or NULL if the directory cannot be resolved or its path has a space,
+ *         the options are separated by spaces.
+ */
+char *include_option(const char *dir, size_t len) {
+    char *copy = NULL, *path = NULL, *opt = NULL;
+
+    if (!(copy = malloc(len + 2)))
+        return NULL;
+    if (len) {
+        memcpy(copy, dir, len);
+        copy[len] = '\0';
+    }
+    else
+        strcpy(copy, ".");
+
+    if ((path = realpath(copy, NULL)) && !strchr(path, ' ')
+        && (opt = malloc(strlen(INCLUDE_PREFIX) + strlen(path) + 1)))
+        sprintf(opt, "%s%s", INCLUDE_PREFIX, path);
+    free(path);
+    free(copy);
+    return opt;
+}
+
+/**
+ * Writes an output file received from the server next to the source file.
+ *
+ * @param file_name The name of the source file, without the .as extension.
+ * @param ext       The extension of the output file.
+ * @param sec       The section holding the file contents.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_output(const char *file_name, const char *ext, const section *sec) {
+    file_context *dest = NULL;
+    status report = NO_ERROR;
+
+    dest = create_file_context(file_name, (char *)ext, strlen(ext), FILE_MODE_WRITE_PLUS, &report);
+    if (report != NO_ERROR)
+        return report;
+    if (sec->len && fwrite(sec->data, 1, sec->len, dest->file_ptr) != sec->len)
+        report = FAILURE;
+    free_file_context(&dest);
+    return report;
+}
+
+/**
+ * Connects to the assembler server.
+ *
+ * @param socket_path The path of the server socket.
+ * @return The connected socket, or -1 if the connection failed.
+ */
+int connect_server(const char *socket_path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
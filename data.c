@@ -7,9 +7,13 @@
 #include "passes.h"
 #include "errors.h"
 #include "utils.h"
+#include "expr.h"
 
 #define get_register_num(reg) ((char) (reg)[2] - '0')
 
+/* Names of the operand slots in the .xref output */
+const char *operand_slot_names[OPERAND_SLOTS_LEN] = {"src", "dest", "data"};
+
 /* "Private" helper functions */
 status concat_default_12bit(data_image *data, char** binary_word);
 status concat_reg_dest(data_image *data, char** binary_word);
@@ -160,6 +164,21 @@ char* binary12_to_base64(const char *binary) {
     return base64;
 }
 
+/**
+ * Converts two base64 characters, as written by write_data_img_to_stream(), into a 12-bit word.
+ *
+ * @param chars The base64 characters.
+ * @return The word, or INVALID_WORD if a character is not a base64 digit.
+ */
+int base64_to_word(const char *chars) {
+    static const char* lookup_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const char *high, *low;
+
+    if (!chars[0] || !chars[1] || !(high = strchr(lookup_table, chars[0])) || !(low = strchr(lookup_table, chars[1])))
+        return INVALID_WORD;
+    return (int)(high - lookup_table) * BASE64_RADIX + (int)(low - lookup_table);
+}
+
 /**
  * Processes the decimal values for a data image, setting the binary representations
  * of the source operand, opcode, destination operand, and A/R/E bits.
@@ -176,6 +195,9 @@ char* binary12_to_base64(const char *binary) {
 status process_data_img_dec(data_image *data, Adrs_mod src_op, Command opcode, Adrs_mod dest_op, ARE are) {
     int has_alloc_err;
 
+    if (options.check_only) /* The encoding is never written, see create_base64_word() */
+        return NO_ERROR;
+
     data->binary_src = decimal_to_binary12(src_op);
     data->binary_opcode = decimal_to_binary12(opcode);
     data->binary_dest = decimal_to_binary12(dest_op);
@@ -209,6 +231,8 @@ data_image *assemble_operand_data_img(file_context *src, Concat_mode con_md, Adr
     if (!data || !(data->concat = con_md)) {
         handle_error(ERR_MEM_ALLOC);
         return NULL;
+    } else if ((mode == DIRECT || mode == IMMEDIATE) && is_expression(word)) {
+        temp_report = assemble_expression_operand(src, data, word, mode);
     } else if (mode == DIRECT) {
         sym = add_symbol(src, word, INVALID_ADDRESS, &temp_report);
         temp_report = sym ? handle_address_reference(data, sym) : TERMINATE;
@@ -335,7 +359,14 @@ Concat_mode get_concat_mode_one_op(Adrs_mod src_op, Adrs_mod dest_op) {
  */
 status create_base64_word(data_image *data) {
     status report = NO_ERROR;
-    char *binary_word = malloc((BINARY_BITS + 1) * sizeof(char));
+    char *binary_word = NULL;
+
+    if (options.check_only) { /* Syntax check only, no output is generated */
+        data->is_word_complete = 1;
+        return NO_ERROR;
+    }
+
+    binary_word = malloc((BINARY_BITS + 1) * sizeof(char));
 
     if (!binary_word) {
         handle_error(ERR_MEM_ALLOC);
@@ -406,7 +437,10 @@ data_image* create_data_image(int lc, int *address) {
     p_ret->concat = DEFAULT_12BIT;
     p_ret->p_sym = NULL;
     p_ret->value = NULL;
+    p_ret->expression = NULL;
+    p_ret->expression_mode = INVALID_MD;
 
+    p_ret->has_label = 0;
     p_ret->is_word_complete = 0;
     p_ret->lc = lc;
     p_ret->data_address = (*address)++;
@@ -414,6 +448,40 @@ data_image* create_data_image(int lc, int *address) {
     return p_ret;
 }
 
+/**
+ * Copies the encoding of a data image into a new one, everything but its address.
+ * A binary_src shared with the symbol (see handle_address_reference()) stays shared,
+ * the way free_data_image() tells them apart.
+ *
+ * @param dest The new data image, created by create_data_image().
+ * @param src  The data image to copy.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status copy_data_image(data_image *dest, const data_image *src) {
+    int owns_src = !(src->p_sym && src->binary_src) && src->concat != ADDRESS;
+
+    dest->directive = src->directive;
+    dest->concat = src->concat;
+    dest->p_sym = src->p_sym;
+    dest->expression_mode = src->expression_mode;
+    dest->is_word_complete = src->is_word_complete;
+    dest->lc = src->lc;
+
+    if ((src->binary_src && !(dest->binary_src = owns_src ? strdup(src->binary_src) : src->binary_src))
+        || (src->binary_opcode && !(dest->binary_opcode = strdup(src->binary_opcode)))
+        || (src->binary_dest && !(dest->binary_dest = strdup(src->binary_dest)))
+        || (src->binary_a_r_e && !(dest->binary_a_r_e = strdup(src->binary_a_r_e)))
+        || (src->base64_word && !(dest->base64_word = strdup(src->base64_word)))
+        || (src->expression && !(dest->expression = strdup(src->expression)))
+        || (src->value && !(dest->value = malloc(sizeof(int))))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+    if (src->value)
+        *dest->value = *src->value;
+    return NO_ERROR;
+}
+
 /**
  * Gets the A/R/E (Absolute/Relocation/External) bits for a given symbol.
  *
@@ -588,7 +656,7 @@ status concat_address(data_image *data, char** binary_word) {
  * @param word The input source string to analyze.
  * @param word_len The length of the input source string.
  * @param report A pointer to the status report.
- * @return The addressing mode determined based on the source string.
+ * @return The addressing mode determined based on the source string, an expression is IMMEDIATE or DIRECT.
  *         Possible return values are: REGISTER, IMMEDIATE, DIRECT, and INVALID_MD.
  */
 Adrs_mod get_addressing_mode(file_context *src, char *word, size_t word_len, status *report) {
@@ -597,8 +665,11 @@ Adrs_mod get_addressing_mode(file_context *src, char *word, size_t word_len, sta
         if (is_valid_register(src, word, report))
             return REGISTER;
         handle_error(ERR_INVALID_REGISTER, src);
+        *report = ERR_INVALID_REGISTER; /* e.g. "@r1+1", an expression the callers would not report again */
         return INVALID_MD;
     }
+    else if (is_expression(word))
+        return get_expression_mode(src, word, report);
 
     val_type = validate_data(src, word, word_len, report);
     if (val_type == LBL)
@@ -654,6 +725,8 @@ void free_symbol(symbol **symbol_t) {
         free((*symbol_t)->label);
     if ((*symbol_t)->address_binary)
         free((*symbol_t)->address_binary);
+    if ((*symbol_t)->uses)
+        free((*symbol_t)->uses);
 
     free(*symbol_t);
     *symbol_t = NULL;
@@ -693,6 +766,7 @@ void free_data_image(data_image** data) {
     if ((*data)->binary_dest) free((*data)->binary_dest);
     if ((*data)->binary_a_r_e) free((*data)->binary_a_r_e);
     if ((*data)->base64_word) free((*data)->base64_word);
+    if ((*data)->expression) free((*data)->expression);
     if ((*data)->value) {
         free((*data)->value);
         (*data)->value = NULL;
@@ -4,6 +4,8 @@
 #include "utils.h"
 
 #define REGISTER_CH '@'
+#define BASE64_RADIX 64
+#define INVALID_WORD (-1)
 
 typedef enum {
     DEFAULT_12BIT,
@@ -15,8 +17,27 @@ typedef enum {
     ILLEGAL_CONCAT = -1
 } Concat_mode;
 
+typedef enum {
+    SLOT_SOURCE,
+    SLOT_DEST,
+    SLOT_DATA, /* a value of .data or .string */
+    OPERAND_SLOTS_LEN
+} Operand_slot;
+
+/* A line of the .xref output: label, line, address, name of the slot (see operand_slot_names) */
+#define XREF_LINE_FORMAT "%s\t%d\t%d\t%s\n"
+
 typedef struct symbol symbol;
 
+extern const char *operand_slot_names[OPERAND_SLOTS_LEN];
+
+/* A use of a label, in the word at address */
+typedef struct {
+    int lc;
+    unsigned short address;
+    unsigned char slot; /* Operand_slot */
+} symbol_use;
+
 typedef struct {
     char* binary_src;
     char* binary_opcode;
@@ -29,6 +50,9 @@ typedef struct {
     symbol *p_sym;
 
     int *value;
+    char *expression; /* evaluated again once every label is known (optional - NULL), see expr.h */
+    Adrs_mod expression_mode; /* of an operand expression, INVALID_MD in a .data list */
+    int has_label; /* referenced by symbol->data, must outlive the line it was assembled on */
     int is_word_complete;
     int lc;
     int data_address;
@@ -45,10 +69,15 @@ struct symbol {
 
     Directive sym_dir;
     data_image *data;
+
+    symbol_use *uses; /* in source order, see record_symbol_use() */
+    size_t uses_count;
+    size_t uses_cap;
 };
 
 char* decimal_to_binary12(int decimal);
 char* binary12_to_base64(const char* binary);
+int base64_to_word(const char *chars);
 char* truncate_string(const char* input, int length);
 
 void free_symbol(symbol** symbol_t);
@@ -68,6 +97,7 @@ status process_data_img_dec(data_image *data, Adrs_mod src_op, Command opcode, A
 ARE get_are(symbol *sym);
 
 data_image *create_data_image(int lc, int *address);
+status copy_data_image(data_image *dest, const data_image *src);
 data_image *assemble_operand_data_img(file_context *src, Concat_mode con_md, Adrs_mod mode, char* word, ...);
 
 Concat_mode get_concat_mode_one_op(Adrs_mod src_op, Adrs_mod dest_op);
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debuginfo.h"
+#include "passes.h"
+
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFF
+#define U16_MAX 0xFFFF
+
+/* "Private" helper functions */
+int write_u16(FILE *dest, unsigned int value);
+int read_u8(FILE *src, unsigned int *value, int *offset);
+int read_u16(FILE *src, unsigned int *value, int *offset);
+int read_bytes(FILE *src, char *buf, size_t len, int *offset);
+
+/**
+ * Writes a source map in the .dbg format (see debuginfo.h).
+ *
+ * @param dest  The output stream, opened in binary mode.
+ * @param info  The source map.
+ * @return NO_ERROR if successful, FAILURE if the stream could not be written.
+ */
+status write_debug_info(FILE *dest, const debug_info *info) {
+    size_t i, len = strlen(info->source);
+    int ok;
+
+    ok = fwrite(DEBUG_MAGIC, 1, DEBUG_MAGIC_LEN, dest) == DEBUG_MAGIC_LEN && fputc(DEBUG_VERSION, dest) != EOF
+         && write_u16(dest, (unsigned int)len) && fwrite(info->source, 1, len, dest) == len
+         && write_u16(dest, (unsigned int)info->size);
+
+    for (i = 0; ok && i < (size_t)info->size; i++)
+        ok = write_u16(dest, info->lines[i]) && fputc(info->is_data[i] != 0, dest) != EOF;
+
+    ok = ok && write_u16(dest, (unsigned int)info->symbols_count);
+    for (i = 0; ok && i < info->symbols_count; i++) {
+        len = strlen(info->symbols[i].label);
+        ok = fputc((int)len, dest) != EOF && fwrite(info->symbols[i].label, 1, len, dest) == len
+             && write_u16(dest, (unsigned int)info->symbols[i].address)
+             && write_u16(dest, (unsigned int)info->symbols[i].line) && fputc(info->symbols[i].is_entry, dest) != EOF;
+    }
+    return ok ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Loads the .dbg file of a program.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param info      The source map to fill, must be released with free_debug_info().
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, ERR_OPEN_FILE if there is no .dbg file, ERR_DEBUG_FILE if it is
+ * @return invalid, or ERR_MEM_ALLOC.
+ */
+status load_debug_info(const char *file_name, debug_info *info, int *offset) {
+    char magic[DEBUG_MAGIC_LEN];
+    char *path = NULL;
+    FILE *file = NULL;
+    status report = ERR_DEBUG_FILE;
+    debug_symbol *sym = NULL;
+    unsigned int len, value, address, line, flag;
+    int i;
+
+    memset(info, 0, sizeof(debug_info));
+    *offset = 0;
+
+    if (!(path = malloc(strlen(file_name) + strlen(DEBUG_EXT) + 1)))
+        return ERR_MEM_ALLOC;
+    file = fopen(strcat(strcpy(path, file_name), DEBUG_EXT), "rb");
+    free(path);
+    if (!file)
+        return ERR_OPEN_FILE;
+
+    if (!read_bytes(file, magic, DEBUG_MAGIC_LEN, offset) || memcmp(magic, DEBUG_MAGIC, DEBUG_MAGIC_LEN) != 0
+        || !read_u8(file, &value, offset) || value != DEBUG_VERSION || !read_u16(file, &len, offset))
+        goto done;
+
+    if (!(info->source = malloc(len + 1))) {
+        report = ERR_MEM_ALLOC;
+        goto done;
+    }
+    info->source[len] = '\0';
+    if (!read_bytes(file, info->source, len, offset) || !read_u16(file, &value, offset)
+        || value > MAX_MEMORY_SIZE - ADDRESS_START)
+        goto done;
+
+    info->size = (int)value;
+    if (!(info->lines = malloc((value ? value : 1) * sizeof(unsigned short)))
+        || !(info->is_data = malloc(value ? value : 1))) {
+        report = ERR_MEM_ALLOC;
+        goto done;
+    }
+    for (i = 0; i < info->size; i++) {
+        if (!read_u16(file, &line, offset) || !read_u8(file, &flag, offset))
+            goto done;
+        info->lines[i] = (unsigned short)line;
+        info->is_data[i] = flag != 0;
+    }
+
+    if (!read_u16(file, &value, offset))
+        goto done;
+    if (value && !(info->symbols = malloc(value * sizeof(debug_symbol)))) {
+        report = ERR_MEM_ALLOC;
+        goto done;
+    }
+    for (info->symbols_count = 0; info->symbols_count < value; info->symbols_count++) {
+        sym = &info->symbols[info->symbols_count];
+        if (!read_u8(file, &len, offset) || len >= MAX_LABEL_LENGTH || !read_bytes(file, sym->label, len, offset)
+            || !read_u16(file, &address, offset) || !read_u16(file, &line, offset) || !read_u8(file, &flag, offset))
+            goto done;
+        sym->label[len] = '\0';
+        sym->address = (int)address;
+        sym->line = (int)line;
+        sym->is_entry = flag != 0;
+    }
+    report = fgetc(file) == EOF ? NO_ERROR : ERR_DEBUG_FILE;
+
+done:
+    fclose(file);
+    if (report != NO_ERROR)
+        free_debug_info(info);
+    return report;
+}
+
+/**
+ * Returns the source line of an address.
+ *
+ * @param info      The source map.
+ * @param address   The address.
+ * @return The line, or DEBUG_NO_LINE if the address is outside of the program.
+ */
+int debug_line_of(const debug_info *info, int address) {
+    return address >= ADDRESS_START && address < ADDRESS_START + info->size ? info->lines[address - ADDRESS_START]
+                                                                            : DEBUG_NO_LINE;
+}
+
+/**
+ * Tells whether the word at an address is a value of .data or .string.
+ *
+ * @param info      The source map.
+ * @param address   The address.
+ * @return 1 for a data word, 0 for a word of an instruction or an address outside of the program.
+ */
+int debug_is_data(const debug_info *info, int address) {
+    return address >= ADDRESS_START && address < ADDRESS_START + info->size && info->is_data[address - ADDRESS_START];
+}
+
+/**
+ * Releases a source map.
+ *
+ * @param info The source map.
+ */
+void free_debug_info(debug_info *info) {
+    if (info->source) free(info->source);
+    if (info->lines) free(info->lines);
+    if (info->is_data) free(info->is_data);
+    if (info->symbols) free(info->symbols);
+    memset(info, 0, sizeof(debug_info));
+}
+
+/**
+ * Writes an unsigned 16-bit little endian number.
+ *
+ * @param dest  The output stream.
+ * @param value The number, larger values are clamped.
+ * @return 1 if successful, 0 otherwise.
+ */
+int write_u16(FILE *dest, unsigned int value) {
+    if (value > U16_MAX)
+        value = U16_MAX;
+    return fputc((int)(value & BYTE_MASK), dest) != EOF && fputc((int)(value >> BYTE_BITS), dest) != EOF;
+}
+
+/**
+ * Reads a byte.
+ *
+ * @param src       The input stream.
+ * @param value     Set to the byte.
+ * @param offset    Advanced by the number of bytes read.
+ * @return 1 if successful, 0 if the stream ended.
+ */
+int read_u8(FILE *src, unsigned int *value, int *offset) {
+    int c = fgetc(src);
+
+    if (c == EOF)
+        return 0;
+    ++*offset;
+    *value = (unsigned int)c;
+    return 1;
+}
+
+/**
+ * Reads an unsigned 16-bit little endian number.
+ *
+ * @param src       The input stream.
+ * @param value     Set to the number.
+ * @param offset    Advanced by the number of bytes read.
+ * @return 1 if successful, 0 if the stream ended.
+ */
+int read_u16(FILE *src, unsigned int *value, int *offset) {
+    int low = fgetc(src), high = low == EOF ? EOF : fgetc(src);
+
+    if (high == EOF)
+        return 0;
+    *offset += 2;
+    *value = (unsigned int)low | ((unsigned int)high << BYTE_BITS);
+    return 1;
+}
+
+/**
+ * Reads a number of bytes.
+ *
+ * @param src       The input stream.
+ * @param buf       The buffer to fill.
+ * @param len       The number of bytes.
+ * @param offset    Advanced by the number of bytes read.
+ * @return 1 if successful, 0 if the stream ended.
+ */
+int read_bytes(FILE *src, char *buf, size_t len, int *offset) {
+    if (fread(buf, 1, len, src) != len)
+        return 0;
+    *offset += (int)len;
+    return 1;
+}
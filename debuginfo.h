@@ -0,0 +1,45 @@
+#ifndef ASSEMBLER_DEBUGINFO_H
+#define ASSEMBLER_DEBUGINFO_H
+
+#include <stdio.h>
+#include "utils.h"
+#include "errors.h"
+
+/*
+ * .dbg file, all the numbers are unsigned 16-bit little endian:
+ *   "ADBG", version (1 byte)
+ *   source name length, source name (the .am file the line numbers refer to)
+ *   number of words, then for every word, in address order from ADDRESS_START: source line, is data (1 byte)
+ *   number of symbols, then for each: label length (1 byte), label, address, line, is entry (1 byte)
+ */
+#define DEBUG_MAGIC "ADBG"
+#define DEBUG_MAGIC_LEN 4
+#define DEBUG_VERSION 2
+#define DEBUG_NO_LINE 0
+
+typedef struct {
+    char label[MAX_LABEL_LENGTH];
+    int address;
+    int line;
+    int is_entry; /* declared with .entry */
+} debug_symbol;
+
+/* Source map of an assembled program */
+typedef struct {
+    char *source;
+    unsigned short *lines; /* lines[i] is the source line of the word at ADDRESS_START + i */
+    unsigned char *is_data; /* is_data[i] is 1 if that word is a value of .data or .string */
+    int size;
+    debug_symbol *symbols;
+    size_t symbols_count;
+} debug_info;
+
+status write_debug_info(FILE *dest, const debug_info *info);
+status load_debug_info(const char *file_name, debug_info *info, int *offset);
+
+int debug_line_of(const debug_info *info, int address);
+int debug_is_data(const debug_info *info, int address);
+
+void free_debug_info(debug_info *info);
+
+#endif
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "object.h"
+#include "debuginfo.h"
+#include "utils.h"
+#include "errors.h"
+
+#define DISASM_OUTPUT_BUFFER 65536
+#define MAX_INSTRUCTION_WORDS 3
+#define INVALID_DIGIT (-1)
+#define NOT_AN_INSTRUCTION 0
+#define DISASM_LINE_LENGTH (3 * MAX_LABEL_LENGTH + 64) /* an instruction with two labels fits */
+#define ADDRESS_WIDTH 6
+#define DECIMAL_RADIX 10
+#define INT_DIGITS 12 /* sign and digits of an int */
+
+/* Decoded first word of an instruction, length is NOT_AN_INSTRUCTION for a word that cannot start one */
+typedef struct {
+    unsigned char cmd;
+    unsigned char src_mode;
+    unsigned char dest_mode;
+    unsigned char length;
+} first_word_entry;
+
+/* Reads the words of a .ob file one at a time, keeps the words of the next instruction */
+typedef struct {
+    FILE *file;
+    unsigned short window[MAX_INSTRUCTION_WORDS];
+    int avail;
+    int line;
+    int eof;
+} word_stream;
+
+/* Symbols of the program sorted by address */
+typedef struct {
+    object_symbol *entries; /* the .ent symbols, or every label of the .dbg file */
+    size_t entries_count;
+    object_symbol *externals;
+    size_t externals_count;
+} symbol_index;
+
+static first_word_entry first_word_table[WORD_MASK + 1];
+static signed char base64_table[UCHAR_MAX + 1];
+
+void build_decode_tables();
+status disassemble_file(const char *file_name);
+status load_symbol_index(const char *file_name, symbol_index *index, int *line);
+status use_debug_labels(symbol_index *index, const debug_info *dbg);
+status fill_window(word_stream *ws);
+void consume_words(word_stream *ws, int count);
+int instruction_length(const word_stream *ws, const symbol_index *index, int address, int size);
+const char *symbol_at(const object_symbol *symbols, size_t count, int address);
+int compare_symbols(const void *a, const void *b);
+char *format_line(char *line, const word_stream *ws, const symbol_index *index, const debug_info *dbg, int address,
+                  int length);
+char *format_operand(char *p, const symbol_index *index, unsigned short word, Adrs_mod mode, int is_dest,
+                     int address);
+char *format_int(char *p, int value, int width);
+char *format_str(char *p, const char *str);
+void report_load_error(const char *file_name, status code, int line);
+
+/**
+ * Disassembler of the .ob files written by the assembler.
+ * Usage: Disassembler file...
+ * Each file is given without extension, the optional .ent and .ext files name the addresses and
+ * the optional .dbg file (Assembler --debug-info) adds the source line of every instruction.
+ * With the .dbg file every label is named and the .data and .string values are known; without it
+ * a word is an instruction if it decodes as one, and data otherwise.
+ * Prints one line per instruction or data word: address, base64 words and assembly text.
+ * The .ob file is decoded as it is read, with lookup tables for the base64 digits and for all
+ * the 4096 possible first words of an instruction.
+ */
+int main(int argc, char *argv[]) {
+    int i;
+
+    if (argc < 2) {
+        handle_error(ERR_INVALID_OPTION, "missing file name");
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, DISASM_OUTPUT_BUFFER);
+    build_decode_tables();
+
+    for (i = 1; i < argc; i++) {
+        (void) disassemble_file(argv[i]);
+        fflush(stdout);
+        flush_diagnostics();
+    }
+    return 0;
+}
+
+/**
+ * Fills the base64 digit table and the first word table, every possible 12-bit word is decoded
+ * once with decode_instruction().
+ */
+void build_decode_tables() {
+    static const char* lookup_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    instruction_layout layout;
+    int i;
+
+    memset(base64_table, INVALID_DIGIT, sizeof(base64_table));
+    for (i = 0; lookup_table[i]; i++)
+        base64_table[(unsigned char)lookup_table[i]] = (signed char)i;
+
+    for (i = 0; i <= WORD_MASK; i++) {
+        first_word_table[i].length = NOT_AN_INSTRUCTION;
+        if (decode_instruction((unsigned short)i, &layout) != NO_ERROR)
+            continue;
+        first_word_table[i].cmd = (unsigned char)layout.cmd;
+        first_word_table[i].src_mode = (unsigned char)layout.src_mode;
+        first_word_table[i].dest_mode = (unsigned char)layout.dest_mode;
+        first_word_table[i].length = (unsigned char)layout.length;
+    }
+}
+
+/**
+ * Disassembles a single program to stdout.
+ *
+ * @param file_name The name of the program, without extension.
+ * @return NO_ERROR if successful, FAILURE otherwise (already reported).
+ */
+status disassemble_file(const char *file_name) {
+    char line[DISASM_LINE_LENGTH];
+    char *path = NULL;
+    word_stream ws;
+    symbol_index index;
+    debug_info dbg;
+    const char *label = NULL;
+    status report = NO_ERROR;
+    int ic = 0, dc = 0, length, size, address = ADDRESS_START;
+
+    memset(&ws, 0, sizeof(ws));
+    if ((report = load_symbol_index(file_name, &index, &ws.line)) != NO_ERROR) {
+        report_load_error(file_name, report, ws.line);
+        return FAILURE;
+    }
+
+    if ((report = load_debug_info(file_name, &dbg, &ws.line)) != NO_ERROR && report != ERR_OPEN_FILE)
+        report_load_error(file_name, report, ws.line); /* disassembled without the source lines */
+    report = NO_ERROR;
+
+    if (!(path = malloc(strlen(file_name) + FILE_EXT_LEN_OUT))) {
+        handle_error(ERR_MEM_ALLOC);
+        free_debug_info(&dbg);
+        free(index.entries);
+        free(index.externals);
+        return FAILURE;
+    }
+    ws.file = fopen(strcat(strcpy(path, file_name), OBJECT_EXT), FILE_MODE_READ);
+    free(path);
+
+    ws.line = 1;
+    if (!ws.file)
+        report = ERR_OPEN_FILE;
+    else if (fscanf(ws.file, "%d %d", &ic, &dc) != 2 || ic < 0 || dc < 0)
+        report = ERR_OBJECT_FILE;
+    else if (dbg.source)
+        printf("; %s%s - IC %d, DC %d, source %s\n", file_name, OBJECT_EXT, ic, dc, dbg.source);
+    else
+        printf("; %s%s - IC %d, DC %d\n", file_name, OBJECT_EXT, ic, dc);
+    size = ic + dc;
+    if (dbg.size != size)
+        free_debug_info(&dbg); /* of another build of the program */
+    else if (report == NO_ERROR)
+        report = use_debug_labels(&index, &dbg);
+
+    while (report == NO_ERROR && (report = fill_window(&ws)) == NO_ERROR && ws.avail) {
+        if ((label = symbol_at(index.entries, index.entries_count, address)))
+            printf("%s:\n", label);
+
+        if (!dbg.size)
+            length = instruction_length(&ws, &index, address, size);
+        else if ((length = debug_is_data(&dbg, address) ? NOT_AN_INSTRUCTION
+                                                        : first_word_table[ws.window[0]].length) > ws.avail)
+            length = NOT_AN_INSTRUCTION;
+        fputs(format_line(line, &ws, &index, &dbg, address, length), stdout);
+        if (length == NOT_AN_INSTRUCTION)
+            length = 1;
+        consume_words(&ws, length);
+        address += length;
+    }
+
+    if (report != NO_ERROR)
+        report_load_error(file_name, report, ws.line);
+    if (ws.file)
+        fclose(ws.file);
+    free_debug_info(&dbg);
+    free(index.entries);
+    free(index.externals);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Loads the .ent and .ext files of a program and sorts them by address.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param index     The index to fill, its symbols must be released with free().
+ * @param line      Set to the line of the first invalid line, if any.
+ * @return NO_ERROR if successful, ERR_ENTRY_FILE, ERR_EXTERN_FILE or ERR_MEM_ALLOC otherwise.
+ */
+status load_symbol_index(const char *file_name, symbol_index *index, int *line) {
+    status report;
+
+    memset(index, 0, sizeof(symbol_index));
+    if ((report = load_symbols(file_name, ENTRY_EXT, &index->entries, &index->entries_count, line,
+                               ERR_ENTRY_FILE)) == NO_ERROR)
+        report = load_symbols(file_name, EXTERNAL_EXT, &index->externals, &index->externals_count, line,
+                              ERR_EXTERN_FILE);
+    if (report != NO_ERROR) {
+        free(index->entries);
+        free(index->externals);
+        return report;
+    }
+
+    if (index->entries_count)
+        qsort(index->entries, index->entries_count, sizeof(object_symbol), compare_symbols);
+    if (index->externals_count)
+        qsort(index->externals, index->externals_count, sizeof(object_symbol), compare_symbols);
+    return NO_ERROR;
+}
+
+/**
+ * Names the addresses with every label of the source map rather than the .ent symbols only.
+ *
+ * @param index The symbol index, its entries are replaced.
+ * @param dbg   The source map.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status use_debug_labels(symbol_index *index, const debug_info *dbg) {
+    object_symbol *labels = NULL;
+    size_t i;
+
+    if (!dbg->symbols_count)
+        return NO_ERROR;
+    if (!(labels = malloc(dbg->symbols_count * sizeof(object_symbol))))
+        return ERR_MEM_ALLOC;
+    for (i = 0; i < dbg->symbols_count; i++) {
+        strcpy(labels[i].label, dbg->symbols[i].label);
+        labels[i].address = dbg->symbols[i].address;
+    }
+    qsort(labels, dbg->symbols_count, sizeof(object_symbol), compare_symbols);
+
+    free(index->entries);
+    index->entries = labels;
+    index->entries_count = dbg->symbols_count;
+    return NO_ERROR;
+}
+
+/**
+ * Reads words until the window holds a whole instruction, or the file ends.
+ *
+ * @param ws The word stream.
+ * @return NO_ERROR if successful, ERR_OBJECT_FILE if a word is not two base64 digits.
+ */
+status fill_window(word_stream *ws) {
+    int c, high, low;
+
+    while (!ws->eof && ws->avail < MAX_INSTRUCTION_WORDS) {
+        do
+            c = getc(ws->file);
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+        if (c == EOF) {
+            ws->eof = 1;
+            break;
+        }
+
+        ws->line++;
+        high = base64_table[(unsigned char)c];
+        low = (c = getc(ws->file)) == EOF ? INVALID_DIGIT : base64_table[(unsigned char)c];
+        c = getc(ws->file);
+        if (high == INVALID_DIGIT || low == INVALID_DIGIT || (c != EOF && c != '\n' && c != '\r' && c != ' '
+                                                               && c != '\t'))
+            return ERR_OBJECT_FILE;
+        ws->window[ws->avail++] = (unsigned short)(high * BASE64_RADIX + low);
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Drops the first words of the window.
+ *
+ * @param ws    The word stream.
+ * @param count The number of words to drop.
+ */
+void consume_words(word_stream *ws, int count) {
+    int i;
+
+    for (i = count; i < ws->avail; i++)
+        ws->window[i - count] = ws->window[i];
+    ws->avail -= count;
+}
+
+/**
+ * Returns the length of the instruction at the start of the window. A word that decodes to an
+ * instruction is still data if its operand words do not match the addressing modes.
+ *
+ * @param ws        The word stream.
+ * @param index     The symbol index.
+ * @param address   The address of the first word of the window.
+ * @param size      The number of words of the program.
+ * @return The number of words of the instruction, or NOT_AN_INSTRUCTION.
+ */
+int instruction_length(const word_stream *ws, const symbol_index *index, int address, int size) {
+    const first_word_entry *entry = &first_word_table[ws->window[0]];
+    const unsigned short *src = NULL, *dest = NULL;
+    int length = entry->length;
+
+    if (length == NOT_AN_INSTRUCTION || length > ws->avail)
+        return NOT_AN_INSTRUCTION;
+    src = &ws->window[1];
+    dest = &ws->window[length - 1];
+    if (entry->src_mode == REGISTER && entry->dest_mode == REGISTER)
+        return WORD_ARE(*src) == ABSOLUTE && WORD_REG_SRC(*src) < REGISTER_COUNT
+               && WORD_REG_DEST(*src) < REGISTER_COUNT ? length : NOT_AN_INSTRUCTION;
+    if (entry->src_mode != INVALID_MD
+        && !is_operand_word(*src, (Adrs_mod)entry->src_mode, 0, size,
+                            symbol_at(index->externals, index->externals_count, address + 1) != NULL))
+        return NOT_AN_INSTRUCTION;
+    if (entry->dest_mode != INVALID_MD
+        && !is_operand_word(*dest, (Adrs_mod)entry->dest_mode, 1, size,
+                            symbol_at(index->externals, index->externals_count, address + length - 1) != NULL))
+        return NOT_AN_INSTRUCTION;
+    return length;
+}
+
+/**
+ * Finds the symbol of an address.
+ *
+ * @param symbols   The symbols, sorted by address.
+ * @param count     The number of symbols.
+ * @param address   The address.
+ * @return The label, or NULL if no symbol has this address.
+ */
+const char *symbol_at(const object_symbol *symbols, size_t count, int address) {
+    object_symbol key, *found = NULL;
+
+    if (!count)
+        return NULL;
+    key.address = address;
+    found = bsearch(&key, symbols, count, sizeof(object_symbol), compare_symbols);
+    return found ? found->label : NULL;
+}
+
+/**
+ * Orders symbols by address, for qsort() and bsearch().
+ */
+int compare_symbols(const void *a, const void *b) {
+    return ((const object_symbol *)a)->address - ((const object_symbol *)b)->address;
+}
+
+/**
+ * Formats the line of an instruction or a data word: address, base64 words and assembly text.
+ * Lines are formatted by hand rather than with printf(), which dominates the cost otherwise.
+ *
+ * @param line      The output buffer, DISASM_LINE_LENGTH characters.
+ * @param ws        The word stream, the instruction is at the start of the window.
+ * @param index     The symbol index.
+ * @param dbg       The source map, empty if there is no .dbg file.
+ * @param address   The address of the instruction.
+ * @param length    The length of the instruction, or NOT_AN_INSTRUCTION for a data word.
+ * @return The line, terminated by a new line.
+ */
+char *format_line(char *line, const word_stream *ws, const symbol_index *index, const debug_info *dbg, int address,
+                  int length) {
+    const first_word_entry *entry = &first_word_table[ws->window[0]];
+    char *p = format_int(line, address, ADDRESS_WIDTH);
+    int k;
+
+    p = format_str(p, "  ");
+    for (k = 0; k < MAX_INSTRUCTION_WORDS; k++) {
+        if (k < (length ? length : 1))
+            word_to_base64(ws->window[k], p);
+        else
+            p[0] = p[1] = ' ';
+        p[BASE64_CHARS] = ' ';
+        p += BASE64_CHARS + 1;
+    }
+
+    if (length == NOT_AN_INSTRUCTION) {
+        p = format_int(format_str(p, " .data "), SIGN_EXTEND_12(ws->window[0]), 0);
+    } else {
+        p = format_str(format_str(p, " "), commands[entry->cmd]);
+        if (entry->src_mode == REGISTER && entry->dest_mode == REGISTER) {
+            p = format_int(format_str(p, " @r"), WORD_REG_SRC(ws->window[1]), 0);
+            p = format_int(format_str(p, ", @r"), WORD_REG_DEST(ws->window[1]), 0);
+        } else {
+            if (entry->src_mode != INVALID_MD) {
+                p = format_operand(format_str(p, " "), index, ws->window[1], (Adrs_mod)entry->src_mode, 0,
+                                   address + 1);
+                p = format_str(p, ",");
+            }
+            if (entry->dest_mode != INVALID_MD)
+                p = format_operand(format_str(p, " "), index, ws->window[length - 1], (Adrs_mod)entry->dest_mode,
+                                   1, address + length - 1);
+        }
+    }
+    if (debug_line_of(dbg, address) != DEBUG_NO_LINE)
+        p = format_int(format_str(p, "  ; line "), debug_line_of(dbg, address), 0);
+    format_str(p, "\n");
+    return line;
+}
+
+/**
+ * Formats an operand: an immediate value, a register, or an address (its label when known).
+ *
+ * @param p         The output position.
+ * @param index     The symbol index.
+ * @param word      The operand word.
+ * @param mode      The addressing mode of the operand.
+ * @param is_dest   1 for the destination operand, 0 for the source operand.
+ * @param address   The address of the operand word.
+ * @return The position after the operand.
+ */
+char *format_operand(char *p, const symbol_index *index, unsigned short word, Adrs_mod mode, int is_dest,
+                     int address) {
+    const char *label = NULL;
+
+    if (mode == IMMEDIATE)
+        return format_int(p, SIGN_EXTEND_12(SIGN_EXTEND_10(WORD_OPERAND(word))), 0);
+    else if (mode == REGISTER)
+        return format_int(format_str(p, "@r"), is_dest ? WORD_REG_DEST(word) : WORD_REG_SRC(word), 0);
+    else if (WORD_ARE(word) == EXTERNAL)
+        return format_str(p, (label = symbol_at(index->externals, index->externals_count, address)) ? label : "?");
+    else if ((label = symbol_at(index->entries, index->entries_count, WORD_OPERAND(word))))
+        return format_str(p, label);
+    return format_int(p, WORD_OPERAND(word), 0);
+}
+
+/**
+ * Formats a decimal integer, right aligned.
+ *
+ * @param p     The output position.
+ * @param value The integer.
+ * @param width The minimum width, padded with spaces.
+ * @return The position after the integer, null terminated.
+ */
+char *format_int(char *p, int value, int width) {
+    char digits[INT_DIGITS];
+    unsigned int magnitude = value < 0 ? (unsigned int)-value : (unsigned int)value;
+    int len = 0;
+
+    do {
+        digits[len++] = (char)('0' + magnitude % DECIMAL_RADIX);
+        magnitude /= DECIMAL_RADIX;
+    } while (magnitude);
+    if (value < 0)
+        digits[len++] = '-';
+
+    for (; width > len; width--)
+        *p++ = ' ';
+    while (len)
+        *p++ = digits[--len];
+    *p = '\0';
+    return p;
+}
+
+/**
+ * Copies a string.
+ *
+ * @param p     The output position.
+ * @param str   The string.
+ * @return The position after the string, null terminated.
+ */
+char *format_str(char *p, const char *str) {
+    while ((*p = *str++))
+        p++;
+    return p;
+}
+
+/**
+ * Reports why a program could not be disassembled.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param code      The status of the failure.
+ * @param line      The invalid line, if any.
+ */
+void report_load_error(const char *file_name, status code, int line) {
+    file_context fc;
+
+    if (code == ERR_OPEN_FILE) {
+        fc.file_name = malloc(strlen(file_name) + FILE_EXT_LEN_OUT);
+        if (!fc.file_name) {
+            handle_error(ERR_MEM_ALLOC);
+            return;
+        }
+        strcat(strcpy(fc.file_name, file_name), OBJECT_EXT);
+        fc.lc = 0;
+        handle_error(ERR_OPEN_FILE, &fc);
+        free(fc.file_name);
+    }
+    else if (code == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else
+        handle_error(code, file_name, line);
+}
@@ -1,9 +1,52 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include "errors.h"
 #include "utils.h"
 
+#define DIAG_INITIAL_CAP 16
+#define DIAG_NUMBERS_LEN 36 /* three ints */
+#define HAS_STRING_ARG(code) ((code) == TERMINATE || (code) == ERR_FOUND_ASSEMBLER || (code) == ERR_INVALID_OPTION \
+        || (code) == WARN_CACHE || (code) == ERR_SOCKET)
+#define HAS_FILE_LINE(code) (((code) >= ERR_OPEN_FILE && (code) <= ERR_MISSING_ENDMACRO) || (code) == ERR_MAX_ERRORS \
+        || ((code) >= ERR_MISSING_IF && (code) <= ERR_REPT_TOO_DEEP) || (code) == ERR_INVALID_INCLUDE \
+        || (code) == ERR_INCLUDE_TOO_DEEP || (code) == ERR_INVALID_DEFINE)
+#define HAS_FILE_TEXT_LINE(code) (((code) >= ERR_INVALID_OPCODE && (code) < ERR_LABEL_DOES_NOT_EXIST) \
+        || (code) == ERR_MACRO_CYCLE || (code) == ERR_MACRO_TOO_DEEP || (code) == ERR_INCLUDE_NOT_FOUND \
+        || (code) == ERR_DUP_CONSTANT || (code) == ERR_UNKNOWN_CONSTANT)
+#define HAS_LINE_IN_NUM(code) ((code) == WARN_UNUSED_EXT || (code) == ERR_LABEL_DOES_NOT_EXIST \
+        || (code) == ERR_INVALID_EXPRESSION || (code) == ERR_EXPRESSION_ADDRESS || (code) == ERR_EXPRESSION_RANGE)
+#define HAS_NAME_NUM_ARGS(code) (((code) >= ERR_OBJECT_FILE && (code) <= ERR_SIM_STEPS) || (code) == ERR_MANIFEST \
+        || (code) == ERR_LINK_MEMORY || (code) == ERR_LINK_SITE || (code) == ERR_LINK_NO_RELOCATIONS \
+        || (code) == ERR_DEBUG_FILE || (code) == ERR_AOBJ_FILE || (code) == ERR_MACRO_LIB)
+
+enum {
+    SEVERITY_ERROR,
+    SEVERITY_WARNING,
+    SEVERITY_TERMINATED,
+    SEVERITY_INTERNAL
+};
+
+/* Diagnostics buffer of the file being processed, emptied by flush_diagnostics() */
+diagnostic *diag_buffer = NULL;
+size_t diag_count = 0;
+size_t diag_cap = 0;
+char **diag_files = NULL;
+size_t diag_files_count = 0;
+size_t diag_files_cap = 0;
+int diag_errors = 0;
+
+/* "Private" helper functions */
+int record_diagnostic(diagnostic *d, const char *text);
+int append_formatted(char **out, size_t *used, size_t *cap, const diagnostic *d);
+int severity_of(status code);
+char *intern_file_name(const char *file_name);
+const char *severity_prefix(status code);
+size_t format_diagnostic(char *buf, const diagnostic *d);
+void write_json_diagnostic(FILE *dest, const diagnostic *d);
+
 /* Status messages */
 const char *msg[MSG_LEN] = {
         "Assembly process for %s.as completed without errors. Output file(s) have been generated.",
@@ -27,8 +70,8 @@ const char *msg[MSG_LEN] = {
         "%s - Missing ',' symbol on line %d.",
         "%s - Missing '.' symbol before a directive on line %d.",
         "%s - Line length exceeds the maximum limit on line %d. Maximum length is 80 characters.",
-        "%s - Macro length exceeds the maximum limit on line %d. Maximum length is 31 characters.",
         "%s - Operand length exceeds the maximum limit on line %d. Maximum length is 31 characters.",
+        "%s - Macro length exceeds the maximum limit on line %d. Maximum length is 31 characters.",
         "%s - Duplicate macro name on line %d.",
         "%s - Missing opening 'mcro' on line %d.",
         "%s - Missing closing 'endmcro' on line %d.",
@@ -49,13 +92,64 @@ const char *msg[MSG_LEN] = {
         "Preprocessor (%d/%d) - No output file(s) have been generated - %s.as.",
         "Preprocessor (%d/%d) - Output file(s) have been successfully generated - %s.",
         "First Pass (%d/%d) - Output file(s) have been successfully generated - %s.as.",
-        "First Pass (%d/%d) - No output file(s) have been generated - %s.as."
+        "First Pass (%d/%d) - No output file(s) have been generated - %s.as.",
+        "Assembler - Invalid command line option - %s.",
+        "Assembler - Unable to use the cache directory - %s. Output file(s) have not been cached.",
+        "Cache - Output file(s) for %s.as are up to date, assembly skipped.",
+        "Syntax check for %s.as completed without errors. No output file(s) have been generated.",
+        "%s - Too many errors, processing stopped on line %d.",
+        "Server - Socket operation failed - %s.",
+        "Server - Listening on %s.",
+        "%s.ob - Invalid object file on line %d.",
+        "%s.ent - Invalid entry file on line %d.",
+        "%s.ext - Invalid extern file on line %d.",
+        "%s - Illegal instruction at address %d.",
+        "%s - Unresolved external operand used at address %d.",
+        "%s - Jump outside of the memory at address %d.",
+        "%s - Call stack overflow or underflow at address %d.",
+        "%s - Step limit reached at address %d.",
+        "%s - Program stopped after %lu instruction(s).",
+        "%s - Invalid manifest line %d.",
+        "Runner - %d of %d job(s) passed.",
+        "%s - Entry symbol %s is already defined by another module.",
+        "%s - Unresolved external symbol %s.",
+        "%s - Linked program does not fit in the memory, %d word(s) needed.",
+        "%s - Invalid external use site at address %d.",
+        "%s - Cannot be loaded at address %d without its relocations, link its .aobj file (--aobj).",
+        "Linker - %s.ob has been linked.",
+        "%s.dbg - Invalid debug file at offset %d.",
+        "%s.aobj - Invalid intermediate file at offset %d.",
+        "Intermediate - Output file(s) for %s.as have been re-emitted from %s.aobj.",
+        "%s - Missing opening '.if' on line %d.",
+        "%s - Missing closing '.endif' for the '.if' on line %d.",
+        "%s - Duplicate '.else' on line %d.",
+        "%s - Conditional blocks are nested too deep on line %d. Maximum depth is 32.",
+        "%s - Invalid condition on line %d.",
+        "%s - Missing opening '.rept' on line %d.",
+        "%s - Missing closing '.endr' for the '.rept' on line %d.",
+        "%s - Invalid repeat count on line %d.",
+        "%s - Label declaration inside a '.rept' block on line %d.",
+        "%s - Repeat blocks are nested too deep on line %d. Maximum depth is 8.",
+        "%s - Macro (%s) expands to a call of itself on line %d.",
+        "%s - Macro (%s) calls are nested too deep on line %d. Maximum depth is 16.",
+        "%s - Invalid '.include', expected a quoted file name outside of a macro on line %d.",
+        "%s - Included files are nested too deep on line %d. Maximum depth is 16.",
+        "%s - Included file (%s) cannot be found on line %d.",
+        "%s - Invalid or unreadable macro library file at offset %d.",
+        "Macro library - %s has been written.",
+        "%s - Invalid '.define', expected a name and a constant expression on line %d.",
+        "%s - Name (%s) is already defined as a constant or a label on line %d.",
+        "%s - Invalid expression (%s) on line %d.",
+        "%s - Expression (%s) must be a number or a label address plus or minus a number on line %d.",
+        "%s - Constant (%s) is not defined before its use on line %d.",
+        "%s - Expression (%s) does not fit its operand, an address must be within the memory on line %d."
 };
 
 /**
  * Handles and reports errors during the assembly process.
  *
- * Handles different error codes and formats the error messages accordingly.
+ * Handles different error codes and records the message arguments in the diagnostics buffer.
+ * Messages are formatted and written once per file by flush_diagnostics().
  * Additional arguments may be required for specific error messages.
  *
  * @param code      The error code indicating the type of error.
@@ -63,83 +157,464 @@ const char *msg[MSG_LEN] = {
  */
 void handle_error(status code, ...) {
     va_list args;
+    diagnostic d;
     file_context *fc = NULL;
-    int num, tot;
     Directive dir;
-    char *fncall, *fncall_par;
+    char *fncall = NULL, *fncall_par;
+
+    d.code = code;
+    d.file = NULL;
+    d.kind = NULL;
+    d.text = NULL;
+    d.line = d.num = d.tot = 0;
 
     va_start(args, code);
 
     if (code == FAILURE || code == ERR_MEM_ALLOC)
-        fprintf(stderr, code == ERR_MEM_ALLOC ? "ERROR ->\t%s" : "TERMINATED ->\t%s", msg[code]);
-    else if (code == TERMINATE || code == ERR_FOUND_ASSEMBLER) {
+        ; /* no arguments */
+    else if (HAS_STRING_ARG(code))
         fncall =  va_arg(args, char *);
-        fprintf(stderr, code == TERMINATE ? "INTERNAL ERROR ->\t" : "TERMINATED ->\t");
-        fprintf(stderr, msg[code], fncall);
-    }
-    else if (code >= ERR_OPEN_FILE && code <= ERR_MISSING_ENDMACRO) {
-        fprintf(stderr, "ERROR ->\t");
+    else if (HAS_FILE_LINE(code))
         fc = va_arg(args, file_context*);
-        fprintf(stderr, msg[code], fc->file_name, fc->lc);
-    }
     else if (code == ERR_INVALID_ACTION || code == ERR_ILLEGAL_CHARS || code == ERR_INVALID_SYNTAX) {
-        fprintf(stderr, "ERROR ->\t");
         fc = va_arg(args, file_context*);
         fncall_par = va_arg(args, char*);
         fncall = va_arg(args, char*);
-        fprintf(stderr, msg[code], fc->file_name, tolower(*fncall_par) == 'l' ? "label declaration"
-        : *fncall_par == 'd' ? "data assigment" : "string assigment", fncall, fc->lc);
+        d.kind = tolower(*fncall_par) == 'l' ? "label declaration" : *fncall_par == 'd' ? "data assigment"
+                : "string assigment";
     }
     else if (code == WARN_EMPTY_DIR) {
         fc = va_arg(args, file_context*);
         dir = va_arg(args, Directive);
-        fprintf(stderr, "WARNING ->\t");
-        fprintf(stderr, msg[code], fc->file_name, dir == ENTRY ? "Entry" : dir == EXTERN ? "Extern"
-             : dir == DATA ? "Data" : "String"   , fc->lc);
-    }
-    else if (code == WARN_UNUSED_EXT) {
-        fc = va_arg(args, file_context*);
-        fncall = va_arg(args, char *);
-        num = va_arg(args, int);
-        fprintf(stderr, "WARNING ->\t");
-        fprintf(stderr, msg[code], fc->file_name, fncall, num);
+        d.kind = dir == ENTRY ? "Entry" : dir == EXTERN ? "Extern" : dir == DATA ? "Data" : "String";
     }
-    else if (code == WARN_MEANINGLESS_LABEL) {
+    else if (code == WARN_MEANINGLESS_LABEL || code ==  ERR_DUPLICATE_DIR) {
         fc = va_arg(args, file_context*);
         fncall =  va_arg(args, char *);
         dir = va_arg(args, Directive);
-        fprintf(stderr, "WARNING ->\t");
-        fprintf(stderr, msg[code], fc->file_name, fncall, dir == ENTRY ? "entry" : "extern", fc->lc);
+        d.kind = dir == ENTRY ? "entry" : "extern";
     }
-    else if (code ==  ERR_DUPLICATE_DIR) {
+    else if (HAS_LINE_IN_NUM(code)) {
         fc = va_arg(args, file_context*);
-        fncall =  va_arg(args, char *);
-        dir = va_arg(args, Directive);
-        fprintf(stderr, "ERROR ->\t");
-        fprintf(stderr, msg[code], fc->file_name, dir == ENTRY ? "entry" : "extern", fncall, fc->lc);
+        fncall = va_arg(args, char*);
+        d.num = va_arg(args, int);
     }
-    else if (code >= ERR_INVALID_OPCODE && code < ERR_LABEL_DOES_NOT_EXIST) {
-        fprintf(stderr, "ERROR ->\t");
+    else if (HAS_FILE_TEXT_LINE(code)) {
         fc = va_arg(args, file_context*);
         fncall =  va_arg(args, char *);
-        fprintf(stderr, msg[code], fc->file_name, fncall, fc->lc);
     }
-    else if (code == ERR_LABEL_DOES_NOT_EXIST) {
-        fprintf(stderr, "ERROR ->\t");
-        fc = va_arg(args, file_context*);
+    else if (HAS_NAME_NUM_ARGS(code)) {
+        fncall = va_arg(args, char*);
+        d.num = va_arg(args, int);
+    }
+    else if (code == ERR_LINK_DUP_SYMBOL || code == ERR_LINK_UNRESOLVED) {
+        d.file = va_arg(args, char*); /* the module */
         fncall = va_arg(args, char*);
-        num = va_arg(args, int);
-        fprintf(stderr, msg[code], fc->file_name, fncall, num);
     }
     else if (code == ERR_PRE || code == ERR_FIRST_PASS) {
-        fprintf(stderr, "ERROR ->\t");
-        num = va_arg(args, int);
-        tot = va_arg(args, int);
+        d.num = va_arg(args, int);
+        d.tot = va_arg(args, int);
         fncall = va_arg(args, char*);
-        fprintf(stderr, msg[code], num, tot, fncall);
     }
     va_end(args);
-    fprintf(stderr, "\n");
+
+    if (fc) {
+        d.file = fc->file_name;
+        d.line = fc->lc;
+    }
+
+    if (d.file && diagnostics_limit_reached())
+        return; /* --max-errors, the lines that are still processed are not reported */
+
+    if (code == ERR_MEM_ALLOC || !record_diagnostic(&d, fncall)) {
+        /* Nothing else can be allocated, report right away */
+        flush_diagnostics();
+        d.text = fncall;
+        write_diagnostic(stderr, &d);
+        return;
+    }
+
+    if (d.file && severity_of(code) == SEVERITY_ERROR && options.max_errors && ++diag_errors == options.max_errors) {
+        d.code = ERR_MAX_ERRORS;
+        d.kind = NULL;
+        d.text = NULL; /* owned by the diagnostic just recorded */
+        (void) record_diagnostic(&d, NULL);
+    }
+}
+
+/**
+ * Checks whether the number of errors of the current file has reached the --max-errors limit.
+ *
+ * @return 1 if the file should not be processed any further, 0 otherwise.
+ */
+int diagnostics_limit_reached() {
+    return options.max_errors && diag_errors >= options.max_errors;
+}
+
+/**
+ * Formats and writes all the buffered diagnostics in a single write to stderr,
+ * and to the --diag-json sink if one is set. Resets the buffer and the --max-errors counter.
+ */
+void flush_diagnostics() {
+    static FILE *json_sink = NULL;
+    static int json_failed = 0;
+    size_t i;
+    char *out = NULL;
+    size_t used = 0, cap = 0;
+
+    if (!diag_count) {
+        diag_errors = 0;
+        return;
+    }
+
+    if (options.diag_json && !json_sink && !json_failed && !(json_sink = fopen(options.diag_json, "a")))
+        json_failed = 1;
+
+    for (i = 0; i < diag_count; i++) {
+        if (!append_formatted(&out, &used, &cap, &diag_buffer[i])) {
+            /* Not enough memory to batch the output, write the rest one by one */
+            if (out) fwrite(out, 1, used, stderr);
+            free(out);
+            out = NULL;
+            used = 0;
+            write_diagnostic(stderr, &diag_buffer[i]);
+        }
+        if (json_sink)
+            write_json_diagnostic(json_sink, &diag_buffer[i]);
+    }
+
+    if (out) {
+        fwrite(out, 1, used, stderr);
+        free(out);
+    }
+    if (json_sink)
+        fflush(json_sink);
+
+    for (i = 0; i < diag_count; i++)
+        if (diag_buffer[i].text) free(diag_buffer[i].text);
+    for (i = 0; i < diag_files_count; i++)
+        free(diag_files[i]);
+
+    diag_count = diag_files_count = 0;
+    diag_errors = 0;
+}
+
+/**
+ * Takes the buffered diagnostics out of the buffer instead of writing them, e.g. to keep them with
+ * the line they were reported on and write them later (see set_diagnostic_line()).
+ * Resets the buffer and the --max-errors counter.
+ *
+ * @param out   Set to the diagnostics, must be released with free_diagnostics(), NULL if there are none.
+ *              Their file names are not kept.
+ * @return The number of diagnostics, 0 if there are none or if memory allocation failed (they are
+ * @return written to stderr instead).
+ */
+size_t take_diagnostics(diagnostic **out) {
+    size_t i, count = diag_count;
+
+    *out = NULL;
+    if (count && !(*out = malloc(count * sizeof(diagnostic)))) {
+        flush_diagnostics();
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        (*out)[i] = diag_buffer[i];
+        (*out)[i].file = NULL; /* interned, released below */
+    }
+    for (i = 0; i < diag_files_count; i++)
+        free(diag_files[i]);
+
+    diag_count = diag_files_count = 0;
+    diag_errors = 0;
+    return count;
+}
+
+/**
+ * Sets the file and line a diagnostic is reported on.
+ *
+ * @param d     The diagnostic.
+ * @param file  The file name, must outlive the diagnostic.
+ * @param line  The line.
+ */
+void set_diagnostic_line(diagnostic *d, const char *file, int line) {
+    d->file = (char *)file;
+    if (HAS_LINE_IN_NUM(d->code))
+        d->num = line;
+    else
+        d->line = line;
+}
+
+/**
+ * Returns the line a diagnostic is reported on.
+ *
+ * @param d The diagnostic.
+ * @return The line.
+ */
+int diagnostic_line(const diagnostic *d) {
+    return HAS_LINE_IN_NUM(d->code) ? d->num : d->line;
+}
+
+/**
+ * Formats the message of a diagnostic without its severity prefix, e.g. for an editor.
+ *
+ * @param d The diagnostic.
+ * @return The allocated message, or NULL if memory allocation failed.
+ */
+char *diagnostic_message(const diagnostic *d) {
+    char *out = NULL;
+    size_t used = 0, cap = 0, prefix_len = strlen(severity_prefix(d->code));
+
+    if (!append_formatted(&out, &used, &cap, d)) {
+        free(out);
+        return NULL;
+    }
+    out[used - 1] = '\0'; /* drop the new line */
+    memmove(out, out + prefix_len, used - prefix_len);
+    return out;
+}
+
+/**
+ * Checks whether a diagnostic is a warning rather than an error.
+ *
+ * @param d The diagnostic.
+ * @return 1 if it is a warning, 0 otherwise.
+ */
+int diagnostic_is_warning(const diagnostic *d) {
+    return severity_of(d->code) == SEVERITY_WARNING;
+}
+
+/**
+ * Releases diagnostics taken out of the buffer.
+ *
+ * @param list  The diagnostics.
+ * @param count The number of diagnostics.
+ */
+void free_diagnostics(diagnostic *list, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (list[i].text) free(list[i].text);
+    free(list);
+}
+
+/**
+ * Adds a diagnostic to the buffer. The file name is interned, the text argument is copied.
+ *
+ * @param d     The diagnostic to record.
+ * @param text  The string argument of the message (optional - NULL).
+ * @return 1 if the diagnostic has been recorded, 0 if memory allocation failed.
+ */
+int record_diagnostic(diagnostic *d, const char *text) {
+    diagnostic *new_buffer = NULL;
+    size_t new_cap;
+
+    if (diag_count == diag_cap) {
+        new_cap = diag_cap ? diag_cap * 2 : DIAG_INITIAL_CAP;
+        if (!(new_buffer = realloc(diag_buffer, new_cap * sizeof(diagnostic))))
+            return 0;
+        diag_buffer = new_buffer;
+        diag_cap = new_cap;
+    }
+
+    if (text && !(d->text = strdup(text)))
+        return 0;
+    if (d->file && !(d->file = intern_file_name(d->file))) {
+        if (d->text) free(d->text);
+        return 0;
+    }
+
+    diag_buffer[diag_count++] = *d;
+    return 1;
+}
+
+/**
+ * Returns the buffered copy of a file name, copying it on first use.
+ * Diagnostics of a file almost always share the same one or two names (.as and .am).
+ *
+ * @param file_name The file name to intern.
+ * @return The interned file name, or NULL if memory allocation failed.
+ */
+char *intern_file_name(const char *file_name) {
+    size_t i;
+    char **new_files = NULL;
+
+    for (i = diag_files_count; i > 0; i--)
+        if (strcmp(diag_files[i - 1], file_name) == 0)
+            return diag_files[i - 1];
+
+    if (diag_files_count == diag_files_cap) {
+        if (!(new_files = realloc(diag_files, (diag_files_cap + DIAG_INITIAL_CAP) * sizeof(char*))))
+            return NULL;
+        diag_files = new_files;
+        diag_files_cap += DIAG_INITIAL_CAP;
+    }
+
+    if (!(diag_files[diag_files_count] = strdup(file_name)))
+        return NULL;
+    return diag_files[diag_files_count++];
+}
+
+/**
+ * Appends the formatted text of a diagnostic, followed by a new line, to a growing buffer.
+ *
+ * @param out   Pointer to the output buffer.
+ * @param used  Pointer to the number of characters in the buffer.
+ * @param cap   Pointer to the capacity of the buffer.
+ * @param d     The diagnostic to format.
+ * @return 1 if successful, 0 if memory allocation failed.
+ */
+int append_formatted(char **out, size_t *used, size_t *cap, const diagnostic *d) {
+    size_t needed, new_cap;
+    char *new_out = NULL;
+
+    /* Upper bound of the formatted length: every argument is at most one of these */
+    needed = strlen(msg[d->code]) + strlen(severity_prefix(d->code)) + DIAG_NUMBERS_LEN + 2
+             + (d->file ? strlen(d->file) : 0) + (d->text ? strlen(d->text) : 0) + (d->kind ? strlen(d->kind) : 0);
+
+    if (*used + needed > *cap) {
+        new_cap = (*cap + needed) * 2;
+        if (!(new_out = realloc(*out, new_cap)))
+            return 0;
+        *out = new_out;
+        *cap = new_cap;
+    }
+
+    *used += format_diagnostic(*out + *used, d);
+    (*out)[(*used)++] = '\n';
+    return 1;
+}
+
+/**
+ * Writes a single diagnostic, followed by a new line, to a stream.
+ *
+ * @param dest  The output stream.
+ * @param d     The diagnostic to write.
+ */
+void write_diagnostic(FILE *dest, const diagnostic *d) {
+    char *out = NULL;
+    size_t used = 0, cap = 0;
+
+    if (append_formatted(&out, &used, &cap, d))
+        fwrite(out, 1, used, dest);
+    else /* Out of memory, the message itself is still better than nothing */
+        fprintf(dest, "%s%s\n", severity_prefix(d->code), msg[d->code]);
+    free(out);
+}
+
+/**
+ * Writes a diagnostic as a single JSON object line:
+ * {"severity":"error","code":9,"file":"prog.am","line":3,"message":"..."}
+ *
+ * @param dest  The output stream.
+ * @param d     The diagnostic to write.
+ */
+void write_json_diagnostic(FILE *dest, const diagnostic *d) {
+    char *out = NULL;
+    size_t used = 0, cap = 0;
+    int severity = severity_of(d->code);
+
+    fprintf(dest, "{\"severity\":\"%s\",\"code\":%d,\"file\":", severity == SEVERITY_WARNING ? "warning"
+            : severity == SEVERITY_ERROR ? "error" : "fatal", (int)d->code);
+    write_json_string(dest, d->file ? d->file : "");
+    fprintf(dest, ",\"line\":%d,\"message\":", HAS_LINE_IN_NUM(d->code) ? d->num : d->line);
+
+    if (append_formatted(&out, &used, &cap, d)) {
+        out[used - 1] = '\0'; /* drop the new line */
+        write_json_string(dest, out + strlen(severity_prefix(d->code)));
+    } else
+        write_json_string(dest, msg[d->code]);
+    fprintf(dest, "}\n");
+    free(out);
+}
+
+/**
+ * Writes a string as a JSON string literal, escaping quotes, backslashes and control characters.
+ *
+ * @param dest  The output stream.
+ * @param str   The string to write.
+ */
+void write_json_string(FILE *dest, const char *str) {
+    fputc('"', dest);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(dest, "\\%c", *str);
+        else if ((unsigned char)*str < ' ')
+            fprintf(dest, "\\u%04x", (unsigned int)(unsigned char)*str);
+        else
+            fputc(*str, dest);
+    }
+    fputc('"', dest);
+}
+
+/**
+ * Formats the text of a diagnostic (prefix and message) into a buffer.
+ *
+ * @param buf   The output buffer, large enough for the message (see append_formatted()).
+ * @param d     The diagnostic to format.
+ * @return The number of characters written, not including the terminating null character.
+ */
+size_t format_diagnostic(char *buf, const diagnostic *d) {
+    status code = d->code;
+    const char *file = d->file ? d->file : "";
+    const char *text = d->text ? d->text : "";
+    size_t len = strlen(strcpy(buf, severity_prefix(code)));
+
+    buf += len;
+    if (code == FAILURE || code == ERR_MEM_ALLOC)
+        strcpy(buf, msg[code]);
+    else if (HAS_STRING_ARG(code))
+        sprintf(buf, msg[code], text);
+    else if (HAS_FILE_LINE(code))
+        sprintf(buf, msg[code], file, d->line);
+    else if (code == ERR_INVALID_ACTION || code == ERR_ILLEGAL_CHARS || code == ERR_INVALID_SYNTAX)
+        sprintf(buf, msg[code], file, d->kind, text, d->line);
+    else if (code == WARN_EMPTY_DIR)
+        sprintf(buf, msg[code], file, d->kind, d->line);
+    else if (code == WARN_MEANINGLESS_LABEL)
+        sprintf(buf, msg[code], file, text, d->kind, d->line);
+    else if (code == ERR_DUPLICATE_DIR)
+        sprintf(buf, msg[code], file, d->kind, text, d->line);
+    else if (HAS_LINE_IN_NUM(code))
+        sprintf(buf, msg[code], file, text, d->num);
+    else if (HAS_FILE_TEXT_LINE(code))
+        sprintf(buf, msg[code], file, text, d->line);
+    else if (HAS_NAME_NUM_ARGS(code))
+        sprintf(buf, msg[code], text, d->num);
+    else if (code == ERR_LINK_DUP_SYMBOL || code == ERR_LINK_UNRESOLVED)
+        sprintf(buf, msg[code], file, text);
+    else if (code == ERR_PRE || code == ERR_FIRST_PASS)
+        sprintf(buf, msg[code], d->num, d->tot, text);
+    else
+        *buf = '\0';
+    return len + strlen(buf);
+}
+
+/**
+ * Classifies a status code by the prefix its message is reported with.
+ *
+ * @param code The status code.
+ * @return SEVERITY_ERROR, SEVERITY_WARNING, SEVERITY_TERMINATED or SEVERITY_INTERNAL.
+ */
+int severity_of(status code) {
+    if (code == FAILURE || code == ERR_FOUND_ASSEMBLER)
+        return SEVERITY_TERMINATED;
+    else if (code == TERMINATE)
+        return SEVERITY_INTERNAL;
+    else if (code == WARN_EMPTY_DIR || code == WARN_UNUSED_EXT || code == WARN_MEANINGLESS_LABEL || code == WARN_CACHE)
+        return SEVERITY_WARNING;
+    return SEVERITY_ERROR;
+}
+
+/**
+ * Returns the prefix of the message of a status code, e.g. "ERROR ->\t".
+ *
+ * @param code The status code.
+ * @return The message prefix.
+ */
+const char *severity_prefix(status code) {
+    static const char *prefixes[] = {"ERROR ->\t", "WARNING ->\t", "TERMINATED ->\t", "INTERNAL ERROR ->\t"};
+    return prefixes[severity_of(code)];
 }
 
 /**
@@ -158,7 +633,8 @@ void handle_progress(status code, ...) {
     char *fncall = NULL;
 
     va_start(args, code);
-    if (code == NO_ERROR)
+    if (code == NO_ERROR || code == CACHE_HIT || code == CHECK_OK || code == SERVER_READY || code == LINK_OK
+        || code == MLIB_OK)
         printf(msg[code], va_arg(args, char*));
     else {
         if (code <= OPEN_FILE) {
@@ -171,6 +647,19 @@ void handle_progress(status code, ...) {
             fncall = va_arg(args, char*);
             printf(msg[code], num, tot, fncall);
         }
+        else if (code == AOBJ_HIT) {
+            fncall = va_arg(args, char*);
+            printf(msg[code], fncall, fncall);
+        }
+        else if (code == SIM_DONE) {
+            fncall = va_arg(args, char*);
+            printf(msg[code], fncall, va_arg(args, unsigned long));
+        }
+        else if (code == RUNNER_DONE) {
+            num = va_arg(args, int);
+            tot = va_arg(args, int);
+            printf(msg[code], num, tot);
+        }
         else if (code == PRE_FILE_OK) {
             fc = va_arg(args, file_context*);
             num = va_arg(args, int);
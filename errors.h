@@ -1,7 +1,9 @@
 #ifndef ASSEMBLER_ERRORS_H
 #define ASSEMBLER_ERRORS_H
 
-#define MSG_LEN 44
+#include <stdio.h>
+
+#define MSG_LEN 94
 extern const char *msg[MSG_LEN];
 
 typedef enum {
@@ -48,10 +50,83 @@ typedef enum {
     ERR_PRE,
     PRE_FILE_OK,
     FIRST_PASS_OK,
-    ERR_FIRST_PASS
+    ERR_FIRST_PASS,
+    ERR_INVALID_OPTION,
+    WARN_CACHE,
+    CACHE_HIT,
+    CHECK_OK,
+    ERR_MAX_ERRORS,
+    ERR_SOCKET,
+    SERVER_READY,
+    ERR_OBJECT_FILE,
+    ERR_ENTRY_FILE,
+    ERR_EXTERN_FILE,
+    ERR_SIM_ILLEGAL,
+    ERR_SIM_UNRESOLVED,
+    ERR_SIM_MEMORY,
+    ERR_SIM_STACK,
+    ERR_SIM_STEPS,
+    SIM_DONE,
+    ERR_MANIFEST,
+    RUNNER_DONE,
+    ERR_LINK_DUP_SYMBOL,
+    ERR_LINK_UNRESOLVED,
+    ERR_LINK_MEMORY,
+    ERR_LINK_SITE,
+    ERR_LINK_NO_RELOCATIONS,
+    LINK_OK,
+    ERR_DEBUG_FILE,
+    ERR_AOBJ_FILE,
+    AOBJ_HIT,
+    ERR_MISSING_IF,
+    ERR_MISSING_ENDIF,
+    ERR_DUP_ELSE,
+    ERR_IF_TOO_DEEP,
+    ERR_INVALID_CONDITION,
+    ERR_MISSING_REPT,
+    ERR_MISSING_ENDR,
+    ERR_INVALID_REPT_COUNT,
+    ERR_REPT_LABEL,
+    ERR_REPT_TOO_DEEP,
+    ERR_MACRO_CYCLE,
+    ERR_MACRO_TOO_DEEP,
+    ERR_INVALID_INCLUDE,
+    ERR_INCLUDE_TOO_DEEP,
+    ERR_INCLUDE_NOT_FOUND,
+    ERR_MACRO_LIB,
+    MLIB_OK,
+    ERR_INVALID_DEFINE,
+    ERR_DUP_CONSTANT,
+    ERR_INVALID_EXPRESSION,
+    ERR_EXPRESSION_ADDRESS,
+    ERR_UNKNOWN_CONSTANT,
+    ERR_EXPRESSION_RANGE
 } status;
 
+/* A deferred diagnostic, formatted only when the buffer is flushed */
+typedef struct {
+    status code;
+    char *file; /* interned while buffered, see intern_file_name() */
+    char *text; /* the string argument of the message, owned */
+    const char *kind; /* static description, e.g. "entry" */
+    int line;
+    int num;
+    int tot;
+} diagnostic;
+
 void handle_error(status code, ...);
 void handle_progress(status code, ...);
+void flush_diagnostics();
+void write_diagnostic(FILE *dest, const diagnostic *d);
+void set_diagnostic_line(diagnostic *d, const char *file, int line);
+void free_diagnostics(diagnostic *list, size_t count);
+
+size_t take_diagnostics(diagnostic **out);
+int diagnostic_line(const diagnostic *d);
+char *diagnostic_message(const diagnostic *d);
+int diagnostic_is_warning(const diagnostic *d);
+void write_json_string(FILE *dest, const char *str);
+
+int diagnostics_limit_reached();
 
 #endif
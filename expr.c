@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "expr.h"
+#include "passes.h"
+#include "data.h"
+#include "utils.h"
+#include "errors.h"
+
+/* An expression being parsed */
+typedef struct {
+    const char *p;
+    file_context *src;
+    Expr_kind kind;
+    int lc;
+    int is_fixup; /* every label is known by now, none is added */
+    status report; /* ERR_INVALID_EXPRESSION until reported, FAILURE once an error has been reported */
+} expr_parser;
+
+constant *constants = NULL;
+size_t constants_count = 0;
+size_t constants_cap = 0;
+size_t *constant_index = NULL; /* open addressing index of constants by name, constant + 1 (0 is empty) */
+size_t constant_index_cap = 0;
+
+/* "Private" helper functions */
+expr_value parse_sum(expr_parser *parser);
+expr_value parse_product(expr_parser *parser);
+expr_value parse_unary(expr_parser *parser);
+expr_value parse_name(expr_parser *parser);
+void check_limit(expr_parser *parser, const expr_value *value);
+void skip_spaces(expr_parser *parser);
+int is_address(expr_value value);
+int fits_operand(long value, Adrs_mod mode);
+size_t *find_constant_slot(const char *name);
+const char *constant_slot_label(const void *table, size_t slot);
+status add_constant(file_context *src, const char *name, long value);
+status encode_expression_word(data_image *data, long value, Adrs_mod mode);
+int has_label_name(const char *word);
+
+/**
+ * Returns whether a line is a .define line.
+ *
+ * @param line The line.
+ * @return The text after the keyword, NULL if the line is not a .define line.
+ */
+char *scan_define(char *line) {
+    size_t len = strlen(DEFINE_DIRECTIVE);
+
+    while (isspace(*line))
+        line++;
+    if (strncmp(line, DEFINE_DIRECTIVE, len) == 0 && (!line[len] || isspace(line[len])))
+        return line + len;
+    return NULL;
+}
+
+/**
+ * Handles a .define NAME value line. The value is folded right away, it may only use numbers and
+ * the constants defined before it.
+ *
+ * @param src   Pointer to the file context for the input file information.
+ * @param rest  The text after .define, modified.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or ERR_MEM_ALLOC.
+ */
+status handle_define(file_context *src, char *rest) {
+    char *name = NULL, *end = NULL;
+    symbol *sym = NULL;
+    expr_value result;
+    status report;
+
+    while (isspace(*rest))
+        rest++;
+    for (end = rest; *end && !isspace(*end); end++)
+        ;
+    name = rest;
+    rest = end;
+    while (isspace(*rest))
+        rest++;
+    if (end == name || !*rest) {
+        handle_error(ERR_INVALID_DEFINE, src);
+        return FAILURE;
+    }
+    *end = '\0';
+
+    if (is_valid_label(name) != ERR_MISSING_COLON) { /* a label, without the colon */
+        handle_error(ERR_INVALID_LABEL, src, name);
+        return FAILURE;
+    }
+    /* A label used before is fine, it has been a constant all along */
+    if (find_constant(name) || ((sym = find_symbol(name)) && (!sym->is_missing_info || sym->sym_dir != DEFAULT))) {
+        handle_error(ERR_DUP_CONSTANT, src, name);
+        return FAILURE;
+    }
+
+    /* Defined whatever its value, its uses are not reported again */
+    report = evaluate_expression(src, rest, EXPR_CONSTANT, src->lc, 0, &result);
+    if (add_constant(src, name, report == NO_ERROR ? result.value : 0) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+    return report;
+}
+
+/**
+ * Adds a constant to the constants of the file, the index is rebuilt twice as large once it is half full.
+ *
+ * @param src   Pointer to the file context for the input file information.
+ * @param name  The name of the constant.
+ * @param value The value of the constant.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status add_constant(file_context *src, const char *name, long value) {
+    constant *new_constants = NULL;
+    size_t *new_index = NULL;
+    size_t new_cap, i;
+
+    if (constants_count == constants_cap) {
+        new_cap = constants_cap ? constants_cap * 2 : CONSTANTS_MIN_CAP;
+        if (!(new_constants = realloc(constants, new_cap * sizeof(constant)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        constants = new_constants;
+        constants_cap = new_cap;
+    }
+    if ((constants_count + 1) * 2 > constant_index_cap) {
+        new_cap = constant_index_cap ? constant_index_cap * 2 : 2 * CONSTANTS_MIN_CAP;
+        if (!(new_index = calloc(new_cap, sizeof(size_t)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        free(constant_index);
+        constant_index = new_index;
+        constant_index_cap = new_cap;
+        for (i = 0; i < constants_count; i++)
+            *find_constant_slot(constants[i].name) = i + 1;
+    }
+
+    if (copy_string(&constants[constants_count].name, name) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+    constants[constants_count].value = value;
+    constants[constants_count].lc = src->lc;
+    *find_constant_slot(name) = ++constants_count;
+    return NO_ERROR;
+}
+
+/**
+ * Finds the slot of a name in the constant index: the slot of its constant, or the empty slot it
+ * would be inserted at.
+ *
+ * @param name The name.
+ * @return The slot.
+ */
+size_t *find_constant_slot(const char *name) {
+    return &constant_index[find_label_slot(constant_index, constant_index_cap, name, constant_slot_label)];
+}
+
+/**
+ * Reads the name of a slot of the constant index, see find_label_slot().
+ *
+ * @param table The constant index.
+ * @param slot  The slot.
+ * @return The name of its constant, NULL for an empty slot.
+ */
+const char *constant_slot_label(const void *table, size_t slot) {
+    size_t constant = ((const size_t *)table)[slot];
+
+    return constant ? constants[constant - 1].name : NULL;
+}
+
+/**
+ * Finds a constant by name.
+ *
+ * @param name The name.
+ * @return The constant, or NULL if no constant has been defined with that name.
+ */
+const constant *find_constant(const char *name) {
+    size_t slot;
+
+    if (!constants_count)
+        return NULL;
+    slot = *find_constant_slot(name);
+    return slot ? &constants[slot - 1] : NULL;
+}
+
+/**
+ * Frees the constants of the file.
+ */
+void free_constants() {
+    size_t i;
+
+    for (i = 0; i < constants_count; i++)
+        free(constants[i].name);
+    free(constants);
+    free(constant_index);
+    constants = NULL;
+    constant_index = NULL;
+    constants_count = constants_cap = constant_index_cap = 0;
+}
+
+/**
+ * Returns whether an operand or a .data value is an expression rather than a number or a label:
+ * it has an operator, or it is the name of a constant.
+ *
+ * @param word The operand or value.
+ * @return 1 if it is an expression, 0 otherwise.
+ */
+int is_expression(const char *word) {
+    const char *p = word + (*word == '+' || *word == '-');
+
+    if (isdigit(*p)) {
+        while (isdigit(*p))
+            p++;
+        if (!*p)
+            return 0; /* a number */
+    }
+    return strpbrk(word, EXPRESSION_OPERATORS) || find_constant(word);
+}
+
+/**
+ * Evaluates an expression: numbers, constants and labels, combined by + - * / and parentheses.
+ * In the first pass a label defined further on is added to the symbol table and left out of the
+ * value, see expr_value.
+ *
+ * @param src       Pointer to the file context for the input file information.
+ * @param text      The expression.
+ * @param kind      What a label stands for.
+ * @param lc        The line errors are reported on.
+ * @param is_fixup  1 once every label is known, a label that is still missing is an error.
+ * @param result    Set to the value.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported.
+ */
+status evaluate_expression(file_context *src, const char *text, Expr_kind kind, int lc, int is_fixup,
+                           expr_value *result) {
+    expr_parser parser;
+
+    parser.p = text;
+    parser.src = src;
+    parser.kind = kind;
+    parser.lc = lc;
+    parser.is_fixup = is_fixup;
+    parser.report = NO_ERROR;
+
+    *result = parse_sum(&parser);
+    skip_spaces(&parser);
+    if (parser.report == NO_ERROR && *parser.p)
+        parser.report = ERR_INVALID_EXPRESSION;
+    if (parser.report == ERR_INVALID_EXPRESSION)
+        handle_error(ERR_INVALID_EXPRESSION, src, text, lc);
+    return parser.report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Parses a sum: products separated by + and -.
+ *
+ * @param parser The parser.
+ * @return The value.
+ */
+expr_value parse_sum(expr_parser *parser) {
+    expr_value left = parse_product(parser), right;
+    char op;
+
+    skip_spaces(parser);
+    while (parser->report == NO_ERROR && (*parser->p == '+' || *parser->p == '-')) {
+        op = *parser->p++;
+        right = parse_product(parser);
+        left.value += op == '+' ? right.value : -right.value;
+        left.labels += op == '+' ? right.labels : -right.labels;
+        left.unknown += right.unknown;
+        check_limit(parser, &left);
+        skip_spaces(parser);
+    }
+    return left;
+}
+
+/**
+ * Parses a product: unary expressions separated by * and /. A label address cannot be scaled,
+ * a name that is not known yet is assumed to be a constant defined further on.
+ *
+ * @param parser The parser.
+ * @return The value.
+ */
+expr_value parse_product(expr_parser *parser) {
+    expr_value left = parse_unary(parser), right;
+    char op;
+
+    skip_spaces(parser);
+    while (parser->report == NO_ERROR && (*parser->p == '*' || *parser->p == '/')) {
+        op = *parser->p++;
+        right = parse_unary(parser);
+        if (parser->report != NO_ERROR)
+            break;
+        if (is_address(left) || is_address(right) || (op == '/' && !right.value && !right.unknown)) {
+            parser->report = ERR_INVALID_EXPRESSION;
+            break;
+        }
+        left.value = op == '*' ? left.value * right.value : right.value ? left.value / right.value : 0;
+        left.labels = 0;
+        left.unknown += right.unknown;
+        check_limit(parser, &left);
+        skip_spaces(parser);
+    }
+    return left;
+}
+
+/**
+ * Parses a unary expression: a signed unary expression, a parenthesized sum, a number or a name.
+ *
+ * @param parser The parser.
+ * @return The value.
+ */
+expr_value parse_unary(expr_parser *parser) {
+    expr_value result;
+    char op;
+
+    result.value = 0;
+    result.labels = result.unknown = 0;
+    skip_spaces(parser);
+
+    if (*parser->p == '+' || *parser->p == '-') {
+        op = *parser->p++;
+        result = parse_unary(parser);
+        if (op == '-') {
+            result.value = -result.value;
+            result.labels = -result.labels;
+        }
+    }
+    else if (*parser->p == '(') {
+        parser->p++;
+        result = parse_sum(parser);
+        skip_spaces(parser);
+        if (*parser->p == ')')
+            parser->p++;
+        else if (parser->report == NO_ERROR)
+            parser->report = ERR_INVALID_EXPRESSION;
+    }
+    else if (isdigit(*parser->p)) {
+        while (isdigit(*parser->p) && parser->report == NO_ERROR) {
+            result.value = result.value * 10 + (*parser->p++ - '0');
+            check_limit(parser, &result);
+        }
+    }
+    else if (isalpha(*parser->p))
+        result = parse_name(parser);
+    else if (parser->report == NO_ERROR)
+        parser->report = ERR_INVALID_EXPRESSION;
+    return result;
+}
+
+/**
+ * Parses a name: a constant, or a label that stands for its address or its value by the kind of
+ * the expression.
+ *
+ * @param parser The parser.
+ * @return The value.
+ */
+expr_value parse_name(expr_parser *parser) {
+    char name[MAX_LABEL_LENGTH + 1];
+    const constant *defined = NULL;
+    symbol *sym = NULL;
+    expr_value result;
+    status report = NO_ERROR;
+    size_t len;
+    int is_known;
+
+    result.value = 0;
+    result.labels = result.unknown = 0;
+    for (len = 0; isalnum(parser->p[len]); len++)
+        ;
+    if (len > MAX_LABEL_LENGTH) {
+        parser->report = ERR_INVALID_EXPRESSION;
+        return result;
+    }
+    strncpy(name, parser->p, len);
+    name[len] = '\0';
+    parser->p += len;
+
+    if ((defined = find_constant(name))) {
+        result.value = defined->value;
+        return result;
+    }
+    else if (parser->kind == EXPR_CONSTANT) { /* still a use, see parse_analysis_line() */
+        (void) add_symbol(parser->src, name, INVALID_ADDRESS, &report);
+        handle_error(ERR_UNKNOWN_CONSTANT, parser->src, name);
+        parser->report = FAILURE;
+        return result;
+    }
+
+    sym = parser->is_fixup ? find_symbol(name) : add_symbol(parser->src, name, INVALID_ADDRESS, &report);
+    if (!sym && !parser->is_fixup) { /* reported by add_symbol() */
+        parser->report = FAILURE;
+        return result;
+    }
+    else if (sym && sym->sym_dir == EXTERN) { /* its address is only known once linked */
+        parser->report = ERR_INVALID_EXPRESSION;
+        return result;
+    }
+
+    is_known = sym && !sym->is_missing_info
+               && (parser->kind == EXPR_ADDRESS || (sym->data && sym->data->value));
+    if (!is_known && parser->is_fixup) {
+        if (!sym || sym->is_missing_info) {
+            handle_error(ERR_LABEL_DOES_NOT_EXIST, parser->src, name, parser->lc);
+            parser->report = FAILURE;
+        }
+        else /* a label without a value, e.g. of an instruction */
+            parser->report = ERR_INVALID_EXPRESSION;
+        return result;
+    }
+
+    result.labels = parser->kind == EXPR_ADDRESS;
+    result.unknown = !is_known;
+    if (is_known)
+        result.value = parser->kind == EXPR_ADDRESS ? sym->address_decimal : *(sym->data->value);
+    check_limit(parser, &result);
+    return result;
+}
+
+/**
+ * Rejects a value out of the range of EXPRESSION_LIMIT, rather than letting it overflow.
+ *
+ * @param parser The parser.
+ * @param value  The value.
+ */
+void check_limit(expr_parser *parser, const expr_value *value) {
+    if (parser->report == NO_ERROR && (value->value > EXPRESSION_LIMIT || value->value < -EXPRESSION_LIMIT))
+        parser->report = ERR_INVALID_EXPRESSION;
+}
+
+/**
+ * Skips the spaces of an expression, only the value of a .define may have any.
+ *
+ * @param parser The parser.
+ */
+void skip_spaces(expr_parser *parser) {
+    while (isspace(*parser->p))
+        parser->p++;
+}
+
+/**
+ * Returns whether a value is known to hold label addresses that do not cancel out.
+ *
+ * @param value The value.
+ * @return 1 if it does, 0 otherwise.
+ */
+int is_address(expr_value value) {
+    return value.labels && !value.unknown;
+}
+
+/**
+ * Returns whether the value of an operand expression fits its word: an address within the memory,
+ * or a number the signed operand field holds, rather than masking it into the word.
+ *
+ * @param value The value.
+ * @param mode  DIRECT or IMMEDIATE.
+ * @return 1 if it fits, 0 otherwise.
+ */
+int fits_operand(long value, Adrs_mod mode) {
+    if (mode == DIRECT)
+        return value >= 0 && value < MAX_MEMORY_SIZE;
+    return value >= -OPERAND_VALUE_LIMIT && value < OPERAND_VALUE_LIMIT;
+}
+
+/**
+ * Returns the addressing mode of an operand expression: DIRECT for a label address plus or minus
+ * a number, IMMEDIATE for a number. A name that is not known yet is assumed to be a label.
+ *
+ * @param src       Pointer to the file context for the input file information.
+ * @param word      The operand.
+ * @param report    Set to the error, if any.
+ * @return The addressing mode, INVALID_MD if an error has been reported.
+ */
+Adrs_mod get_expression_mode(file_context *src, const char *word, status *report) {
+    expr_value result;
+
+    if (evaluate_expression(src, word, EXPR_ADDRESS, src->lc, 0, &result) != NO_ERROR) {
+        *report = ERR_INVALID_EXPRESSION;
+        return INVALID_MD;
+    }
+    if (!result.unknown && result.labels != 0 && result.labels != 1) {
+        handle_error(ERR_EXPRESSION_ADDRESS, src, word, src->lc);
+        *report = ERR_EXPRESSION_ADDRESS;
+        return INVALID_MD;
+    }
+    if (!result.unknown && !fits_operand(result.value, result.labels ? DIRECT : IMMEDIATE)) {
+        handle_error(ERR_EXPRESSION_RANGE, src, word, src->lc);
+        *report = ERR_EXPRESSION_RANGE;
+        return INVALID_MD;
+    }
+    return result.labels > 0 ? DIRECT : IMMEDIATE;
+}
+
+/**
+ * Assembles the word of an operand expression, or keeps the expression until every label is
+ * known, see resolve_expression(). An expression that uses a label is always kept while the
+ * first pass keeps label expressions, the labels may still move (see keep_label_expressions).
+ *
+ * @param src   Pointer to the file context for the input file information.
+ * @param data  The word.
+ * @param word  The operand.
+ * @param mode  The addressing mode returned by get_expression_mode().
+ * @return NO_ERROR if successful, FAILURE or ERR_MEM_ALLOC otherwise.
+ */
+status assemble_expression_operand(file_context *src, data_image *data, const char *word, Adrs_mod mode) {
+    expr_value result;
+
+    if (evaluate_expression(src, word, EXPR_ADDRESS, src->lc, 0, &result) != NO_ERROR)
+        return FAILURE;
+    data->expression_mode = mode;
+    if (result.unknown || (keep_label_expressions && has_label_name(word))) {
+        data->concat = ADDRESS;
+        return copy_string(&data->expression, word);
+    }
+    return encode_expression_word(data, result.value, mode);
+}
+
+/**
+ * Assigns the value of a .data expression, or keeps the expression until every label is known,
+ * see resolve_expression().
+ *
+ * @param src   Pointer to the file context for the input file information.
+ * @param data  The word.
+ * @param word  The value.
+ * @param value The value of the word, freed and set to NULL if the expression is kept.
+ * @return NO_ERROR if successful, FAILURE or ERR_MEM_ALLOC otherwise.
+ */
+status assemble_expression_value(file_context *src, data_image *data, const char *word, int **value) {
+    expr_value result;
+
+    if (evaluate_expression(src, word, EXPR_DATA, src->lc, 0, &result) != NO_ERROR)
+        return FAILURE;
+    if (record_expression_uses(word, src->lc, data->data_address, SLOT_DATA) != NO_ERROR) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+    if (result.unknown) {
+        free(*value);
+        *value = NULL;
+        return copy_string(&data->expression, word);
+    }
+    **value = (int)result.value;
+    return NO_ERROR;
+}
+
+/**
+ * Records the uses of the labels of an expression, see record_symbol_use().
+ *
+ * @param word      The expression.
+ * @param lc        The source line of the word.
+ * @param address   The address of the word.
+ * @param slot      Where the expression is used.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status record_expression_uses(const char *word, int lc, int address, Operand_slot slot) {
+    char name[MAX_LABEL_LENGTH + 1];
+    size_t len;
+
+    while (*word) {
+        for (len = 0; isalnum(word[len]); len++)
+            ;
+        if (isalpha(*word) && len <= MAX_LABEL_LENGTH) {
+            strncpy(name, word, len);
+            name[len] = '\0';
+            if (!find_constant(name) && record_symbol_use(find_symbol(name), lc, address, slot) != NO_ERROR)
+                return ERR_MEM_ALLOC;
+        }
+        word += len ? len : 1;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Returns whether an expression uses a label, its address or its value.
+ *
+ * @param word The expression.
+ * @return 1 if a name of the expression is not a constant, 0 otherwise.
+ */
+int has_label_name(const char *word) {
+    char name[MAX_LABEL_LENGTH + 1];
+    size_t len;
+
+    while (*word) {
+        for (len = 0; isalnum(word[len]); len++)
+            ;
+        if (isalpha(*word) && len <= MAX_LABEL_LENGTH) {
+            strncpy(name, word, len);
+            name[len] = '\0';
+            if (!find_constant(name))
+                return 1;
+        }
+        word += len ? len : 1;
+    }
+    return 0;
+}
+
+/**
+ * Evaluates a kept expression once every label is known, and completes its word.
+ *
+ * @param src   Pointer to the file context for the input file information.
+ * @param data  The word, its expression set.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or ERR_MEM_ALLOC.
+ */
+status resolve_expression(file_context *src, data_image *data) {
+    expr_value result;
+    status report = NO_ERROR;
+    Adrs_mod mode = data->expression_mode;
+
+    if (evaluate_expression(src, data->expression, mode == INVALID_MD ? EXPR_DATA : EXPR_ADDRESS, data->lc, 1,
+                            &result) != NO_ERROR)
+        return FAILURE;
+
+    if (mode == INVALID_MD) { /* the word is created from its value, as any .data word */
+        if (!(data->value = malloc(sizeof(int)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        *(data->value) = (int)result.value;
+    }
+    else if (result.labels != (mode == DIRECT)) { /* a name was a constant defined after its use */
+        handle_error(ERR_EXPRESSION_ADDRESS, src, data->expression, data->lc);
+        return FAILURE;
+    }
+    else if (!fits_operand(result.value, mode)) {
+        handle_error(ERR_EXPRESSION_RANGE, src, data->expression, data->lc);
+        return FAILURE;
+    }
+    else
+        report = encode_expression_word(data, result.value, mode);
+
+    free(data->expression);
+    data->expression = NULL;
+    return report;
+}
+
+/**
+ * Completes the word of an operand expression: its value and the A/R/E bits, relocatable for
+ * a label address.
+ *
+ * @param data  The word.
+ * @param value The value.
+ * @param mode  DIRECT or IMMEDIATE.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status encode_expression_word(data_image *data, long value, Adrs_mod mode) {
+    status report;
+
+    data->concat = ADDRESS;
+    data->binary_src = decimal_to_binary12((int)value);
+    data->binary_a_r_e = decimal_to_binary12(mode == DIRECT ? RELOCATABLE : ABSOLUTE);
+    report = data->binary_src && data->binary_a_r_e ? create_base64_word(data) : ERR_MEM_ALLOC;
+    free(data->binary_src); /* not shared with a symbol, see free_data_image() */
+    data->binary_src = NULL;
+    data->is_word_complete = 1;
+    return report;
+}
@@ -0,0 +1,55 @@
+#ifndef ASSEMBLER_EXPR_H
+#define ASSEMBLER_EXPR_H
+
+#include "utils.h"
+#include "errors.h"
+#include "data.h"
+
+#define DEFINE_DIRECTIVE ".define"
+#define CONSTANTS_MIN_CAP 16
+#define EXPRESSION_LIMIT 32767L /* of every value computed, a product of two of them still fits a long */
+#define OPERAND_VALUE_LIMIT (1L << (ADDRESS_BINARY_LEN - 1)) /* an immediate is a signed ADDRESS_BINARY_LEN bit field */
+
+/* A .define constant, known from its line to the end of the file */
+typedef struct {
+    char *name;
+    long value;
+    int lc;
+} constant;
+
+/* What a name that is not a constant stands for */
+typedef enum {
+    EXPR_CONSTANT, /* nothing, the value of a .define only uses numbers and constants */
+    EXPR_ADDRESS, /* the address of the label, in an operand */
+    EXPR_DATA /* the value of the label, in a .data list, as a label on its own there */
+} Expr_kind;
+
+/*
+ * The value of an expression. In an operand the labels must cancel out (an absolute number) or
+ * leave a single address plus or minus a number (a relocatable address).
+ */
+typedef struct {
+    long value;
+    int labels; /* net count of the label addresses added, 0 if none or if they cancel out */
+    int unknown; /* names not known yet: labels defined further on, their value left out */
+} expr_value;
+
+/* The constants of the file being assembled, reset by free_global_data_and_symbol() */
+extern constant *constants;
+extern size_t constants_count;
+
+char *scan_define(char *line);
+status handle_define(file_context *src, char *rest);
+const constant *find_constant(const char *name);
+void free_constants();
+
+int is_expression(const char *word);
+status evaluate_expression(file_context *src, const char *text, Expr_kind kind, int lc, int is_fixup,
+                           expr_value *result);
+Adrs_mod get_expression_mode(file_context *src, const char *word, status *report);
+status assemble_expression_operand(file_context *src, data_image *data, const char *word, Adrs_mod mode);
+status assemble_expression_value(file_context *src, data_image *data, const char *word, int **value);
+status record_expression_uses(const char *word, int lc, int address, Operand_slot slot);
+status resolve_expression(file_context *src, data_image *data);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linker.h"
+#include "object.h"
+#include "aobj.h"
+#include "utils.h"
+#include "errors.h"
+
+#define LINK_DEFAULT_OUTPUT "linked"
+
+status load_modules(char *names[], int count, object_module *modules, int from_aobj);
+void report_load_error(const char *file_name, const char *ext, status code, int line);
+
+/**
+ * Linker of assembled modules.
+ * Usage: Linker [--output NAME] [--aobj] file...
+ * Each file is given without extension, its .ob file is loaded together with the .ent and .ext files,
+ * or with --aobj its .aobj file (see aobj.h), which is mapped rather than parsed.
+ * The modules are placed in the order they are given, the first one starts at address 100. The .ob
+ * file does not tell which words are addresses, so only the .aobj files can be moved: without --aobj
+ * a single module can be linked.
+ * The linked program is written to NAME.ob (and NAME.ent if any module has entries).
+ */
+int main(int argc, char *argv[]) {
+    object_module *modules = NULL, linked;
+    const char *output = LINK_DEFAULT_OUTPUT;
+    status report = NO_ERROR;
+    int i, files = 0, from_aobj = 0;
+
+    /* Options may appear anywhere, file names are packed to the front of argv */
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--aobj") == 0)
+            from_aobj = 1;
+        else {
+            handle_error(ERR_INVALID_OPTION, argv[i]);
+            flush_diagnostics();
+            exit(FAILURE);
+        }
+    }
+
+    if (!files) {
+        handle_error(ERR_INVALID_OPTION, "missing file name");
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    if (!(modules = calloc((size_t)files, sizeof(object_module)))) {
+        handle_error(ERR_MEM_ALLOC);
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    if ((report = load_modules(argv + 1, files, modules, from_aobj)) == NO_ERROR
+        && (report = link_modules(modules, (const char **)(argv + 1), (size_t)files, &linked)) == NO_ERROR) {
+        if ((report = write_object(output, &linked)) == NO_ERROR)
+            handle_progress(LINK_OK, output);
+        else
+            report_load_error(output, OBJECT_EXT, report, 0);
+        free_object(&linked);
+    }
+
+    flush_diagnostics();
+    for (i = 0; i < files; i++)
+        free_object(&modules[i]);
+    free(modules);
+    return report == NO_ERROR ? 0 : FAILURE;
+}
+
+/**
+ * Loads the modules to link, reports every module that cannot be loaded.
+ *
+ * @param names     The names of the modules, without extension.
+ * @param count     The number of modules.
+ * @param modules   The modules to fill.
+ * @param from_aobj 1 to load the .aobj files, 0 for the .ob, .ent and .ext files.
+ * @return NO_ERROR if all the modules have been loaded, FAILURE otherwise.
+ */
+status load_modules(char *names[], int count, object_module *modules, int from_aobj) {
+    status report, result = NO_ERROR;
+    int i, line;
+
+    for (i = 0; i < count; i++) {
+        report = from_aobj ? map_aobj(names[i], NULL, &modules[i], &line) : load_object(names[i], &modules[i], &line);
+        if (report != NO_ERROR) {
+            report_load_error(names[i], from_aobj ? AOBJ_EXT : OBJECT_EXT, report, line);
+            result = FAILURE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Reports why a module could not be loaded, or the linked program could not be written.
+ *
+ * @param file_name The name of the module, without extension.
+ * @param ext       The extension of the file that could not be opened.
+ * @param code      The status returned by load_object(), map_aobj() or write_object().
+ * @param line      The invalid line (or offset), if any.
+ */
+void report_load_error(const char *file_name, const char *ext, status code, int line) {
+    file_context fc;
+
+    if (code == ERR_OPEN_FILE) {
+        fc.file_name = malloc(strlen(file_name) + strlen(ext) + 1);
+        if (!fc.file_name) {
+            handle_error(ERR_MEM_ALLOC);
+            return;
+        }
+        strcat(strcpy(fc.file_name, file_name), ext);
+        fc.lc = 0;
+        handle_error(ERR_OPEN_FILE, &fc);
+        free(fc.file_name);
+    }
+    else if (code == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else
+        handle_error(code, file_name, line);
+}
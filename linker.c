@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linker.h"
+#include "utils.h"
+
+/* "Private" helper functions */
+status build_link_table(link_table *table, const object_module *modules, const char **names, size_t count,
+                        const int *bases);
+link_symbol *find_link_symbol(const link_table *table, const char *label);
+const char *link_slot_label(const void *table, size_t slot);
+status relocate_module(object_module *out, const object_module *module, const char *name, int base,
+                       const link_table *table);
+status append_entries(object_module *out, const object_module *module, int base);
+
+/**
+ * Links assembled modules into a single program. The modules are placed one after the other,
+ * starting at ADDRESS_START, in the given order.
+ *
+ * Every .ent symbol goes into one global hashed table, every .ext use site is patched with the
+ * relocated address of its symbol. The result has the entries of all the modules and no externals.
+ *
+ * A module is moved by shifting the words its relocation list marks as RELOCATABLE, see
+ * module_relocation. The .ob format has no such list: a module read from it can only be the first
+ * one, any other must be linked from its .aobj file.
+ *
+ * @param modules   The modules.
+ * @param names     The names of the modules, used in the diagnostics.
+ * @param count     The number of modules.
+ * @param out       The linked program, must be released with free_object().
+ * @return NO_ERROR if successful, FAILURE if a symbol is duplicate or unresolved or the program
+ * @return does not fit in the memory (already reported), or ERR_MEM_ALLOC.
+ */
+status link_modules(const object_module *modules, const char **names, size_t count, object_module *out) {
+    link_table table;
+    int *bases = NULL;
+    size_t i;
+    long size = 0;
+    status report = NO_ERROR;
+
+    memset(out, 0, sizeof(object_module));
+    memset(&table, 0, sizeof(table));
+
+    if (count && !(bases = malloc(count * sizeof(int)))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < count; i++) {
+        bases[i] = ADDRESS_START + (int)size;
+        size += modules[i].size;
+        if (ADDRESS_START + size > MAX_MEMORY_SIZE) {
+            handle_error(ERR_LINK_MEMORY, names[i], (int)(ADDRESS_START + size));
+            free(bases);
+            return FAILURE;
+        }
+        out->ic += modules[i].ic;
+        out->dc += modules[i].dc;
+    }
+
+    report = build_link_table(&table, modules, names, count, bases);
+    for (i = 0; i < count && report != ERR_MEM_ALLOC; i++)
+        if (relocate_module(out, &modules[i], names[i], bases[i], &table) != NO_ERROR)
+            report = FAILURE;
+    for (i = 0; i < count && report == NO_ERROR; i++)
+        report = append_entries(out, &modules[i], bases[i]);
+
+    if (report == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    if (report != NO_ERROR)
+        free_object(out);
+    free(table.slots);
+    free(bases);
+    return report;
+}
+
+/**
+ * Builds the global symbol table from the entries of all the modules, reports duplicate symbols.
+ *
+ * @param table     The table to build, its slots must be released with free().
+ * @param modules   The modules.
+ * @param names     The names of the modules.
+ * @param count     The number of modules.
+ * @param bases     The address every module is loaded at.
+ * @return NO_ERROR if successful, FAILURE if a symbol is duplicate, or ERR_MEM_ALLOC.
+ */
+status build_link_table(link_table *table, const object_module *modules, const char **names, size_t count,
+                        const int *bases) {
+    link_symbol *slot = NULL;
+    const object_symbol *entry = NULL;
+    size_t i, k, entries = 0;
+    status report = NO_ERROR;
+
+    for (i = 0; i < count; i++)
+        entries += modules[i].entries_count;
+
+    /* At most half full, a lookup is expected to probe one or two slots */
+    for (table->cap = LINK_TABLE_MIN_CAP; table->cap < entries * 2; table->cap *= 2)
+        ;
+    if (!(table->slots = calloc(table->cap, sizeof(link_symbol))))
+        return ERR_MEM_ALLOC;
+
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < modules[i].entries_count; k++) {
+            entry = &modules[i].entries[k];
+            slot = find_link_symbol(table, entry->label);
+            if (slot->label) {
+                handle_error(ERR_LINK_DUP_SYMBOL, names[i], entry->label);
+                report = FAILURE;
+                continue;
+            }
+            slot->label = entry->label;
+            slot->address = entry->address - ADDRESS_START + bases[i];
+            slot->module = i;
+            table->count++;
+        }
+    }
+    return report;
+}
+
+/**
+ * Finds the slot of a label: the slot that holds it, or the empty slot it would be inserted at.
+ *
+ * @param table The table, it always has an empty slot.
+ * @param label The label to find.
+ * @return The slot.
+ */
+link_symbol *find_link_symbol(const link_table *table, const char *label) {
+    return &table->slots[find_label_slot(table->slots, table->cap, label, link_slot_label)];
+}
+
+/**
+ * Reads the label of a slot of a link table, see find_label_slot().
+ *
+ * @param table The slots of the table.
+ * @param slot  The slot.
+ * @return Its label, NULL for an empty slot.
+ */
+const char *link_slot_label(const void *table, size_t slot) {
+    return ((const link_symbol *)table)[slot].label;
+}
+
+/**
+ * Copies a module into the linked program, relocates its address operands and resolves its
+ * external use sites.
+ *
+ * Only the words of the relocation list of the module are relocated, any other word, a .data value
+ * in particular, is copied as is. A module without a relocation list can only be loaded at
+ * ADDRESS_START.
+ *
+ * @param out       The linked program.
+ * @param module    The module.
+ * @param name      The name of the module.
+ * @param base      The address the module is loaded at.
+ * @param table     The global symbol table.
+ * @return NO_ERROR if successful, FAILURE if the module cannot be moved, an external symbol is
+ * @return unresolved or a use site is invalid.
+ */
+status relocate_module(object_module *out, const object_module *module, const char *name, int base,
+                       const link_table *table) {
+    unsigned short *words = out->words + (base - ADDRESS_START);
+    link_symbol *sym = NULL;
+    size_t k;
+    int site, delta = base - ADDRESS_START;
+    status report = NO_ERROR;
+
+    memcpy(words, module->words, (size_t)module->size * sizeof(unsigned short));
+    out->size += module->size;
+
+    if (delta && !module->is_relocatable) {
+        handle_error(ERR_LINK_NO_RELOCATIONS, name, base);
+        return FAILURE;
+    }
+
+    for (k = 0; delta && k < module->relocations_count; k++) {
+        site = module->relocations[k].offset;
+        if (module->relocations[k].are == RELOCATABLE)
+            words[site] = (unsigned short)(((WORD_OPERAND(module->words[site]) + delta) << 2) | RELOCATABLE);
+    }
+
+    for (k = 0; k < module->externals_count; k++) {
+        site = module->externals[k].address - ADDRESS_START;
+        if (site < 0 || site >= module->size || WORD_ARE(module->words[site]) != EXTERNAL) {
+            handle_error(ERR_LINK_SITE, name, module->externals[k].address);
+            report = FAILURE;
+            continue;
+        }
+        sym = find_link_symbol(table, module->externals[k].label);
+        if (!sym->label) {
+            handle_error(ERR_LINK_UNRESOLVED, name, module->externals[k].label);
+            report = FAILURE;
+        }
+        else
+            words[site] = (unsigned short)((sym->address << 2) | RELOCATABLE);
+    }
+    return report;
+}
+
+/**
+ * Appends the relocated entries of a module to the linked program.
+ *
+ * @param out       The linked program.
+ * @param module    The module.
+ * @param base      The address the module is loaded at.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status append_entries(object_module *out, const object_module *module, int base) {
+    object_symbol *new_entries = NULL;
+    size_t k;
+
+    if (!module->entries_count)
+        return NO_ERROR;
+    if (!(new_entries = realloc(out->entries, (out->entries_count + module->entries_count) * sizeof(object_symbol))))
+        return ERR_MEM_ALLOC;
+    out->entries = new_entries;
+
+    for (k = 0; k < module->entries_count; k++) {
+        out->entries[out->entries_count] = module->entries[k];
+        out->entries[out->entries_count++].address += base - ADDRESS_START;
+    }
+    return NO_ERROR;
+}
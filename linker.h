@@ -0,0 +1,25 @@
+#ifndef ASSEMBLER_LINKER_H
+#define ASSEMBLER_LINKER_H
+
+#include "object.h"
+#include "errors.h"
+
+#define LINK_TABLE_MIN_CAP 16
+
+/* Global symbol of the linker, an entry of one of the modules */
+typedef struct {
+    const char *label; /* NULL for an empty slot */
+    int address; /* relocated address */
+    size_t module;
+} link_symbol;
+
+/* Open addressing hash table of the global symbols, the capacity is a power of two */
+typedef struct {
+    link_symbol *slots;
+    size_t cap;
+    size_t count;
+} link_table;
+
+status link_modules(const object_module *modules, const char **names, size_t count, object_module *out);
+
+#endif
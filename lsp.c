@@ -0,0 +1,782 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lsp.h"
+#include "analysis.h"
+#include "utils.h"
+#include "errors.h"
+
+#define LSP_MIN_DOCUMENTS 8
+#define UTF8_MAX_1 0x7F
+#define UTF8_MAX_2 0x7FF
+#define UTF16_ESCAPE_LEN 4
+
+/* "Private" helper functions */
+char *read_message(FILE *in, status *report);
+void handle_message(lsp_server *server, const char *body);
+void handle_request(lsp_server *server, const char *method, const char *id, int id_len, const char *params);
+void handle_notification(lsp_server *server, const char *method, const char *params);
+status open_document(lsp_server *server, const char *params);
+status change_document(lsp_server *server, const char *params);
+void close_document(lsp_server *server, const char *params);
+status apply_change(analysis *doc, const char *change);
+lsp_document *find_document(lsp_server *server, const char *params);
+void publish_diagnostics(lsp_server *server, const char *uri, const analysis *doc);
+void write_publish_diagnostic(const diagnostic *d, int line, void *ctx);
+void write_definition(FILE *dest, const lsp_document *document, const char *params);
+void write_references(FILE *dest, const lsp_document *document, const char *params);
+void write_location(FILE *dest, const lsp_document *document, int line, const char *word, int *count);
+int word_at(const analysis *doc, const char *params, char *word);
+int find_word(const char *text, const char *word);
+const char *line_text(const analysis *doc, int line);
+FILE *begin_message(char **buf, size_t *len);
+void send_message(lsp_server *server, FILE *body, char **buf, size_t *len);
+void send_error(lsp_server *server, const char *id, int id_len, int code, const char *message);
+const char *json_skip_space(const char *p);
+const char *json_skip_value(const char *p);
+const char *json_member(const char *object, const char *key);
+const char *json_path(const char *object, const char *path);
+const char *json_first_element(const char *array);
+const char *json_next_element(const char *element);
+char *json_string_value(const char *value);
+int json_int_value(const char *value, int *out);
+
+/**
+ * Runs the assembler as a language server, speaking the Language Server Protocol (JSON-RPC framed
+ * by Content-Length headers) until the exit notification or the end of the input.
+ *
+ * Every open document is kept in memory as an incremental analysis (see analysis.h): an edit
+ * re-runs the first pass on the edited lines only, and the diagnostics, definitions and references
+ * are answered from its symbol and macro index instead of assembling the file again from disk.
+ *
+ * @param in    The input stream of the client.
+ * @param out   The output stream of the client, nothing else may be written to it.
+ * @return NO_ERROR if the client shut the server down before it exited, FAILURE otherwise.
+ */
+status serve_lsp(FILE *in, FILE *out) {
+    lsp_server server;
+    status report = NO_ERROR;
+    char *body = NULL;
+    size_t i;
+
+    memset(&server, 0, sizeof(lsp_server));
+    server.out = out;
+    while (!server.exited && (body = read_message(in, &report))) {
+        handle_message(&server, body);
+        free(body);
+    }
+
+    for (i = 0; i < server.count; i++) {
+        analysis_close(&server.docs[i].doc);
+        free(server.docs[i].uri);
+    }
+    free(server.docs);
+    return server.exited && server.shutdown && report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Reads the next message: its headers, then a body of Content-Length bytes.
+ *
+ * @param in        The input stream.
+ * @param report    Set to FAILURE if the message is not framed properly.
+ * @return The allocated body, null terminated, or NULL at the end of the input or on error.
+ */
+char *read_message(FILE *in, status *report) {
+    char header[MAX_BUFFER_LENGTH], *body = NULL;
+    long len = -1;
+
+    while (fgets(header, sizeof(header), in) && strcmp(header, "\r\n") != 0 && strcmp(header, "\n") != 0)
+        if (strncmp(header, LSP_HEADER_LENGTH, strlen(LSP_HEADER_LENGTH)) == 0)
+            len = strtol(header + strlen(LSP_HEADER_LENGTH), NULL, 10);
+
+    if (feof(in) || ferror(in))
+        return NULL;
+    if (len < 0 || len > LSP_MAX_MESSAGE_LEN || !(body = malloc((size_t)len + 1))) {
+        *report = FAILURE;
+        return NULL;
+    }
+    if (fread(body, 1, (size_t)len, in) != (size_t)len) {
+        *report = FAILURE;
+        free(body);
+        return NULL;
+    }
+    body[len] = '\0';
+    return body;
+}
+
+/**
+ * Handles a message: a request gets a response, a notification does not and a response from
+ * the client is ignored (the server sends no requests).
+ *
+ * @param server    The server.
+ * @param body      The message.
+ */
+void handle_message(lsp_server *server, const char *body) {
+    const char *id = json_member(body, "id"), *id_end = json_skip_value(id);
+    char *method = json_string_value(json_member(body, "method"));
+
+    if (!json_skip_value(body) || *json_skip_space(body) != '{')
+        send_error(server, NULL, 0, LSP_PARSE_ERROR, "Parse error");
+    else if (method && id && id_end)
+        handle_request(server, method, id, (int)(id_end - id), json_member(body, "params"));
+    else if (method)
+        handle_notification(server, method, json_member(body, "params"));
+    free(method);
+}
+
+/**
+ * Handles a request and sends its response.
+ *
+ * @param server    The server.
+ * @param method    The method.
+ * @param id        The id of the request, as written by the client.
+ * @param id_len    The length of the id.
+ * @param params    The parameters (optional - NULL).
+ */
+void handle_request(lsp_server *server, const char *method, const char *id, int id_len, const char *params) {
+    lsp_document *document = NULL;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *body = NULL;
+
+    if (strcmp(method, "initialize") != 0 && strcmp(method, "shutdown") != 0
+        && strcmp(method, "textDocument/definition") != 0 && strcmp(method, "textDocument/references") != 0) {
+        send_error(server, id, id_len, LSP_METHOD_NOT_FOUND, "Method not found");
+        return;
+    }
+    if (!(body = begin_message(&buf, &len))) {
+        send_error(server, id, id_len, LSP_INTERNAL_ERROR, msg[ERR_MEM_ALLOC]);
+        return;
+    }
+
+    fprintf(body, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"result\":", id_len, id);
+    if (strcmp(method, "initialize") == 0)
+        fprintf(body, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":%d},"
+                      "\"definitionProvider\":true,\"referencesProvider\":true},"
+                      "\"serverInfo\":{\"name\":\"Assembler\"}}", LSP_SYNC_INCREMENTAL);
+    else if (strcmp(method, "shutdown") == 0) {
+        server->shutdown = 1;
+        fputs("null", body);
+    }
+    else if (!(document = find_document(server, params)))
+        fputs("null", body);
+    else if (strcmp(method, "textDocument/definition") == 0)
+        write_definition(body, document, params);
+    else
+        write_references(body, document, params);
+    fputc('}', body);
+    send_message(server, body, &buf, &len);
+}
+
+/**
+ * Handles a notification. The diagnostics of a document are published whenever it changes.
+ *
+ * @param server    The server.
+ * @param method    The method.
+ * @param params    The parameters (optional - NULL).
+ */
+void handle_notification(lsp_server *server, const char *method, const char *params) {
+    lsp_document *document = NULL;
+
+    if (strcmp(method, "exit") == 0)
+        server->exited = 1;
+    else if (strcmp(method, "textDocument/didOpen") == 0 && open_document(server, params) == NO_ERROR)
+        document = &server->docs[server->count - 1];
+    else if (strcmp(method, "textDocument/didChange") == 0 && (document = find_document(server, params)))
+        (void) change_document(server, params);
+    else if (strcmp(method, "textDocument/didClose") == 0)
+        close_document(server, params);
+
+    if (document)
+        publish_diagnostics(server, document->uri, &document->doc);
+}
+
+/**
+ * Opens a document, or replaces it if it is already open.
+ *
+ * @param server    The server.
+ * @param params    The parameters of textDocument/didOpen.
+ * @return NO_ERROR if the document is the last one of the server, FAILURE or ERR_MEM_ALLOC otherwise.
+ */
+status open_document(lsp_server *server, const char *params) {
+    lsp_document *new_docs = NULL, *document = NULL;
+    char *uri = json_string_value(json_path(params, "textDocument.uri"));
+    char *text = json_string_value(json_path(params, "textDocument.text"));
+    const char *name = NULL;
+    status report = uri && text ? NO_ERROR : FAILURE;
+
+    close_document(server, params);
+    if (report == NO_ERROR && server->count == server->cap) {
+        if ((new_docs = realloc(server->docs, (server->cap ? server->cap * 2 : LSP_MIN_DOCUMENTS) * sizeof(lsp_document)))) {
+            server->docs = new_docs;
+            server->cap = server->cap ? server->cap * 2 : LSP_MIN_DOCUMENTS;
+        }
+        else
+            report = ERR_MEM_ALLOC;
+    }
+
+    if (report == NO_ERROR) {
+        document = &server->docs[server->count];
+        name = strrchr(uri, '/') ? strrchr(uri, '/') + 1 : uri; /* diagnostics name the file, as the assembler does */
+        if ((report = analysis_open(&document->doc, name, text)) == NO_ERROR)
+            report = analysis_update(&document->doc);
+        if (report == NO_ERROR) {
+            document->uri = uri;
+            uri = NULL;
+            server->count++;
+        }
+        else
+            analysis_close(&document->doc);
+    }
+    free(uri);
+    free(text);
+    return report;
+}
+
+/**
+ * Applies the changes of a textDocument/didChange notification to an open document, in order.
+ *
+ * @param server    The server.
+ * @param params    The parameters of the notification.
+ * @return NO_ERROR if successful, FAILURE or ERR_MEM_ALLOC otherwise.
+ */
+status change_document(lsp_server *server, const char *params) {
+    lsp_document *document = find_document(server, params);
+    const char *change = NULL;
+    status report = document ? NO_ERROR : FAILURE;
+
+    for (change = json_first_element(json_member(params, "contentChanges")); change && report == NO_ERROR;
+         change = json_next_element(change))
+        report = apply_change(&document->doc, change);
+
+    if (document && report != ERR_MEM_ALLOC)
+        report = analysis_update(&document->doc) == NO_ERROR ? report : ERR_MEM_ALLOC;
+    return report;
+}
+
+/**
+ * Closes a document, if it is open, and clears its diagnostics.
+ *
+ * @param server    The server.
+ * @param params    The parameters of textDocument/didClose (or textDocument/didOpen).
+ */
+void close_document(lsp_server *server, const char *params) {
+    lsp_document *document = find_document(server, params);
+
+    if (!document)
+        return;
+    publish_diagnostics(server, document->uri, NULL);
+    analysis_close(&document->doc);
+    free(document->uri);
+    *document = server->docs[--server->count];
+}
+
+/**
+ * Applies a change to a document. A change of a range is turned into an edit of the whole lines
+ * it touches, only those are analyzed again.
+ *
+ * @param doc       The document.
+ * @param change    A TextDocumentContentChangeEvent, with a range or with the whole text.
+ * @return NO_ERROR if successful, FAILURE if the change is invalid, or ERR_MEM_ALLOC.
+ */
+status apply_change(analysis *doc, const char *change) {
+    const char *range = json_member(change, "range"), *prefix = NULL, *suffix = NULL;
+    char *text = json_string_value(json_member(change, "text")), *joined = NULL;
+    int start_line, start_char, end_line, end_char;
+    size_t first, last;
+    status report;
+
+    if (text && !range) {
+        report = analysis_edit(doc, 0, doc->count, text);
+        free(text);
+        return report;
+    }
+    if (!text || !json_int_value(json_path(range, "start.line"), &start_line)
+        || !json_int_value(json_path(range, "start.character"), &start_char)
+        || !json_int_value(json_path(range, "end.line"), &end_line)
+        || !json_int_value(json_path(range, "end.character"), &end_char)
+        || start_line < 0 || start_char < 0 || end_char < 0 || end_line < start_line) {
+        free(text);
+        return FAILURE;
+    }
+
+    /* The kept start of the first line and end of the last line, the positions are clamped to the text */
+    prefix = line_text(doc, start_line);
+    suffix = line_text(doc, end_line);
+    start_char = start_char > (int)strlen(prefix) ? (int)strlen(prefix) : start_char;
+    suffix += end_char > (int)strlen(suffix) ? strlen(suffix) : (size_t)end_char;
+
+    if (!(joined = malloc((size_t)start_char + strlen(text) + strlen(suffix) + 2))) {
+        free(text);
+        return ERR_MEM_ALLOC;
+    }
+    memcpy(joined, prefix, (size_t)start_char);
+    strcat(strcat(strcpy(joined + start_char, text), suffix), "\n"); /* an empty last line is still a line */
+
+    first = (size_t)start_line < doc->count ? (size_t)start_line : doc->count;
+    last = (size_t)end_line < doc->count ? (size_t)end_line + 1 : doc->count;
+    report = analysis_edit(doc, first, last - first, joined);
+    free(joined);
+    free(text);
+    return report;
+}
+
+/**
+ * Finds the open document the parameters of a message refer to.
+ *
+ * @param server    The server.
+ * @param params    The parameters, with a textDocument.uri member.
+ * @return The document, or NULL if it is not open.
+ */
+lsp_document *find_document(lsp_server *server, const char *params) {
+    char *uri = json_string_value(json_path(params, "textDocument.uri"));
+    size_t i;
+
+    for (i = 0; uri && i < server->count; i++)
+        if (strcmp(server->docs[i].uri, uri) == 0)
+            break;
+    free(uri);
+    return uri && i < server->count ? &server->docs[i] : NULL;
+}
+
+/**
+ * Publishes the diagnostics of a document, replacing the ones published before.
+ *
+ * @param server    The server.
+ * @param uri       The uri of the document.
+ * @param doc       The document, up to date (optional - NULL to clear its diagnostics).
+ */
+void publish_diagnostics(lsp_server *server, const char *uri, const analysis *doc) {
+    lsp_publish publish;
+    char *buf = NULL;
+    size_t len = 0;
+
+    if (!(publish.dest = begin_message(&buf, &len)))
+        return;
+    publish.doc = doc;
+    publish.count = 0;
+
+    fputs("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":", publish.dest);
+    write_json_string(publish.dest, uri);
+    fputs(",\"diagnostics\":[", publish.dest);
+    if (doc)
+        visit_analysis_diagnostics(doc, write_publish_diagnostic, &publish);
+    fputs("]}}", publish.dest);
+    send_message(server, publish.dest, &buf, &len);
+}
+
+/**
+ * Writes a diagnostic visited by publish_diagnostics(), its range is the whole line.
+ *
+ * @param d     The diagnostic.
+ * @param line  The line it is reported on, from 1 (0 for the whole document).
+ * @param ctx   The lsp_publish of the message.
+ */
+void write_publish_diagnostic(const diagnostic *d, int line, void *ctx) {
+    lsp_publish *publish = ctx;
+    char *message = diagnostic_message(d);
+
+    line = line > 0 ? line - 1 : 0;
+    fprintf(publish->dest, "%s{\"range\":{\"start\":{\"line\":%d,\"character\":0},"
+                           "\"end\":{\"line\":%d,\"character\":%d}},\"severity\":%d,\"code\":%d,"
+                           "\"source\":\"assembler\",\"message\":", publish->count++ ? "," : "", line, line,
+            (int)strlen(line_text(publish->doc, line)),
+            diagnostic_is_warning(d) ? LSP_SEVERITY_WARNING : LSP_SEVERITY_ERROR, (int)d->code);
+    write_json_string(publish->dest, message ? message : msg[d->code]);
+    fputc('}', publish->dest);
+    free(message);
+}
+
+/**
+ * Writes the result of textDocument/definition: the definition of the macro or label at the
+ * position, its .extern declaration for an external label.
+ *
+ * @param dest      The output stream.
+ * @param document  The document.
+ * @param params    The parameters of the request.
+ */
+void write_definition(FILE *dest, const lsp_document *document, const char *params) {
+    const analysis *doc = &document->doc;
+    char word[MAX_LABEL_LENGTH];
+    int index, line = ANALYSIS_NONE, found = word_at(doc, params, word);
+
+    if (found && (index = find_analysis_macro(doc, word)) != ANALYSIS_NONE)
+        line = doc->macros[index].start;
+    else if (found && (index = find_analysis_symbol(doc, word)) != ANALYSIS_NONE)
+        line = doc->symbols[index].defined != ANALYSIS_NONE ? doc->symbols[index].defined
+                                                             : doc->symbols[index].external;
+
+    if (line == ANALYSIS_NONE)
+        fputs("null", dest);
+    else
+        write_location(dest, document, line, word, NULL);
+}
+
+/**
+ * Writes the result of textDocument/references: the calls of the macro at the position, or the
+ * uses and .entry declarations of the label at the position, and its definition if requested.
+ *
+ * @param dest      The output stream.
+ * @param document  The document.
+ * @param params    The parameters of the request.
+ */
+void write_references(FILE *dest, const lsp_document *document, const char *params) {
+    const analysis *doc = &document->doc;
+    const analysis_symbol *sym = NULL;
+    const char *include = json_path(params, "context.includeDeclaration");
+    char word[MAX_LABEL_LENGTH];
+    int index, count = 0, with_declaration = include && *include == 't', found = word_at(doc, params, word);
+    size_t i;
+
+    fputc('[', dest);
+    if (found && (index = find_analysis_macro(doc, word)) != ANALYSIS_NONE) {
+        if (with_declaration)
+            write_location(dest, document, doc->macros[index].start, word, &count);
+        for (i = 0; i < doc->count; i++)
+            if (doc->lines[i].call == index)
+                write_location(dest, document, (int)i, word, &count);
+    }
+    else if (found && (index = find_analysis_symbol(doc, word)) != ANALYSIS_NONE) {
+        sym = &doc->symbols[index];
+        if (with_declaration && sym->defined != ANALYSIS_NONE)
+            write_location(dest, document, sym->defined, word, &count);
+        if (with_declaration && sym->external != ANALYSIS_NONE)
+            write_location(dest, document, sym->external, word, &count);
+        if (sym->entry != ANALYSIS_NONE)
+            write_location(dest, document, sym->entry, word, &count);
+        for (i = 0; i < doc->uses_count; i++)
+            if (doc->uses[i].symbol == (size_t)index)
+                write_location(dest, document, doc->uses[i].line, word, &count);
+    }
+    fputc(']', dest);
+}
+
+/**
+ * Writes a Location: the word on a line of a document, or the whole line if the word is not on it
+ * (a label defined by the expansion of a macro).
+ *
+ * @param dest      The output stream.
+ * @param document  The document.
+ * @param line      The line, from 0.
+ * @param word      The word.
+ * @param count     Pointer to the number of locations written so far, incremented (optional - NULL for one).
+ */
+void write_location(FILE *dest, const lsp_document *document, int line, const char *word, int *count) {
+    const char *text = line_text(&document->doc, line);
+    int start = find_word(text, word);
+    int end = start == ANALYSIS_NONE ? (int)strlen(text) : start + (int)strlen(word);
+
+    if (count && (*count)++)
+        fputc(',', dest);
+    fputs("{\"uri\":", dest);
+    write_json_string(dest, document->uri);
+    fprintf(dest, ",\"range\":{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}}",
+            line, start == ANALYSIS_NONE ? 0 : start, line, end);
+}
+
+/**
+ * Copies the word at the position of a request: the letters and digits around it.
+ *
+ * @param doc       The document.
+ * @param params    The parameters of the request, with a position member.
+ * @param word      The buffer of the word, MAX_LABEL_LENGTH characters.
+ * @return 1 if there is a word at the position, 0 otherwise.
+ */
+int word_at(const analysis *doc, const char *params, char *word) {
+    const char *text = NULL;
+    int line, character, start, end;
+
+    if (!json_int_value(json_path(params, "position.line"), &line)
+        || !json_int_value(json_path(params, "position.character"), &character))
+        return 0;
+
+    text = line_text(doc, line);
+    start = end = character > (int)strlen(text) ? (int)strlen(text) : character < 0 ? 0 : character;
+    while (start > 0 && isalnum(text[start - 1]))
+        start--;
+    while (isalnum(text[end]))
+        end++;
+    if (start == end || end - start >= MAX_LABEL_LENGTH)
+        return 0;
+
+    memcpy(word, text + start, (size_t)(end - start));
+    word[end - start] = '\0';
+    return 1;
+}
+
+/**
+ * Finds a whole word in a line.
+ *
+ * @param text  The line.
+ * @param word  The word.
+ * @return The column of the first occurrence, ANALYSIS_NONE if there is none.
+ */
+int find_word(const char *text, const char *word) {
+    const char *p = NULL;
+    size_t len = strlen(word);
+
+    for (p = strstr(text, word); p; p = strstr(p + 1, word))
+        if ((p == text || !isalnum(p[-1])) && !isalnum(p[len]))
+            return (int)(p - text);
+    return ANALYSIS_NONE;
+}
+
+/**
+ * Returns the text of a line of a document.
+ *
+ * @param doc   The document (optional - NULL).
+ * @param line  The line, from 0.
+ * @return The text, an empty string past the end of the document.
+ */
+const char *line_text(const analysis *doc, int line) {
+    return doc && line >= 0 && (size_t)line < doc->count && doc->lines[line].text ? doc->lines[line].text : "";
+}
+
+/**
+ * Starts a message, its body is written to a memory stream.
+ *
+ * @param buf   Set by the stream to the body, see send_message().
+ * @param len   Set by the stream to the length of the body.
+ * @return The stream, or NULL if memory allocation failed.
+ */
+FILE *begin_message(char **buf, size_t *len) {
+    return open_memstream(buf, len);
+}
+
+/**
+ * Sends a message started with begin_message(), framed by its Content-Length header.
+ *
+ * @param server    The server.
+ * @param body      The stream of the body, closed.
+ * @param buf       The body, released.
+ * @param len       The length of the body.
+ */
+void send_message(lsp_server *server, FILE *body, char **buf, size_t *len) {
+    if (fclose(body) == 0) {
+        fprintf(server->out, "%s %lu\r\n\r\n", LSP_HEADER_LENGTH, (unsigned long)*len);
+        fwrite(*buf, 1, *len, server->out);
+        fflush(server->out);
+    }
+    free(*buf);
+    *buf = NULL;
+}
+
+/**
+ * Sends an error response.
+ *
+ * @param server    The server.
+ * @param id        The id of the request, as written by the client (optional - NULL if unknown).
+ * @param id_len    The length of the id.
+ * @param code      The JSON-RPC error code.
+ * @param message   The error message.
+ */
+void send_error(lsp_server *server, const char *id, int id_len, int code, const char *message) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *body = begin_message(&buf, &len);
+
+    if (!body)
+        return;
+    fprintf(body, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"error\":{\"code\":%d,\"message\":",
+            id ? id_len : (int)strlen("null"), id ? id : "null", code);
+    write_json_string(body, message);
+    fputs("}}", body);
+    send_message(server, body, &buf, &len);
+}
+
+/**
+ * Skips white space in a JSON text.
+ *
+ * @param p The text (optional - NULL).
+ * @return The first other character, NULL if p is NULL.
+ */
+const char *json_skip_space(const char *p) {
+    while (p && isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+/**
+ * Skips a JSON value: a string, a number, a literal, or an object or array with everything in it.
+ *
+ * @param p The value, may be preceded by white space (optional - NULL).
+ * @return The character after the value, NULL if it is not a complete value.
+ */
+const char *json_skip_value(const char *p) {
+    const char *start = NULL;
+    int depth = 0;
+
+    if (!(start = p = json_skip_space(p)) || !*p)
+        return NULL;
+    do {
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++)
+                if (*p == '\\' && p[1])
+                    p++;
+            if (!*p++)
+                return NULL;
+        }
+        else if (*p == '{' || *p == '[') {
+            depth++;
+            p++;
+        }
+        else if (*p == '}' || *p == ']') {
+            if (--depth < 0)
+                return NULL;
+            p++;
+        }
+        else if (!depth) { /* a number or a literal */
+            while (*p && !isspace((unsigned char)*p) && *p != ',' && *p != '}' && *p != ']' && *p != ':')
+                p++;
+        }
+        else
+            p++;
+    } while (depth && *p);
+    return depth || p == start ? NULL : p;
+}
+
+/**
+ * Finds a member of a JSON object. The keys are compared as written, without unescaping them.
+ *
+ * @param object    The object, may be preceded by white space (optional - NULL).
+ * @param key       The key.
+ * @return The value of the member, NULL if there is no such member or object.
+ */
+const char *json_member(const char *object, const char *key) {
+    const char *p = json_skip_space(object), *name = NULL, *value = NULL;
+    size_t key_len = strlen(key);
+
+    if (!p || *p != '{')
+        return NULL;
+    for (p = json_skip_space(p + 1); *p == '"'; p = json_skip_space(p + 1)) {
+        name = p + 1;
+        if (!(p = json_skip_value(p)) || *(p = json_skip_space(p)) != ':')
+            return NULL;
+        value = json_skip_space(p + 1);
+        if ((size_t)(p - name) > key_len && strncmp(name, key, key_len) == 0 && name[key_len] == '"')
+            return value;
+        if (!(p = json_skip_value(value)) || *(p = json_skip_space(p)) != ',')
+            return NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Finds a nested member of a JSON object.
+ *
+ * @param object    The object (optional - NULL).
+ * @param path      The keys, separated by '.', e.g. "textDocument.uri".
+ * @return The value of the member, NULL if there is none.
+ */
+const char *json_path(const char *object, const char *path) {
+    char key[MAX_BUFFER_LENGTH];
+    const char *end = NULL;
+    size_t len;
+
+    for (; object && *path; path = *end ? end + 1 : end) {
+        end = strchr(path, '.') ? strchr(path, '.') : path + strlen(path);
+        if ((len = (size_t)(end - path)) >= sizeof(key))
+            return NULL;
+        memcpy(key, path, len);
+        key[len] = '\0';
+        object = json_member(object, key);
+    }
+    return object;
+}
+
+/**
+ * Returns the first element of a JSON array.
+ *
+ * @param array The array (optional - NULL).
+ * @return The first element, NULL if the array is empty or is not an array.
+ */
+const char *json_first_element(const char *array) {
+    const char *p = json_skip_space(array);
+
+    if (!p || *p != '[')
+        return NULL;
+    p = json_skip_space(p + 1);
+    return *p == ']' ? NULL : p;
+}
+
+/**
+ * Returns the element of a JSON array after another.
+ *
+ * @param element The element.
+ * @return The next element, NULL if it is the last one.
+ */
+const char *json_next_element(const char *element) {
+    const char *p = json_skip_space(json_skip_value(element));
+
+    return p && *p == ',' ? json_skip_space(p + 1) : NULL;
+}
+
+/**
+ * Copies a JSON string, unescaping it. Escaped characters are encoded in UTF-8.
+ *
+ * @param value The string (optional - NULL).
+ * @return The allocated string, NULL if value is not a string or if memory allocation failed.
+ */
+char *json_string_value(const char *value) {
+    const char *end = json_skip_value(value), *p = NULL;
+    char *str = NULL, *out = NULL, hex[UTF16_ESCAPE_LEN + 1];
+    unsigned long code;
+    int i;
+
+    if (!end || *(value = json_skip_space(value)) != '"' || !(str = malloc((size_t)(end - value))))
+        return NULL;
+
+    for (p = value + 1, out = str; p < end - 1; p++) {
+        if (*p != '\\') {
+            *out++ = *p;
+            continue;
+        }
+        switch (*++p) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case 'r': *out++ = '\r'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'u':
+                for (i = 0; i < UTF16_ESCAPE_LEN && p + 1 < end - 1; i++)
+                    hex[i] = *++p;
+                hex[i] = '\0';
+                code = strtoul(hex, NULL, 16); /* the 6 escape characters hold up to 3 bytes */
+                if (code <= UTF8_MAX_1)
+                    *out++ = (char)code;
+                else if (code <= UTF8_MAX_2) {
+                    *out++ = (char)(0xC0 | (code >> 6));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                else {
+                    *out++ = (char)(0xE0 | (code >> 12));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            default: *out++ = *p; /* '"', '\\' and '/' */
+        }
+    }
+    *out = '\0';
+    return str;
+}
+
+/**
+ * Reads a JSON integer.
+ *
+ * @param value The number (optional - NULL).
+ * @param out   Set to the number.
+ * @return 1 if value is an integer, 0 otherwise.
+ */
+int json_int_value(const char *value, int *out) {
+    char *end = NULL;
+    long number;
+
+    if (!(value = json_skip_space(value)) || (!isdigit((unsigned char)*value) && *value != '-'))
+        return 0;
+    number = strtol(value, &end, 10);
+    *out = (int)number;
+    return end != value && *end != '.';
+}
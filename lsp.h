@@ -0,0 +1,42 @@
+#ifndef ASSEMBLER_LSP_H
+#define ASSEMBLER_LSP_H
+
+#include <stdio.h>
+#include "analysis.h"
+#include "errors.h"
+
+#define LSP_HEADER_LENGTH "Content-Length:"
+#define LSP_MAX_MESSAGE_LEN (64 * 1024 * 1024)
+#define LSP_SYNC_INCREMENTAL 2
+#define LSP_SEVERITY_ERROR 1
+#define LSP_SEVERITY_WARNING 2
+#define LSP_PARSE_ERROR (-32700)
+#define LSP_INVALID_PARAMS (-32602)
+#define LSP_METHOD_NOT_FOUND (-32601)
+#define LSP_INTERNAL_ERROR (-32603)
+
+/* An open document, kept in memory from textDocument/didOpen until textDocument/didClose */
+typedef struct {
+    char *uri;
+    analysis doc;
+} lsp_document;
+
+typedef struct {
+    FILE *out;
+    lsp_document *docs;
+    size_t count;
+    size_t cap;
+    int shutdown; /* a shutdown request has been received, exit is expected next */
+    int exited;
+} lsp_server;
+
+/* The diagnostics of a document being published */
+typedef struct {
+    FILE *dest;
+    const analysis *doc;
+    int count;
+} lsp_publish;
+
+status serve_lsp(FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "machine.h"
+
+/*
+ * GCC and Clang dispatch through a table of label addresses (computed goto), each handler jumps
+ * straight to the next one. Other compilers, or -DMACHINE_SWITCH_DISPATCH, use a plain switch.
+ * The label addresses are an extension, -Wpedantic is silenced for machine_run() only.
+ */
+#if defined(__GNUC__) && !defined(MACHINE_SWITCH_DISPATCH)
+#define MACHINE_COMPUTED_GOTO
+#endif
+
+#define INVALIDATE(m, address) do { \
+    (m)->decoded[address].op = OP_UNDECODED; \
+    if ((address) >= 1) (m)->decoded[(address) - 1].op = OP_UNDECODED; \
+    if ((address) >= 2) (m)->decoded[(address) - 2].op = OP_UNDECODED; \
+    } while (0)
+
+#define WRITE_DEST(value) do { \
+    *ins->dest = (unsigned short)((value) & WORD_MASK); \
+    if (ins->dest_is_memory) INVALIDATE(m, ins->dest_address); \
+    } while (0)
+
+/* Braces rather than do-while(0), DISPATCH() is a continue of the loop around the switch */
+#ifdef MACHINE_COMPUTED_GOTO
+#define CASE(op) op_##op
+#define DISPATCH() { \
+    if (steps == limit) goto step_limit; \
+    steps++; \
+    COUNT(pc); \
+    ins = &m->decoded[pc]; \
+    goto *dispatch[ins->op]; \
+    }
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+
+/* Profiling, the branch goes the same way for the whole run and costs next to nothing when off */
+#define COUNT(pc) if (counts) counts[pc]++
+#define UNCOUNT(pc) if (counts) counts[pc]--
+
+#define NEXT() { pc += ins->length; DISPATCH(); }
+#define JUMP(target) { \
+    if ((target) >= MAX_MEMORY_SIZE) { report = ERR_SIM_MEMORY; goto fault; } \
+    pc = (target); \
+    DISPATCH(); \
+    }
+
+/* "Private" helper functions */
+void decode_at(machine *m, int pc);
+int decode_operand(machine *m, decoded_instruction *ins, Adrs_mod mode, int is_dest, unsigned short word);
+
+/**
+ * Loads a program into a machine and resets its registers, flags and call stack.
+ * Execution starts at ADDRESS_START, without profiling (see machine->counts).
+ *
+ * @param m         The machine.
+ * @param module    The program.
+ * @param in        The input of red (optional - NULL for stdin).
+ * @param out       The output of prn (optional - NULL for stdout).
+ */
+void machine_reset(machine *m, const object_module *module, FILE *in, FILE *out) {
+    int i;
+
+    memset(m->memory, 0, sizeof(m->memory));
+    memset(m->regs, 0, sizeof(m->regs));
+    memcpy(m->memory + ADDRESS_START, module->words, (size_t)module->size * sizeof(unsigned short));
+
+    for (i = 0; i < MAX_MEMORY_SIZE; i++)
+        m->decoded[i].op = OP_UNDECODED;
+    m->decoded[MAX_MEMORY_SIZE].op = OP_OUT_OF_MEMORY;
+    m->decoded[MAX_MEMORY_SIZE].length = 0;
+
+    m->pc = ADDRESS_START;
+    m->sp = 0;
+    m->zero_flag = 0;
+    m->steps = 0;
+    m->counts = NULL;
+    m->in = in ? in : stdin;
+    m->out = out ? out : stdout;
+}
+
+#ifdef MACHINE_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+/**
+ * Runs a machine until it executes stop, fails, or reaches the step limit.
+ * The machine may be resumed by calling machine_run() again after ERR_SIM_STEPS.
+ *
+ * @param m         The machine.
+ * @param max_steps The total number of instructions the machine may execute, or MACHINE_NO_LIMIT.
+ * @return NO_ERROR after stop, or ERR_SIM_ILLEGAL, ERR_SIM_UNRESOLVED, ERR_SIM_MEMORY, ERR_SIM_STACK,
+ * @return ERR_SIM_STEPS. m->pc is the address of the instruction that stopped the machine.
+ */
+status machine_run(machine *m, unsigned long max_steps) {
+    decoded_instruction *ins = NULL;
+    unsigned long steps = m->steps, limit = max_steps == MACHINE_NO_LIMIT ? ULONG_MAX : max_steps;
+    unsigned long *counts = m->counts;
+    int pc = m->pc, zero = m->zero_flag, value;
+    status report = NO_ERROR;
+#ifdef MACHINE_COMPUTED_GOTO
+    static void *dispatch[OPS_LEN] = {
+            &&op_MOV, &&op_CMP, &&op_ADD, &&op_SUB, &&op_NOT, &&op_CLR, &&op_LEA, &&op_INC,
+            &&op_DEC, &&op_JMP, &&op_BNE, &&op_RED, &&op_PRN, &&op_JSR, &&op_RTS, &&op_STOP,
+            &&op_OP_UNDECODED, &&op_OP_ILLEGAL, &&op_OP_UNRESOLVED, &&op_OP_OUT_OF_MEMORY
+    };
+
+    DISPATCH();
+#else
+    for (;;) {
+        if (steps == limit)
+            goto step_limit;
+        steps++;
+        COUNT(pc);
+        ins = &m->decoded[pc];
+
+        switch (ins->op) {
+#endif
+        CASE(MOV):
+            WRITE_DEST(*ins->src);
+            NEXT();
+        CASE(CMP):
+            zero = *ins->src == *ins->dest;
+            NEXT();
+        CASE(ADD):
+            WRITE_DEST(*ins->dest + *ins->src);
+            NEXT();
+        CASE(SUB):
+            WRITE_DEST(*ins->dest - *ins->src);
+            NEXT();
+        CASE(NOT):
+            WRITE_DEST(~*ins->dest);
+            NEXT();
+        CASE(CLR):
+            WRITE_DEST(0);
+            NEXT();
+        CASE(LEA):
+            WRITE_DEST(*ins->src);
+            NEXT();
+        CASE(INC):
+            WRITE_DEST(*ins->dest + 1);
+            NEXT();
+        CASE(DEC):
+            WRITE_DEST(*ins->dest - 1);
+            NEXT();
+        CASE(JMP):
+            JUMP(*ins->dest);
+        CASE(BNE):
+            if (zero)
+                NEXT();
+            JUMP(*ins->dest);
+        CASE(RED):
+            value = fgetc(m->in);
+            WRITE_DEST(value == EOF ? WORD_MASK : value);
+            NEXT();
+        CASE(PRN):
+            fprintf(m->out, "%d\n", SIGN_EXTEND_12(*ins->dest));
+            NEXT();
+        CASE(JSR):
+            if (m->sp == MACHINE_STACK_SIZE) {
+                report = ERR_SIM_STACK;
+                goto fault;
+            }
+            m->stack[m->sp++] = (unsigned short)(pc + ins->length);
+            JUMP(*ins->dest);
+        CASE(RTS):
+            if (!m->sp) {
+                report = ERR_SIM_STACK;
+                goto fault;
+            }
+            value = m->stack[--m->sp];
+            JUMP(value);
+        CASE(STOP):
+            goto halt;
+        CASE(OP_UNDECODED):
+            decode_at(m, pc);
+            steps--; /* counted again once decoded */
+            UNCOUNT(pc);
+            DISPATCH();
+        CASE(OP_ILLEGAL):
+            report = ERR_SIM_ILLEGAL;
+            goto fault;
+        CASE(OP_UNRESOLVED):
+            report = ERR_SIM_UNRESOLVED;
+            goto fault;
+        CASE(OP_OUT_OF_MEMORY):
+            report = ERR_SIM_MEMORY;
+            goto fault;
+#ifndef MACHINE_COMPUTED_GOTO
+        default:
+            report = ERR_SIM_ILLEGAL;
+            goto fault;
+        }
+    }
+#endif
+
+step_limit:
+    report = ERR_SIM_STEPS;
+    goto halt;
+fault:
+    steps--; /* the instruction has not been executed */
+    UNCOUNT(pc);
+halt:
+    m->pc = pc;
+    m->steps = steps;
+    m->zero_flag = zero;
+    return report;
+}
+#ifdef MACHINE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+/**
+ * Decodes the instruction at an address into m->decoded, an invalid instruction decodes to
+ * OP_ILLEGAL and an operand that refers to an external symbol to OP_UNRESOLVED.
+ *
+ * @param m     The machine.
+ * @param pc    The address of the instruction.
+ */
+void decode_at(machine *m, int pc) {
+    decoded_instruction *ins = &m->decoded[pc];
+    instruction_layout layout;
+    unsigned short word;
+    int next = pc + 1;
+
+    ins->dest_is_memory = 0;
+    ins->length = 1;
+    ins->op = OP_ILLEGAL;
+
+    if (decode_instruction(m->memory[pc], &layout) != NO_ERROR || pc + layout.length > MAX_MEMORY_SIZE)
+        return;
+    ins->op = (unsigned char)layout.cmd;
+    ins->length = (unsigned char)layout.length;
+
+    if (layout.src_mode == REGISTER && layout.dest_mode == REGISTER) {
+        word = m->memory[next];
+        if (WORD_ARE(word) != ABSOLUTE || WORD_REG_SRC(word) >= MACHINE_REGISTERS
+            || WORD_REG_DEST(word) >= MACHINE_REGISTERS) {
+            ins->op = OP_ILLEGAL;
+            return;
+        }
+        ins->src = &m->regs[WORD_REG_SRC(word)];
+        ins->dest = &m->regs[WORD_REG_DEST(word)];
+        return;
+    }
+
+    if (layout.src_mode != INVALID_MD && !decode_operand(m, ins, layout.src_mode, 0, m->memory[next++]))
+        return;
+    if (layout.dest_mode != INVALID_MD)
+        (void) decode_operand(m, ins, layout.dest_mode, 1, m->memory[next]);
+}
+
+/**
+ * Resolves an operand word of a decoded instruction into a pointer.
+ * Jump targets and the source of lea resolve to the address itself rather than the memory word.
+ *
+ * @param m         The machine.
+ * @param ins       The instruction, its op is set to OP_ILLEGAL or OP_UNRESOLVED on failure.
+ * @param mode      The addressing mode of the operand.
+ * @param is_dest   1 for the destination operand, 0 for the source operand.
+ * @param word      The operand word.
+ * @return 1 if successful, 0 otherwise.
+ */
+int decode_operand(machine *m, decoded_instruction *ins, Adrs_mod mode, int is_dest, unsigned short word) {
+    unsigned short **operand = is_dest ? &ins->dest : &ins->src;
+    unsigned short *imm = &ins->imm[is_dest];
+    int reg = is_dest ? WORD_REG_DEST(word) : WORD_REG_SRC(word);
+    int address_only = is_dest ? ins->op == JMP || ins->op == BNE || ins->op == JSR : ins->op == LEA;
+
+    if (mode == DIRECT && WORD_ARE(word) == EXTERNAL) {
+        ins->op = OP_UNRESOLVED;
+        return 0;
+    } else if (mode == DIRECT) {
+        *imm = (unsigned short)WORD_OPERAND(word);
+        *operand = address_only ? imm : &m->memory[*imm];
+        if (is_dest && !address_only) {
+            ins->dest_is_memory = 1;
+            ins->dest_address = *imm;
+        }
+    } else if (WORD_ARE(word) != ABSOLUTE || (mode == REGISTER && reg >= MACHINE_REGISTERS)) {
+        ins->op = OP_ILLEGAL;
+        return 0;
+    } else if (mode == REGISTER)
+        *operand = &m->regs[reg];
+    else { /* IMMEDIATE */
+        *imm = (unsigned short)(SIGN_EXTEND_10(WORD_OPERAND(word)) & WORD_MASK);
+        *operand = imm;
+    }
+    return 1;
+}
@@ -0,0 +1,56 @@
+#ifndef ASSEMBLER_MACHINE_H
+#define ASSEMBLER_MACHINE_H
+
+#include <stdio.h>
+#include "object.h"
+
+#define MACHINE_REGISTERS REGISTER_COUNT
+#define MACHINE_STACK_SIZE 256
+#define MACHINE_NO_LIMIT 0UL
+#define MACHINE_COUNTS (MAX_MEMORY_SIZE + 1) /* + the OP_OUT_OF_MEMORY sentinel */
+
+/* Dispatch indexes past the commands, see machine_run() */
+typedef enum {
+    OP_UNDECODED = COMMANDS_LEN,
+    OP_ILLEGAL,
+    OP_UNRESOLVED,
+    OP_OUT_OF_MEMORY, /* the pc ran past the last word */
+    OPS_LEN
+} Machine_op;
+
+/*
+ * An instruction decoded once and executed from then on. Operands are resolved to pointers:
+ * a register, a memory word, or one of the imm slots (immediate values and jump / lea addresses).
+ */
+typedef struct {
+    unsigned short *src;
+    unsigned short *dest;
+    unsigned short imm[2];
+    unsigned short dest_address; /* memory word written by the instruction, if dest_is_memory */
+    unsigned char op; /* Command, or Machine_op */
+    unsigned char length;
+    unsigned char dest_is_memory;
+} decoded_instruction;
+
+/* The whole state of a simulated machine, independent machines may run on different threads */
+typedef struct {
+    unsigned short memory[MAX_MEMORY_SIZE];
+    unsigned short regs[MACHINE_REGISTERS];
+    unsigned short stack[MACHINE_STACK_SIZE];
+    decoded_instruction decoded[MAX_MEMORY_SIZE + 1]; /* + OP_OUT_OF_MEMORY sentinel */
+
+    int pc;
+    int sp;
+    int zero_flag;
+    unsigned long steps;
+    unsigned long *counts; /* executions of every address, MACHINE_COUNTS counters (optional - NULL) */
+
+    FILE *in; /* red */
+    FILE *out; /* prn */
+} machine;
+
+void machine_reset(machine *m, const object_module *module, FILE *in, FILE *out);
+
+status machine_run(machine *m, unsigned long max_steps);
+
+#endif
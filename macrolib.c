@@ -0,0 +1,311 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "macrolib.h"
+#include "preprocessor.h"
+#include "utils.h"
+#include "errors.h"
+
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFF
+#define U32_LEN 4
+
+/* "Private" helper functions */
+status decode_macro_lib(const unsigned char *data, size_t len, size_t *count, size_t *slots, int *offset);
+int put_u32(FILE *dest, unsigned long value);
+unsigned long get_u32(const unsigned char *data);
+const char *lib_slot_label(const void *table, size_t slot);
+const char *name_slot_label(const void *table, size_t slot);
+
+/**
+ * Writes a .mlib file (see macrolib.h).
+ *
+ * @param path      The path of the file.
+ * @param macros    The macros, their calls of each other expanded by flatten_macro().
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_macro_lib(const char *path, const macro_node *macros) {
+    char name[MAX_MACRO_NAME_LENGTH];
+    const macro_node *macro = NULL;
+    const char *body = NULL, **names = NULL;
+    unsigned long *index = NULL, offset;
+    size_t count = 0, slots = MLIB_MIN_SLOTS, slot, i;
+    FILE *file = NULL;
+    int ok;
+
+    for (macro = macros; macro; macro = macro->next)
+        count++;
+    while (slots < 2 * count) /* at most half full, the probing sequences stay short */
+        slots *= 2;
+    index = calloc(slots, sizeof(unsigned long));
+    names = calloc(slots, sizeof(const char *)); /* the name of the macro of each slot, for the probing */
+    if (!index || !names) {
+        free(index);
+        free(names);
+        return ERR_MEM_ALLOC;
+    }
+    for (macro = macros, i = 1; macro; macro = macro->next, i++) {
+        slot = find_label_slot(names, slots, macro->name, name_slot_label);
+        if (!names[slot]) { /* a name is defined once, the preprocessor reports the others */
+            names[slot] = macro->name;
+            index[slot] = i;
+        }
+    }
+    free(names);
+
+    if (!(file = fopen(path, "wb"))) {
+        free(index);
+        return ERR_OPEN_FILE;
+    }
+
+    ok = fwrite(MLIB_MAGIC, 1, MLIB_MAGIC_LEN, file) == MLIB_MAGIC_LEN && fputc(MLIB_VERSION, file) != EOF
+         && put_u32(file, count) && put_u32(file, slots);
+    for (slot = 0; ok && slot < slots; slot++)
+        ok = put_u32(file, index[slot]);
+
+    offset = MLIB_HEADER_LEN + slots * U32_LEN + count * MLIB_RECORD_LEN;
+    for (macro = macros; ok && macro; macro = macro->next) {
+        body = macro->expansion ? macro->expansion : macro->body;
+        memset(name, 0, sizeof(name));
+        strncpy(name, macro->name, MAX_MACRO_NAME_LENGTH - 1);
+        ok = fwrite(name, 1, MAX_MACRO_NAME_LENGTH, file) == MAX_MACRO_NAME_LENGTH
+             && put_u32(file, offset) && put_u32(file, strlen(body));
+        offset += strlen(body) + 1;
+    }
+    for (macro = macros; ok && macro; macro = macro->next) {
+        body = macro->expansion ? macro->expansion : macro->body;
+        ok = fwrite(body, 1, strlen(body) + 1, file) == strlen(body) + 1;
+    }
+
+    free(index);
+    if (fclose(file) != 0 || !ok) {
+        remove(path); /* a partial file would only be rejected later */
+        ok = 0;
+    }
+    return ok ? NO_ERROR : ERR_OPEN_FILE;
+}
+
+/**
+ * Maps a .mlib file into memory. Only the header, the index and the records are checked, the
+ * bodies are used in place.
+ *
+ * @param path      The path of the file.
+ * @param lib       The library to fill, must be released with unmap_macro_lib().
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, ERR_OPEN_FILE if the file cannot be opened, ERR_MACRO_LIB if
+ * @return it is invalid, or ERR_MEM_ALLOC.
+ */
+status map_macro_lib(const char *path, macro_lib *lib, int *offset) {
+    struct stat st;
+    void *data = NULL;
+    status report;
+    int fd;
+
+    memset(lib, 0, sizeof(macro_lib));
+    *offset = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return ERR_OPEN_FILE;
+    if (fstat(fd, &st) != 0 || st.st_size < MLIB_HEADER_LEN
+        || (data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return ERR_MACRO_LIB;
+    }
+    close(fd); /* the mapping stays valid */
+
+    report = decode_macro_lib(data, (size_t)st.st_size, &lib->count, &lib->slots, offset);
+    if (report == NO_ERROR && !(lib->path = strdup(path)))
+        report = ERR_MEM_ALLOC;
+    if (report != NO_ERROR) {
+        munmap(data, (size_t)st.st_size);
+        return report;
+    }
+
+    lib->data = data;
+    lib->len = (size_t)st.st_size;
+    lib->mtime = (long)st.st_mtim.tv_sec;
+    lib->mtime_nsec = st.st_mtim.tv_nsec;
+    return NO_ERROR;
+}
+
+/**
+ * Checks the header, the index and the records of a mapped .mlib file.
+ *
+ * @param data      The contents of the file.
+ * @param len       The size of the file, at least MLIB_HEADER_LEN.
+ * @param count     Set to the number of macros.
+ * @param slots     Set to the number of index slots.
+ * @param offset    Set to the offset of the first invalid byte, if any.
+ * @return NO_ERROR if successful, ERR_MACRO_LIB if it is invalid, or ERR_MEM_ALLOC.
+ */
+status decode_macro_lib(const unsigned char *data, size_t len, size_t *count, size_t *slots, int *offset) {
+    const unsigned char *record = NULL;
+    unsigned long body, body_len, macro;
+    size_t i, bodies, empty = 0;
+    char *seen = NULL;
+
+    if (memcmp(data, MLIB_MAGIC, MLIB_MAGIC_LEN) != 0)
+        return ERR_MACRO_LIB;
+    *offset = MLIB_MAGIC_LEN;
+    if (data[*offset] != MLIB_VERSION)
+        return ERR_MACRO_LIB;
+    *offset += 1;
+
+    *count = get_u32(data + *offset);
+    *slots = get_u32(data + *offset + U32_LEN);
+    if (*slots < MLIB_MIN_SLOTS || (*slots & (*slots - 1)) || *count >= *slots
+        || (len - MLIB_HEADER_LEN) / MLIB_RECORD_LEN < *count
+        || len - MLIB_HEADER_LEN - *count * MLIB_RECORD_LEN < *slots * U32_LEN)
+        return ERR_MACRO_LIB;
+    *offset = MLIB_HEADER_LEN;
+
+    /* every macro is in a single slot, and a slot is empty, or the probing of a missing name never ends */
+    if (!(seen = calloc(*count + 1, sizeof(char))))
+        return ERR_MEM_ALLOC;
+    for (i = 0; i < *slots; i++, *offset += U32_LEN) {
+        if ((macro = get_u32(data + *offset)) > *count || (macro && seen[macro])) {
+            free(seen);
+            return ERR_MACRO_LIB;
+        }
+        seen[macro] = 1;
+        empty += !macro;
+    }
+    free(seen);
+    if (!empty)
+        return ERR_MACRO_LIB;
+
+    bodies = (size_t)*offset + *count * MLIB_RECORD_LEN;
+    for (i = 0; i < *count; i++, *offset += MLIB_RECORD_LEN) {
+        record = data + *offset;
+        body = get_u32(record + MAX_MACRO_NAME_LENGTH);
+        body_len = get_u32(record + MAX_MACRO_NAME_LENGTH + U32_LEN);
+        if (!*record || !memchr(record, '\0', MAX_MACRO_NAME_LENGTH) || body < bodies || body >= len
+            || body_len >= len - body || data[body + body_len] != '\0')
+            return ERR_MACRO_LIB;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Looks up a macro of a library.
+ *
+ * @param lib   The library.
+ * @param name  The name of the macro.
+ * @return The index of the macro, or MLIB_NONE if the library has no such macro or none is mapped.
+ */
+long find_lib_macro(const macro_lib *lib, const char *name) {
+    size_t slot;
+
+    if (!lib->path || (slot = find_label_slot(lib, lib->slots, name, lib_slot_label)) == lib->slots)
+        return MLIB_NONE;
+    return (long)get_u32(lib->data + MLIB_HEADER_LEN + slot * U32_LEN) - 1; /* MLIB_NONE for an empty slot */
+}
+
+/**
+ * Reads the name of a slot of the index of a mapped library, see find_label_slot().
+ *
+ * @param table The library.
+ * @param slot  The slot.
+ * @return The name of its macro, NULL for an empty slot.
+ */
+const char *lib_slot_label(const void *table, size_t slot) {
+    const macro_lib *lib = (const macro_lib *)table;
+    unsigned long macro = get_u32(lib->data + MLIB_HEADER_LEN + slot * U32_LEN);
+
+    return macro ? lib_macro_name(lib, (long)macro - 1) : NULL;
+}
+
+/**
+ * Reads the name of a slot of the index of a library being written, see find_label_slot().
+ *
+ * @param table The names of the slots.
+ * @param slot  The slot.
+ * @return The name, NULL for an empty slot.
+ */
+const char *name_slot_label(const void *table, size_t slot) {
+    return ((const char *const *)table)[slot];
+}
+
+/**
+ * Returns the name of a macro of a library.
+ *
+ * @param lib   The library.
+ * @param index The index of the macro.
+ * @return The name, within the mapped file.
+ */
+const char *lib_macro_name(const macro_lib *lib, long index) {
+    return (const char *)lib->data + MLIB_HEADER_LEN + lib->slots * U32_LEN + (size_t)index * MLIB_RECORD_LEN;
+}
+
+/**
+ * Returns the body of a macro of a library.
+ *
+ * @param lib   The library.
+ * @param index The index of the macro.
+ * @return The body, within the mapped file.
+ */
+const char *lib_macro_body(const macro_lib *lib, long index) {
+    const unsigned char *record = (const unsigned char *)lib_macro_name(lib, index);
+
+    return (const char *)lib->data + get_u32(record + MAX_MACRO_NAME_LENGTH);
+}
+
+/**
+ * Checks whether a library is the mapping of a file, as the file is now.
+ *
+ * @param lib   The library.
+ * @param path  The path of the file.
+ * @return 1 if the file has not changed since it has been mapped, 0 otherwise.
+ */
+int is_macro_lib_unchanged(const macro_lib *lib, const char *path) {
+    struct stat st;
+
+    return lib->path && strcmp(lib->path, path) == 0 && stat(path, &st) == 0 && (size_t)st.st_size == lib->len
+           && (long)st.st_mtim.tv_sec == lib->mtime && st.st_mtim.tv_nsec == lib->mtime_nsec;
+}
+
+/**
+ * Unmaps a library.
+ *
+ * @param lib The library, emptied.
+ */
+void unmap_macro_lib(macro_lib *lib) {
+    if (lib->path) {
+        munmap((void *)lib->data, lib->len);
+        free(lib->path);
+    }
+    memset(lib, 0, sizeof(macro_lib));
+}
+
+/**
+ * Writes an unsigned 32-bit number, little endian.
+ *
+ * @param dest  The file.
+ * @param value The number.
+ * @return 1 if successful, 0 otherwise.
+ */
+int put_u32(FILE *dest, unsigned long value) {
+    int i;
+
+    for (i = 0; i < U32_LEN; i++)
+        if (fputc((int)((value >> (i * BYTE_BITS)) & BYTE_MASK), dest) == EOF)
+            return 0;
+    return 1;
+}
+
+/**
+ * Reads an unsigned 32-bit number, little endian.
+ *
+ * @param data The bytes of the number.
+ * @return The number.
+ */
+unsigned long get_u32(const unsigned char *data) {
+    return (unsigned long)data[0] | ((unsigned long)data[1] << BYTE_BITS)
+           | ((unsigned long)data[2] << (2 * BYTE_BITS)) | ((unsigned long)data[3] << (3 * BYTE_BITS));
+}
@@ -0,0 +1,47 @@
+#ifndef ASSEMBLER_MACROLIB_H
+#define ASSEMBLER_MACROLIB_H
+
+#include <stddef.h>
+#include "preprocessor.h"
+#include "utils.h"
+#include "errors.h"
+
+/*
+ * .mlib file, precompiled macro definitions, all the numbers are unsigned 32-bit little endian:
+ *   "MLIB", version (1 byte)
+ *   number of macros, number of index slots (a power of 2)
+ *   the index: per slot, the number of the macro from 1, 0 for an empty slot, by hash_label() of
+ *   the name with linear probing
+ *   per macro: name (MAX_MACRO_NAME_LENGTH bytes, null padded), offset and length of the body
+ *   the bodies, each null terminated, the calls of other macros of the library already expanded
+ * A mapped file is used in place: a body is written to the .am file as is, nothing is parsed.
+ */
+#define MLIB_EXT ".mlib"
+#define MLIB_MAGIC "MLIB"
+#define MLIB_MAGIC_LEN 4
+#define MLIB_VERSION 1
+#define MLIB_HEADER_LEN (MLIB_MAGIC_LEN + 1 + 2 * 4)
+#define MLIB_RECORD_LEN (MAX_MACRO_NAME_LENGTH + 2 * 4)
+#define MLIB_MIN_SLOTS 8
+#define MLIB_NONE (-1)
+
+/* A mapped .mlib file */
+typedef struct {
+    char *path; /* NULL while no file is mapped */
+    const unsigned char *data;
+    size_t len;
+    long mtime;
+    long mtime_nsec;
+    size_t count;
+    size_t slots;
+} macro_lib;
+
+status map_macro_lib(const char *path, macro_lib *lib, int *offset);
+status write_macro_lib(const char *path, const macro_node *macros);
+long find_lib_macro(const macro_lib *lib, const char *name);
+const char *lib_macro_name(const macro_lib *lib, long index);
+const char *lib_macro_body(const macro_lib *lib, long index);
+int is_macro_lib_unchanged(const macro_lib *lib, const char *path);
+void unmap_macro_lib(macro_lib *lib);
+
+#endif
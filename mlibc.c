@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "macrolib.h"
+#include "preprocessor.h"
+#include "utils.h"
+#include "errors.h"
+
+#define MLIB_DEFAULT_OUTPUT "macros"
+
+status compile_macro_source(const char *file_name);
+status write_library(const char *output);
+
+/**
+ * Compiler of macro libraries.
+ * Usage: MacroCompiler [--output NAME] [-DNAME[=VALUE]] [-IDIR] file...
+ * Each file is given without extension, the macros its .as file defines are written to NAME.mlib
+ * (see macrolib.h) together with the macros of the other files, their calls of each other expanded.
+ * The lines outside of the macro definitions are preprocessed for errors, and otherwise ignored.
+ * The assembler maps the library with --macro-lib NAME.mlib.
+ */
+int main(int argc, char *argv[]) {
+    const char *output = MLIB_DEFAULT_OUTPUT;
+    status report = NO_ERROR;
+    int i, files = 0;
+
+    /* Options may appear anywhere, file names are packed to the front of argv */
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strncmp(argv[i], DEFINE_PREFIX, strlen(DEFINE_PREFIX)) == 0 && argv[i][strlen(DEFINE_PREFIX)]
+                 && options.defines_count < MAX_DEFINES)
+            options.defines[options.defines_count++] = argv[i] + strlen(DEFINE_PREFIX);
+        else if (strncmp(argv[i], INCLUDE_PREFIX, strlen(INCLUDE_PREFIX)) == 0 && argv[i][strlen(INCLUDE_PREFIX)]
+                 && options.include_dirs_count < MAX_INCLUDE_DIRS)
+            options.include_dirs[options.include_dirs_count++] = argv[i] + strlen(INCLUDE_PREFIX);
+        else {
+            handle_error(ERR_INVALID_OPTION, argv[i]);
+            flush_diagnostics();
+            exit(FAILURE);
+        }
+    }
+
+    if (!files) {
+        handle_error(ERR_INVALID_OPTION, "missing file name");
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    /* Every file is preprocessed, so that all of their errors are reported */
+    for (i = 1; i <= files; i++) {
+        if (compile_macro_source(argv[i]) != NO_ERROR)
+            report = FAILURE;
+        flush_diagnostics();
+    }
+    if (report == NO_ERROR)
+        report = write_library(output);
+
+    flush_diagnostics();
+    free_macros();
+    free_include_cache();
+    return report == NO_ERROR ? 0 : FAILURE;
+}
+
+/**
+ * Preprocesses a source of the library, its macros are added to the macros of the files before it
+ * and expanded.
+ *
+ * @param file_name The name of the source file, without extension.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported.
+ */
+status compile_macro_source(const char *file_name) {
+    file_context *src = NULL, *dest = NULL;
+    macro_node *macro = NULL;
+    status report = NO_ERROR;
+
+    if (!(src = create_file_context(file_name, ASSEMBLY_EXT, FILE_EXT_LEN, FILE_MODE_READ, &report))
+        || !(dest = create_scratch_context(file_name, PREPROCESSOR_EXT, &report))) {
+        if (report == ERR_MEM_ALLOC) handle_error(ERR_MEM_ALLOC);
+        free_file_context(&src);
+        return FAILURE;
+    }
+
+    report = preprocess_lines(src, dest, 0);
+    for (macro = macro_head; report == NO_ERROR && macro; macro = macro->next)
+        report = flatten_macro(src, macro, 0);
+    reset_includes();
+    if (report != NO_ERROR)
+        handle_error(ERR_FOUND_ASSEMBLER, file_name);
+
+    free_file_context(&src);
+    free_file_context(&dest);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Writes the macros of all the sources to the library file.
+ *
+ * @param output The name of the library, without extension.
+ * @return NO_ERROR if successful, an error status otherwise.
+ */
+status write_library(const char *output) {
+    file_context fc;
+    status report;
+
+    if (!(fc.file_name = malloc(strlen(output) + strlen(MLIB_EXT) + 1))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+    strcat(strcpy(fc.file_name, output), MLIB_EXT);
+    fc.lc = 0;
+
+    if ((report = write_macro_lib(fc.file_name, macro_head)) == NO_ERROR)
+        handle_progress(MLIB_OK, fc.file_name);
+    else if (report == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else
+        handle_error(ERR_OPEN_FILE, &fc);
+    free(fc.file_name);
+    return report;
+}
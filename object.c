@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "utils.h"
+#include "errors.h"
+
+#define IS_VALID_MODE(m) ((m) == IMMEDIATE || (m) == DIRECT || (m) == REGISTER)
+
+/* "Private" helper functions */
+char *object_path(const char *file_name, const char *ext);
+
+/**
+ * Converts a 12-bit word into two base64 characters, the inverse of base64_to_word().
+ *
+ * @param word  The word.
+ * @param chars Filled with the two characters (not null terminated).
+ */
+void word_to_base64(int word, char *chars) {
+    static const char* lookup_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    chars[0] = lookup_table[(word & WORD_MASK) / BASE64_RADIX];
+    chars[1] = lookup_table[(word & WORD_MASK) % BASE64_RADIX];
+}
+
+/**
+ * Loads an assembled program: the .ob file and the optional .ent and .ext files.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The module to fill, must be released with free_object().
+ * @param line      Set to the line of the first invalid line, if any.
+ * @return NO_ERROR if successful, ERR_OPEN_FILE if the .ob file could not be opened,
+ * @return ERR_OBJECT_FILE, ERR_ENTRY_FILE or ERR_EXTERN_FILE for an invalid line, or ERR_MEM_ALLOC.
+ */
+status load_object(const char *file_name, object_module *module, int *line) {
+    const char *ext[OBJECT_FILES_LEN] = {OBJECT_EXT, ENTRY_EXT, EXTERNAL_EXT};
+    FILE *files[OBJECT_FILES_LEN] = {NULL, NULL, NULL};
+    char *path = NULL;
+    status report = NO_ERROR;
+    int i;
+
+    memset(module, 0, sizeof(object_module));
+    *line = 0;
+
+    for (i = 0; i < OBJECT_FILES_LEN && report == NO_ERROR; i++) {
+        if (!(path = object_path(file_name, ext[i])))
+            report = ERR_MEM_ALLOC;
+        else if (!(files[i] = fopen(path, FILE_MODE_READ)) && i == 0)
+            report = ERR_OPEN_FILE; /* the .ent and .ext files are optional */
+        free(path);
+    }
+
+    if (report == NO_ERROR)
+        report = read_object(files[0], files[1], files[2], module, line);
+    for (i = 0; i < OBJECT_FILES_LEN; i++)
+        if (files[i]) fclose(files[i]);
+    return report;
+}
+
+/**
+ * Reads an assembled program from streams in the format of the .ob, .ent and .ext files.
+ *
+ * @param ob        The .ob stream.
+ * @param ent       The .ent stream (optional - NULL for no entries).
+ * @param ext       The .ext stream (optional - NULL for no external use sites).
+ * @param module    The module to fill, must be released with free_object().
+ * @param line      Set to the line of the first invalid line, if any.
+ * @return NO_ERROR if successful, ERR_OBJECT_FILE, ERR_ENTRY_FILE or ERR_EXTERN_FILE for an
+ * @return invalid line, or ERR_MEM_ALLOC.
+ */
+status read_object(FILE *ob, FILE *ent, FILE *ext, object_module *module, int *line) {
+    char buffer[MAX_BUFFER_LENGTH];
+    status report = NO_ERROR;
+    int word;
+
+    memset(module, 0, sizeof(object_module));
+    *line = 1;
+    if (fscanf(ob, "%d %d", &module->ic, &module->dc) != 2 || module->ic < 0 || module->dc < 0)
+        return ERR_OBJECT_FILE;
+
+    while (fscanf(ob, "%255s", buffer) == 1) {
+        (*line)++;
+        if (strlen(buffer) != BASE64_CHARS || (word = base64_to_word(buffer)) == INVALID_WORD
+            || ADDRESS_START + module->size >= MAX_MEMORY_SIZE) {
+            report = ERR_OBJECT_FILE;
+            break;
+        }
+        module->words[module->size++] = (unsigned short)word;
+    }
+
+    if (report == NO_ERROR && module->size != module->ic + module->dc) {
+        *line = 1; /* the header does not match the words */
+        report = ERR_OBJECT_FILE;
+    }
+    if (report == NO_ERROR && ent)
+        report = read_symbols(ent, &module->entries, &module->entries_count, line, ERR_ENTRY_FILE);
+    if (report == NO_ERROR && ext)
+        report = read_symbols(ext, &module->externals, &module->externals_count, line, ERR_EXTERN_FILE);
+    if (report != NO_ERROR)
+        free_object(module);
+    return report;
+}
+
+/**
+ * Loads a "LABEL ADDRESS" per line symbol file. A missing file is an empty list.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param ext       The extension of the symbol file.
+ * @param symbols   Set to the allocated symbols.
+ * @param count     Set to the number of symbols.
+ * @param line      Set to the line of the first invalid line, if any.
+ * @param invalid   The status to return for an invalid line.
+ * @return NO_ERROR if successful, invalid for an invalid line, or ERR_MEM_ALLOC.
+ */
+status load_symbols(const char *file_name, const char *ext, object_symbol **symbols, size_t *count, int *line,
+                    status invalid) {
+    char *path = NULL;
+    FILE *file = NULL;
+    status report;
+
+    if (!(path = object_path(file_name, ext)))
+        return ERR_MEM_ALLOC;
+    file = fopen(path, FILE_MODE_READ);
+    free(path);
+    if (!file)
+        return NO_ERROR;
+
+    report = read_symbols(file, symbols, count, line, invalid);
+    fclose(file);
+    return report;
+}
+
+/**
+ * Reads a "LABEL ADDRESS" per line symbol stream.
+ *
+ * @param src       The stream.
+ * @param symbols   Set to the allocated symbols.
+ * @param count     Set to the number of symbols.
+ * @param line      Set to the line of the first invalid line, if any.
+ * @param invalid   The status to return for an invalid line.
+ * @return NO_ERROR if successful, invalid for an invalid line, or ERR_MEM_ALLOC.
+ */
+status read_symbols(FILE *src, object_symbol **symbols, size_t *count, int *line, status invalid) {
+    char label[MAX_BUFFER_LENGTH];
+    object_symbol *new_symbols = NULL;
+    size_t cap = 0;
+    int address, read;
+
+    *line = 0;
+    while ((read = fscanf(src, "%255s %d", label, &address)) != EOF) {
+        (*line)++;
+        if (read != 2 || strlen(label) >= MAX_LABEL_LENGTH || address < 0 || address >= MAX_MEMORY_SIZE)
+            return invalid;
+        if (*count == cap) {
+            cap = cap ? cap * 2 : DEFAULT_DATA_IMAGE_CAP;
+            if (!(new_symbols = realloc(*symbols, cap * sizeof(object_symbol))))
+                return ERR_MEM_ALLOC;
+            *symbols = new_symbols;
+        }
+        strcpy((*symbols)[*count].label, label);
+        (*symbols)[(*count)++].address = address;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Writes a module in the format of the assembler: the .ob file, and the .ent and .ext files
+ * if the module has entries or external use sites.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param module    The module.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_object(const char *file_name, const object_module *module) {
+    char chars[BASE64_CHARS];
+    char *path = NULL;
+    FILE *file = NULL;
+    status report = NO_ERROR;
+    int i;
+
+    if (!(path = object_path(file_name, OBJECT_EXT)))
+        return ERR_MEM_ALLOC;
+    file = fopen(path, FILE_MODE_WRITE_PLUS);
+    free(path);
+    if (!file)
+        return ERR_OPEN_FILE;
+
+    fprintf(file, "%d %d", module->ic, module->dc);
+    for (i = 0; i < module->size; i++) {
+        word_to_base64(module->words[i], chars);
+        fprintf(file, "\n%.2s", chars);
+    }
+    if (fclose(file) != 0)
+        return ERR_OPEN_FILE;
+
+    if (module->entries_count)
+        report = write_symbols(file_name, ENTRY_EXT, module->entries, module->entries_count);
+    if (report == NO_ERROR && module->externals_count)
+        report = write_symbols(file_name, EXTERNAL_EXT, module->externals, module->externals_count);
+    return report;
+}
+
+/**
+ * Writes a "LABEL\tADDRESS" per line symbol file.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param ext       The extension of the symbol file.
+ * @param symbols   The symbols.
+ * @param count     The number of symbols.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or ERR_OPEN_FILE otherwise.
+ */
+status write_symbols(const char *file_name, const char *ext, const object_symbol *symbols, size_t count) {
+    char *path = NULL;
+    FILE *file = NULL;
+    size_t i;
+
+    if (!(path = object_path(file_name, ext)))
+        return ERR_MEM_ALLOC;
+    file = fopen(path, FILE_MODE_WRITE_PLUS);
+    free(path);
+    if (!file)
+        return ERR_OPEN_FILE;
+
+    for (i = 0; i < count; i++)
+        fprintf(file, "%s\t%d\n", symbols[i].label, symbols[i].address);
+    return fclose(file) == 0 ? NO_ERROR : ERR_OPEN_FILE;
+}
+
+/**
+ * Finds a symbol by its label.
+ *
+ * @param symbols   The symbols to search.
+ * @param count     The number of symbols.
+ * @param label     The label to find.
+ * @return The address of the symbol, or INVALID_ADDRESS if it does not exist.
+ */
+int find_object_symbol(const object_symbol *symbols, size_t count, const char *label) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (strcmp(symbols[i].label, label) == 0)
+            return symbols[i].address;
+    return INVALID_ADDRESS;
+}
+
+/**
+ * Decodes the first word of an instruction and checks it the way is_legal_addressing() does.
+ *
+ * @param word      The first word of the instruction.
+ * @param layout    Filled with the command, the addressing modes and the number of words.
+ * @return NO_ERROR if the word is a valid instruction, FAILURE otherwise.
+ */
+status decode_instruction(unsigned short word, instruction_layout *layout) {
+    Adrs_mod src_mode = (Adrs_mod)WORD_SRC_MODE(word), dest_mode = (Adrs_mod)WORD_DEST_MODE(word);
+    Command cmd = (Command)WORD_OPCODE(word);
+    int operands = cmd <= SUB || cmd == LEA ? 2 : cmd <= JSR ? 1 : 0;
+
+    layout->cmd = cmd;
+    layout->src_mode = src_mode;
+    layout->dest_mode = dest_mode;
+    layout->length = 0;
+
+    if (WORD_ARE(word) != ABSOLUTE)
+        return FAILURE;
+    if (operands == 2 && (!IS_VALID_MODE(src_mode) || !IS_VALID_MODE(dest_mode)))
+        return FAILURE;
+    if (operands == 1 && (src_mode != INVALID_MD || !IS_VALID_MODE(dest_mode)))
+        return FAILURE;
+    if (operands == 0 && (src_mode != INVALID_MD || dest_mode != INVALID_MD))
+        return FAILURE;
+    if ((dest_mode == IMMEDIATE && cmd != CMP && cmd != PRN) || (cmd == LEA && src_mode != DIRECT))
+        return FAILURE;
+
+    /* Two register operands share a single word */
+    layout->length = 1 + (src_mode != INVALID_MD) + (dest_mode != INVALID_MD)
+                     - (src_mode == REGISTER && dest_mode == REGISTER);
+    return NO_ERROR;
+}
+
+/**
+ * Checks that a word is consistent with being an operand word of the given addressing mode,
+ * as written by the assembler. Tells instructions apart from data words that happen to decode.
+ *
+ * @param word          The word.
+ * @param mode          The addressing mode of the operand.
+ * @param is_dest       1 for the destination operand, 0 for the source operand.
+ * @param size          The number of words of the program, an address must point into it.
+ * @param is_ext_site   1 if the word is an external use site listed in the .ext file, 0 otherwise.
+ * @return 1 if the word may be the operand, 0 otherwise.
+ */
+int is_operand_word(unsigned short word, Adrs_mod mode, int is_dest, int size, int is_ext_site) {
+    int value = WORD_OPERAND(word);
+
+    if (mode == IMMEDIATE)
+        return WORD_ARE(word) == ABSOLUTE;
+    else if (mode == REGISTER && is_dest)
+        return WORD_ARE(word) == ABSOLUTE && WORD_REG_DEST(word) < REGISTER_COUNT && !WORD_REG_SRC(word);
+    else if (mode == REGISTER)
+        return WORD_ARE(word) == ABSOLUTE && WORD_REG_SRC(word) < REGISTER_COUNT && !WORD_REG_DEST(word);
+    else if (WORD_ARE(word) == EXTERNAL)
+        return !value && is_ext_site;
+    return WORD_ARE(word) == RELOCATABLE && value >= ADDRESS_START && value < ADDRESS_START + size;
+}
+
+/**
+ * Releases the symbols, the symbol uses and the relocations of a module.
+ *
+ * @param module The module.
+ */
+void free_object(object_module *module) {
+    if (module->entries) free(module->entries);
+    if (module->externals) free(module->externals);
+    module->entries = module->externals = NULL;
+    module->entries_count = module->externals_count = 0;
+    if (module->symbols) free(module->symbols);
+    if (module->uses) free(module->uses);
+    if (module->relocations) free(module->relocations);
+    module->symbols = NULL;
+    module->uses = NULL;
+    module->relocations = NULL;
+    module->symbols_count = module->uses_count = module->relocations_count = 0;
+    module->is_relocatable = 0;
+}
+
+/**
+ * Concatenates a file name and an extension into a new string.
+ *
+ * @param file_name The file name.
+ * @param ext       The extension, including the dot.
+ * @return The allocated string, or NULL if memory allocation failed.
+ */
+char *object_path(const char *file_name, const char *ext) {
+    char *path = malloc(strlen(file_name) + strlen(ext) + 1);
+
+    if (path) {
+        strcpy(path, file_name);
+        strcat(path, ext);
+    }
+    return path;
+}
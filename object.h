@@ -0,0 +1,108 @@
+#ifndef ASSEMBLER_OBJECT_H
+#define ASSEMBLER_OBJECT_H
+
+#include "utils.h"
+#include "passes.h"
+
+#define WORD_MASK 0xFFF
+#define ARE_MASK 0x3
+#define REGISTER_COUNT 8 /* @r0 - @r7 */
+#define OBJECT_FILES_LEN 3 /* .ob, .ent, .ext */
+
+/* Fields of the first word of an instruction: src mode | opcode | dest mode | A,R,E */
+#define WORD_SRC_MODE(w) (((w) >> 9) & 0x7)
+#define WORD_OPCODE(w) (((w) >> 5) & 0xF)
+#define WORD_DEST_MODE(w) (((w) >> 2) & 0x7)
+#define WORD_ARE(w) ((w) & ARE_MASK)
+
+/* Fields of an operand word */
+#define WORD_OPERAND(w) (((w) >> 2) & 0x3FF)
+#define WORD_REG_SRC(w) (((w) >> 7) & 0x1F)
+#define WORD_REG_DEST(w) (((w) >> 2) & 0x1F)
+#define SIGN_EXTEND_10(v) ((v) & 0x200 ? ((v) | 0xC00) : (v))
+#define SIGN_EXTEND_12(v) ((v) & 0x800 ? (int)(v) - 0x1000 : (int)(v))
+
+#define MODULE_SYMBOL_ENTRY 1 /* declared with .entry */
+#define MODULE_SYMBOL_EXTERN 2 /* declared with .extern, its address is 0 */
+
+typedef struct {
+    char label[MAX_LABEL_LENGTH];
+    int address;
+} object_symbol;
+
+/* A label of the symbol table of the first pass */
+typedef struct {
+    char label[MAX_LABEL_LENGTH];
+    int address;
+    int line;
+    int flags; /* MODULE_SYMBOL_ENTRY, MODULE_SYMBOL_EXTERN */
+} module_symbol;
+
+/* A use of a label, see symbol_use */
+typedef struct {
+    int symbol; /* index in module->symbols */
+    int line;
+    int address; /* of the word that uses the label */
+    int slot; /* Operand_slot */
+} module_use;
+
+/*
+ * A word that holds an address: of a label of the module (RELOCATABLE), moved with the module when
+ * it is linked at another address, or of an external symbol (EXTERNAL), patched with its address.
+ */
+typedef struct {
+    int offset; /* index of the word in module->words */
+    int are; /* RELOCATABLE or EXTERNAL */
+} module_relocation;
+
+/*
+ * An assembled program as written to the .ob, .ent and .ext files. A module assembled with --aobj
+ * or --project also has the symbol table and the symbol uses of its first pass, the source line of
+ * every word and the words that hold an address (is_relocatable).
+ */
+typedef struct object_module {
+    unsigned short words[MAX_MEMORY_SIZE]; /* words[i] is loaded at ADDRESS_START + i */
+    int ic; /* instruction count of the .ob header */
+    int dc; /* data count of the .ob header */
+    int size; /* number of words */
+
+    object_symbol *entries;
+    size_t entries_count;
+    object_symbol *externals; /* one per use of an external symbol */
+    size_t externals_count;
+
+    int is_relocatable;
+    unsigned short lines[MAX_MEMORY_SIZE]; /* lines[i] is the source line of words[i] */
+    unsigned char is_data[MAX_MEMORY_SIZE]; /* words[i] is a value of .data or .string */
+    module_symbol *symbols;
+    size_t symbols_count;
+    module_use *uses; /* grouped by symbol, in source order */
+    size_t uses_count;
+    module_relocation *relocations; /* in address order */
+    size_t relocations_count;
+} object_module;
+
+/* Decoded first word and operands of an instruction */
+typedef struct {
+    Command cmd;
+    Adrs_mod src_mode;
+    Adrs_mod dest_mode;
+    int length; /* number of words, 0 if the word is not a valid instruction */
+} instruction_layout;
+
+void word_to_base64(int word, char *chars);
+int find_object_symbol(const object_symbol *symbols, size_t count, const char *label);
+
+status load_object(const char *file_name, object_module *module, int *line);
+status write_object(const char *file_name, const object_module *module);
+status write_symbols(const char *file_name, const char *ext, const object_symbol *symbols, size_t count);
+status read_object(FILE *ob, FILE *ent, FILE *ext, object_module *module, int *line);
+status load_symbols(const char *file_name, const char *ext, object_symbol **symbols, size_t *count, int *line,
+                    status invalid);
+status read_symbols(FILE *src, object_symbol **symbols, size_t *count, int *line, status invalid);
+status decode_instruction(unsigned short word, instruction_layout *layout);
+int is_operand_word(unsigned short word, Adrs_mod mode, int is_dest, int size, int is_ext_site);
+
+void free_object(object_module *module);
+
+#endif
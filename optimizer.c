@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "passes.h"
+#include "data.h"
+#include "utils.h"
+#include "errors.h"
+
+#define AMT_WORD_3 3
+
+/* The image as the optimizer sees it, one entry per word of data_img_obj */
+typedef struct {
+    size_t size;
+    int *length; /* of the instruction the word starts, 0 for an operand word or a .data/.string word */
+    symbol **refs; /* the label whose address an operand word holds (NULL if none) */
+    char *removed;
+} image_map;
+
+/* --prune: the use graph of the image, walked from its roots */
+typedef struct {
+    size_t size;
+    char *live;
+    size_t *pending; /* live words whose successors and labels are still to be followed */
+    size_t pending_count;
+    char *labeled; /* a label of the file is on the word */
+    char *in_code; /* the word is part of an instruction */
+    size_t *labels_start; /* per word, where its labels start in labels, size + 1 entries */
+    symbol **labels; /* the labels each word uses, by the uses the first pass has recorded */
+    int is_indirect; /* a jump goes to an address that is not a label of the file */
+} use_graph;
+
+/* "Private" helper functions */
+status map_image(image_map *map);
+status prune_image(image_map *map);
+status build_use_graph(const image_map *map, use_graph *graph);
+void follow_word(const image_map *map, use_graph *graph, size_t index);
+void use_label(use_graph *graph, const symbol *sym, int is_whole_block);
+void make_live(use_graph *graph, size_t index);
+void free_use_graph(use_graph *graph);
+status compact_image(image_map *map);
+status move_symbol(symbol *sym, int address);
+void fold_jump_chains(image_map *map);
+void remove_redundant_instructions(image_map *map);
+void free_image_map(image_map *map);
+symbol *jump_target(const image_map *map, long index, Command *cmd);
+int is_jump_to_next(const image_map *map, size_t index, const symbol *target, Command cmd);
+int image_word_count(const data_image *word);
+int binary_field(const char *binary);
+
+/**
+ * Runs the -O and --prune passes over the image of the first pass (see optimizer.h).
+ *
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status optimize_image() {
+    image_map map;
+    status report;
+
+    if ((report = map_image(&map)) != NO_ERROR)
+        return report;
+    if (options.optimize) {
+        fold_jump_chains(&map);
+        remove_redundant_instructions(&map);
+    }
+    if (options.prune) /* after the folding, a jump it has bypassed may be left unreachable */
+        report = prune_image(&map);
+    if (options.prune && options.optimize) /* and a jump over unreachable words only goes to the next one */
+        remove_redundant_instructions(&map);
+    if (report == NO_ERROR)
+        report = compact_image(&map);
+    free_image_map(&map);
+    return report;
+}
+
+/**
+ * Finds the instructions of the image and the labels its operand words refer to.
+ *
+ * @param map The map to fill, released with free_image_map().
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status map_image(image_map *map) {
+    symbol *sym = NULL;
+    data_image *word = NULL;
+    size_t i, j, size = data_arr_obj_index ? data_arr_obj_index : 1;
+    long index;
+
+    map->size = data_arr_obj_index;
+    map->length = calloc(size, sizeof(int));
+    map->refs = calloc(size, sizeof(symbol *));
+    map->removed = calloc(size, sizeof(char));
+    if (!map->length || !map->refs || !map->removed) {
+        free_image_map(map);
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < map->size; i += map->length[i] ? map->length[i] : 1)
+        map->length[i] = image_word_count(data_img_obj[i]);
+
+    for (i = 0; i < symbol_count; i++) {
+        sym = symbol_table[i];
+        for (j = 0; j < sym->uses_count; j++) {
+            index = (long)sym->uses[j].address - ADDRESS_START;
+            if (sym->uses[j].slot == SLOT_DATA || index < 0 || index >= (long)map->size)
+                continue;
+            word = data_img_obj[index];
+            /* an expression word holds neither, see assemble_expression_operand() */
+            if (word->concat == ADDRESS && !word->expression
+                && (word->p_sym == sym || (word->binary_src && word->binary_src == sym->address_binary)))
+                map->refs[index] = sym;
+        }
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Sends every jmp, bne and jsr to a jmp straight to where that jmp goes, following the whole chain.
+ * A chain that loops ends anywhere on the loop, the program never leaves it either way.
+ *
+ * @param map The map of the image.
+ */
+void fold_jump_chains(image_map *map) {
+    symbol *target = NULL, *next = NULL;
+    Command cmd;
+    size_t i, hops;
+
+    for (i = 0; i < map->size; i++) {
+        if (!(target = jump_target(map, (long)i, &cmd)) || is_jump_to_next(map, i, target, cmd))
+            continue; /* removed as it is */
+        for (hops = 0; hops < map->size; hops++) {
+            next = jump_target(map, (long)target->address_decimal - ADDRESS_START, &cmd);
+            if (!next || cmd != JMP || next == target)
+                break;
+            target = next;
+        }
+        map->refs[i + 1] = target;
+    }
+}
+
+/**
+ * Marks the instructions that do nothing: a jmp or bne to the instruction right after it (bne
+ * does not change the flags), and a mov of a register to itself. A mov that ends the image is
+ * kept, a label on it would have no word left to move to.
+ *
+ * @param map The map of the image, its jump chains folded.
+ */
+void remove_redundant_instructions(image_map *map) {
+    data_image *word = NULL;
+    symbol *target = NULL;
+    Command cmd;
+    size_t i;
+    int is_redundant;
+
+    for (i = 0; i < map->size; i += map->length[i] ? map->length[i] : 1) {
+        word = data_img_obj[i];
+        if ((target = jump_target(map, (long)i, &cmd)))
+            is_redundant = is_jump_to_next(map, i, target, cmd);
+        else
+            is_redundant = map->length[i] == AMT_WORD_2 && i + AMT_WORD_2 < map->size
+                           && binary_field(word->binary_opcode) == MOV
+                           && binary_field(word->binary_src) == REGISTER && binary_field(word->binary_dest) == REGISTER
+                           && !strcmp(data_img_obj[i + 1]->binary_src, data_img_obj[i + 1]->binary_dest);
+        if (is_redundant)
+            memset(map->removed + i, 1, (size_t)map->length[i]);
+    }
+}
+
+/**
+ * Marks the words that no path of the program reaches: the instructions that cannot run and the
+ * data that is never used. The walk starts at the first word, where the program starts, and at
+ * the .entry labels. A live instruction leads to the next one unless it is a jmp, rts or stop, and
+ * to the labels its operands use. The label of a jump leads to its instruction only, any other use
+ * leads to every word up to the next label, a label expression may point anywhere in between. A
+ * jump that does not go to a label of the file (a register, an expression) keeps every instruction.
+ *
+ * @param map The map of the image.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status prune_image(image_map *map) {
+    use_graph graph;
+    size_t i;
+    int is_all_code = 0;
+
+    if (build_use_graph(map, &graph) != NO_ERROR) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    if (map->size)
+        make_live(&graph, 0);
+    for (i = 0; i < symbol_count; i++)
+        if (symbol_table[i]->sym_dir == ENTRY)
+            use_label(&graph, symbol_table[i], 0);
+
+    while (graph.pending_count || (graph.is_indirect && !is_all_code)) {
+        if (!graph.pending_count) {
+            for (i = 0; i < map->size; i++)
+                if (map->length[i])
+                    make_live(&graph, i);
+            is_all_code = 1;
+            continue;
+        }
+        follow_word(map, &graph, graph.pending[--graph.pending_count]);
+    }
+
+    for (i = 0; i < map->size; i++)
+        map->removed[i] = map->removed[i] || !graph.live[i];
+    free_use_graph(&graph);
+    return NO_ERROR;
+}
+
+/**
+ * Builds the use graph of the image: the words with a label on them, the words of the instructions,
+ * and the labels each word uses.
+ *
+ * @param map   The map of the image.
+ * @param graph The graph to fill, released with free_use_graph().
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status build_use_graph(const image_map *map, use_graph *graph) {
+    symbol *sym = NULL;
+    size_t i, j, k, size = map->size ? map->size : 1, count = 0;
+    long index;
+
+    memset(graph, 0, sizeof(use_graph));
+    graph->size = map->size;
+    for (i = 0; i < symbol_count; i++)
+        count += symbol_table[i]->uses_count;
+    graph->live = calloc(size, sizeof(char));
+    graph->pending = malloc(size * sizeof(size_t));
+    graph->labeled = calloc(size, sizeof(char));
+    graph->in_code = calloc(size, sizeof(char));
+    graph->labels_start = calloc(size + 1, sizeof(size_t));
+    graph->labels = calloc(count ? count : 1, sizeof(symbol *));
+    if (!graph->live || !graph->pending || !graph->labeled || !graph->in_code || !graph->labels_start
+        || !graph->labels) {
+        free_use_graph(graph);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < map->size; i++)
+        for (j = 0; j < (size_t)map->length[i]; j++)
+            graph->in_code[i + j] = 1;
+
+    /* counted per word first, then each word's labels are stored after those of the words before it */
+    for (i = 0; i < symbol_count; i++) {
+        sym = symbol_table[i];
+        index = (long)sym->address_decimal - ADDRESS_START;
+        if (sym->sym_dir != EXTERN && !sym->is_missing_info && index >= 0 && index < (long)map->size)
+            graph->labeled[index] = 1;
+        for (j = 0; j < sym->uses_count; j++)
+            if ((index = (long)sym->uses[j].address - ADDRESS_START) >= 0 && index < (long)map->size)
+                graph->labels_start[index + 1]++;
+    }
+    for (i = 0; i < map->size; i++)
+        graph->labels_start[i + 1] += graph->labels_start[i];
+    for (i = 0; i < symbol_count; i++) {
+        sym = symbol_table[i];
+        for (j = 0; j < sym->uses_count; j++)
+            if ((index = (long)sym->uses[j].address - ADDRESS_START) >= 0 && index < (long)map->size) {
+                for (k = graph->labels_start[index]; graph->labels[k]; k++) /* the first free entry of the word */
+                    ;
+                graph->labels[k] = sym;
+            }
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Follows a live word: its instruction, the instruction after it and the labels it uses, or the
+ * data word after it up to the next label.
+ *
+ * @param map   The map of the image.
+ * @param graph The use graph.
+ * @param index The index of the word.
+ */
+void follow_word(const image_map *map, use_graph *graph, size_t index) {
+    Command cmd;
+    size_t i, j, next;
+
+    if (!map->length[index]) {
+        if (!graph->in_code[index] && index + 1 < map->size && !graph->in_code[index + 1]
+            && !graph->labeled[index + 1])
+            make_live(graph, index + 1);
+        for (j = graph->labels_start[index]; j < graph->labels_start[index + 1]; j++)
+            use_label(graph, graph->labels[j], 1);
+        return;
+    }
+
+    cmd = (Command)binary_field(data_img_obj[index]->binary_opcode);
+    next = index + map->length[index];
+    if (cmd != JMP && cmd != RTS && cmd != STOP && next < map->size && map->length[next])
+        make_live(graph, next);
+    if ((cmd == JMP || cmd == BNE || cmd == JSR) && !map->refs[index + 1]) /* the label of another file is one */
+        graph->is_indirect = 1;
+
+    for (i = index + 1; i < next; i++) {
+        graph->live[i] = 1;
+        if (map->refs[i])
+            use_label(graph, map->refs[i], 0);
+        else
+            for (j = graph->labels_start[i]; j < graph->labels_start[i + 1]; j++)
+                use_label(graph, graph->labels[j], 1);
+    }
+}
+
+/**
+ * Makes the word of a label live, and the words after it up to the next label.
+ *
+ * @param graph             The use graph.
+ * @param sym               The symbol of the label, nothing is done for a label of another file.
+ * @param is_whole_block    0 to make the word of the label live only.
+ */
+void use_label(use_graph *graph, const symbol *sym, int is_whole_block) {
+    long index = (long)sym->address_decimal - ADDRESS_START;
+
+    if (sym->sym_dir == EXTERN || sym->is_missing_info || index < 0 || index >= (long)graph->size)
+        return;
+    make_live(graph, (size_t)index);
+    while (is_whole_block && ++index < (long)graph->size && !graph->labeled[index])
+        make_live(graph, (size_t)index);
+}
+
+/**
+ * Makes a word live, it is followed once (see follow_word()).
+ *
+ * @param graph The use graph.
+ * @param index The index of the word.
+ */
+void make_live(use_graph *graph, size_t index) {
+    if (graph->live[index])
+        return;
+    graph->live[index] = 1;
+    graph->pending[graph->pending_count++] = index;
+}
+
+/**
+ * Removes the marked words from the image. The words after them, the labels and their uses move
+ * down, and the words that hold the address of a label are encoded again.
+ *
+ * @param map The map of the image.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status compact_image(image_map *map) {
+    size_t *before = NULL; /* number of words removed before each word */
+    symbol *sym = NULL;
+    data_image *word = NULL;
+    size_t i, j, kept = 0, code_end = 0, uses_kept;
+    long index;
+
+    if (!(before = malloc((map->size ? map->size : 1) * sizeof(size_t)))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < map->size; i++) {
+        before[i] = i - kept;
+        code_end = map->length[i] ? i + map->length[i] : code_end;
+        if (map->removed[i]) {
+            if (i < code_end) IC--;
+            else DC--;
+            next_free_address--;
+            free_data_image(&data_img_obj[i]);
+            continue;
+        }
+        data_img_obj[kept] = data_img_obj[i];
+        data_img_obj[kept]->data_address = ADDRESS_START + (int)kept;
+        map->refs[kept++] = map->refs[i];
+    }
+    data_arr_obj_index = kept;
+
+    for (i = 0; i < symbol_count; i++) {
+        sym = symbol_table[i];
+        index = (long)sym->address_decimal - ADDRESS_START;
+        if (sym->sym_dir != EXTERN && !sym->is_missing_info && index >= 0 && index < (long)map->size) {
+            if (move_symbol(sym, sym->address_decimal - (int)before[index]) != NO_ERROR) {
+                free(before);
+                return ERR_MEM_ALLOC;
+            }
+            /* a label on a removed instruction is now on the word that took its address */
+            index = (long)sym->address_decimal - ADDRESS_START;
+            if (sym->data && (sym->data = index < (long)kept ? data_img_obj[index] : NULL))
+                sym->data->has_label = 1;
+        }
+        for (j = 0, uses_kept = 0; j < sym->uses_count; j++) {
+            index = (long)sym->uses[j].address - ADDRESS_START;
+            if (index >= 0 && index < (long)map->size) {
+                if (map->removed[index])
+                    continue;
+                sym->uses[j].address -= (unsigned short)before[index];
+            }
+            sym->uses[uses_kept++] = sym->uses[j];
+        }
+        sym->uses_count = uses_kept;
+    }
+    free(before);
+
+    for (i = 0; i < kept; i++) {
+        word = data_img_obj[i];
+        if (!map->refs[i])
+            continue;
+        else if (!word->is_word_complete) /* resolved with the final address by write_data_img_to_stream() */
+            word->p_sym = map->refs[i];
+        else if ((word->binary_src = map->refs[i]->address_binary) && create_base64_word(word) != NO_ERROR)
+            return ERR_MEM_ALLOC;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Moves a label, its binary address is updated in place: the words that already hold the address
+ * share it (see handle_address_reference()).
+ *
+ * @param sym       The symbol of the label.
+ * @param address   The new address.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status move_symbol(symbol *sym, int address) {
+    char *binary = NULL;
+
+    if (sym->address_decimal == address)
+        return NO_ERROR;
+    if (!(binary = decimal_to_binary12(address)))
+        return ERR_MEM_ALLOC;
+    strcpy(sym->address_binary, binary);
+    free(binary);
+    sym->address_decimal = address;
+    return NO_ERROR;
+}
+
+/**
+ * Returns the label a jmp, bne or jsr goes to, when it is a label of the file.
+ *
+ * @param map   The map of the image.
+ * @param index The index of a word of the image, any.
+ * @param cmd   Set to the command of the instruction, if it is one.
+ * @return The symbol of the label, NULL if the word does not start such an instruction.
+ */
+symbol *jump_target(const image_map *map, long index, Command *cmd) {
+    symbol *target = NULL;
+
+    if (index < 0 || index >= (long)map->size || map->length[index] != AMT_WORD_2 || map->removed[index])
+        return NULL;
+    *cmd = (Command)binary_field(data_img_obj[index]->binary_opcode);
+    target = map->refs[index + 1];
+    if ((*cmd != JMP && *cmd != BNE && *cmd != JSR) || !target || target->sym_dir == EXTERN || target->is_missing_info)
+        return NULL;
+    return target;
+}
+
+/**
+ * Returns whether a jump goes to the instruction right after it, past the words already removed.
+ *
+ * @param map       The map of the image.
+ * @param index     The index of the jump in the image.
+ * @param target    The label it goes to, see jump_target().
+ * @param cmd       Its command, jsr is never removed.
+ * @return 1 if the jump does nothing, 0 otherwise.
+ */
+int is_jump_to_next(const image_map *map, size_t index, const symbol *target, Command cmd) {
+    long next = (long)index + AMT_WORD_2;
+
+    while (next < (long)map->size && map->removed[next] && next != (long)target->address_decimal - ADDRESS_START)
+        next++;
+    return cmd != JSR && target->address_decimal == ADDRESS_START + (int)next;
+}
+
+/**
+ * Returns the number of words of the instruction a word starts.
+ *
+ * @param word The word.
+ * @return The number of words, 0 if the word does not start an instruction.
+ */
+int image_word_count(const data_image *word) {
+    Adrs_mod src_op, dest_op;
+
+    if (word->concat != DEFAULT_12BIT || !word->binary_opcode)
+        return 0;
+    src_op = (Adrs_mod)binary_field(word->binary_src);
+    dest_op = (Adrs_mod)binary_field(word->binary_dest);
+    if (dest_op == INVALID_MD)
+        return AMT_WORD_1;
+    else if (src_op == INVALID_MD || (src_op == REGISTER && dest_op == REGISTER))
+        return AMT_WORD_2; /* the registers share a word */
+    return AMT_WORD_3;
+}
+
+/**
+ * Returns the value of a field of a word, see decimal_to_binary12().
+ *
+ * @param binary The binary string (optional - NULL).
+ * @return The value, 0 for NULL.
+ */
+int binary_field(const char *binary) {
+    return binary ? (int)strtol(binary, NULL, 2) : 0;
+}
+
+/**
+ * Frees the arrays of a use graph.
+ *
+ * @param graph The graph.
+ */
+void free_use_graph(use_graph *graph) {
+    free(graph->live);
+    free(graph->pending);
+    free(graph->labeled);
+    free(graph->in_code);
+    free(graph->labels_start);
+    free(graph->labels);
+    memset(graph, 0, sizeof(use_graph));
+}
+
+/**
+ * Frees the arrays of a map of the image.
+ *
+ * @param map The map.
+ */
+void free_image_map(image_map *map) {
+    free(map->length);
+    free(map->refs);
+    free(map->removed);
+    map->length = NULL;
+    map->refs = NULL;
+    map->removed = NULL;
+}
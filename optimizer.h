@@ -0,0 +1,27 @@
+#ifndef ASSEMBLER_OPTIMIZER_H
+#define ASSEMBLER_OPTIMIZER_H
+
+#include "utils.h"
+#include "errors.h"
+
+/*
+ * -O: peephole pass over the image of the first pass, run before the outputs are written:
+ *   a jmp, bne or jsr to a jmp goes straight to where that jmp goes,
+ *   a jmp or bne to the instruction right after it is removed,
+ *   a mov of a register to itself is removed.
+ * The words after a removed one move down, and so do the labels, their uses, IC and DC. The words
+ * that hold the address of a label, found through its uses (see record_symbol_use()), are encoded
+ * again. Only the plain label operands are followed, a label expression is kept by the first pass
+ * and evaluated with the final addresses.
+ *
+ * --prune: the instructions that cannot run and the data that is never used are removed the same
+ * way, by a use graph of the labels and the flow of the program (see prune_image()). The program
+ * starts at its first word, the .entry labels are where the other files of a program come in.
+ */
+
+/* The words of the image may move after the first pass */
+#define IMAGE_IS_REWRITTEN() (options.optimize || options.prune)
+
+status optimize_image();
+
+#endif
@@ -6,6 +6,10 @@
 #include "utils.h"
 #include "errors.h"
 #include "data.h"
+#include "debuginfo.h"
+#include "object.h"
+#include "expr.h"
+#include "optimizer.h"
 
 #define UPDATE_REPORT_STATUS(condition, file) if ((condition) != NO_ERROR) { \
 cleanup(*(file)); \
@@ -17,6 +21,9 @@ free ((p_mem)); \
 (p_mem) = NULL;                             \
 }
 
+#define SPILL_KEPT_MARK '*' /* not part of the base64 alphabet */
+#define IMAGE_IS_EMPTY() (!data_arr_obj_index && !spill_records)
+
 /** Global variables are reset to zero during cleanup **/
 symbol **symbol_table = NULL;
 data_image **data_img_obj = NULL;
@@ -24,6 +31,34 @@ data_image **data_img_obj = NULL;
 size_t symbol_count = 0;
 size_t data_arr_obj_index = 0;
 
+/* Capacity of symbol_table, and its open addressing index by label, at most half full (see find_symbol()) */
+size_t symbol_table_cap = 0;
+symbol **symbol_index = NULL;
+size_t symbol_index_cap = 0;
+
+/* Streaming mode (--stream): one BASE64_CHARS record per word, in address order.
+ * Words that are still needed in memory are marked with SPILL_KEPT_MARK and stay in data_img_obj. */
+FILE *spill_stream = NULL;
+size_t spill_records = 0;
+
+/* --debug-info: source line of every word and whether it is data, in address order */
+unsigned short *debug_lines = NULL;
+unsigned char *debug_data = NULL;
+size_t debug_lines_cap = 0;
+
+/* .rept blocks whose body is being assembled, innermost last */
+repeat_block repeat_stack[MAX_REPEAT_DEPTH];
+int repeat_depth = 0;
+
+/* The words of the image may still move after the first pass, a label expression is kept until they are final */
+int keep_label_expressions = 0;
+
+/* --project: outputs of the last file, written to scratch streams, owned by the caller */
+FILE *captured_outputs[CAPTURED_OUTPUTS_LEN] = {NULL};
+
+/* --aobj: filled by the second pass when set, owned by the caller (see capture_module()) */
+object_module *captured_module = NULL;
+
 int DC = 0;
 int IC = 0;
 int next_free_address = ADDRESS_START;
@@ -38,38 +73,54 @@ status assembler_first_pass(file_context **src) {
     char line[MAX_BUFFER_LENGTH];
     file_context *p_src = NULL;
     status report = NO_ERROR;
-    int has_error = 0, ch = -1;;
+    int has_error = 0, ch = -1, is_repeat, lc;
 
     p_src = *src;
 
     if (!p_src)
         return FAILURE;
 
+    keep_label_expressions = IMAGE_IS_REWRITTEN();
+
     /* The check for comment lines (;), invalid line start, and handling too long lines
      * is taken care of at the preprocessor stage. */
     while ((fscanf(p_src->file_ptr, "%[^\n]%*c", line) == 1  || (ch = fgetc(p_src->file_ptr)) == '\n')
-        && report != ERR_MEM_ALLOC) {
+        && report != ERR_MEM_ALLOC && !diagnostics_limit_reached()) {
         if (ch == '\n') {
             ch = -1;
             continue; /* empty line */
         }
 
-        report =  process_line(p_src,line);
+        report = handle_repeat(p_src, line, &is_repeat);
+        if (!is_repeat)
+            report = process_line(p_src, line);
         p_src->lc++;
         has_error = report != NO_ERROR ? 1 : has_error;
+        /* The words of a .rept body are replicated from data_img_obj at its .endr,
+         * -O and --prune rewrite the whole image */
+        if (options.stream_output && !IMAGE_IS_REWRITTEN() && !options.check_only && !has_error && !repeat_depth)
+            report = spill_complete_images();
         report = report == ERR_MEM_ALLOC ? ERR_MEM_ALLOC : NO_ERROR; /* resetting for next line processing */
     }
 
+    if (repeat_depth) { /* reported on the outermost block left open */
+        lc = p_src->lc;
+        p_src->lc = repeat_stack[0].lc;
+        handle_error(ERR_MISSING_ENDR, p_src);
+        p_src->lc = lc;
+        has_error = 1;
+    }
+
     /* Generate output file(s) only if no error has occurred */
     if (!has_error) {
-        handle_progress(FIRST_PASS_OK, (*src)->fc, (*src)->tc, (*src)->file_name_wout_ext);
+        if (!options.check_only) /* nothing is generated */
+            handle_progress(FIRST_PASS_OK, (*src)->fc, (*src)->tc, (*src)->file_name_wout_ext);
         report = assembler_second_pass(src);
     }
     else {  /* Cleanup output files if an error occurred */
         handle_error(ERR_FIRST_PASS, (*src)->fc, (*src)->tc, (*src)->file_name_wout_ext);
         fclose(p_src->file_ptr);
         p_src->file_ptr = NULL;
-        remove(p_src->file_name);
         cleanup(src);
     }
 
@@ -89,12 +140,28 @@ status assembler_second_pass(file_context **src) {
     if (!p_src)
         return FAILURE;
 
+    if (IMAGE_IS_REWRITTEN() && !options.check_only) {
+        report = optimize_image();
+        UPDATE_REPORT_STATUS(report, &src);
+    }
     report = generate_output_by_dest(p_src,  EXTERN); /* .ext output */
     UPDATE_REPORT_STATUS(report, &src);
     report = generate_output_by_dest(p_src,  ENTRY); /* .ent output */
     UPDATE_REPORT_STATUS(report, &src);
     report = generate_output_by_dest(p_src, DEFAULT); /* .obj output */
     UPDATE_REPORT_STATUS(report, &src);
+    if (captured_module && !options.check_only) {
+        report = capture_module(); /* the words have been captured with .obj */
+        UPDATE_REPORT_STATUS(report, &src);
+    }
+    if (options.debug_info && !options.check_only) {
+        report = generate_output_by_dest(p_src, DEBUG_INFO); /* .dbg output, the lines are recorded with .obj */
+        UPDATE_REPORT_STATUS(report, &src);
+    }
+    if (options.xref && !options.check_only) {
+        report = generate_output_by_dest(p_src, XREF_INFO); /* .xref output */
+        UPDATE_REPORT_STATUS(report, &src);
+    }
 
     free_file_context(src);
     free_global_data_and_symbol();
@@ -116,6 +183,9 @@ status process_line(file_context *src, char *p_line) {
     status report = NO_ERROR;
     size_t word_len;
 
+    if ((p_ch = scan_define(p_line)))
+        return handle_define(src, p_ch);
+
     p_ch = p_line;
     word_len = get_word(&p_line, first_word, COLON);
     has_directive = word_len && (is_directive(first_word) || (is_directive(first_word + 1)));
@@ -135,6 +205,178 @@ status process_line(file_context *src, char *p_line) {
     return report;
 }
 
+/**
+ * Returns whether a line is a .rept or a .endr line.
+ *
+ * @param line The line.
+ * @param is_start Set to 1 for a .rept line, 0 for a .endr line.
+ * @return The text after the keyword, NULL if the line is neither.
+ */
+char *scan_repeat(char *line, int *is_start) {
+    size_t len;
+
+    while (isspace(*line))
+        line++;
+    if (strncmp(line, REPEAT_START, len = strlen(REPEAT_START)) == 0 && (!line[len] || isspace(line[len])))
+        *is_start = 1;
+    else if (strncmp(line, REPEAT_END, len = strlen(REPEAT_END)) == 0 && (!line[len] || isspace(line[len])))
+        *is_start = 0;
+    else
+        return NULL;
+    return line + len;
+}
+
+/**
+ * Handles a .rept N or a .endr line. The body of a .rept block is assembled once, its words are
+ * then replicated at its .endr, so the lines of the body are parsed only once whatever N is.
+ *
+ * @param src Pointer to the file context for the input file information.
+ * @param line The line.
+ * @param handled Set to 1 if the line is a .rept or a .endr line, 0 otherwise.
+ * @return The status of the line processing (NO_ERROR or an error status).
+ */
+status handle_repeat(file_context *src, char *line, int *handled) {
+    int is_start = 0;
+    char *rest = scan_repeat(line, &is_start);
+
+    *handled = rest != NULL;
+    if (!rest)
+        return NO_ERROR;
+    return is_start ? open_repeat(src, rest) : close_repeat(src, rest);
+}
+
+/**
+ * Opens a .rept block.
+ *
+ * @param src Pointer to the file context for the input file information.
+ * @param count The text after .rept, the number of times the body is assembled (0 or more), a constant expression.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported.
+ */
+status open_repeat(file_context *src, char *count) {
+    repeat_block *block = NULL;
+    char *p = count;
+    expr_value result;
+    status report = NO_ERROR;
+
+    if (repeat_depth == MAX_REPEAT_DEPTH) {
+        handle_error(ERR_REPT_TOO_DEEP, src);
+        return FAILURE;
+    }
+
+    while (isspace(*p))
+        p++;
+    /* the block is still opened on an error, its .endr is matched */
+    if (*p && evaluate_expression(src, p, EXPR_CONSTANT, src->lc, 0, &result) != NO_ERROR)
+        report = FAILURE;
+    else if (!*p || result.value < 0 || result.value > MAX_MEMORY_SIZE) {
+        handle_error(ERR_INVALID_REPT_COUNT, src);
+        report = FAILURE;
+    }
+
+    block = &repeat_stack[repeat_depth++];
+    block->first = data_arr_obj_index;
+    block->address = next_free_address;
+    block->ic = IC;
+    block->dc = DC;
+    block->count = report == NO_ERROR ? (int)result.value : 1;
+    block->lc = src->lc;
+    return report;
+}
+
+/**
+ * Closes the innermost .rept block: replicates the words of its body count - 1 times, along with
+ * their label uses, or drops them for a count of 0.
+ *
+ * @param src Pointer to the file context for the input file information.
+ * @param rest The text after .endr.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, TERMINATE or ERR_MEM_ALLOC.
+ */
+status close_repeat(file_context *src, char *rest) {
+    repeat_block block;
+    data_image *copy = NULL;
+    size_t i, words;
+    int k, size, lc = src->lc;
+    status report = NO_ERROR;
+
+    if (get_word_length(&rest)) {
+        handle_error(ERR_EXTRA_TEXT, src);
+        report = FAILURE;
+    }
+    if (!repeat_depth) {
+        handle_error(ERR_MISSING_REPT, src);
+        return FAILURE;
+    }
+
+    block = repeat_stack[--repeat_depth];
+    words = data_arr_obj_index - block.first;
+    size = next_free_address - block.address;
+    for (i = block.first; i < data_arr_obj_index; i++) {
+        if (data_img_obj[i]->has_label) { /* it would only name the first copy */
+            src->lc = data_img_obj[i]->lc;
+            handle_error(ERR_REPT_LABEL, src);
+            src->lc = lc;
+            return FAILURE;
+        }
+    }
+
+    if (!block.count) {
+        while (data_arr_obj_index > block.first)
+            free_data_image(&data_img_obj[--data_arr_obj_index]);
+        next_free_address = block.address;
+        IC = block.ic;
+        DC = block.dc;
+        return repeat_symbol_uses(block.address, size, 0) == NO_ERROR ? report : ERR_MEM_ALLOC;
+    }
+
+    for (k = 1; k < block.count; k++) {
+        for (i = 0; i < words; i++) {
+            if (!(copy = add_data_image(src, NULL, &report)))
+                return report;
+            if (copy_data_image(copy, data_img_obj[block.first + i]) != NO_ERROR)
+                return ERR_MEM_ALLOC;
+        }
+    }
+    IC += (IC - block.ic) * (block.count - 1);
+    DC += (DC - block.dc) * (block.count - 1);
+    return repeat_symbol_uses(block.address, size, block.count) == NO_ERROR ? report : ERR_MEM_ALLOC;
+}
+
+/**
+ * Updates the recorded label uses of the words of a replicated .rept body (see record_symbol_use()).
+ *
+ * @param address The address of the first word of the body.
+ * @param size The number of words of the body.
+ * @param count The number of copies of the body, the uses within it are dropped for 0.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status repeat_symbol_uses(int address, int size, int count) {
+    size_t i, j, kept, uses_count;
+    symbol *sym = NULL;
+    symbol_use use;
+    int k;
+
+    for (i = 0; i < symbol_count; i++) {
+        if (!(sym = symbol_table[i]))
+            continue;
+        uses_count = sym->uses_count;
+        for (k = 1; k < count; k++) {
+            for (j = 0; j < uses_count; j++) {
+                use = sym->uses[j];
+                if (use.address >= address && use.address < address + size
+                    && record_symbol_use(sym, use.lc, use.address + k * size, (Operand_slot)use.slot) != NO_ERROR)
+                    return ERR_MEM_ALLOC;
+            }
+        }
+        if (!count) {
+            for (j = 0, kept = 0; j < uses_count; j++)
+                if (sym->uses[j].address < address || sym->uses[j].address >= address + size)
+                    sym->uses[kept++] = sym->uses[j];
+            sym->uses_count = kept;
+        }
+    }
+    return NO_ERROR;
+}
+
 /**
  * Handle the processing of a line, including labels, directives, and commands.
  *
@@ -153,7 +395,7 @@ void handle_processing_line(file_context *src, char **line, symbol *sym, status
 
     word_len =  get_word(line, next_word, SPACE);
     if (sym) p_label = sym->label;
-    if (next_word[word_len - 1] == ',') {
+    if (word_len && next_word[word_len - 1] == ',') {
         next_word[word_len - 1] = '\0';
         word_len--;
         *report = ERR_EXTRA_COMMA;
@@ -211,7 +453,7 @@ void process_data(file_context *src, const char *label, char *line, status *repo
             continue;
         }
 
-        if (label && !strncmp(label, word, strlen(label))) {
+        if (label && !strcmp(label, word)) { /* not a label it is the prefix of, e.g. in an expression */
             *report = ERR_FORBIDDEN_LABEL_DECLARE;
             handle_error(ERR_FORBIDDEN_LABEL_DECLARE, src, label);
             is_first_value = 1;
@@ -468,7 +710,7 @@ void handle_one_operand(file_context *src, Command cmd, const char *label, char
         handle_error(*report, src);
     } if (word_len > MAX_LABEL_LENGTH) {
         *report = ERR_OPERAND_TOO_LONG;
-        handle_error(ERR_OPERAND_TOO_LONG);
+        handle_error(ERR_OPERAND_TOO_LONG, src);
     } if (word[word_len - 1] == ',') {
         word[word_len - 1] = '\0';
         word_len--;
@@ -477,7 +719,8 @@ void handle_one_operand(file_context *src, Command cmd, const char *label, char
     }
 
     op_mode = get_addressing_mode(src, word, word_len, report);
-    if (!is_legal_addressing(src, cmd, INVALID_MD, op_mode, report) ||
+    if ((op_mode == INVALID_MD && is_expression(word)) /* already reported, see get_addressing_mode() */
+        || !is_legal_addressing(src, cmd, INVALID_MD, op_mode, report) ||
         (concat = get_concat_mode_one_op(INVALID_MD, op_mode)) == -1) {
         free(word);
         return;
@@ -493,6 +736,10 @@ void handle_one_operand(file_context *src, Command cmd, const char *label, char
         return;
     }
 
+    if (record_operand_use(op_mode, word, src->lc, p_data_op->data_address, SLOT_DEST) != NO_ERROR) {
+        *report = ERR_MEM_ALLOC;
+        handle_error(ERR_MEM_ALLOC);
+    }
     free(word);
     p_data_word->is_word_complete = 1;
     IC += 2;
@@ -537,13 +784,14 @@ void handle_two_operands(file_context *src, Command cmd, const char *label, char
         handle_error(ERR_EXTRA_TEXT, src);
     } if (word_len > MAX_LABEL_LENGTH || word_len_sec > MAX_LABEL_LENGTH) {
         *report = ERR_OPERAND_TOO_LONG;
-        handle_error(ERR_OPERAND_TOO_LONG);
+        handle_error(ERR_OPERAND_TOO_LONG, src);
     }
 
     op_mode = get_addressing_mode(src, word, word_len, report);
     sec_op_mode = get_addressing_mode(src, next_word, word_len_sec, report);
 
-    if (!is_legal_addressing(src, cmd, op_mode, sec_op_mode, report) ||
+    if ((op_mode == INVALID_MD && is_expression(word)) || (sec_op_mode == INVALID_MD && is_expression(next_word))
+        || !is_legal_addressing(src, cmd, op_mode, sec_op_mode, report) ||
         get_concat_mode(op_mode, sec_op_mode, &concat_1, &concat_2) != NO_ERROR) {
         if (word) free(word);
         if (next_word) free(next_word);
@@ -569,6 +817,12 @@ void handle_two_operands(file_context *src, Command cmd, const char *label, char
         return;
     }
 
+    if (record_operand_use(op_mode, word, src->lc, p_data_op->data_address, SLOT_SOURCE) != NO_ERROR
+        || (concat_1 != REG_REG && record_operand_use(sec_op_mode, next_word, src->lc,
+                                                      p_data_sec_op->data_address, SLOT_DEST) != NO_ERROR)) {
+        *report = ERR_MEM_ALLOC;
+        handle_error(ERR_MEM_ALLOC);
+    }
     p_data_word->is_word_complete = 1;
     if (word) free(word);
     if (next_word) free(next_word);
@@ -578,8 +832,9 @@ void handle_two_operands(file_context *src, Command cmd, const char *label, char
         IC += 2;
         return;
     }
-    if (op_mode == IMMEDIATE || op_mode == REGISTER) p_data_op-> is_word_complete = 1;
-    if (sec_op_mode == IMMEDIATE || sec_op_mode == REGISTER) p_data_sec_op-> is_word_complete = 1;
+    if ((op_mode == IMMEDIATE && !p_data_op->expression) || op_mode == REGISTER) p_data_op-> is_word_complete = 1;
+    if ((sec_op_mode == IMMEDIATE && !p_data_sec_op->expression) || sec_op_mode == REGISTER)
+        p_data_sec_op-> is_word_complete = 1;
 
     IC += 3; /* Instruction + 2 operands words */
 }
@@ -722,19 +977,64 @@ status string_parser(file_context *src, char **word, char *ch, status *report) {
 
 /**
  * Find a symbol in the symbol table based on its label.
+ * Every label of the file goes through here, so the lookup is hashed rather than a scan of the table.
  *
  * @param label The label to search for in the symbol table.
  * @return A pointer to the symbol if found, or NULL if the label is not found.
  */
 symbol* find_symbol(const char* label) {
-    size_t i;
+    if (!label || !symbol_index) return NULL;
+    return *find_symbol_slot(label);
+}
+
+/**
+ * Finds the slot of a label in the symbol index: the slot that holds its symbol, or the empty
+ * slot it would be inserted at.
+ *
+ * @param label The label, the index must exist.
+ * @return The slot.
+ */
+symbol **find_symbol_slot(const char *label) {
+    return &symbol_index[find_label_slot(symbol_index, symbol_index_cap, label, symbol_slot_label)];
+}
+
+/**
+ * Reads the label of a slot of the symbol index, see find_label_slot().
+ *
+ * @param table The symbol index.
+ * @param slot  The slot.
+ * @return The label of its symbol, NULL for an empty slot.
+ */
+const char *symbol_slot_label(const void *table, size_t slot) {
+    const symbol *sym = ((symbol *const *)table)[slot];
+
+    return sym ? sym->label : NULL;
+}
+
+/**
+ * Adds the last symbol of the symbol table to the symbol index, the index is rebuilt twice
+ * as large once it is half full.
+ *
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status index_last_symbol() {
+    symbol **new_index = NULL;
+    size_t new_cap, i;
 
-    if (!label) return NULL;
+    if (symbol_count * 2 <= symbol_index_cap) {
+        *find_symbol_slot(symbol_table[symbol_count - 1]->label) = symbol_table[symbol_count - 1];
+        return NO_ERROR;
+    }
 
-    for (i = 0; i < symbol_count; ++i)
-        if (symbol_table[i] && strcmp(symbol_table[i]->label, label) == 0)
-            return symbol_table[i];
-    return NULL;
+    new_cap = symbol_index_cap ? symbol_index_cap * 2 : SYMBOL_INDEX_MIN_CAP;
+    if (!(new_index = calloc(new_cap, sizeof(symbol *))))
+        return ERR_MEM_ALLOC;
+    free(symbol_index);
+    symbol_index = new_index;
+    symbol_index_cap = new_cap;
+    for (i = 0; i < symbol_count; i++)
+        *find_symbol_slot(symbol_table[i]->label) = symbol_table[i];
+    return NO_ERROR;
 }
 
 /**
@@ -775,13 +1075,16 @@ symbol *add_symbol(file_context *src, const char *label, int address, status *re
     symbol *new_symbol = NULL;
     symbol *existing_symbol = NULL;
     status temp_report;
+    size_t new_cap;
     existing_symbol = find_symbol(label);
 
     if (existing_symbol) {
         if (address == INVALID_ADDRESS)
             return existing_symbol;
-        else if (existing_symbol->is_missing_info)
+        else if (existing_symbol->is_missing_info) {
+            existing_symbol->lc = src->lc; /* the line of the definition, not of the first use */
             return update_symbol_info(existing_symbol, address) == NO_ERROR ? existing_symbol : NULL;
+        }
         else {
             handle_error(ERR_DUP_LABEL, src);
             *report = ERR_DUP_LABEL;
@@ -795,14 +1098,24 @@ symbol *add_symbol(file_context *src, const char *label, int address, status *re
             *report = temp_report;
             return NULL;
         }
-        new_symbol_table = realloc(symbol_table, (symbol_count + 1) * sizeof(symbol*));
+        if (symbol_count == symbol_table_cap) { /* grows geometrically, a symbol is added per label */
+            new_cap = symbol_table_cap ? symbol_table_cap * 2 : DEFAULT_DATA_IMAGE_CAP;
+            if ((new_symbol_table = realloc(symbol_table, new_cap * sizeof(symbol*)))) {
+                symbol_table = new_symbol_table;
+                symbol_table_cap = new_cap;
+            }
+        }
         new_symbol = malloc(sizeof(symbol));
 
-        if (new_symbol) new_symbol->label = new_symbol->address_binary = NULL;
-        if (!label || !new_symbol_table || !new_symbol || copy_string(&(new_symbol->label), label) != NO_ERROR)    {
+        if (new_symbol) {
+            new_symbol->label = new_symbol->address_binary = NULL;
+            new_symbol->uses = NULL;
+            new_symbol->uses_count = new_symbol->uses_cap = 0;
+        }
+        if (!label || symbol_count == symbol_table_cap || !new_symbol
+            || copy_string(&(new_symbol->label), label) != NO_ERROR) {
             handle_error(ERR_MEM_ALLOC);
             if (new_symbol) free_symbol(&new_symbol);
-            symbol_table = new_symbol_table ? new_symbol_table : symbol_table;
             *report = ERR_MEM_ALLOC;
             return NULL;
         }
@@ -820,13 +1133,80 @@ symbol *add_symbol(file_context *src, const char *label, int address, status *re
         new_symbol->lc = src->lc;
         new_symbol->sym_dir = DEFAULT;
         new_symbol->data = NULL;
-        symbol_table = new_symbol_table;
         symbol_table[symbol_count++] = new_symbol;
 
+        if (index_last_symbol() != NO_ERROR) {
+            handle_error(ERR_MEM_ALLOC);
+            *report = ERR_MEM_ALLOC;
+            return NULL;
+        }
         return new_symbol;
     }
 }
 
+/**
+ * Records a use of a label for the .xref output. A use that cannot be recorded is only missing
+ * from the cross-reference, the word itself is assembled regardless.
+ *
+ * @param sym The symbol of the label (optional - NULL).
+ * @param lc The source line of the use.
+ * @param address The address of the word that holds the label.
+ * @param slot Where the label is used in the statement.
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status record_symbol_use(symbol *sym, int lc, int address, Operand_slot slot) {
+    symbol_use *new_uses = NULL;
+    size_t new_cap;
+
+    if (!sym)
+        return NO_ERROR;
+    if (sym->uses_count == sym->uses_cap) {
+        new_cap = sym->uses_cap ? sym->uses_cap * 2 : SYMBOL_USES_MIN_CAP;
+        if (!(new_uses = realloc(sym->uses, new_cap * sizeof(symbol_use))))
+            return ERR_MEM_ALLOC;
+        sym->uses = new_uses;
+        sym->uses_cap = new_cap;
+    }
+    sym->uses[sym->uses_count].lc = lc;
+    sym->uses[sym->uses_count].address = (unsigned short)address;
+    sym->uses[sym->uses_count++].slot = (unsigned char)slot;
+    return NO_ERROR;
+}
+
+/**
+ * Records the uses of the labels of an operand: the label of a direct operand, or the labels of
+ * an expression (see record_expression_uses()).
+ *
+ * @param mode The addressing mode of the operand.
+ * @param word The operand.
+ * @param lc The source line of the use.
+ * @param address The address of the word of the operand.
+ * @param slot Where the operand is used in the statement.
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status record_operand_use(Adrs_mod mode, const char *word, int lc, int address, Operand_slot slot) {
+    if (mode != DIRECT && mode != IMMEDIATE)
+        return NO_ERROR;
+    else if (is_expression(word))
+        return record_expression_uses(word, lc, address, slot);
+    return mode == DIRECT ? record_symbol_use(find_symbol(word), lc, address, slot) : NO_ERROR;
+}
+
+/**
+ * Returns the uses of a label recorded by the first pass, valid until the symbol table is freed
+ * (free_global_data_and_symbol()).
+ *
+ * @param label The label.
+ * @param count Set to the number of uses.
+ * @return The uses in source order, NULL if there are none or if the label is unknown.
+ */
+const symbol_use *get_symbol_uses(const char *label, size_t *count) {
+    symbol *sym = find_symbol(label);
+
+    *count = sym ? sym->uses_count : 0;
+    return *count ? sym->uses : NULL;
+}
+
 /**
  * Adds a data image entry to the data image array.
  *
@@ -873,7 +1253,8 @@ data_image* add_data_image(file_context *src, const char* label, status *report)
             return NULL;
         }
         next_free_address--; /* updated within create_data_image() */
-        new_image->data_address = next_free_address;
+        new_image->data_address = find_symbol(label)->address_decimal; /* the label took the word's address */
+        new_image->has_label = 1;
     }
 
     if (data_arr) {
@@ -914,6 +1295,12 @@ symbol* declare_label(file_context *src, char *label, size_t label_len, status *
         handle_error(ERR_MISSING_COLON, src);
     }
 
+    if (find_constant(label)) {
+        *report = ERR_DUP_CONSTANT;
+        handle_error(ERR_DUP_CONSTANT, src, label);
+        return NULL;
+    }
+
     sym = add_symbol(src, label, next_free_address, report);
     next_free_address = sym ? next_free_address + 1 : next_free_address;
 
@@ -973,14 +1360,26 @@ status assert_value_to_data(file_context *src, Directive dir, Value val_type ,
     symbol *sym = NULL;
     status temp_report = is_valid_label(word);
 
-    if (dir == DATA && val_type == NUM)
+    if (dir == DATA && (val_type == EXP || (val_type == LBL && is_expression(word)))) {
+        if ((temp_report = assemble_expression_value(src, *p_data, word, value)) == NO_ERROR)
+            return NO_ERROR;
+        *report = temp_report == ERR_MEM_ALLOC ? ERR_MEM_ALLOC : ERR_INVALID_EXPRESSION;
+        FREE_AND_NULL(*value);
+        free_data_image(&data_img_obj[--data_arr_obj_index]);
+        return temp_report == ERR_MEM_ALLOC ? TERMINATE : FAILURE;
+    }
+    else if (dir == DATA && val_type == NUM)
         **value = safe_atoi(word);
     else if (dir == STRING && val_type == STR)
         **value = (int)*word;
     else if (temp_report == ERR_MISSING_COLON && val_type == LBL) { /* A label (usage) within statement */
         sym = add_symbol(src, word, INVALID_ADDRESS, report);
+        if (record_symbol_use(sym, src->lc, (*p_data)->data_address, SLOT_DATA) != NO_ERROR) {
+            *report = ERR_MEM_ALLOC;
+            handle_error(ERR_MEM_ALLOC);
+        }
         if (sym && sym->data && sym->data->value)
-            *value = sym->data->value;
+            **value = *(sym->data->value); /* copied, the label's word may be freed independently */
         else if (sym) {
             (*p_data)->p_sym = sym;
             free(*value);
@@ -1003,6 +1402,59 @@ status assert_value_to_data(file_context *src, Directive dir, Value val_type ,
     return NO_ERROR;
 }
 
+/**
+ * Spills every final word assembled since the previous call to the spill stream.
+ *
+ * A word is final once its base64 representation can no longer change. Words that are
+ * still waiting for a label (and words owned by a label) are kept in data_img_obj and are
+ * recorded in the spill stream by a placeholder, so the output order is preserved.
+ * Peak memory is therefore bound by the symbols and unresolved references rather than the program size.
+ *
+ * @return The status of the operation: NO_ERROR on success, ERR_MEM_ALLOC if the spill stream could not be written.
+ */
+status spill_complete_images() {
+    static size_t kept = 0;
+    size_t i;
+    data_image *runner = NULL;
+    char record[BASE64_CHARS];
+
+    if (!spill_stream) {
+        kept = 0;
+        if (!(spill_stream = tmpfile())) {
+            handle_error(TERMINATE, "spill_complete_images()");
+            return ERR_MEM_ALLOC;
+        }
+    }
+
+    for (i = kept; i < data_arr_obj_index; i++) {
+        runner = data_img_obj[i];
+        data_img_obj[i] = NULL;
+
+        if (runner->concat == VALUE && runner->value && !runner->p_sym && !runner->has_label)
+            create_base64_word(runner);
+
+        if (record_source_word(spill_records, runner) != NO_ERROR)
+            return ERR_MEM_ALLOC;
+
+        if (runner->has_label || !runner->is_word_complete || !runner->base64_word) {
+            memset(record, SPILL_KEPT_MARK, BASE64_CHARS);
+            data_img_obj[kept++] = runner;
+        }
+        else {
+            memcpy(record, runner->base64_word, BASE64_CHARS);
+            free_data_image(&runner);
+        }
+
+        if (fwrite(record, 1, BASE64_CHARS, spill_stream) != BASE64_CHARS) {
+            handle_error(TERMINATE, "spill_complete_images()");
+            return ERR_MEM_ALLOC;
+        }
+        spill_records++;
+    }
+    data_arr_obj_index = kept;
+    return NO_ERROR;
+}
+
 /**
  * Generates the output file for the object code.
  *
@@ -1022,22 +1474,33 @@ status generate_output_by_dest(file_context *src, Directive dir) {
 
     char *file_name= src->file_name_wout_ext;
 
-    if (dir == DEFAULT) {
-        dest = create_file_context(file_name, OBJECT_EXT, FILE_EXT_LEN, FILE_MODE_WRITE_PLUS, &report);
+    if (options.check_only) /* Same validation as the output path, without creating any file */
+        p_write_func = dir == DEFAULT ? write_data_img_to_stream : dir == EXTERN ? write_extern_to_stream
+                     : dir == ENTRY ? write_entry_to_stream : NULL;
+    else if (dir == DEFAULT) {
+        dest = create_output_context(file_name, OBJECT_EXT, FILE_EXT_LEN, &report);
         p_write_func = write_data_img_to_stream;
     } else if (dir == EXTERN) {
-        dest = create_file_context(file_name, EXTERNAL_EXT, FILE_EXT_LEN_OUT, FILE_MODE_WRITE_PLUS, &report);
+        dest = create_output_context(file_name, EXTERNAL_EXT, FILE_EXT_LEN_OUT, &report);
         p_write_func = write_extern_to_stream;
     } else if (dir == ENTRY) {
-        dest = create_file_context(file_name, ENTRY_EXT, FILE_EXT_LEN_OUT, FILE_MODE_WRITE_PLUS, &report);
+        dest = create_output_context(file_name, ENTRY_EXT, FILE_EXT_LEN_OUT, &report);
         p_write_func = write_entry_to_stream;
+    } else if (dir == DEBUG_INFO) {
+        dest = create_output_context(file_name, DEBUG_EXT, FILE_EXT_LEN_OUT, &report);
+        p_write_func = write_debug_to_stream;
+    } else if (dir == XREF_INFO) {
+        dest = create_output_context(file_name, XREF_EXT, strlen(XREF_EXT), &report);
+        p_write_func = write_xref_to_stream;
     }
     else {
-        handle_error(TERMINATE, generate_output_by_dest);
+        handle_error(TERMINATE, "generate_output_by_dest()");
         return TERMINATE;
     }
 
-    if (dest && p_write_func)
+    if (options.check_only && p_write_func)
+        return p_write_func(src, NULL);
+    else if (dest && p_write_func)
         report = p_write_func(src, dest->file_ptr);
     else
         return TERMINATE;
@@ -1045,13 +1508,35 @@ status generate_output_by_dest(file_context *src, Directive dir) {
     if (report != NO_ERROR) {
         fclose(dest->file_ptr);
         dest->file_ptr = NULL;
-        remove(dest->file_name);
+        if (!dest->is_scratch) remove(dest->file_name);
+    }
+    else if (dest->is_scratch) { /* --project: the stream is handed over to the caller */
+        rewind(dest->file_ptr);
+        captured_outputs[dir == DEFAULT ? CAPTURED_OB : dir == ENTRY ? CAPTURED_ENT
+                         : dir == EXTERN ? CAPTURED_EXT : CAPTURED_DBG] = dest->file_ptr;
+        dest->file_ptr = NULL;
     }
 
     free_file_context(&dest);
     return report;
 }
 
+/**
+ * Creates the context of an output file: the file itself, or a scratch stream in --project mode,
+ * where the outputs are linked in memory (see captured_outputs).
+ *
+ * @param file_name The file name without extension.
+ * @param ext       The extension of the output file.
+ * @param ext_len   The length of the extension.
+ * @param report    Set to the status of the operation.
+ * @return The context, or NULL if it could not be created.
+ */
+file_context *create_output_context(const char *file_name, char *ext, size_t ext_len, status *report) {
+    if (options.project)
+        return create_scratch_context(file_name, ext, report);
+    return create_file_context(file_name, ext, ext_len, FILE_MODE_WRITE_PLUS, report);
+}
+
 /**
  * Writes the data image to the specified output stream.
  *
@@ -1059,21 +1544,33 @@ status generate_output_by_dest(file_context *src, Directive dir) {
  * instruction count (IC) and data count (DC) in the output.
  *
  * @param src The source file_context pointer.
- * @param dest The output stream to write the data image to.
+ * @param dest The output stream to write the data image to (NULL to only validate the image, see --check).
  * @return The status of the output generation: NO_ERROR on success, TERMINATE if no data
  *         image is available or an error occurred.
  */
 status write_data_img_to_stream(file_context *src, FILE *dest) {
-    size_t i;
-    int error_flag = 0;
+    size_t i, j, total = data_arr_obj_index;
+    int error_flag = 0, lc;
     data_image *runner = NULL;
+    char record[BASE64_CHARS];
 
-    if (!data_arr_obj_index) return FAILURE; /* not an actual error, just no output file has been created */
+    if (IMAGE_IS_EMPTY()) return FAILURE; /* not an actual error, just no output file has been created */
 
     for (i = 0; i < data_arr_obj_index; i++) {
         runner = data_img_obj[i];
-        if (!runner->value && runner->p_sym && runner->concat == VALUE) {
-            if (runner->p_sym->data) {
+        if (runner->expression) {
+            if (resolve_expression(src, runner) != NO_ERROR)
+                error_flag = 1;
+        }
+        else if (!runner->value && runner->p_sym && runner->concat == VALUE) {
+            if (runner->p_sym->data && !runner->p_sym->data->value) { /* the label of an instruction */
+                error_flag = 1;
+                lc = src->lc;
+                src->lc = runner->lc;
+                handle_error(ERR_FORBIDDEN_LABEL_DECLARE, src, runner->p_sym->label);
+                src->lc = lc;
+            }
+            else if (runner->p_sym->data) {
                 runner->value = malloc(sizeof(int));
                 if (runner->value != NULL)
                     *(runner->value) = *(runner->p_sym->data->value);
@@ -1090,19 +1587,46 @@ status write_data_img_to_stream(file_context *src, FILE *dest) {
         }
     }
 
+    if (!dest) /* --check */
+        return error_flag ? TERMINATE : NO_ERROR;
+
     fprintf(dest, "%lu %lu", (unsigned long)IC, (unsigned long)DC);
 
-    for (i = 0; i < data_arr_obj_index && !error_flag; i++) {
-        if (!data_img_obj[i]->is_word_complete)
-            create_base64_word(data_img_obj[i]);
-        if (!data_img_obj[i]->base64_word) {
+    if (spill_stream) {
+        total = spill_records;
+        rewind(spill_stream);
+    }
+
+    for (i = 0, j = 0; i < total && !error_flag; i++) {
+        if (spill_stream) {
+            if (fread(record, 1, BASE64_CHARS, spill_stream) != BASE64_CHARS) {
+                error_flag = 1;
+                handle_error(TERMINATE, "write_data_img_to_stream()");
+                break;
+            } else if (*record != SPILL_KEPT_MARK) {
+                fprintf(dest, "\n%.2s", record);
+                if (captured_module && i < MAX_MEMORY_SIZE)
+                    captured_module->words[i] = (unsigned short)base64_to_word(record);
+                continue;
+            }
+        }
+        runner = data_img_obj[j++];
+        if (!spill_stream && record_source_word(i, runner) != NO_ERROR) {
+            error_flag = 1;
+            break;
+        }
+        if (!runner->is_word_complete)
+            create_base64_word(runner);
+        if (!runner->base64_word) {
             error_flag = 1;
             handle_error(TERMINATE, "write_data_img_to_stream()");
             break;
         }
-        fprintf(dest, "\n%s", data_img_obj[i]->base64_word);
-        free(data_img_obj[i]->base64_word);
-        data_img_obj[i]->base64_word = NULL;
+        fprintf(dest, "\n%s", runner->base64_word);
+        if (captured_module && i < MAX_MEMORY_SIZE)
+            captured_module->words[i] = (unsigned short)base64_to_word(runner->base64_word);
+        free(runner->base64_word);
+        runner->base64_word = NULL;
     }
     return error_flag ? TERMINATE : NO_ERROR;
 }
@@ -1114,7 +1638,7 @@ status write_data_img_to_stream(file_context *src, FILE *dest) {
  * output stream. Only generates output if there are existing entry symbols.
  *
  * @param src The source file_context pointer.
- * @param dest The output stream to write the entry information to.
+ * @param dest The output stream to write the entry information to (NULL to only validate).
  * @return The status of the output generation: NO_ERROR if output was generated
  *         and no errors were encountered, TERMINATE if no output was generated
  *         (no entry symbols), or FAILURE in case of an error.
@@ -1125,7 +1649,7 @@ status write_entry_to_stream(file_context *src, FILE *dest) {
     int error_flag = 0;
     symbol *runner = NULL;
 
-    if (!data_arr_obj_index) return FAILURE;
+    if (IMAGE_IS_EMPTY()) return FAILURE;
 
     for (i = 0; i < symbol_count; i++) {
         runner = symbol_table[i];
@@ -1135,7 +1659,7 @@ status write_entry_to_stream(file_context *src, FILE *dest) {
                 handle_error(ERR_LABEL_DOES_NOT_EXIST, src, runner->label, runner->lc);
                 continue;
             }
-            if (!error_flag)
+            if (!error_flag && dest)
                 fprintf(dest, "%s\t%d\n", runner->label, runner->address_decimal);
         }
     }
@@ -1149,7 +1673,7 @@ status write_entry_to_stream(file_context *src, FILE *dest) {
  * output stream. Generates output only if there are existing extern symbols.
  *
  * @param src The source file_context pointer.
- * @param dest The output stream to write the extern information to.
+ * @param dest The output stream to write the extern information to (NULL to only validate).
  * @return The status of the output generation: NO_ERROR if output was generated
  *         and no errors were encountered, TERMINATE if no output was generated
  *         (no extern symbols), or FAILURE in case of an error.
@@ -1160,11 +1684,14 @@ status write_extern_to_stream(file_context *src, FILE *dest) {
     data_image *runner = NULL;
     symbol *sym = NULL;
 
-    if (!data_arr_obj_index) return FAILURE;
+    if (IMAGE_IS_EMPTY()) return FAILURE;
 
     for (i = 0; i < data_arr_obj_index; i++) {
         runner = data_img_obj[i];
         if (runner && runner->p_sym && runner->p_sym->sym_dir == EXTERN) {
+            runner->p_sym->is_missing_info = 0;
+            if (!dest)
+                continue; /* --check: the words are not written, only the unused externals are reported */
             if (runner->p_sym->address_binary) free (runner->p_sym->address_binary);
 
             runner->p_sym->address_binary = decimal_to_binary12(EXTERNAL);
@@ -1173,12 +1700,12 @@ status write_extern_to_stream(file_context *src, FILE *dest) {
                 return ERR_MEM_ALLOC;
             }
 
-            runner->p_sym->is_missing_info = 0;
             runner->p_sym->address_decimal = 0;
             *(runner->value) = 0;
-            if (create_base64_word(runner) == NO_ERROR && (runner->is_word_complete = 1))
-                fprintf(dest, "%s\t%d\n", runner->p_sym->label, runner->data_address);
-            else {
+            if (create_base64_word(runner) == NO_ERROR && (runner->is_word_complete = 1)) {
+                if (dest)
+                    fprintf(dest, "%s\t%d\n", runner->p_sym->label, runner->data_address);
+            } else {
                 handle_error(TERMINATE, "write_extern_to_stream()");
                 error_flag = 1;
             }
@@ -1192,13 +1719,202 @@ status write_extern_to_stream(file_context *src, FILE *dest) {
     return error_flag ? TERMINATE : NO_ERROR;
 }
 
+/**
+ * Writes the source map of the program (.dbg): the source line and kind of every word, recorded
+ * while the words were written (see record_debug_line()), and the address and line of every symbol.
+ *
+ * @param src The source file_context pointer.
+ * @param dest The output stream to write the source map to.
+ * @return The status of the output generation: NO_ERROR on success, ERR_MEM_ALLOC or FAILURE otherwise.
+ */
+status write_debug_to_stream(file_context *src, FILE *dest) {
+    debug_info info;
+    symbol *runner = NULL;
+    status report;
+    size_t i;
+
+    info.source = src->file_name;
+    info.lines = debug_lines;
+    info.is_data = debug_data;
+    info.size = IC + DC;
+    info.symbols_count = 0;
+    if (!(info.symbols = malloc((symbol_count ? symbol_count : 1) * sizeof(debug_symbol)))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < symbol_count; i++) {
+        runner = symbol_table[i];
+        if (!runner || runner->sym_dir == EXTERN || runner->address_decimal < ADDRESS_START)
+            continue;
+        strcpy(info.symbols[info.symbols_count].label, runner->label);
+        info.symbols[info.symbols_count].address = runner->address_decimal;
+        info.symbols[info.symbols_count].line = runner->lc;
+        info.symbols[info.symbols_count++].is_entry = runner->sym_dir == ENTRY;
+    }
+
+    report = write_debug_info(dest, &info);
+    free(info.symbols);
+    return report;
+}
+
+/**
+ * Writes the cross-reference of the program (.xref): every use of every label, one per line,
+ * "LABEL<tab>LINE<tab>ADDRESS<tab>SLOT" with SLOT one of src, dest or data. The labels are in the
+ * order they first appear, their uses in source order, and the lines are the ones of the .am file.
+ *
+ * @param src The source file_context pointer.
+ * @param dest The output stream to write the cross-reference to.
+ * @return The status of the output generation: NO_ERROR on success, FAILURE otherwise.
+ */
+status write_xref_to_stream(file_context *src, FILE *dest) {
+    symbol *runner = NULL;
+    size_t i, j;
+
+    (void) src;
+    for (i = 0; i < symbol_count; i++) {
+        runner = symbol_table[i];
+        for (j = 0; runner && j < runner->uses_count; j++)
+            if (fprintf(dest, XREF_LINE_FORMAT, runner->label, runner->uses[j].lc,
+                        runner->uses[j].address, operand_slot_names[runner->uses[j].slot]) < 0)
+                return FAILURE;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Records where a word comes from, once its place in the image is final: its source line for the
+ * .dbg output, and its line and kind for the captured module.
+ *
+ * @param index The index of the word in the image (its address minus ADDRESS_START).
+ * @param word  The word.
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status record_source_word(size_t index, const data_image *word) {
+    if (captured_module && index < MAX_MEMORY_SIZE) {
+        captured_module->lines[index] = (unsigned short)word->lc;
+        captured_module->is_data[index] = word->concat == VALUE;
+    }
+    return options.debug_info ? record_debug_line(index, word->lc, word->concat == VALUE) : NO_ERROR;
+}
+
+/**
+ * Records the source line of a word for the .dbg output, and whether it is a .data or .string value.
+ *
+ * @param index     The index of the word in the image (its address minus ADDRESS_START).
+ * @param lc        The source line of the word.
+ * @param is_data   1 for a value of .data or .string, 0 for a word of an instruction.
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status record_debug_line(size_t index, int lc, int is_data) {
+    unsigned short *new_lines = NULL;
+    unsigned char *new_data = NULL;
+    size_t new_cap;
+
+    if (index >= debug_lines_cap) {
+        for (new_cap = debug_lines_cap ? debug_lines_cap : DEFAULT_DATA_IMAGE_CAP; new_cap <= index; new_cap *= 2)
+            ;
+        if (!(new_lines = realloc(debug_lines, new_cap * sizeof(unsigned short)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        debug_lines = new_lines;
+        if (!(new_data = realloc(debug_data, new_cap))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        debug_data = new_data;
+        debug_lines_cap = new_cap;
+    }
+    debug_lines[index] = (unsigned short)lc;
+    debug_data[index] = (unsigned char)is_data;
+    return NO_ERROR;
+}
+
+/**
+ * Fills captured_module, once its words have been written, with the state of the first pass: the
+ * symbol table and the uses of every label. The words that hold an address are the ones the uses
+ * of the operands point at (see record_symbol_use()), with the A,R,E bits the word was encoded with:
+ * a relocatable address, or the 0 of an external symbol. The uses follow the words moved by -O,
+ * --prune and .rept, and a .data value is never one of them, whatever its bits.
+ *
+ * @return NO_ERROR on success, ERR_MEM_ALLOC otherwise.
+ */
+status capture_module() {
+    object_module *module = captured_module;
+    unsigned char are[MAX_MEMORY_SIZE];
+    module_symbol *dest = NULL;
+    module_use *use = NULL;
+    symbol *runner = NULL;
+    size_t i, j, uses_count = 0;
+    int offset;
+
+    module->ic = IC;
+    module->dc = DC;
+    module->size = IC + DC;
+    for (i = 0; i < symbol_count; i++)
+        uses_count += symbol_table[i] ? symbol_table[i]->uses_count : 0;
+    if (!(module->symbols = malloc((symbol_count ? symbol_count : 1) * sizeof(module_symbol)))
+        || !(module->uses = malloc((uses_count ? uses_count : 1) * sizeof(module_use)))
+        || !(module->relocations = malloc((size_t)(module->size ? module->size : 1) * sizeof(module_relocation)))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    memset(are, ABSOLUTE, sizeof(are));
+    for (i = 0; i < symbol_count; i++) {
+        if (!(runner = symbol_table[i]))
+            continue;
+        dest = &module->symbols[module->symbols_count];
+        strcpy(dest->label, runner->label);
+        dest->address = runner->sym_dir == EXTERN ? 0 : runner->address_decimal;
+        dest->line = runner->lc;
+        dest->flags = runner->sym_dir == ENTRY ? MODULE_SYMBOL_ENTRY : runner->sym_dir == EXTERN ? MODULE_SYMBOL_EXTERN : 0;
+
+        for (j = 0; j < runner->uses_count; j++) {
+            use = &module->uses[module->uses_count++];
+            use->symbol = (int)module->symbols_count;
+            use->line = runner->uses[j].lc;
+            use->address = runner->uses[j].address;
+            use->slot = runner->uses[j].slot;
+            offset = use->address - ADDRESS_START;
+            if (use->slot != SLOT_DATA && offset >= 0 && offset < module->size)
+                are[offset] = (unsigned char)WORD_ARE(module->words[offset]);
+        }
+        module->symbols_count++;
+    }
+
+    for (offset = 0; offset < module->size; offset++) {
+        if (are[offset] == RELOCATABLE || are[offset] == EXTERNAL) {
+            module->relocations[module->relocations_count].offset = offset;
+            module->relocations[module->relocations_count++].are = are[offset];
+        }
+    }
+    module->is_relocatable = 1;
+    return NO_ERROR;
+}
+
 /**
  * Frees the global data image arrays and symbol table.
  */
 void free_global_data_and_symbol() {
     free_data_image_array(&data_img_obj, &data_arr_obj_index);
     free_symbol_table(&symbol_table, &symbol_count);
+    symbol_table_cap = 0;
+    FREE_AND_NULL(symbol_index);
+    symbol_index_cap = 0;
+    if (spill_stream) {
+        fclose(spill_stream);
+        spill_stream = NULL;
+    }
+    spill_records = 0;
+    FREE_AND_NULL(debug_lines);
+    FREE_AND_NULL(debug_data);
+    debug_lines_cap = 0;
     DC = IC = 0;
+    repeat_depth = 0;
+    keep_label_expressions = 0;
+    free_constants();
     next_free_address = ADDRESS_START;
     (void) add_data_image(NULL, NULL, NULL); /* resetting static variables */
     (void) string_parser(NULL, NULL, NULL, NULL);
@@ -1214,7 +1930,7 @@ void free_global_data_and_symbol() {
  */
 void cleanup(file_context **src) {
     file_context *p_src = *src;
-    remove(p_src->file_name);
+    if (!p_src->is_scratch) remove(p_src->file_name);
     p_src->file_ptr = NULL;
     free_file_context(&p_src);
     *src = NULL;
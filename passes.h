@@ -19,22 +19,81 @@
 #define AMT_WORD_1 1
 #define ADDRESS_START 100
 #define MAX_MEMORY_SIZE 1024
+#define SYMBOL_INDEX_MIN_CAP 64
+#define SYMBOL_USES_MIN_CAP 4
+#define REPEAT_START ".rept"
+#define REPEAT_END ".endr"
+#define MAX_REPEAT_DEPTH 8
+
+/* A .rept block whose body is being assembled, replicated when its .endr is reached */
+typedef struct {
+    size_t first; /* index of its first word in data_img_obj */
+    int address; /* of its first word */
+    int ic;
+    int dc;
+    int count;
+    int lc; /* of the .rept line */
+} repeat_block;
+
+/* Outputs of a file in --project mode, in memory rather than on the disk */
+typedef enum {
+    CAPTURED_OB,
+    CAPTURED_ENT,
+    CAPTURED_EXT,
+    CAPTURED_DBG,
+    CAPTURED_AOBJ, /* written by store_aobj(), the module the file is linked from */
+    CAPTURED_OUTPUTS_LEN
+} Captured_output;
+
+extern FILE *captured_outputs[CAPTURED_OUTPUTS_LEN];
+
+/* --aobj: the module of the last file with the state of its first pass, see object.h */
+struct object_module;
+extern struct object_module *captured_module;
+
+/* State of the first pass, reset by free_global_data_and_symbol() */
+extern symbol **symbol_table;
+extern data_image **data_img_obj;
+extern size_t symbol_count;
+extern size_t data_arr_obj_index;
+extern int DC;
+extern int IC;
+extern int next_free_address;
+extern int keep_label_expressions;
 
 status assembler_first_pass(file_context **src);
 status assembler_second_pass(file_context **src);
 status update_symbol_info(symbol* sym, int address);
 status process_line(file_context *src, char *p_line);
+status handle_repeat(file_context *src, char *line, int *handled);
+char *scan_repeat(char *line, int *is_start);
+status open_repeat(file_context *src, char *count);
+status close_repeat(file_context *src, char *rest);
+status repeat_symbol_uses(int address, int size, int count);
+status spill_complete_images();
 status write_entry_to_stream(file_context *src, FILE *dest);
 status write_extern_to_stream(file_context *src, FILE *dest);
 status write_data_img_to_stream(file_context *src, FILE *dest);
+status write_debug_to_stream(file_context *src, FILE *dest);
+status write_xref_to_stream(file_context *src, FILE *dest);
+status record_source_word(size_t index, const data_image *word);
+status record_debug_line(size_t index, int lc, int is_data);
+status capture_module();
 status generate_output_by_dest(file_context *src, Directive dir);
+file_context *create_output_context(const char *file_name, char *ext, size_t ext_len, status *report);
 status string_parser(file_context *src, char **word, char *ch, status *report);
 status assert_value_to_data(file_context *src, Directive dir, Value val_type, char *word, int **value,
                                                                    data_image **p_data, status *report);
 
 symbol* find_symbol(const char* label);
+symbol **find_symbol_slot(const char *label);
+const char *symbol_slot_label(const void *table, size_t slot);
+status index_last_symbol();
 symbol* add_symbol(file_context *src, const char* label, int address, status *report);
 symbol *declare_label(file_context *src, char *label, size_t label_len, status *report);
+status record_symbol_use(symbol *sym, int lc, int address, Operand_slot slot);
+status record_operand_use(Adrs_mod mode, const char *word, int lc, int address, Operand_slot slot);
+const symbol_use *get_symbol_uses(const char *label, size_t *count);
 
 Value line_parser(file_context *src, Directive dir, char **line, char **word, status *report);
 
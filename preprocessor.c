@@ -1,14 +1,26 @@
+#define _XOPEN_SOURCE 700
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "preprocessor.h"
+#include "macrolib.h"
 #include "utils.h"
 #include "errors.h"
 
 macro_node* macro_head = NULL; /* Head of the macros linked list */
 macro_node* macro_tail = NULL; /* Tail of the macros linked list */
 
+include_entry *include_cache = NULL; /* Included files preprocessed by the process, see include_entry */
+char **included = NULL; /* Canonical paths of the files the current source has included */
+size_t included_count = 0, included_cap = 0;
+include_dep *include_deps = NULL; /* Files read for the current source, in the order they are included */
+size_t include_deps_count = 0, include_deps_cap = 0;
+int includes_skipped = 0; /* .include lines of the current source skipped as already included */
+macro_lib library = {0}; /* The --macro-lib file, mapped until another one is used */
+macro_node **library_nodes = NULL; /* The macros of the library looked up so far, by index */
+
 #define HANDLE_REPORT if(report == ERR_MEM_ALLOC || report == TERMINATE) return TERMINATE; \
 else if (report != NO_ERROR) found_error = 1;
 
@@ -17,6 +29,35 @@ else if (report != NO_ERROR) found_error = 1;
 
 #define IS_EMPTY() (macro_head == NULL)
 
+#define IS_NAME_CHAR(ch) (isalnum((unsigned char)(ch)) || (ch) == '_')
+
+#define MLIB_SIGNATURE_LEN 72 /* three numbers and the separators after the path of the library */
+
+/* Conditional directives, in Conditional order from COND_IF */
+static const char *conditionals[] = {".if", ".ifdef", ".ifndef", ".else", ".endif"};
+
+/* "Private" helper functions */
+int parse_condition_operand(char **p, int *value);
+size_t name_length(const char *name);
+macro_node *find_called_macro(const char *line, size_t len);
+status append_text(char **text, size_t *len, size_t *cap, const char *src, size_t src_len);
+int is_included(const char *path);
+status add_included(const char *path);
+status add_include_dep(const char *path, const struct stat *st);
+status copy_include_dep(const include_dep *dep);
+int is_dep_unchanged(const include_dep *dep);
+status add_included_macros(file_context *src, macro_node *macros);
+include_entry *find_include_entry(const char *path, const char *signature);
+status store_include_entry(const char *path, const char *signature, size_t first_dep, char *text, size_t text_len,
+                           macro_node *macros);
+file_context *open_include(const char *found, const file_context *src);
+char *include_signature();
+char *read_scratch(FILE *fp, size_t *len);
+void free_macro_list(macro_node *head);
+void free_include_entry(include_entry *entry);
+macro_node *library_macro(const char *name);
+void free_library_nodes();
+
 /**
  * Processes the input source file for assembler preprocessing.
  *
@@ -30,24 +71,87 @@ else if (report != NO_ERROR) found_error = 1;
  * @return NO_ERROR if successful, or an appropriate error status otherwise.
  */
 status assembler_preprocessor(file_context *src, file_context *dest) {
+    char *path = NULL;
+    status report = NO_ERROR;
+
+    if (!src || !dest)
+        return FAILURE; /* Unexpected error, probably unreachable */
+
+    /* A source that includes itself is not expanded again */
+    if ((report = use_macro_library(options.macro_lib)) == NO_ERROR && (path = realpath(src->file_name, NULL)))
+        report = add_included(path);
+    free(path);
+    if (report == NO_ERROR)
+        report = preprocess_lines(src, dest, 0);
+
+    /* Reset line counter and rewind files */
+    dest->lc = 1;
+    rewind(dest->file_ptr);
+
+
+    if (report != NO_ERROR) { /* Error found, output file should be removed */
+        fclose(dest->file_ptr);
+        dest->file_ptr = NULL;
+        if (!dest->is_scratch) remove(dest->file_name);
+    }
+
+    free_macros();
+    reset_includes();
+    return report == NO_ERROR ? NO_ERROR : report == TERMINATE ? TERMINATE : FAILURE;
+}
+
+/**
+ * Preprocesses the lines of a source or included file into the destination file.
+ *
+ * @param src   Pointer to the source file_context struct.
+ * @param dest  Pointer to the destination file_context struct.
+ * @param depth The number of files the source is included within, 0 for the source assembled.
+ *
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or TERMINATE.
+ */
+status preprocess_lines(file_context *src, file_context *dest, int depth) {
     char line[MAX_BUFFER_LENGTH];
     char *macro_name = NULL, *macro_body = NULL;
     unsigned int line_len;
-    int found_macro = 0, found_error = 0, ch = -1;
+    int found_macro = 0, found_error = 0, ch = -1, lc;
+    char *rest = NULL;
+    conditional_stack conds;
+    Conditional cond;
     status report;
 
-    if (!src || !dest)
-        return FAILURE; /* Unexpected error, probably unreachable */
     rewind(src->file_ptr); /* make sure we read from the beginning */
+    memset(&conds, 0, sizeof(conditional_stack));
 
-    while (fscanf(src->file_ptr, "%[^\n]%*c", line) == 1
-            || (ch = fgetc(src->file_ptr)) == '\n') {
+    while ((fscanf(src->file_ptr, "%[^\n]%*c", line) == 1
+            || (ch = fgetc(src->file_ptr)) == '\n') && !diagnostics_limit_reached()) {
 
+        if (ch == '\n') { /* checked first, line still holds the previous line */
+            if (!conds.skipping)
+                fprintf(dest->file_ptr, "\n");
+            ch = -1;
+            continue;
+        }
         if (*line == ';')
             continue;
-        if (ch == '\n') {
-            fprintf(dest->file_ptr, "\n");
-            ch = -1;
+
+        /* A skipped line is never tokenized or expanded, only its first word is compared */
+        cond = scan_conditional(line, &rest);
+        if (cond != COND_NONE || conds.skipping) {
+            if (cond != COND_NONE && handle_conditional(src, &conds, cond, rest) != NO_ERROR)
+                found_error = 1;
+            src->lc++;
+            continue;
+        }
+
+        if (scan_include(line, &rest)) {
+            if (found_macro) { /* the included lines cannot be part of a macro body */
+                handle_error(ERR_INVALID_INCLUDE, src);
+                report = FAILURE;
+            }
+            else
+                report = handle_include(src, dest, rest, depth, found_error);
+            HANDLE_REPORT;
+            src->lc++;
             continue;
         }
 
@@ -72,19 +176,170 @@ status assembler_preprocessor(file_context *src, file_context *dest) {
 
         src->lc++;
     }
-    /* Reset line counter and rewind files */
-    dest->lc = 1;
-    rewind(dest->file_ptr);
+    if (conds.depth) { /* reported on the outermost block left open */
+        lc = src->lc;
+        src->lc = conds.line[0];
+        handle_error(ERR_MISSING_ENDIF, src);
+        src->lc = lc;
+        found_error = 1;
+    }
+
+    free(macro_name);
+    free(macro_body);
+    return found_error ? FAILURE : NO_ERROR;
+}
 
+/**
+ * Handles an .include "file" line: the file is preprocessed in place of the line, once per source.
+ * The name is looked up relative to the directory of the including file, then in the -I directories.
+ *
+ * @param src           Pointer to the source file_context struct.
+ * @param dest          Pointer to the destination file_context struct.
+ * @param rest          The text after the directive.
+ * @param depth         The number of files the source is included within.
+ * @param found_error   Flag indicating whether an error is found, nothing is written then.
+ *
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or ERR_MEM_ALLOC.
+ */
+status handle_include(file_context *src, file_context *dest, char *rest, int depth, int found_error) {
+    char name[MAX_BUFFER_LENGTH];
+    char *path = NULL, *found = NULL, *signature = NULL;
+    include_entry *entry = NULL;
+    size_t i;
+    status report;
 
-    if (found_error) { /* Error found, output file should be removed */
-        fclose(dest->file_ptr);
-        dest->file_ptr = NULL;
-        remove(dest->file_name);
+    if (include_name(rest, name) != NO_ERROR) {
+        handle_error(ERR_INVALID_INCLUDE, src);
+        return FAILURE;
+    }
+    if (depth == MAX_INCLUDE_DEPTH) {
+        handle_error(ERR_INCLUDE_TOO_DEEP, src);
+        return FAILURE;
+    }
+    if (!(path = resolve_include(src->file_name, name, &found))) {
+        handle_error(ERR_INCLUDE_NOT_FOUND, src, name);
+        return FAILURE;
+    }
+    if (is_included(path)) {
+        includes_skipped++;
+        free(path);
+        free(found);
+        return NO_ERROR;
+    }
+    if (!(signature = include_signature())) {
+        free(path);
+        free(found);
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
     }
 
-    free_macros();
-    return found_error ? FAILURE : NO_ERROR;
+    /* The cached text holds the files the file includes, it is of no use once one of them is included */
+    if ((entry = find_include_entry(path, signature)))
+        for (i = 0; entry && i < entry->deps_count; i++)
+            if (is_included(entry->deps[i].path))
+                entry = NULL;
+    if (entry)
+        report = use_include_entry(src, dest, entry, found_error);
+    else
+        report = preprocess_include(src, dest, path, found, depth, found_error, signature);
+
+    free(path);
+    free(found);
+    free(signature);
+    return report;
+}
+
+/**
+ * Preprocesses an included file, with macros of its own, and writes the text it expands to in place
+ * of the .include line. Its macros are then added to the macros of the including file. The result is
+ * kept in the include cache, unless part of it has been left out as already included by the source.
+ *
+ * @param src           Pointer to the including file_context struct.
+ * @param dest          Pointer to the destination file_context struct.
+ * @param path          The canonical path of the included file.
+ * @param found         The path the file has been found at, the errors of its lines are reported with it.
+ * @param depth         The number of files the including file is included within.
+ * @param found_error   Flag indicating whether an error is found, nothing is written then.
+ * @param signature     The options the file is preprocessed with, see include_signature().
+ *
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or ERR_MEM_ALLOC.
+ */
+status preprocess_include(file_context *src, file_context *dest, const char *path, const char *found, int depth,
+                          int found_error, const char *signature) {
+    file_context *inc = NULL, *text = NULL;
+    macro_node *saved_head = macro_head, *saved_tail = macro_tail, *macros = NULL;
+    struct stat st;
+    char *buffer = NULL;
+    size_t len = 0, first_dep = include_deps_count;
+    int skipped = includes_skipped;
+    status report = NO_ERROR;
+
+    if (stat(path, &st) != 0 || !(inc = open_include(found, src))) {
+        handle_error(ERR_INCLUDE_NOT_FOUND, src, (char *)found);
+        return FAILURE;
+    }
+    if (!(text = create_scratch_context(found, PREPROCESSOR_EXT, &report))) {
+        free_file_context(&inc);
+        return report == ERR_MEM_ALLOC ? ERR_MEM_ALLOC : FAILURE;
+    }
+    if ((report = add_included(path)) != NO_ERROR
+        || (report = add_include_dep(path, &st)) != NO_ERROR) {
+        free_file_context(&inc);
+        free_file_context(&text);
+        return report;
+    }
+
+    macro_head = macro_tail = NULL;
+    report = preprocess_lines(inc, text, depth + 1);
+    macros = macro_head;
+    macro_head = saved_head;
+    macro_tail = saved_tail;
+
+    if (report == NO_ERROR && !(buffer = read_scratch(text->file_ptr, &len)))
+        report = ERR_MEM_ALLOC;
+    if (report == NO_ERROR) {
+        if (!found_error && len)
+            fwrite(buffer, 1, len, dest->file_ptr);
+        report = add_included_macros(src, macros);
+        if (report != ERR_MEM_ALLOC && report != TERMINATE && includes_skipped == skipped
+            && store_include_entry(path, signature, first_dep, buffer, len, macros) == NO_ERROR) {
+            buffer = NULL; /* owned by the cache */
+            macros = NULL;
+        }
+    }
+
+    free(buffer);
+    free_macro_list(macros);
+    free_file_context(&inc);
+    free_file_context(&text);
+    return report == TERMINATE ? ERR_MEM_ALLOC : report;
+}
+
+/**
+ * Writes the cached text of an included file in place of the .include line and adds its macros to
+ * the macros of the including file.
+ *
+ * @param src           Pointer to the including file_context struct.
+ * @param dest          Pointer to the destination file_context struct.
+ * @param entry         The include cache entry of the file.
+ * @param found_error   Flag indicating whether an error is found, nothing is written then.
+ *
+ * @return NO_ERROR if successful, FAILURE if an error has been reported, or ERR_MEM_ALLOC.
+ */
+status use_include_entry(file_context *src, file_context *dest, const include_entry *entry, int found_error) {
+    size_t i;
+    status report = NO_ERROR;
+
+    for (i = 0; i < entry->deps_count && report == NO_ERROR; i++)
+        if ((report = add_included(entry->deps[i].path)) == NO_ERROR)
+            report = copy_include_dep(&entry->deps[i]);
+    if (report != NO_ERROR)
+        return report;
+
+    if (!found_error && entry->text_len)
+        fwrite(entry->text, 1, entry->text_len, dest->file_ptr);
+    report = add_included_macros(src, entry->macros);
+    return report == TERMINATE ? ERR_MEM_ALLOC : report;
 }
 
 /**
@@ -344,9 +599,13 @@ status write_to_file(file_context *src, file_context *dest, char *line, int foun
         found_macro = 0;
 
         if ((matched_macro = is_macro_exists(word))) {
-                /* Replace the macro name with the macro body */
+                /* Replace the macro name with the macro body, the macros it calls expanded */
                 found_macro = 1;
-                fprintf(dest->file_ptr, "%s", matched_macro->body);
+                if (flatten_macro(src, matched_macro, 0) != NO_ERROR) {
+                    free(word);
+                    return FAILURE;
+                }
+                fputs(matched_macro->expansion, dest->file_ptr);
         }
         if (strncmp(word, MACRO_END,SKIP_MCRO) == 0) {
             ptr += SKIP_MCR0_END;
@@ -378,6 +637,320 @@ status write_to_file(file_context *src, file_context *dest, char *line, int foun
     return NO_ERROR;
 }
 
+/**
+ * Returns the conditional directive a line starts with. Only the first word of the line is
+ * compared, so that the lines of a skipped block cost a single comparison.
+ *
+ * @param line  The input line.
+ * @param rest  Set to the text after the directive, if any.
+ * @return The conditional directive, or COND_NONE if the line does not start with one.
+ */
+Conditional scan_conditional(const char *line, char **rest) {
+    const char *p = line;
+    size_t len, i;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p != '.')
+        return COND_NONE;
+    for (len = 1; p[len] && !isspace((unsigned char)p[len]); len++)
+        ;
+    for (i = 0; i < sizeof(conditionals) / sizeof(*conditionals); i++) {
+        if (strlen(conditionals[i]) == len && strncmp(p, conditionals[i], len) == 0) {
+            *rest = (char *)p + len;
+            return (Conditional)(COND_IF + i);
+        }
+    }
+    return COND_NONE;
+}
+
+/**
+ * Handles a conditional directive line: opens, switches or closes a block and decides whether
+ * the lines that follow are skipped.
+ *
+ * @param src   Pointer to the source file_context struct.
+ * @param conds The open blocks.
+ * @param cond  The directive of the line.
+ * @param rest  The text after the directive.
+ * @return NO_ERROR if successful, FAILURE if an error has been reported.
+ */
+status handle_conditional(file_context *src, conditional_stack *conds, Conditional cond, char *rest) {
+    int result = 0, top = conds->depth - 1, line_offset = 0;
+    status report = NO_ERROR;
+
+    if (conds->skipping && cond != COND_ELSE && cond != COND_ENDIF) { /* nested in a skipped block */
+        conds->skipped_nested++;
+        return NO_ERROR;
+    }
+    if (conds->skipping && conds->skipped_nested) {
+        if (cond == COND_ENDIF)
+            conds->skipped_nested--;
+        return NO_ERROR;
+    }
+
+    if (cond == COND_ELSE || cond == COND_ENDIF) {
+        COUNT_SPACES(line_offset, rest);
+        if (!conds->depth) {
+            handle_error(ERR_MISSING_IF, src);
+            return FAILURE;
+        }
+        if (rest[line_offset] != '\0') { /* still applied, so that the blocks that follow are matched */
+            handle_error(ERR_EXTRA_TEXT, src);
+            report = FAILURE;
+        }
+        if (cond == COND_ENDIF) {
+            conds->depth--;
+            conds->skipping = 0;
+        }
+        else if (conds->has_else[top]) {
+            handle_error(ERR_DUP_ELSE, src);
+            report = FAILURE;
+        }
+        else {
+            conds->has_else[top] = 1;
+            conds->skipping = conds->taken[top];
+            conds->taken[top] = 1;
+        }
+        return report;
+    }
+
+    if (conds->depth == MAX_IF_DEPTH) {
+        handle_error(ERR_IF_TOO_DEEP, src);
+        return FAILURE;
+    }
+    if ((report = evaluate_condition(cond, rest, &result)) != NO_ERROR) {
+        handle_error(ERR_INVALID_CONDITION, src);
+        report = FAILURE;
+        result = 0; /* the block is still opened, its .else and .endif are matched */
+    }
+    conds->line[conds->depth] = src->lc;
+    conds->has_else[conds->depth] = 0;
+    conds->taken[conds->depth++] = (char)(result != 0);
+    conds->skipping = !result;
+    return report;
+}
+
+/**
+ * Evaluates the condition of an opening conditional directive:
+ * .ifdef NAME and .ifndef NAME test whether NAME is defined (-DNAME[=VALUE]),
+ * .if A [OP B] compares two operands with ==, !=, <, >, <= or >=, or tests a single one against 0.
+ * An operand is a decimal number or a NAME, whose value is 0 when it is not defined.
+ *
+ * @param cond      COND_IF, COND_IFDEF or COND_IFNDEF.
+ * @param rest      The text after the directive.
+ * @param result    Set to the value of the condition, 0 or 1.
+ * @return NO_ERROR if successful, ERR_INVALID_CONDITION if the condition cannot be parsed.
+ */
+status evaluate_condition(Conditional cond, char *rest, int *result) {
+    char *p = rest, *op;
+    size_t len;
+    int left, right, value;
+
+    while (isspace((unsigned char)*p))
+        p++;
+
+    if (cond == COND_IFDEF || cond == COND_IFNDEF) {
+        if (!(len = name_length(p)))
+            return ERR_INVALID_CONDITION;
+        *result = find_define(p, len, &value) == (cond == COND_IFDEF);
+        p += len;
+    }
+    else {
+        if (!parse_condition_operand(&p, &left))
+            return ERR_INVALID_CONDITION;
+        *result = left != 0;
+        if (*p) {
+            op = p;
+            len = (p[1] == '=') ? 2 : 1;
+            p += len;
+            if (!parse_condition_operand(&p, &right))
+                return ERR_INVALID_CONDITION;
+            if (len == 2 && *op == '=')
+                *result = left == right;
+            else if (len == 2 && *op == '!')
+                *result = left != right;
+            else if (*op == '<')
+                *result = len == 2 ? left <= right : left < right;
+            else if (*op == '>')
+                *result = len == 2 ? left >= right : left > right;
+            else
+                return ERR_INVALID_CONDITION;
+        }
+    }
+
+    while (isspace((unsigned char)*p))
+        p++;
+    return *p ? ERR_INVALID_CONDITION : NO_ERROR;
+}
+
+/**
+ * Parses an operand of a .if condition and the spaces that follow it.
+ *
+ * @param p     Pointer to the operand, advanced past it.
+ * @param value Set to the value of the operand.
+ * @return 1 if successful, 0 if there is no valid operand.
+ */
+int parse_condition_operand(char **p, int *value) {
+    char *end = NULL;
+    size_t len;
+
+    while (isspace((unsigned char)**p))
+        (*p)++;
+    if (isdigit((unsigned char)**p) || ((**p == '-' || **p == '+') && isdigit((unsigned char)(*p)[1]))) {
+        *value = (int)strtol(*p, &end, 10);
+        if (IS_NAME_CHAR(*end))
+            return 0;
+        *p = end;
+    }
+    else if ((len = name_length(*p))) {
+        if (!find_define(*p, len, value))
+            *value = 0;
+        *p += len;
+    }
+    else
+        return 0;
+
+    while (isspace((unsigned char)**p))
+        (*p)++;
+    return 1;
+}
+
+/**
+ * Returns the length of the name at the start of a string.
+ *
+ * @param name The string.
+ * @return The number of letters, digits and underscores, 0 if the string does not start with a name.
+ */
+size_t name_length(const char *name) {
+    size_t len = 0;
+
+    if (isdigit((unsigned char)*name))
+        return 0;
+    while (IS_NAME_CHAR(name[len]))
+        len++;
+    return len;
+}
+
+/**
+ * Looks up a name defined on the command line (-DNAME or -DNAME=VALUE).
+ *
+ * @param name  The name, not necessarily terminated.
+ * @param len   The length of the name.
+ * @param value Set to the value of the name, DEFINE_DEFAULT_VALUE if it has none.
+ * @return 1 if the name is defined, 0 otherwise.
+ */
+int find_define(const char *name, size_t len, int *value) {
+    int i;
+    const char *def;
+
+    for (i = options.defines_count - 1; i >= 0; i--) { /* the last definition wins */
+        def = options.defines[i];
+        if (strncmp(def, name, len) == 0 && (def[len] == '\0' || def[len] == '=')) {
+            *value = def[len] == '=' ? safe_atoi(def + len + 1) : DEFINE_DEFAULT_VALUE;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Checks whether a line is an .include directive. Only the first word of the line is compared.
+ *
+ * @param line  The input line.
+ * @param rest  Set to the text after the directive.
+ * @return 1 if the line starts with .include, 0 otherwise.
+ */
+int scan_include(const char *line, char **rest) {
+    const char *p = line;
+    size_t len = strlen(INCLUDE_DIRECTIVE);
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (strncmp(p, INCLUDE_DIRECTIVE, len) != 0 || (p[len] && !isspace((unsigned char)p[len])))
+        return 0;
+    *rest = (char *)p + len;
+    return 1;
+}
+
+/**
+ * Parses the file name of an .include directive, a non empty name between double quotes.
+ *
+ * @param rest  The text after the directive.
+ * @param name  Buffer of MAX_BUFFER_LENGTH characters to store the name.
+ * @return NO_ERROR if successful, ERR_INVALID_INCLUDE otherwise.
+ */
+status include_name(const char *rest, char *name) {
+    const char *end = NULL;
+
+    while (isspace((unsigned char)*rest))
+        rest++;
+    if (*rest != '"' || !(end = strchr(rest + 1, '"')) || end == rest + 1 || end - rest > MAX_BUFFER_LENGTH)
+        return ERR_INVALID_INCLUDE;
+    memcpy(name, rest + 1, end - rest - 1);
+    name[end - rest - 1] = '\0';
+
+    for (end++; isspace((unsigned char)*end); end++)
+        ;
+    return *end ? ERR_INVALID_INCLUDE : NO_ERROR;
+}
+
+/**
+ * Looks up an included file: relative to the directory of the including file first, then in the
+ * -I directories in order. An absolute name is used as is. A file outside of the include roots
+ * (--serve, see assembler_options) is not found.
+ *
+ * @param including The path of the including file.
+ * @param name      The name of the included file.
+ * @param found     Set to the allocated path the file has been found at (optional - NULL).
+ * @return The allocated canonical path of the file, or NULL if there is no such regular file.
+ */
+char *resolve_include(const char *including, const char *name, char **found) {
+    const char *slash = strrchr(including, '/'), *dir = including;
+    char *candidate = NULL, *path = NULL;
+    size_t dir_len = slash ? (size_t)(slash - including) + 1 : 0;
+    struct stat st;
+    int i;
+
+    for (i = -1; !path && i < options.include_dirs_count && (i < 0 || *name != '/'); i++) {
+        if (i >= 0) {
+            dir = options.include_dirs[i];
+            dir_len = strlen(dir);
+        }
+        if (*name == '/')
+            dir_len = 0;
+        if (!(candidate = malloc(dir_len + strlen(name) + 2)))
+            return NULL;
+        sprintf(candidate, "%.*s%s%s", (int)dir_len, dir,
+                dir_len && dir[dir_len - 1] != '/' ? "/" : "", name);
+
+        if ((path = realpath(candidate, NULL)) && (stat(path, &st) != 0 || !S_ISREG(st.st_mode)
+                                                   || !is_include_root(path))) {
+            free(path);
+            path = NULL;
+        }
+        if (path && found)
+            *found = candidate;
+        else
+            free(candidate);
+    }
+    return path;
+}
+
+/**
+ * Checks that an included file is in one of the include roots, if there are any.
+ *
+ * @param path The canonical path of the file.
+ * @return 1 if the file may be included, 0 otherwise.
+ */
+int is_include_root(const char *path) {
+    int i;
+
+    for (i = 0; i < options.include_roots_count; i++)
+        if (is_path_within(path, options.include_roots[i]))
+            return 1;
+    return !options.include_roots_count;
+}
+
 /**
 * Adds a new macro with the given name and body to the global linked list of macros.
 *
@@ -397,6 +970,8 @@ status add_macro(char* name, char* body) {
 
     new_macro->name = NULL; /* Set name pointer to NULL to ensure proper initialization */
     new_macro->body = NULL; /* Set body pointer to NULL to ensure proper initialization */
+    new_macro->expansion = NULL;
+    new_macro->expanding = 0;
 
     s_name = copy_string(&new_macro->name, name);
     s_body = copy_string(&new_macro->body, body);
@@ -420,6 +995,104 @@ status add_macro(char* name, char* body) {
     return NO_ERROR;
 }
 
+/**
+ * Expands the calls of other macros in the body of a macro, once: the expansion is kept in the
+ * macro and every later call is a copy of it. A body line that consists of a macro name only
+ * is a call, the called macro is expanded first.
+ *
+ * @param src   Pointer to the source file_context struct, the errors are reported on its line.
+ * @param macro The macro.
+ * @param depth The number of calls the macro is expanded within, 0 for a call from the source.
+ * @return NO_ERROR if successful, FAILURE if a cycle or too deep calls have been reported, ERR_MEM_ALLOC.
+ */
+status flatten_macro(file_context *src, macro_node *macro, int depth) {
+    char *line = NULL, *end = NULL, *text = NULL, *copied = macro->body;
+    size_t len = 0, cap = 0;
+    macro_node *called = NULL;
+    status report = NO_ERROR;
+
+    if (macro->expansion)
+        return NO_ERROR;
+    if (macro->expanding) {
+        handle_error(ERR_MACRO_CYCLE, src, macro->name);
+        return FAILURE;
+    }
+    if (depth == MAX_MACRO_DEPTH) {
+        handle_error(ERR_MACRO_TOO_DEEP, src, macro->name);
+        return FAILURE;
+    }
+
+    macro->expanding = 1;
+    for (line = macro->body; report == NO_ERROR && *line; line = *end ? end + 1 : end) {
+        end = strchr(line, '\n');
+        end = end ? end : line + strlen(line);
+        if (!(called = find_called_macro(line, end - line)))
+            continue;
+        if ((report = flatten_macro(src, called, depth + 1)) == NO_ERROR
+            && (report = append_text(&text, &len, &cap, copied, line - copied)) == NO_ERROR)
+            report = append_text(&text, &len, &cap, called->expansion, strlen(called->expansion));
+        copied = *end ? end + 1 : end;
+    }
+    macro->expanding = 0;
+
+    if (report == NO_ERROR && text)
+        report = append_text(&text, &len, &cap, copied, strlen(copied));
+    if (report != NO_ERROR)
+        free(text);
+    else /* without any call, the body is its own expansion */
+        macro->expansion = text ? text : macro->body;
+    return report;
+}
+
+/**
+ * Returns the macro a body line calls.
+ *
+ * @param line  The body line, not necessarily terminated.
+ * @param len   The length of the line.
+ * @return The macro, or NULL if the line is not a macro name only.
+ */
+macro_node *find_called_macro(const char *line, size_t len) {
+    char name[MAX_MACRO_NAME_LENGTH];
+
+    while (len && isspace((unsigned char)line[len - 1]))
+        len--;
+    if (!len || len >= MAX_MACRO_NAME_LENGTH || memchr(line, ' ', len) || memchr(line, '\t', len))
+        return NULL;
+    memcpy(name, line, len);
+    name[len] = '\0';
+    return is_macro_exists(name);
+}
+
+/**
+ * Appends text to a growing string.
+ *
+ * @param text      The string (NULL when empty).
+ * @param len       Its length.
+ * @param cap       Its capacity.
+ * @param src       The text to append.
+ * @param src_len   The length of the text to append.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status append_text(char **text, size_t *len, size_t *cap, const char *src, size_t src_len) {
+    char *new_text = NULL;
+    size_t new_cap = *cap ? *cap : MAX_BUFFER_LENGTH;
+
+    while (new_cap < *len + src_len + 1)
+        new_cap *= 2;
+    if (new_cap != *cap) {
+        if (!(new_text = realloc(*text, new_cap))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        *text = new_text;
+        *cap = new_cap;
+    }
+    memcpy(*text + *len, src, src_len);
+    *len += src_len;
+    (*text)[*len] = '\0';
+    return NO_ERROR;
+}
+
 /**
  * Checks if a macro with the given name exists.
  *
@@ -436,7 +1109,334 @@ macro_node* is_macro_exists(char* name) {
         current = current->next;
     }
 
-    return NULL; /* no matching macro found */
+    return library_macro(name); /* no matching macro found, the --macro-lib file may define it */
+}
+
+/**
+ * Maps the --macro-lib file, unless it is mapped already, and unmaps the one used before.
+ *
+ * @param path The path of the .mlib file (optional - NULL to use none).
+ * @return NO_ERROR if successful, ERR_MACRO_LIB if the file cannot be used, or ERR_MEM_ALLOC.
+ */
+status use_macro_library(const char *path) {
+    int offset = 0;
+    status report;
+
+    if (path ? is_macro_lib_unchanged(&library, path) : !library.path)
+        return NO_ERROR;
+    free_library_nodes();
+    unmap_macro_lib(&library);
+    if (!path)
+        return NO_ERROR;
+
+    if ((report = map_macro_lib(path, &library, &offset)) == NO_ERROR
+        && !(library_nodes = calloc(library.count ? library.count : 1, sizeof(macro_node *)))) {
+        unmap_macro_lib(&library);
+        report = ERR_MEM_ALLOC;
+    }
+    if (report == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else if (report != NO_ERROR)
+        handle_error(ERR_MACRO_LIB, path, offset);
+    return report == ERR_MEM_ALLOC ? ERR_MEM_ALLOC : report == NO_ERROR ? NO_ERROR : ERR_MACRO_LIB;
+}
+
+/**
+ * Returns a macro of the --macro-lib file. Its node points into the mapped file, the body is
+ * already expanded and is written as is.
+ *
+ * @param name The name of the macro.
+ * @return The macro, or NULL if the library does not define it.
+ */
+macro_node *library_macro(const char *name) {
+    long index = find_lib_macro(&library, name);
+    macro_node *node = NULL;
+
+    if (index == MLIB_NONE)
+        return NULL;
+    if (!library_nodes[index] && (node = calloc(1, sizeof(macro_node)))) {
+        node->name = (char *)lib_macro_name(&library, index);
+        node->body = node->expansion = (char *)lib_macro_body(&library, index);
+        library_nodes[index] = node;
+    }
+    return library_nodes[index];
+}
+
+/**
+ * Frees the nodes of the macros of the --macro-lib file, their names and bodies belong to the mapping.
+ */
+void free_library_nodes() {
+    size_t i;
+
+    for (i = 0; library_nodes && i < library.count; i++)
+        free(library_nodes[i]);
+    free(library_nodes);
+    library_nodes = NULL;
+}
+
+/**
+ * Checks whether the current source has included a file already.
+ *
+ * @param path The canonical path of the file.
+ * @return 1 if it has, 0 otherwise.
+ */
+int is_included(const char *path) {
+    size_t i;
+
+    for (i = 0; i < included_count; i++)
+        if (strcmp(included[i], path) == 0)
+            return 1;
+    return 0;
+}
+
+/**
+ * Records a file as included by the current source, a later .include of it is skipped.
+ *
+ * @param path The canonical path of the file.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status add_included(const char *path) {
+    char **new_included = NULL;
+    size_t new_cap;
+
+    if (included_count == included_cap) {
+        new_cap = included_cap ? included_cap * 2 : MAX_INCLUDE_DEPTH;
+        if (!(new_included = realloc(included, new_cap * sizeof(char *)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        included = new_included;
+        included_cap = new_cap;
+    }
+    if (!(included[included_count] = strdup(path))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+    included_count++;
+    return NO_ERROR;
+}
+
+/**
+ * Records a file read for the current source, the include cache entries of the files that
+ * include it depend on it.
+ *
+ * @param path  The canonical path of the file.
+ * @param st    Its status when it has been read.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status add_include_dep(const char *path, const struct stat *st) {
+    include_dep dep;
+
+    dep.path = (char *)path;
+    dep.size = (long)st->st_size;
+    dep.mtime = (long)st->st_mtim.tv_sec;
+    dep.mtime_nsec = st->st_mtim.tv_nsec;
+    return copy_include_dep(&dep);
+}
+
+/**
+ * Records a copy of a file read for the current source.
+ *
+ * @param dep The file.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status copy_include_dep(const include_dep *dep) {
+    include_dep *new_deps = NULL;
+    size_t new_cap;
+
+    if (include_deps_count == include_deps_cap) {
+        new_cap = include_deps_cap ? include_deps_cap * 2 : MAX_INCLUDE_DEPTH;
+        if (!(new_deps = realloc(include_deps, new_cap * sizeof(include_dep)))) {
+            handle_error(ERR_MEM_ALLOC);
+            return ERR_MEM_ALLOC;
+        }
+        include_deps = new_deps;
+        include_deps_cap = new_cap;
+    }
+    include_deps[include_deps_count] = *dep;
+    if (!(include_deps[include_deps_count].path = strdup(dep->path))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+    include_deps_count++;
+    return NO_ERROR;
+}
+
+/**
+ * Checks whether a file read for a source is unchanged since.
+ *
+ * @param dep The file.
+ * @return 1 if it has the same size and modification time, 0 otherwise.
+ */
+int is_dep_unchanged(const include_dep *dep) {
+    struct stat st;
+
+    return stat(dep->path, &st) == 0 && (long)st.st_size == dep->size && (long)st.st_mtim.tv_sec == dep->mtime
+           && st.st_mtim.tv_nsec == dep->mtime_nsec;
+}
+
+/**
+ * Adds copies of the macros an included file defines to the macros of the including file.
+ *
+ * @param src       Pointer to the including file_context struct, duplicates are reported on its line.
+ * @param macros    The macros of the included file.
+ * @return NO_ERROR if successful, FAILURE if a duplicate has been reported, or TERMINATE.
+ */
+status add_included_macros(file_context *src, macro_node *macros) {
+    int check = !IS_EMPTY(); /* the macros of a file are distinct, they are only compared with earlier ones */
+    status report = NO_ERROR;
+
+    for (; macros; macros = macros->next) {
+        if (check && is_macro_exists(macros->name)) {
+            handle_error(ERR_DUP_MACRO, src);
+            report = FAILURE;
+        }
+        else if (add_macro(macros->name, macros->body) != NO_ERROR)
+            return TERMINATE;
+    }
+    return report;
+}
+
+/**
+ * Looks up an included file in the include cache. An entry one of whose files has changed
+ * since it has been stored is removed.
+ *
+ * @param path      The canonical path of the file.
+ * @param signature The options the file is preprocessed with.
+ * @return The up to date entry, or NULL if there is none.
+ */
+include_entry *find_include_entry(const char *path, const char *signature) {
+    include_entry **link = &include_cache, *entry = NULL;
+    size_t i;
+
+    for (; (entry = *link); link = &entry->next) {
+        if (strcmp(entry->path, path) != 0 || strcmp(entry->signature, signature) != 0)
+            continue;
+        for (i = 0; i < entry->deps_count && is_dep_unchanged(&entry->deps[i]); i++)
+            ;
+        if (i == entry->deps_count)
+            return entry;
+        *link = entry->next;
+        free_include_entry(entry);
+        return NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Stores a preprocessed included file in the include cache.
+ *
+ * @param path      The canonical path of the file.
+ * @param signature The options the file has been preprocessed with.
+ * @param first_dep The index of the file in the files read for the current source, the files
+ *                  recorded after it are the ones it includes.
+ * @param text      The text the file expands to, owned by the entry if successful.
+ * @param text_len  The length of the text.
+ * @param macros    The macros the file defines, owned by the entry if successful.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status store_include_entry(const char *path, const char *signature, size_t first_dep, char *text, size_t text_len,
+                           macro_node *macros) {
+    include_entry *entry = calloc(1, sizeof(include_entry));
+    size_t i;
+
+    if (!entry || !(entry->path = strdup(path)) || !(entry->signature = strdup(signature))
+        || !(entry->deps = malloc((include_deps_count - first_dep) * sizeof(include_dep)))) {
+        free_include_entry(entry);
+        return ERR_MEM_ALLOC;
+    }
+    for (i = first_dep; i < include_deps_count; i++, entry->deps_count++) {
+        entry->deps[entry->deps_count] = include_deps[i];
+        if (!(entry->deps[entry->deps_count].path = strdup(include_deps[i].path))) {
+            free_include_entry(entry);
+            return ERR_MEM_ALLOC;
+        }
+    }
+
+    entry->text = text;
+    entry->text_len = text_len;
+    entry->macros = macros;
+    entry->next = include_cache;
+    include_cache = entry;
+    return NO_ERROR;
+}
+
+/**
+ * Opens an included file for preprocessing.
+ *
+ * @param found The path the file has been found at.
+ * @param src   Pointer to the including file_context struct.
+ * @return The file_context of the included file, or NULL if it cannot be opened.
+ */
+file_context *open_include(const char *found, const file_context *src) {
+    file_context *inc = calloc(1, sizeof(file_context));
+
+    if (!inc)
+        return NULL;
+    if (!(inc->file_name = strdup(found)) || !(inc->file_name_wout_ext = strdup(found))
+        || !(inc->file_ptr = fopen(found, FILE_MODE_READ))) {
+        free_file_context(&inc);
+        return NULL;
+    }
+    inc->lc = 1; /* line starts from 1 */
+    inc->tc = src->tc;
+    inc->fc = src->fc;
+    return inc;
+}
+
+/**
+ * Returns the options that change the text of an included file: the -D definitions select its
+ * lines and the -I directories the files it includes.
+ *
+ * @return The allocated signature, or NULL if memory allocation fails.
+ */
+char *include_signature() {
+    char *signature = NULL;
+    size_t len = 1;
+    int i;
+
+    for (i = 0; i < options.defines_count; i++)
+        len += strlen(options.defines[i]) + 3;
+    for (i = 0; i < options.include_dirs_count; i++)
+        len += strlen(options.include_dirs[i]) + 3;
+    if (library.path)
+        len += strlen(library.path) + MLIB_SIGNATURE_LEN;
+    if (!(signature = malloc(len)))
+        return NULL;
+
+    *signature = '\0';
+    for (i = 0; i < options.defines_count; i++)
+        strcat(strcat(strcat(signature, DEFINE_PREFIX), options.defines[i]), "\n");
+    for (i = 0; i < options.include_dirs_count; i++)
+        strcat(strcat(strcat(signature, INCLUDE_PREFIX), options.include_dirs[i]), "\n");
+    if (library.path) /* the macros it defines are expanded as well */
+        sprintf(signature + strlen(signature), "%s %lu %ld %ld\n", library.path, (unsigned long)library.len,
+                library.mtime, library.mtime_nsec);
+    return signature;
+}
+
+/**
+ * Reads the whole contents of a scratch file.
+ *
+ * @param fp    The file.
+ * @param len   Set to the length of the contents.
+ * @return The allocated contents, or NULL if memory allocation fails.
+ */
+char *read_scratch(FILE *fp, size_t *len) {
+    char *buffer = NULL;
+    long size;
+
+    if (fflush(fp) != 0 || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+        return NULL;
+    rewind(fp);
+    if (!(buffer = malloc((size_t)size + 1)) || fread(buffer, 1, (size_t)size, fp) != (size_t)size) {
+        free(buffer);
+        handle_error(ERR_MEM_ALLOC);
+        return NULL;
+    }
+    buffer[size] = '\0';
+    *len = (size_t)size;
+    return buffer;
 }
 
 /**
@@ -445,17 +1445,75 @@ macro_node* is_macro_exists(char* name) {
  * After freeing the memory, the macro list is empty.
  */
 void free_macros() {
-    macro_node* current = macro_head;
-    macro_node* next;
+    free_macro_list(macro_head);
+    macro_head = NULL;
+    macro_tail = NULL;
+}
 
-    while (current && !IS_EMPTY()) {
-        next = current->next;
-        free(current->name);
-        free(current->body);
-        free(current);
-        current = next;
+/**
+ * Frees a linked list of macros.
+ *
+ * @param head The head of the list.
+ */
+void free_macro_list(macro_node *head) {
+    macro_node *next;
+
+    for (; head; head = next) {
+        next = head->next;
+        if (head->expansion != head->body)
+            free(head->expansion);
+        free(head->name);
+        free(head->body);
+        free(head);
     }
+}
 
-    macro_head = NULL;
-    macro_tail = NULL;
+/**
+ * Frees an include cache entry.
+ *
+ * @param entry The entry (optional - NULL).
+ */
+void free_include_entry(include_entry *entry) {
+    size_t i;
+
+    if (!entry)
+        return;
+    for (i = 0; i < entry->deps_count; i++)
+        free(entry->deps[i].path);
+    free(entry->deps);
+    free(entry->path);
+    free(entry->signature);
+    free(entry->text);
+    free_macro_list(entry->macros);
+    free(entry);
+}
+
+/**
+ * Frees the include cache, the included files are preprocessed again afterwards.
+ */
+void free_include_cache() {
+    include_entry *next;
+
+    for (; include_cache; include_cache = next) {
+        next = include_cache->next;
+        free_include_entry(include_cache);
+    }
+}
+
+/**
+ * Forgets the files the current source has included, once it has been preprocessed.
+ */
+void reset_includes() {
+    size_t i;
+
+    for (i = 0; i < included_count; i++)
+        free(included[i]);
+    for (i = 0; i < include_deps_count; i++)
+        free(include_deps[i].path);
+    free(included);
+    free(include_deps);
+    included = NULL;
+    include_deps = NULL;
+    included_count = included_cap = include_deps_count = include_deps_cap = 0;
+    includes_skipped = 0;
 }
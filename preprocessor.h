@@ -10,25 +10,99 @@
 #define MACRO_END "endmcro"
 #define SKIP_MCRO 4 /* mcro length */
 #define SKIP_MCR0_END 7 /* endmcro length */
+#define MAX_IF_DEPTH 32
+#define MAX_MACRO_DEPTH 16
+#define DEFINE_DEFAULT_VALUE 1 /* of a -DNAME without a value */
+#define INCLUDE_DIRECTIVE ".include"
+#define MAX_INCLUDE_DEPTH 16
+
+typedef enum {
+    COND_NONE,
+    COND_IF,
+    COND_IFDEF,
+    COND_IFNDEF,
+    COND_ELSE,
+    COND_ENDIF
+} Conditional;
+
+/*
+ * The open .if blocks of the file being preprocessed. While a block is skipped, only the
+ * conditional directives of its lines are looked at, the blocks nested in it are just counted.
+ */
+typedef struct {
+    int depth;
+    int skipping; /* the lines of the innermost block are skipped */
+    int skipped_nested; /* blocks opened within the skipped lines */
+    int line[MAX_IF_DEPTH]; /* of the opening directive */
+    char taken[MAX_IF_DEPTH]; /* a branch of the block has been assembled */
+    char has_else[MAX_IF_DEPTH];
+} conditional_stack;
 
 
 typedef struct macro_node{
     char* name;
     char* body;
+    char* expansion; /* the body, its calls of other macros expanded once by flatten_macro() (optional - NULL) */
+    int expanding; /* flatten_macro() is expanding the body, a call of the macro is a cycle */
     struct macro_node* next;
 } macro_node;
 
+/* A file read while preprocessing, an included file is up to date while all of its files are unchanged */
+typedef struct {
+    char *path; /* canonical */
+    long size;
+    long mtime;
+    long mtime_nsec;
+} include_dep;
+
+/*
+ * An included file, preprocessed once per process: the text it expands to and the macros it
+ * defines are reused by every later source that includes it, as long as it has been
+ * preprocessed with the same options and none of its files has changed since.
+ */
+typedef struct include_entry {
+    char *path; /* canonical */
+    char *signature; /* the -D and -I options it has been preprocessed with */
+    include_dep *deps; /* the file itself, then every file it includes */
+    size_t deps_count;
+    char *text;
+    size_t text_len;
+    macro_node *macros;
+    struct include_entry *next;
+} include_entry;
+
+
+extern macro_node *macro_head;
 
 status assembler_preprocessor(file_context *src, file_context *dest);
+status preprocess_lines(file_context *src, file_context *dest, int depth);
+status handle_include(file_context *src, file_context *dest, char *rest, int depth, int found_error);
+status preprocess_include(file_context *src, file_context *dest, const char *path, const char *found, int depth,
+                          int found_error, const char *signature);
+status use_include_entry(file_context *src, file_context *dest, const include_entry *entry, int found_error);
+status include_name(const char *rest, char *name);
 
 status handle_macro_start(file_context *src, char *line, int *found_macro, char **macro_name, char **macro_body);
 status handle_macro_body(char *line, int found_macro, char **macro_body);
 status handle_macro_end(char *line, int *found_macro, char **macro_name, char **macro_body);
 status write_to_file(file_context *src, file_context *dest, char *line, int found_macro, int found_error);
 status add_macro(char* name, char* body);
+status flatten_macro(file_context *src, macro_node *macro, int depth);
+status handle_conditional(file_context *src, conditional_stack *conds, Conditional cond, char *rest);
+status evaluate_condition(Conditional cond, char *rest, int *result);
+
+Conditional scan_conditional(const char *line, char **rest);
+int scan_include(const char *line, char **rest);
+char *resolve_include(const char *including, const char *name, char **found);
+int is_include_root(const char *path);
+int find_define(const char *name, size_t len, int *value);
 
 macro_node* is_macro_exists(char* name);
 
+status use_macro_library(const char *path);
+
 void free_macros();
+void free_include_cache();
+void reset_includes();
 
 #endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+/* "Private" helper functions */
+status collect_symbols(const object_module *module, const debug_info *info, profile_symbol **symbols,
+                       size_t *count);
+int compare_symbols(const void *a, const void *b);
+int label_of(const profile_symbol *symbols, size_t count, int address);
+size_t sort_rows(profile_row *rows, size_t count);
+int compare_rows(const void *a, const void *b);
+void write_count(FILE *dest, unsigned long count, unsigned long total);
+
+/**
+ * Writes the hot-spot report of a profiled run: the executed instructions per opcode, per label,
+ * per source line (if there is a source map) and per address, each sorted by count, hottest first.
+ *
+ * Every address counts towards the nearest label at or before it, the labels are the symbols of the
+ * source map, or the entries of the program if there is none.
+ *
+ * @param dest      The output stream.
+ * @param name      The name of the program.
+ * @param m         The machine after the run, m->counts must be set.
+ * @param module    The program.
+ * @param info      The source map (optional - NULL).
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or FAILURE if the stream could not be written.
+ */
+status write_profile(FILE *dest, const char *name, const machine *m, const object_module *module,
+                     const debug_info *info) {
+    profile_row opcodes[COMMANDS_LEN], addresses[MACHINE_COUNTS];
+    profile_row *labels = NULL, *lines = NULL;
+    profile_symbol *symbols = NULL;
+    size_t symbols_count, lines_count = 1, i, n;
+    unsigned long total = 0;
+    int address, label, line;
+
+    if (collect_symbols(module, info, &symbols, &symbols_count) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+    for (i = 0; info && i < (size_t)info->size; i++)
+        if (info->lines[i] >= lines_count)
+            lines_count = info->lines[i] + 1;
+    if (!(labels = calloc(symbols_count + 1, sizeof(profile_row)))
+        || !(lines = calloc(lines_count, sizeof(profile_row)))) {
+        free(labels);
+        free(symbols);
+        return ERR_MEM_ALLOC;
+    }
+
+    memset(opcodes, 0, sizeof(opcodes));
+    for (i = 0; i < COMMANDS_LEN; i++)
+        opcodes[i].key = (int)i;
+    for (i = 0; i <= symbols_count; i++)
+        labels[i].key = (int)i; /* symbols_count for PROFILE_NO_LABEL */
+    for (i = 0; i < lines_count; i++)
+        lines[i].key = (int)i;
+
+    for (address = 0; address < MACHINE_COUNTS; address++) {
+        addresses[address].key = address;
+        if (!(addresses[address].count = m->counts[address]))
+            continue;
+        total += m->counts[address];
+        if (m->decoded[address].op < COMMANDS_LEN)
+            opcodes[m->decoded[address].op].count += m->counts[address];
+        label = label_of(symbols, symbols_count, address);
+        labels[label < 0 ? symbols_count : (size_t)label].count += m->counts[address];
+        if (info && (line = debug_line_of(info, address)) != DEBUG_NO_LINE)
+            lines[line].count += m->counts[address];
+    }
+
+    fprintf(dest, "; %s - %lu instruction(s) executed\n", name, total);
+
+    fprintf(dest, "; Opcodes\n");
+    for (i = 0, n = sort_rows(opcodes, COMMANDS_LEN); i < n; i++) {
+        write_count(dest, opcodes[i].count, total);
+        fprintf(dest, "%s\n", commands[opcodes[i].key]);
+    }
+
+    fprintf(dest, "; Labels\n");
+    for (i = 0, n = sort_rows(labels, symbols_count + 1); i < n; i++) {
+        write_count(dest, labels[i].count, total);
+        fprintf(dest, "%s\n",
+                (size_t)labels[i].key < symbols_count ? symbols[labels[i].key].label : PROFILE_NO_LABEL);
+    }
+
+    if (info) {
+        fprintf(dest, "; Lines of %s\n", info->source);
+        for (i = 0, n = sort_rows(lines, lines_count); i < n; i++) {
+            write_count(dest, lines[i].count, total);
+            fprintf(dest, "line %d\n", lines[i].key);
+        }
+    }
+
+    fprintf(dest, "; Addresses\n");
+    for (i = 0, n = sort_rows(addresses, MACHINE_COUNTS); i < n; i++) {
+        address = addresses[i].key;
+        write_count(dest, addresses[i].count, total);
+        if ((label = label_of(symbols, symbols_count, address)) < 0)
+            fprintf(dest, "%6d  %s", address, PROFILE_NO_LABEL);
+        else
+            fprintf(dest, "%6d  %s+%d", address, symbols[label].label, address - symbols[label].address);
+        if (info && (line = debug_line_of(info, address)) != DEBUG_NO_LINE)
+            fprintf(dest, "  line %d", line);
+        fputc('\n', dest);
+    }
+
+    free(lines);
+    free(labels);
+    free(symbols);
+    return ferror(dest) ? FAILURE : NO_ERROR;
+}
+
+/**
+ * Writes a profiled run in the folded stack format of flame graph tools, one "NAME;LABEL;LINE COUNT"
+ * line per run of addresses that share a label and a source line. Without a source map the
+ * addresses take the place of the lines.
+ *
+ * @param dest      The output stream.
+ * @param name      The name of the program, the root of every stack.
+ * @param m         The machine after the run, m->counts must be set.
+ * @param module    The program.
+ * @param info      The source map (optional - NULL).
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or FAILURE if the stream could not be written.
+ */
+status write_folded_profile(FILE *dest, const char *name, const machine *m, const object_module *module,
+                            const debug_info *info) {
+    profile_symbol *symbols = NULL;
+    size_t symbols_count;
+    unsigned long count = 0;
+    int address, label, line, frame_label = 0, frame_line = 0;
+
+    if (collect_symbols(module, info, &symbols, &symbols_count) != NO_ERROR)
+        return ERR_MEM_ALLOC;
+
+    for (address = 0; address <= MACHINE_COUNTS; address++) {
+        if (address < MACHINE_COUNTS) {
+            if (!m->counts[address])
+                continue;
+            label = label_of(symbols, symbols_count, address);
+            line = info ? debug_line_of(info, address) : address;
+            if (count && label == frame_label && line == frame_line) {
+                count += m->counts[address];
+                continue;
+            }
+        }
+        if (count) {
+            fprintf(dest, "%s;%s;", name, frame_label < 0 ? PROFILE_NO_LABEL : symbols[frame_label].label);
+            if (info)
+                fprintf(dest, "line %d %lu\n", frame_line, count);
+            else
+                fprintf(dest, "%d %lu\n", frame_line, count);
+        }
+        if (address < MACHINE_COUNTS) {
+            frame_label = label;
+            frame_line = line;
+            count = m->counts[address];
+        }
+    }
+
+    free(symbols);
+    return ferror(dest) ? FAILURE : NO_ERROR;
+}
+
+/**
+ * Collects the labels of a program sorted by address: the symbols of the source map, or the
+ * entries of the program if there is none.
+ *
+ * @param module    The program.
+ * @param info      The source map (optional - NULL).
+ * @param symbols   Set to the labels, must be released with free(), they point into module or info.
+ * @param count     Set to the number of labels.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC otherwise.
+ */
+status collect_symbols(const object_module *module, const debug_info *info, profile_symbol **symbols,
+                       size_t *count) {
+    size_t i;
+
+    *count = info ? info->symbols_count : module->entries_count;
+    if (!(*symbols = malloc((*count ? *count : 1) * sizeof(profile_symbol))))
+        return ERR_MEM_ALLOC;
+
+    for (i = 0; i < *count; i++) {
+        (*symbols)[i].label = info ? info->symbols[i].label : module->entries[i].label;
+        (*symbols)[i].address = info ? info->symbols[i].address : module->entries[i].address;
+    }
+    qsort(*symbols, *count, sizeof(profile_symbol), compare_symbols);
+    return NO_ERROR;
+}
+
+/**
+ * Orders labels by address, then by name.
+ */
+int compare_symbols(const void *a, const void *b) {
+    const profile_symbol *x = a, *y = b;
+
+    if (x->address != y->address)
+        return x->address < y->address ? -1 : 1;
+    return strcmp(x->label, y->label);
+}
+
+/**
+ * Finds the label an address belongs to.
+ *
+ * @param symbols   The labels, sorted by address.
+ * @param count     The number of labels.
+ * @param address   The address.
+ * @return The index of the last label at or before the address, or -1 if there is none.
+ */
+int label_of(const profile_symbol *symbols, size_t count, int address) {
+    size_t low = 0, high = count, mid;
+
+    /* The first label after the address */
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (symbols[mid].address <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return (int)low - 1;
+}
+
+/**
+ * Sorts report rows, hottest first and the rest by key, the rows that were never executed go last.
+ *
+ * @param rows  The rows.
+ * @param count The number of rows.
+ * @return The number of executed rows.
+ */
+size_t sort_rows(profile_row *rows, size_t count) {
+    size_t executed = 0;
+
+    qsort(rows, count, sizeof(profile_row), compare_rows);
+    while (executed < count && rows[executed].count)
+        executed++;
+    return executed;
+}
+
+/**
+ * Orders report rows by count, descending, then by key.
+ */
+int compare_rows(const void *a, const void *b) {
+    const profile_row *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/**
+ * Writes the count and share columns of a report row.
+ *
+ * @param dest  The output stream.
+ * @param count The count of the row.
+ * @param total The total count.
+ */
+void write_count(FILE *dest, unsigned long count, unsigned long total) {
+    fprintf(dest, "%12lu %6.2f%%  ", count, total ? 100.0 * (double)count / (double)total : 0.0);
+}
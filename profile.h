@@ -0,0 +1,30 @@
+#ifndef ASSEMBLER_PROFILE_H
+#define ASSEMBLER_PROFILE_H
+
+#include <stdio.h>
+#include "machine.h"
+#include "debuginfo.h"
+#include "errors.h"
+
+#define PROFILE_EXT ".prof"
+#define FOLDED_EXT ".folded"
+#define PROFILE_NO_LABEL "?" /* code before the first label */
+
+/* A line of a report: what is counted (an opcode, label index, line or address) and its count */
+typedef struct {
+    int key;
+    unsigned long count;
+} profile_row;
+
+/* A label the counts roll up into, every address belongs to the nearest label at or before it */
+typedef struct {
+    const char *label;
+    int address;
+} profile_symbol;
+
+status write_profile(FILE *dest, const char *name, const machine *m, const object_module *module,
+                     const debug_info *info);
+status write_folded_profile(FILE *dest, const char *name, const machine *m, const object_module *module,
+                            const debug_info *info);
+
+#endif
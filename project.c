@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "project.h"
+#include "assembler.h"
+#include "linker.h"
+#include "protocol.h"
+#include "passes.h"
+#include "aobj.h"
+#include "utils.h"
+
+/* "Private" helper functions */
+void start_worker(project_file *file, int index, int count);
+void run_project_worker(FILE *dest, const char *name, int index, int count);
+status collect_worker(project_file *file, object_module *module);
+status read_module(const project_file *file, const section *aobj, object_module *module);
+status write_linked(const char *output, const object_module *linked);
+
+/**
+ * Assembles the files of a project in parallel and links them into a single program, the .extern
+ * references of every file are resolved against the .entry symbols of the others.
+ *
+ * The assembler keeps its state in globals, so every file is assembled by a worker process, at most
+ * jobs of them at a time. A worker sends its module back over a pipe in the format of the --serve
+ * protocol, together with what it printed. The module is the one of its .aobj file, with the
+ * relocations of its first pass, and never reaches the disk: the modules are linked in memory into
+ * OUTPUT.ob (and OUTPUT.ent). Whatever the order the workers finish in, their
+ * output is replayed, and the modules are linked, in the order the files are given.
+ *
+ * @param files     The file names, without the .as extension.
+ * @param count     The number of files.
+ * @param output    The name of the linked program, without extension.
+ * @param jobs      The number of worker processes, 0 for the default.
+ * @return NO_ERROR if the program has been linked (or checked with --check), FAILURE otherwise.
+ */
+status assemble_project(char *files[], int count, const char *output, int jobs) {
+    project_file *project = NULL;
+    object_module *modules = NULL, linked;
+    status report = NO_ERROR;
+    int i, started;
+
+    jobs = jobs <= 0 ? PROJECT_DEFAULT_JOBS : jobs > PROJECT_MAX_JOBS ? PROJECT_MAX_JOBS : jobs;
+    if (!(project = calloc((size_t)count, sizeof(project_file)))
+        || !(modules = calloc((size_t)count, sizeof(object_module)))) {
+        free(project);
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < count; i++)
+        project[i].name = files[i];
+
+    /* A new worker is started whenever one is collected, so at most jobs of them run at a time */
+    for (started = 0; started < count && started < jobs; started++)
+        start_worker(&project[started], started, count);
+    for (i = 0; i < count; i++) {
+        if (collect_worker(&project[i], &modules[i]) != NO_ERROR)
+            report = FAILURE;
+        if (started < count) {
+            start_worker(&project[started], started, count);
+            started++;
+        }
+        flush_diagnostics();
+    }
+
+    if (report == NO_ERROR && !options.check_only) {
+        report = link_modules(modules, (const char **)files, (size_t)count, &linked);
+        if (report == NO_ERROR) {
+            report = write_linked(output, &linked);
+            free_object(&linked);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        free_object(&modules[i]);
+    free(modules);
+    free(project);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Starts the worker process of a file. A worker that could not be started is reported when
+ * it is collected.
+ *
+ * @param file  The file.
+ * @param index The index of the file, from 0.
+ * @param count The number of files.
+ */
+void start_worker(project_file *file, int index, int count) {
+    FILE *dest = NULL;
+    int fds[2];
+
+    file->pid = 0;
+    file->result = NULL;
+    if (pipe(fds) != 0)
+        return;
+
+    /* Anything still buffered would be written again by the worker */
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((file->pid = fork()) == 0) {
+        close(fds[0]);
+        if ((dest = fdopen(fds[1], "w"))) {
+            run_project_worker(dest, file->name, index + 1, count);
+            fclose(dest);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (file->pid < 0 || !(file->result = fdopen(fds[0], "r"))) {
+        close(fds[0]);
+        file->pid = file->pid < 0 ? 0 : file->pid;
+    }
+}
+
+/**
+ * Assembles a file in a worker process and writes the response: what the assembler printed,
+ * its module in the .aobj format and whether it succeeded.
+ *
+ * @param dest  The response stream.
+ * @param name  The file name without the .as extension.
+ * @param index The index of the file, from 1.
+ * @param count The number of files.
+ */
+void run_project_worker(FILE *dest, const char *name, int index, int count) {
+    FILE *capture[2] = {NULL, NULL};
+    status report = FAILURE;
+    int i;
+
+    options.cache_dir = NULL; /* restoring from the cache writes the outputs to the disk */
+    options.debug_info = options.xref = 0; /* a source map is per file, the linked program has none */
+    options.write_aobj = options.from_aobj = 0; /* both work on the files on the disk */
+    if ((capture[0] = tmpfile()) && (capture[1] = tmpfile()) && dup2(fileno(capture[0]), STDOUT_FILENO) >= 0
+        && dup2(fileno(capture[1]), STDERR_FILENO) >= 0) {
+        report = assemble_file(name, index, count);
+        flush_diagnostics();
+        fflush(stdout);
+        fflush(stderr);
+        write_stream_section(dest, TAG_OUT, capture[0]);
+        write_stream_section(dest, TAG_ERR, capture[1]);
+    }
+
+    /* The .ob, .ent and .ext outputs follow from the module, they are not needed */
+    for (i = 0; i < CAPTURED_OUTPUTS_LEN; i++) {
+        if (captured_outputs[i]) {
+            if (i == CAPTURED_AOBJ && report == NO_ERROR)
+                write_stream_section(dest, TAG_AOBJ, captured_outputs[i]);
+            fclose(captured_outputs[i]);
+            captured_outputs[i] = NULL;
+        }
+    }
+    write_section(dest, TAG_STAT, report == NO_ERROR ? "0" : "1", 1);
+    write_section(dest, TAG_END, NULL, 0);
+    fflush(dest);
+
+    for (i = 0; i < 2; i++)
+        if (capture[i]) fclose(capture[i]);
+}
+
+/**
+ * Waits for the response of the worker of a file, replays what it printed and reads its module.
+ *
+ * @param file      The file.
+ * @param module    The module to fill, must be released with free_object().
+ * @return NO_ERROR if the file has been assembled, FAILURE otherwise.
+ */
+status collect_worker(project_file *file, object_module *module) {
+    section sec, aobj;
+    status report = FAILURE, received;
+    int wstatus;
+
+    memset(&aobj, 0, sizeof(aobj));
+    memset(module, 0, sizeof(object_module));
+    if (!file->result) {
+        if (file->pid) waitpid(file->pid, &wstatus, 0);
+        handle_error(TERMINATE, "start_worker()");
+        return FAILURE;
+    }
+
+    while ((received = read_section(file->result, &sec)) == NO_ERROR && strcmp(sec.tag, TAG_END) != 0) {
+        if (strcmp(sec.tag, TAG_OUT) == 0 || strcmp(sec.tag, TAG_ERR) == 0) {
+            if (sec.len)
+                fwrite(sec.data, 1, sec.len, *sec.tag == 'O' ? stdout : stderr);
+        }
+        else if (strcmp(sec.tag, TAG_STAT) == 0)
+            report = sec.len == 1 && *sec.data == '0' ? NO_ERROR : FAILURE;
+        else if (strcmp(sec.tag, TAG_AOBJ) == 0 && !aobj.data) {
+            aobj = sec;
+            continue;
+        }
+        free(sec.data);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    fclose(file->result);
+    file->result = NULL;
+    waitpid(file->pid, &wstatus, 0);
+    file->pid = 0;
+
+    if (received != NO_ERROR) {
+        handle_error(TERMINATE, "collect_worker()");
+        report = FAILURE;
+    }
+    if (report == NO_ERROR && !options.check_only)
+        report = read_module(file, &aobj, module);
+
+    free(aobj.data);
+    return report;
+}
+
+/**
+ * Reads the module of a file from the .aobj contents sent by its worker.
+ *
+ * @param file      The file.
+ * @param aobj      The AOBJ section of the response, empty if the worker did not send any.
+ * @param module    The module to fill, must be released with free_object().
+ * @return NO_ERROR if successful, FAILURE otherwise (already reported).
+ */
+status read_module(const project_file *file, const section *aobj, object_module *module) {
+    status report;
+    int offset = 0;
+
+    report = aobj->data ? read_aobj((const unsigned char *)aobj->data, aobj->len, NULL, module, &offset)
+                        : ERR_AOBJ_FILE;
+    if (report == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else if (report != NO_ERROR)
+        handle_error(ERR_AOBJ_FILE, file->name, offset);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Writes the linked program of the project.
+ *
+ * @param output    The name of the program, without extension.
+ * @param linked    The program.
+ * @return NO_ERROR if successful, FAILURE otherwise (already reported).
+ */
+status write_linked(const char *output, const object_module *linked) {
+    file_context fc;
+    status report = write_object(output, linked);
+
+    if (report == NO_ERROR) {
+        handle_progress(LINK_OK, output);
+        return NO_ERROR;
+    }
+    if (report == ERR_MEM_ALLOC || !(fc.file_name = malloc(strlen(output) + FILE_EXT_LEN_OUT))) {
+        handle_error(ERR_MEM_ALLOC);
+        return FAILURE;
+    }
+    strcat(strcpy(fc.file_name, output), OBJECT_EXT);
+    fc.lc = 0;
+    handle_error(ERR_OPEN_FILE, &fc);
+    free(fc.file_name);
+    return FAILURE;
+}
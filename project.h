@@ -0,0 +1,20 @@
+#ifndef ASSEMBLER_PROJECT_H
+#define ASSEMBLER_PROJECT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include "errors.h"
+
+#define PROJECT_DEFAULT_JOBS 4
+#define PROJECT_MAX_JOBS 64
+
+/* A file of the project, assembled by a worker process */
+typedef struct {
+    const char *name; /* file name without the .as extension */
+    pid_t pid; /* the worker, 0 once it has been reaped */
+    FILE *result; /* read end of the pipe the worker writes its response to (NULL if it could not start) */
+} project_file;
+
+status assemble_project(char *files[], int count, const char *output, int jobs);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "protocol.h"
+
+/**
+ * Writes a single section: the "TAG LENGTH\n" header followed by the data.
+ *
+ * @param dest  The output stream.
+ * @param tag   The section tag.
+ * @param data  The section data (optional - NULL if len is 0).
+ * @param len   The length of the data.
+ * @return NO_ERROR if successful, or FAILURE if the stream could not be written.
+ */
+status write_section(FILE *dest, const char *tag, const char *data, size_t len) {
+    if (fprintf(dest, "%s %lu\n", tag, (unsigned long)len) < 0)
+        return FAILURE;
+    if (len && fwrite(data, 1, len, dest) != len)
+        return FAILURE;
+    return NO_ERROR;
+}
+
+/**
+ * Writes the whole contents of a seekable stream as a single section.
+ *
+ * @param dest  The output stream.
+ * @param tag   The section tag.
+ * @param src   The stream to copy, read from the beginning.
+ * @return NO_ERROR if successful, or FAILURE if a stream could not be read or written.
+ */
+status write_stream_section(FILE *dest, const char *tag, FILE *src) {
+    char buffer[PROTOCOL_BUFFER];
+    long len;
+    size_t count;
+
+    if (fseek(src, 0L, SEEK_END) != 0 || (len = ftell(src)) < 0)
+        return FAILURE;
+    rewind(src);
+
+    if (fprintf(dest, "%s %ld\n", tag, len) < 0)
+        return FAILURE;
+    while (len > 0 && (count = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        if ((long)count > len)
+            count = (size_t)len;
+        if (fwrite(buffer, 1, count, dest) != count)
+            return FAILURE;
+        len -= (long)count;
+    }
+    return len ? FAILURE : NO_ERROR;
+}
+
+/**
+ * Reads a single section. The data is allocated and NUL terminated, the caller must free it.
+ *
+ * @param src   The input stream.
+ * @param dest  The section to fill.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC if memory allocation failed,
+ * @return or FAILURE if the stream ended or the section is malformed or too large.
+ */
+status read_section(FILE *src, section *dest) {
+    unsigned long len;
+
+    dest->data = NULL;
+    dest->len = 0;
+    if (fscanf(src, "%7s %lu", dest->tag, &len) != 2 || fgetc(src) != '\n' || len > PROTOCOL_MAX_SECTION)
+        return FAILURE;
+    if (!len)
+        return NO_ERROR;
+
+    if (!(dest->data = malloc(len + 1)))
+        return ERR_MEM_ALLOC;
+    if (fread(dest->data, 1, len, src) != len) {
+        free(dest->data);
+        dest->data = NULL;
+        return FAILURE;
+    }
+    dest->data[len] = '\0';
+    dest->len = len;
+    return NO_ERROR;
+}
@@ -0,0 +1,44 @@
+#ifndef ASSEMBLER_PROTOCOL_H
+#define ASSEMBLER_PROTOCOL_H
+
+#include <stdio.h>
+#include "errors.h"
+
+/*
+ * Wire format of the --serve socket. A message is a sequence of sections, each one is
+ * a "TAG LENGTH\n" header followed by exactly LENGTH raw bytes, and it ends with an END section.
+ *
+ * Request:  NAME (file name without .as), OPTS (space separated options), SRC (.as contents).
+ * Response: OUT (stdout), ERR (stderr), OB / ENT / EXT / DBG / XREF (only the generated ones), STAT ("0" on success).
+ * A --project worker answers in the same format, with the AOBJ section (see aobj.h) instead of the outputs.
+ */
+#define SERVER_DEFAULT_SOCKET "/tmp/assembler.sock"
+#define PROTOCOL_TAG_LEN 8
+#define PROTOCOL_MAX_SECTION (4L * 1024L * 1024L)
+#define PROTOCOL_BUFFER 4096
+
+#define TAG_NAME "NAME"
+#define TAG_OPTS "OPTS"
+#define TAG_SRC "SRC"
+#define TAG_OUT "OUT"
+#define TAG_ERR "ERR"
+#define TAG_OB "OB"
+#define TAG_ENT "ENT"
+#define TAG_EXT "EXT"
+#define TAG_DBG "DBG"
+#define TAG_XREF "XREF"
+#define TAG_AOBJ "AOBJ"
+#define TAG_STAT "STAT"
+#define TAG_END "END"
+
+typedef struct {
+    char tag[PROTOCOL_TAG_LEN];
+    char *data; /* NUL terminated, NULL for an empty section */
+    size_t len;
+} section;
+
+status write_section(FILE *dest, const char *tag, const char *data, size_t len);
+status write_stream_section(FILE *dest, const char *tag, FILE *src);
+status read_section(FILE *src, section *dest);
+
+#endif
@@ -0,0 +1,518 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "machine.h"
+#include "object.h"
+#include "utils.h"
+#include "errors.h"
+
+#define RUNNER_LINE_LENGTH 1024
+#define RUNNER_MAX_THREADS 256
+#define RUNNER_DEFAULT_STEPS 10000000UL
+#define RUNNER_COMPARE_BUFFER 4096
+#define RUNNER_NO_FILE "-"
+#define RUNNER_EMPTY_INPUT "/dev/null"
+#define MS_PER_SEC 1000.0
+#define NS_PER_MS 1000000.0
+
+/* A single (program, input, expected output, step limit) line of a manifest */
+typedef struct {
+    char *program;
+    char *input; /* RUNNER_NO_FILE for an empty input */
+    char *expected; /* RUNNER_NO_FILE to only check that the program stops */
+    unsigned long max_steps;
+    const object_module *module;
+
+    status result; /* NO_ERROR (pass), FAILURE (output differs), or the status of the failure */
+    unsigned long steps;
+    int pc;
+    double wall_ms;
+} job;
+
+/* Jobs of a worker, the owner takes from the bottom while other workers steal from the top */
+typedef struct {
+    job **jobs;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+} job_deque;
+
+typedef struct {
+    job_deque *deques;
+    int workers;
+} job_pool;
+
+typedef struct {
+    job_pool *pool;
+    int index;
+} worker_context;
+
+typedef struct {
+    char *name;
+    object_module module;
+} loaded_program;
+
+typedef struct {
+    int threads; /* --threads: worker threads, 0 for one per online processor */
+    unsigned long max_steps; /* --steps: limit of jobs without a limit of their own */
+} runner_options;
+
+static runner_options run_options = {0, RUNNER_DEFAULT_STEPS};
+
+status parse_runner_option(int argc, char *argv[], int *index);
+status read_manifest(const char *path, job **jobs, size_t *count, size_t *cap);
+status load_programs(job *jobs, size_t count, loaded_program **programs, size_t *programs_count);
+status run_jobs(job *jobs, size_t count, int threads);
+job *take_job(job_pool *pool, int index);
+void *worker_main(void *arg);
+void run_job(job *j, machine *m);
+status report_jobs(const job *jobs, size_t count);
+void report_load_error(const char *file_name, status code, int line);
+void free_jobs(job *jobs, size_t count, loaded_program *programs, size_t programs_count);
+int output_matches(const char *output, size_t output_len, const char *expected_path);
+double elapsed_ms(const struct timespec *start);
+
+/**
+ * Batch runner of assembled programs.
+ * Usage: Runner [--threads N] [--steps N] manifest...
+ * Each manifest line is "program input expected [steps]", '#' starts a comment line.
+ * The program is given without extension (a trailing .ob is accepted), "-" stands for no input
+ * or no expected output. The jobs run in parallel, each one on a freshly reset machine.
+ */
+int main(int argc, char *argv[]) {
+    job *jobs = NULL;
+    loaded_program *programs = NULL;
+    size_t count = 0, cap = 0, programs_count = 0;
+    status report = NO_ERROR;
+    int i, files = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (parse_runner_option(argc, argv, &i) != NO_ERROR) {
+            flush_diagnostics();
+            exit(FAILURE);
+        }
+    }
+
+    if (!files) {
+        handle_error(ERR_INVALID_OPTION, "missing manifest file");
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    for (i = 1; i <= files && report == NO_ERROR; i++)
+        report = read_manifest(argv[i], &jobs, &count, &cap);
+    if (report == NO_ERROR)
+        report = load_programs(jobs, count, &programs, &programs_count);
+    if (report == NO_ERROR)
+        report = run_jobs(jobs, count, run_options.threads);
+    if (report == NO_ERROR)
+        report = report_jobs(jobs, count);
+
+    flush_diagnostics();
+    free_jobs(jobs, count, programs, programs_count);
+    return report == NO_ERROR ? 0 : FAILURE;
+}
+
+/**
+ * Parses a single command line option of the runner.
+ *
+ * @param argc      The number of command line arguments.
+ * @param argv      The command line arguments.
+ * @param index     Pointer to the index of the option, advanced past any option argument.
+ *
+ * @return NO_ERROR if the option is valid, or ERR_INVALID_OPTION otherwise.
+ */
+status parse_runner_option(int argc, char *argv[], int *index) {
+    char *opt = argv[*index], *end = NULL;
+
+    if (strcmp(opt, "--threads") == 0 && *index + 1 < argc && safe_atoi(argv[*index + 1]) > 0)
+        run_options.threads = safe_atoi(argv[++*index]);
+    else if (strcmp(opt, "--steps") == 0 && *index + 1 < argc
+             && (run_options.max_steps = strtoul(argv[*index + 1], &end, 10)) > 0 && !*end)
+        ++*index;
+    else {
+        handle_error(ERR_INVALID_OPTION, opt);
+        return ERR_INVALID_OPTION;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Appends the jobs of a manifest file to the jobs array.
+ *
+ * @param path  The manifest file.
+ * @param jobs  Pointer to the jobs array, grown as needed.
+ * @param count Pointer to the number of jobs.
+ * @param cap   Pointer to the capacity of the jobs array.
+ * @return NO_ERROR if successful, or the status of the first error (already reported).
+ */
+status read_manifest(const char *path, job **jobs, size_t *count, size_t *cap) {
+    char line[RUNNER_LINE_LENGTH], program[RUNNER_LINE_LENGTH], input[RUNNER_LINE_LENGTH];
+    char expected[RUNNER_LINE_LENGTH], extra[RUNNER_LINE_LENGTH];
+    job *new_jobs = NULL, *j = NULL;
+    FILE *file = NULL;
+    file_context fc;
+    size_t len;
+    unsigned long steps;
+    int fields, lc = 0;
+
+    if (!(file = fopen(path, FILE_MODE_READ))) {
+        fc.file_name = (char *)path;
+        fc.lc = 0;
+        handle_error(ERR_OPEN_FILE, &fc);
+        return ERR_OPEN_FILE;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        lc++;
+        steps = 0;
+        if ((fields = sscanf(line, "%s %s %s %lu %s", program, input, expected, &steps, extra)) <= 0
+            || *program == '#')
+            continue; /* empty or comment line */
+        if (fields < 3 || fields > 4 || (fields == 4 && !steps)) {
+            handle_error(ERR_MANIFEST, path, lc);
+            fclose(file);
+            return ERR_MANIFEST;
+        }
+
+        if (*count == *cap) {
+            *cap = *cap ? *cap * 2 : DEFAULT_DATA_IMAGE_CAP;
+            if (!(new_jobs = realloc(*jobs, *cap * sizeof(job)))) {
+                handle_error(ERR_MEM_ALLOC);
+                fclose(file);
+                return ERR_MEM_ALLOC;
+            }
+            *jobs = new_jobs;
+        }
+
+        len = strlen(program);
+        if (len > FILE_EXT_LEN && strcmp(program + len - FILE_EXT_LEN, OBJECT_EXT) == 0)
+            program[len - FILE_EXT_LEN] = '\0';
+
+        j = &(*jobs)[*count];
+        memset(j, 0, sizeof(job));
+        j->max_steps = steps ? steps : run_options.max_steps;
+        j->program = strdup(program);
+        j->input = strdup(input);
+        j->expected = strdup(expected);
+        (*count)++;
+        if (!j->program || !j->input || !j->expected) {
+            handle_error(ERR_MEM_ALLOC);
+            fclose(file);
+            return ERR_MEM_ALLOC;
+        }
+    }
+    fclose(file);
+    return NO_ERROR;
+}
+
+/**
+ * Loads every distinct program of the jobs once, the jobs share the loaded modules.
+ *
+ * @param jobs              The jobs.
+ * @param count             The number of jobs.
+ * @param programs          Set to the loaded programs.
+ * @param programs_count    Set to the number of loaded programs.
+ * @return NO_ERROR if successful, or the status of the first error (already reported).
+ */
+status load_programs(job *jobs, size_t count, loaded_program **programs, size_t *programs_count) {
+    size_t i, k;
+    status report;
+    int line;
+
+    if (count && !(*programs = calloc(count, sizeof(loaded_program)))) {
+        handle_error(ERR_MEM_ALLOC);
+        return ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < *programs_count && strcmp((*programs)[k].name, jobs[i].program) != 0; k++)
+            ;
+        if (k == *programs_count) {
+            if ((report = load_object(jobs[i].program, &(*programs)[k].module, &line)) != NO_ERROR) {
+                report_load_error(jobs[i].program, report, line);
+                return report;
+            }
+            (*programs)[(*programs_count)++].name = jobs[i].program;
+        }
+        jobs[i].module = &(*programs)[k].module;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Runs all the jobs on a work-stealing pool of threads.
+ * Jobs are dealt round-robin to the workers, a worker that runs out of jobs steals from the others.
+ *
+ * @param jobs      The jobs.
+ * @param count     The number of jobs.
+ * @param threads   The number of worker threads, 0 for one per online processor.
+ * @return NO_ERROR if successful, ERR_MEM_ALLOC or FAILURE if the pool could not be started.
+ */
+status run_jobs(job *jobs, size_t count, int threads) {
+    job_pool pool;
+    worker_context *contexts = NULL;
+    pthread_t *ids = NULL;
+    size_t i;
+    int w, started = 0;
+    status report = NO_ERROR;
+
+    if (threads <= 0 && (threads = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+        threads = 1;
+    if ((size_t)threads > count)
+        threads = count ? (int)count : 1;
+    if (threads > RUNNER_MAX_THREADS)
+        threads = RUNNER_MAX_THREADS;
+
+    pool.workers = threads;
+    pool.deques = calloc((size_t)threads, sizeof(job_deque));
+    contexts = calloc((size_t)threads, sizeof(worker_context));
+    ids = calloc((size_t)threads, sizeof(pthread_t));
+    for (w = 0; pool.deques && w < threads; w++)
+        if (!(pool.deques[w].jobs = malloc((count / threads + 1) * sizeof(job*))))
+            break;
+    if (!pool.deques || !contexts || !ids || w < threads) {
+        handle_error(ERR_MEM_ALLOC);
+        report = ERR_MEM_ALLOC;
+    }
+
+    if (report == NO_ERROR) {
+        for (w = 0; w < threads; w++)
+            pthread_mutex_init(&pool.deques[w].lock, NULL);
+        for (i = 0; i < count; i++) {
+            w = (int)(i % threads);
+            pool.deques[w].jobs[pool.deques[w].bottom++] = &jobs[i];
+        }
+
+        for (started = 0; started < threads; started++) {
+            contexts[started].pool = &pool;
+            contexts[started].index = started;
+            if (pthread_create(&ids[started], NULL, worker_main, &contexts[started]) != 0)
+                break;
+        }
+        /* The started workers steal the jobs of the ones that could not be started */
+        if (!started) {
+            handle_error(TERMINATE, "pthread_create()");
+            report = FAILURE;
+        }
+        for (w = 0; w < started; w++)
+            pthread_join(ids[w], NULL);
+        for (w = 0; w < threads; w++)
+            pthread_mutex_destroy(&pool.deques[w].lock);
+    }
+
+    for (w = 0; pool.deques && w < threads; w++)
+        free(pool.deques[w].jobs);
+    free(pool.deques);
+    free(contexts);
+    free(ids);
+    return report;
+}
+
+/**
+ * Worker thread: runs its own jobs, then steals from the other workers until all deques are empty.
+ * Every worker owns a machine, it is reset for each job.
+ *
+ * @param arg The worker_context of the thread.
+ * @return NULL.
+ */
+void *worker_main(void *arg) {
+    worker_context *ctx = arg;
+    machine *m = malloc(sizeof(machine));
+    job *j = NULL;
+
+    while ((j = take_job(ctx->pool, ctx->index))) {
+        if (m)
+            run_job(j, m);
+        else
+            j->result = ERR_MEM_ALLOC;
+    }
+    free(m);
+    return NULL;
+}
+
+/**
+ * Takes the next job of a worker: the bottom of its own deque, or else the top of another one.
+ *
+ * @param pool  The pool.
+ * @param index The index of the worker.
+ * @return The job, or NULL if no job is left.
+ */
+job *take_job(job_pool *pool, int index) {
+    job_deque *dq = NULL;
+    job *j = NULL;
+    int k;
+
+    dq = &pool->deques[index];
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top)
+        j = dq->jobs[--dq->bottom];
+    pthread_mutex_unlock(&dq->lock);
+
+    for (k = 1; !j && k < pool->workers; k++) {
+        dq = &pool->deques[(index + k) % pool->workers];
+        pthread_mutex_lock(&dq->lock);
+        if (dq->bottom > dq->top)
+            j = dq->jobs[dq->top++];
+        pthread_mutex_unlock(&dq->lock);
+    }
+    return j;
+}
+
+/**
+ * Runs a single job and records its result, steps and wall time.
+ *
+ * @param j The job.
+ * @param m The machine of the worker.
+ */
+void run_job(job *j, machine *m) {
+    struct timespec start;
+    FILE *in = NULL, *out = NULL;
+    char *output = NULL;
+    size_t output_len = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    in = fopen(strcmp(j->input, RUNNER_NO_FILE) == 0 ? RUNNER_EMPTY_INPUT : j->input, FILE_MODE_READ);
+    out = open_memstream(&output, &output_len);
+    if (!in || !out)
+        j->result = !in ? ERR_OPEN_FILE : ERR_MEM_ALLOC;
+    else {
+        machine_reset(m, j->module, in, out);
+        j->result = machine_run(m, j->max_steps);
+        j->steps = m->steps;
+        j->pc = m->pc;
+    }
+
+    if (in) fclose(in);
+    if (out) fclose(out);
+    if (j->result == NO_ERROR && strcmp(j->expected, RUNNER_NO_FILE) != 0
+        && !output_matches(output, output_len, j->expected))
+        j->result = FAILURE;
+    free(output);
+
+    j->wall_ms = elapsed_ms(&start);
+}
+
+/**
+ * Compares the output of a program with the expected output file.
+ *
+ * @param output        The output of the program.
+ * @param output_len    The length of the output.
+ * @param expected_path The expected output file.
+ * @return 1 if they are identical, 0 otherwise (or if the file cannot be read).
+ */
+int output_matches(const char *output, size_t output_len, const char *expected_path) {
+    char buffer[RUNNER_COMPARE_BUFFER];
+    FILE *file = fopen(expected_path, FILE_MODE_READ);
+    size_t read, offset = 0;
+    int equal = file != NULL;
+
+    while (equal && (read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        equal = offset + read <= output_len && memcmp(output + offset, buffer, read) == 0;
+        offset += read;
+    }
+    if (file) fclose(file);
+    return equal && offset == output_len;
+}
+
+/**
+ * Prints one line per job, in manifest order, followed by a summary.
+ * Jobs that failed to run report the reason as a diagnostic.
+ *
+ * @param jobs  The jobs.
+ * @param count The number of jobs.
+ * @return NO_ERROR if every job passed, FAILURE otherwise.
+ */
+status report_jobs(const job *jobs, size_t count) {
+    const job *j = NULL;
+    file_context fc;
+    size_t i;
+    int passed = 0;
+
+    printf("%-6s %12s %12s  %s\n", "RESULT", "STEPS", "TIME (ms)", "PROGRAM INPUT EXPECTED");
+    for (i = 0; i < count; i++) {
+        j = &jobs[i];
+        passed += j->result == NO_ERROR;
+        printf("%-6s %12lu %12.3f  %s %s %s\n", j->result == NO_ERROR ? "PASS" : j->result == FAILURE ? "FAIL"
+               : j->result == ERR_SIM_STEPS ? "LIMIT" : "ERROR", j->steps, j->wall_ms, j->program, j->input,
+               j->expected);
+
+        if (j->result == ERR_OPEN_FILE) {
+            fc.file_name = j->input;
+            fc.lc = 0;
+            handle_error(ERR_OPEN_FILE, &fc);
+        }
+        else if (j->result == ERR_MEM_ALLOC)
+            handle_error(ERR_MEM_ALLOC);
+        else if (j->result >= ERR_SIM_ILLEGAL && j->result <= ERR_SIM_STEPS)
+            handle_error(j->result, j->program, j->pc);
+    }
+    handle_progress(RUNNER_DONE, passed, (int)count);
+    return (size_t)passed == count ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Reports why a program could not be loaded.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param code      The status returned by load_object().
+ * @param line      The invalid line, if any.
+ */
+void report_load_error(const char *file_name, status code, int line) {
+    file_context fc;
+
+    if (code == ERR_OPEN_FILE) {
+        fc.file_name = malloc(strlen(file_name) + FILE_EXT_LEN_OUT);
+        if (!fc.file_name) {
+            handle_error(ERR_MEM_ALLOC);
+            return;
+        }
+        strcat(strcpy(fc.file_name, file_name), OBJECT_EXT);
+        fc.lc = 0;
+        handle_error(ERR_OPEN_FILE, &fc);
+        free(fc.file_name);
+    }
+    else if (code == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else
+        handle_error(code, file_name, line);
+}
+
+/**
+ * Releases the jobs and the loaded programs.
+ *
+ * @param jobs              The jobs.
+ * @param count             The number of jobs.
+ * @param programs          The loaded programs.
+ * @param programs_count    The number of loaded programs.
+ */
+void free_jobs(job *jobs, size_t count, loaded_program *programs, size_t programs_count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        free_strings(3, &jobs[i].program, &jobs[i].input, &jobs[i].expected);
+    for (i = 0; i < programs_count; i++)
+        free_object(&programs[i].module);
+    free(jobs);
+    free(programs);
+}
+
+/**
+ * Returns the milliseconds elapsed since a point in time.
+ *
+ * @param start The point in time, from clock_gettime(CLOCK_MONOTONIC).
+ * @return The elapsed time in milliseconds.
+ */
+double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * MS_PER_SEC + (double)(now.tv_nsec - start->tv_nsec) / NS_PER_MS;
+}
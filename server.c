@@ -0,0 +1,456 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "assembler.h"
+#include "utils.h"
+#include "errors.h"
+#include "aobj.h"
+#include "preprocessor.h"
+
+#define RESPONSE_FILES_LEN 5
+#define CAPTURED_STREAMS_LEN 2
+
+/* Output files sent back to the client, in the order they are written */
+static const char *response_ext[RESPONSE_FILES_LEN] = {OBJECT_EXT, ENTRY_EXT, EXTERNAL_EXT, DEBUG_EXT,
+                                                            XREF_EXT};
+static const char *response_tags[RESPONSE_FILES_LEN] = {TAG_OB, TAG_ENT, TAG_EXT, TAG_DBG, TAG_XREF};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/* "Private" helper functions */
+pid_t spawn_worker(int listen_fd, const assembler_options *base);
+void run_worker(int listen_fd, const assembler_options *base);
+void handle_client(int fd, const assembler_options *base);
+void request_stop(int sig);
+void remove_request_files(const char *name);
+char *join_ext(const char *name, const char *ext);
+char *absolute_path(const char *path);
+void confine_includes(const assembler_options *base, char *dir, char **resolved);
+status assemble_request(FILE *dest, const char *name, char *opts, const char *src, size_t src_len,
+                        const assembler_options *base);
+
+/**
+ * Runs the assembler as a server on a Unix domain socket until SIGINT or SIGTERM is received.
+ *
+ * The assembler keeps its state in globals, so requests are served by a pool of pre-forked
+ * worker processes rather than threads. Each worker accepts connections from the shared
+ * listening socket and assembles one request at a time, a worker that dies is replaced.
+ *
+ * @param socket_path   The path of the socket, an existing socket file is replaced.
+ * @param workers       The number of worker processes, 0 for the default.
+ * @return NO_ERROR once the server has been stopped, or FAILURE if the socket could not be set up.
+ */
+status serve(const char *socket_path, int workers) {
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    assembler_options base;
+    pid_t *pids = NULL, pid;
+    char *cache_dir = NULL, *dir = NULL;
+    int listen_fd, i, dirs = 0, missing;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        handle_error(ERR_SOCKET, socket_path);
+        return FAILURE;
+    }
+    workers = workers <= 0 ? SERVER_DEFAULT_WORKERS : workers > SERVER_MAX_WORKERS ? SERVER_MAX_WORKERS : workers;
+
+    /* Requests are assembled in their own directory, the cache must not depend on the working directory */
+    if (options.cache_dir && *options.cache_dir != '/') {
+        if (!(cache_dir = absolute_path(options.cache_dir))) {
+            handle_error(ERR_MEM_ALLOC);
+            return FAILURE;
+        }
+        options.cache_dir = cache_dir;
+    }
+    if (!(pids = calloc((size_t)workers, sizeof(pid_t)))) {
+        handle_error(ERR_MEM_ALLOC);
+        free(cache_dir);
+        return FAILURE;
+    }
+
+    /* Canonical, they are the only directories outside of a request an included file may come from */
+    for (i = 0; i < options.include_dirs_count; i++)
+        if ((dir = realpath(options.include_dirs[i], NULL)))
+            options.include_dirs[dirs++] = dir;
+    options.include_dirs_count = dirs;
+    base = options;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SERVER_BACKLOG) != 0) {
+        handle_error(ERR_SOCKET, socket_path);
+        if (listen_fd >= 0) close(listen_fd);
+        for (i = 0; i < dirs; i++)
+            free(base.include_dirs[i]);
+        free(pids);
+        free(cache_dir);
+        return FAILURE;
+    }
+
+    /* No SA_RESTART, waitpid() has to return when the server is asked to stop */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); /* a client that went away is handled per request */
+
+    handle_progress(SERVER_READY, socket_path);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        /* An empty slot is a worker that died, or that fork() failed for: tried again every second */
+        for (i = 0, missing = 0; i < workers; i++)
+            if (!pids[i] && !(pids[i] = spawn_worker(listen_fd, &base)))
+                missing = 1;
+        if ((pid = waitpid(-1, NULL, missing ? WNOHANG : 0)) <= 0) {
+            if (missing && !stop_requested)
+                sleep(SERVER_RESPAWN_DELAY);
+            continue;
+        }
+        for (i = 0; i < workers; i++)
+            if (pids[i] == pid)
+                pids[i] = 0;
+    }
+
+    for (i = 0; i < workers; i++)
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+        ;
+
+    close(listen_fd);
+    unlink(socket_path);
+    for (i = 0; i < dirs; i++)
+        free(base.include_dirs[i]);
+    free(pids);
+    free(cache_dir);
+    return NO_ERROR;
+}
+
+/**
+ * Forks a worker process that serves connections from the listening socket.
+ *
+ * @param listen_fd The listening socket.
+ * @param base      The server options, every request starts from them.
+ * @return The pid of the worker, or 0 if fork() failed.
+ */
+pid_t spawn_worker(int listen_fd, const assembler_options *base) {
+    pid_t pid;
+
+    flush_diagnostics();
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        run_worker(listen_fd, base);
+        _exit(FAILURE);
+    }
+    if (pid < 0) {
+        handle_error(ERR_SOCKET, "fork()");
+        flush_diagnostics();
+        return 0;
+    }
+    return pid;
+}
+
+/**
+ * Accepts and serves connections, one at a time, until accept() fails.
+ *
+ * @param listen_fd The listening socket.
+ * @param base      The server options.
+ */
+void run_worker(int listen_fd, const assembler_options *base) {
+    int fd;
+
+    for (;;) {
+        if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            handle_error(ERR_SOCKET, "accept()");
+            flush_diagnostics();
+            return;
+        }
+        handle_client(fd, base);
+    }
+}
+
+/**
+ * Reads a request from a connection, assembles it and writes the response.
+ * A malformed request is answered by closing the connection.
+ *
+ * @param fd    The connection, closed when done.
+ * @param base  The server options.
+ */
+void handle_client(int fd, const assembler_options *base) {
+    FILE *in = NULL, *out = NULL;
+    section sec;
+    char *name = NULL, *opts = NULL, *src = NULL;
+    size_t src_len = 0;
+    status report;
+    int out_fd;
+
+    if (!(in = fdopen(fd, "r"))) {
+        close(fd);
+        return;
+    }
+    if ((out_fd = dup(fd)) < 0 || !(out = fdopen(out_fd, "w"))) {
+        if (out_fd >= 0) close(out_fd);
+        fclose(in);
+        return;
+    }
+
+    while ((report = read_section(in, &sec)) == NO_ERROR && strcmp(sec.tag, TAG_END) != 0) {
+        if (strcmp(sec.tag, TAG_NAME) == 0 && !name)
+            name = sec.data;
+        else if (strcmp(sec.tag, TAG_OPTS) == 0 && !opts)
+            opts = sec.data;
+        else if (strcmp(sec.tag, TAG_SRC) == 0 && !src) {
+            src = sec.data;
+            src_len = sec.len;
+        }
+        else if (sec.data)
+            free(sec.data);
+    }
+
+    /* The name is used as a file name in the request directory, it may not leave it */
+    if (report == NO_ERROR && name && !strchr(name, '/'))
+        (void) assemble_request(out, name, opts, src, src_len, base);
+
+    free(name);
+    free(opts);
+    free(src);
+    fclose(out);
+    fclose(in);
+}
+
+/**
+ * Assembles a single request in a temporary directory and writes the response.
+ *
+ * Output that the assembler writes to stdout and stderr is captured and sent back,
+ * so the client reports exactly what the command line assembler would.
+ *
+ * @param dest      The response stream.
+ * @param name      The file name without the .as extension.
+ * @param opts      Space separated assembler options (optional - NULL), split in place.
+ * @param src       The source file contents (optional - NULL for an empty file).
+ * @param src_len   The length of the source.
+ * @param base      The server options, the request options are applied on top of them.
+ * @return The status of the assembly, or FAILURE if the request could not be processed.
+ */
+status assemble_request(FILE *dest, const char *name, char *opts, const char *src, size_t src_len,
+                        const assembler_options *base) {
+    char dir[SERVER_TMP_LEN] = SERVER_TMP_TEMPLATE;
+    char *argv[SERVER_MAX_OPTS + 1], *resolved[MAX_INCLUDE_DIRS];
+    char *path = NULL, *root = NULL;
+    FILE *capture[CAPTURED_STREAMS_LEN] = {NULL, NULL};
+    FILE *file = NULL;
+    int saved[CAPTURED_STREAMS_LEN] = {-1, -1};
+    int argc = 1, i;
+    status report = NO_ERROR;
+
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        handle_error(ERR_SOCKET, dir);
+        flush_diagnostics();
+        return FAILURE;
+    }
+    memset(resolved, 0, sizeof(resolved));
+    if (!(root = realpath(".", NULL)))
+        report = FAILURE;
+
+    if (!(path = join_ext(name, ASSEMBLY_EXT)) || !(file = fopen(path, "w"))
+        || (src_len && fwrite(src, 1, src_len, file) != src_len))
+        report = FAILURE;
+    if (file) fclose(file);
+    free(path);
+
+    /* stdout and stderr of the assembler are redirected for the duration of the request */
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < CAPTURED_STREAMS_LEN && report == NO_ERROR; i++) {
+        if (!(capture[i] = tmpfile()) || (saved[i] = dup(STDOUT_FILENO + i)) < 0
+            || dup2(fileno(capture[i]), STDOUT_FILENO + i) < 0)
+            report = FAILURE;
+    }
+
+    if (report == NO_ERROR) {
+        options = *base;
+        argv[0] = "Assembler";
+        for (path = opts ? strtok(opts, " ") : NULL; path && argc < SERVER_MAX_OPTS; path = strtok(NULL, " "))
+            argv[argc++] = path;
+        argv[argc] = NULL;
+        for (i = 1; i < argc && report == NO_ERROR; i++)
+            report = parse_option(argc, argv, &i);
+
+        /* Paths and server settings are not the client's to choose */
+        options.cache_dir = base->cache_dir;
+        options.cache_max_size = base->cache_max_size;
+        options.diag_json = base->diag_json;
+        options.serve_path = base->serve_path;
+        options.workers = base->workers;
+        options.project = base->project;
+        options.lsp = base->lsp;
+        options.macro_lib = base->macro_lib; /* the library the server mapped, a client path is not opened */
+
+        if (report == NO_ERROR) {
+            confine_includes(base, root, resolved);
+            report = assemble_file(name, 1, 1);
+        }
+        flush_diagnostics();
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < CAPTURED_STREAMS_LEN; i++) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], STDOUT_FILENO + i);
+            close(saved[i]);
+        }
+    }
+
+    if (capture[0] && capture[1]) {
+        write_stream_section(dest, TAG_OUT, capture[0]);
+        write_stream_section(dest, TAG_ERR, capture[1]);
+        for (i = 0; i < RESPONSE_FILES_LEN; i++) {
+            if ((path = join_ext(name, response_ext[i])) && (file = fopen(path, "r"))) {
+                write_stream_section(dest, response_tags[i], file);
+                fclose(file);
+            }
+            free(path);
+        }
+        write_section(dest, TAG_STAT, report == NO_ERROR ? "0" : "1", 1);
+        write_section(dest, TAG_END, NULL, 0);
+        fflush(dest);
+    }
+
+    for (i = 0; i < CAPTURED_STREAMS_LEN; i++)
+        if (capture[i]) fclose(capture[i]);
+    for (i = 0; i < MAX_INCLUDE_DIRS; i++)
+        free(resolved[i]);
+    free(root);
+    options.include_roots_count = 0;
+    remove_request_files(name);
+    if (chdir("/") != 0 || rmdir(dir) != 0) {
+        handle_error(ERR_SOCKET, dir);
+        flush_diagnostics();
+    }
+    return report;
+}
+
+/**
+ * Confines the .include files of a request to the request directory and the -I directories of the
+ * server. The -I directories of the request are resolved, the ones outside of them are not searched:
+ * the client forwards the directory of the source, which the server may not share.
+ *
+ * @param base      The server options, their -I directories are canonical.
+ * @param dir       The canonical path of the request directory.
+ * @param resolved  Set to the canonical -I directories of the request, to be released with free().
+ */
+void confine_includes(const assembler_options *base, char *dir, char **resolved) {
+    char *path = NULL;
+    int i, kept = base->include_dirs_count;
+
+    options.include_roots[0] = dir;
+    for (i = 0; i < base->include_dirs_count; i++)
+        options.include_roots[1 + i] = base->include_dirs[i];
+    options.include_roots_count = 1 + base->include_dirs_count;
+
+    for (i = base->include_dirs_count; i < options.include_dirs_count; i++) {
+        if ((path = realpath(options.include_dirs[i], NULL)) && is_include_root(path))
+            options.include_dirs[kept++] = resolved[i - base->include_dirs_count] = path;
+        else
+            free(path);
+    }
+    options.include_dirs_count = kept;
+}
+
+/**
+ * Removes the source, intermediate and output files of a request from the working directory.
+ *
+ * @param name The file name without extension.
+ */
+void remove_request_files(const char *name) {
+    const char *ext[] = {ASSEMBLY_EXT, PREPROCESSOR_EXT, OBJECT_EXT, ENTRY_EXT, EXTERNAL_EXT, DEBUG_EXT, XREF_EXT,
+                         AOBJ_EXT};
+    char *path = NULL;
+    size_t i;
+
+    for (i = 0; i < sizeof(ext) / sizeof(ext[0]); i++) {
+        if ((path = join_ext(name, ext[i])))
+            remove(path);
+        free(path);
+    }
+}
+
+/**
+ * Concatenates a file name and an extension into a new string.
+ *
+ * @param name  The file name.
+ * @param ext   The extension, including the dot.
+ * @return The allocated string, or NULL if memory allocation failed.
+ */
+char *join_ext(const char *name, const char *ext) {
+    char *path = malloc(strlen(name) + strlen(ext) + 1);
+
+    if (path) {
+        strcpy(path, name);
+        strcat(path, ext);
+    }
+    return path;
+}
+
+/**
+ * Converts a path relative to the working directory into an absolute path.
+ *
+ * @param path The relative path.
+ * @return The allocated absolute path, or NULL if it could not be resolved.
+ */
+char *absolute_path(const char *path) {
+    char *cwd = NULL, *new_cwd = NULL, *result = NULL;
+    size_t size = PROTOCOL_BUFFER;
+
+    for (;;) {
+        if (!(new_cwd = realloc(cwd, size))) {
+            free(cwd);
+            return NULL;
+        }
+        cwd = new_cwd;
+        if (getcwd(cwd, size))
+            break;
+        if (errno != ERANGE) {
+            free(cwd);
+            return NULL;
+        }
+        size *= 2;
+    }
+
+    if ((result = malloc(strlen(cwd) + strlen(path) + 2)))
+        sprintf(result, "%s/%s", cwd, path);
+    free(cwd);
+    return result;
+}
+
+/**
+ * Signal handler of the server process, stops it after the current waitpid() call.
+ *
+ * @param sig The signal number (unused).
+ */
+void request_stop(int sig) {
+    (void) sig;
+    stop_requested = 1;
+}
@@ -0,0 +1,17 @@
+#ifndef ASSEMBLER_SERVER_H
+#define ASSEMBLER_SERVER_H
+
+#include "errors.h"
+#include "protocol.h"
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_MAX_WORKERS 64
+#define SERVER_BACKLOG 16
+#define SERVER_MAX_OPTS 16
+#define SERVER_TMP_TEMPLATE "/tmp/asmXXXXXX"
+#define SERVER_TMP_LEN 16
+#define SERVER_RESPAWN_DELAY 1 /* seconds between two attempts to start a worker */
+
+status serve(const char *socket_path, int workers);
+
+#endif
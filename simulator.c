@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "machine.h"
+#include "object.h"
+#include "profile.h"
+#include "debuginfo.h"
+#include "utils.h"
+#include "errors.h"
+
+#define SIMULATOR_DEFAULT_STEPS 10000000UL /* a program that never stops is reported rather than run forever */
+
+typedef struct {
+    unsigned long max_steps; /* --steps: instruction limit per program, SIMULATOR_DEFAULT_STEPS by default */
+    char *start; /* --start: entry label or address to start at (optional - NULL for ADDRESS_START) */
+    int stats; /* --stats: report the number of executed instructions */
+    int profile; /* --profile: write the hot-spot report to NAME.prof */
+    int folded; /* --folded: write the profile in the flame graph folded format to NAME.folded */
+} simulator_options;
+
+static simulator_options sim_options = {SIMULATOR_DEFAULT_STEPS, NULL, 0, 0, 0};
+
+status simulate_file(const char *file_name);
+status parse_simulator_option(int argc, char *argv[], int *index);
+status write_profiles(const char *file_name, const machine *m, const object_module *module);
+status write_profile_file(const char *file_name, const char *ext, const machine *m, const object_module *module,
+                          const debug_info *info);
+void report_load_error(const char *file_name, status code, int line);
+
+/**
+ * Simulator of the 12-bit machine, runs programs assembled by the assembler.
+ * Usage: Simulator [--steps N] [--start LABEL|ADDRESS] [--stats] [--profile] [--folded] file...
+ * Each file is given without extension, its .ob file is loaded together with the .ent and .ext files.
+ * red reads a character from stdin, prn prints the signed value of its operand to stdout.
+ * A program is stopped after 10000000 instructions, --steps sets another limit.
+ * A profiled run counts the executions of every address, the reports roll the counts up into source
+ * lines and labels when the program has been assembled with --debug-info.
+ */
+int main(int argc, char *argv[]) {
+    int i, files = 0;
+
+    /* Options may appear anywhere, file names are packed to the front of argv */
+    for (i = 1; i < argc; i++) {
+        if (*argv[i] != OPTION_PREFIX)
+            argv[1 + files++] = argv[i];
+        else if (parse_simulator_option(argc, argv, &i) != NO_ERROR) {
+            flush_diagnostics();
+            exit(FAILURE);
+        }
+    }
+
+    if (!files) {
+        handle_error(ERR_INVALID_OPTION, "missing file name");
+        flush_diagnostics();
+        exit(FAILURE);
+    }
+
+    for (i = 1; i <= files; i++) {
+        (void) simulate_file(argv[i]);
+        flush_diagnostics();
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a single command line option of the simulator.
+ *
+ * @param argc      The number of command line arguments.
+ * @param argv      The command line arguments.
+ * @param index     Pointer to the index of the option, advanced past any option argument.
+ *
+ * @return NO_ERROR if the option is valid, or ERR_INVALID_OPTION otherwise.
+ */
+status parse_simulator_option(int argc, char *argv[], int *index) {
+    char *opt = argv[*index], *end = NULL;
+
+    if (strcmp(opt, "--steps") == 0 && *index + 1 < argc
+        && (sim_options.max_steps = strtoul(argv[*index + 1], &end, 10)) > 0 && !*end)
+        ++*index;
+    else if (strcmp(opt, "--start") == 0 && *index + 1 < argc)
+        sim_options.start = argv[++*index];
+    else if (strcmp(opt, "--stats") == 0)
+        sim_options.stats = 1;
+    else if (strcmp(opt, "--profile") == 0)
+        sim_options.profile = 1;
+    else if (strcmp(opt, "--folded") == 0)
+        sim_options.folded = 1;
+    else {
+        handle_error(ERR_INVALID_OPTION, opt);
+        return ERR_INVALID_OPTION;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * Loads and runs a single program.
+ *
+ * @param file_name The name of the program, without extension.
+ * @return NO_ERROR if the program ran until stop, FAILURE otherwise.
+ */
+status simulate_file(const char *file_name) {
+    static machine m;
+    static unsigned long counts[MACHINE_COUNTS];
+    object_module module;
+    status report;
+    int line, start = ADDRESS_START;
+
+    if ((report = load_object(file_name, &module, &line)) != NO_ERROR) {
+        report_load_error(file_name, report, line);
+        return FAILURE;
+    }
+
+    if (sim_options.start) {
+        start = find_object_symbol(module.entries, module.entries_count, sim_options.start);
+        if (start == INVALID_ADDRESS)
+            start = safe_atoi(sim_options.start);
+        if (start < ADDRESS_START || start >= MAX_MEMORY_SIZE) {
+            handle_error(ERR_INVALID_OPTION, sim_options.start);
+            free_object(&module);
+            return FAILURE;
+        }
+    }
+
+    machine_reset(&m, &module, NULL, NULL);
+    m.pc = start;
+    if (sim_options.profile || sim_options.folded) {
+        memset(counts, 0, sizeof(counts));
+        m.counts = counts;
+    }
+    report = machine_run(&m, sim_options.max_steps);
+    fflush(stdout);
+
+    if (report != NO_ERROR)
+        handle_error(report, file_name, m.pc);
+    else if (sim_options.stats)
+        handle_progress(SIM_DONE, file_name, m.steps);
+
+    /* A program that faults or runs out of steps is profiled as well, up to where it stopped */
+    if (m.counts && write_profiles(file_name, &m, &module) != NO_ERROR)
+        report = FAILURE;
+
+    free_object(&module);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Writes the profiles of a program run, with its source map if it has a .dbg file.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param m         The machine after the run.
+ * @param module    The program.
+ * @return NO_ERROR if successful, FAILURE otherwise (already reported).
+ */
+status write_profiles(const char *file_name, const machine *m, const object_module *module) {
+    debug_info info;
+    status report;
+    int offset, has_info;
+
+    report = load_debug_info(file_name, &info, &offset);
+    if (report == ERR_MEM_ALLOC) {
+        handle_error(ERR_MEM_ALLOC);
+        return FAILURE;
+    }
+    if (report == ERR_DEBUG_FILE)
+        handle_error(ERR_DEBUG_FILE, file_name, offset); /* profiled by address only */
+    has_info = report == NO_ERROR;
+
+    report = NO_ERROR;
+    if (sim_options.profile)
+        report = write_profile_file(file_name, PROFILE_EXT, m, module, has_info ? &info : NULL);
+    if (report == NO_ERROR && sim_options.folded)
+        report = write_profile_file(file_name, FOLDED_EXT, m, module, has_info ? &info : NULL);
+
+    if (has_info)
+        free_debug_info(&info);
+    return report;
+}
+
+/**
+ * Writes a single profile file of a program run.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param ext       PROFILE_EXT for the hot-spot report, or FOLDED_EXT for the folded stacks.
+ * @param m         The machine after the run.
+ * @param module    The program.
+ * @param info      The source map (optional - NULL).
+ * @return NO_ERROR if successful, FAILURE otherwise (already reported).
+ */
+status write_profile_file(const char *file_name, const char *ext, const machine *m, const object_module *module,
+                          const debug_info *info) {
+    file_context fc;
+    FILE *file = NULL;
+    status report;
+
+    if (!(fc.file_name = malloc(strlen(file_name) + strlen(ext) + 1))) {
+        handle_error(ERR_MEM_ALLOC);
+        return FAILURE;
+    }
+    strcat(strcpy(fc.file_name, file_name), ext);
+    fc.lc = 0;
+
+    if (!(file = fopen(fc.file_name, FILE_MODE_WRITE_PLUS))) {
+        handle_error(ERR_OPEN_FILE, &fc);
+        free(fc.file_name);
+        return FAILURE;
+    }
+
+    report = strcmp(ext, PROFILE_EXT) == 0 ? write_profile(file, file_name, m, module, info)
+                                           : write_folded_profile(file, file_name, m, module, info);
+    if (fclose(file) != 0 && report == NO_ERROR)
+        report = FAILURE;
+
+    if (report == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else if (report != NO_ERROR)
+        handle_error(ERR_OPEN_FILE, &fc);
+    free(fc.file_name);
+    return report == NO_ERROR ? NO_ERROR : FAILURE;
+}
+
+/**
+ * Reports why a program could not be loaded.
+ *
+ * @param file_name The name of the program, without extension.
+ * @param code      The status returned by load_object().
+ * @param line      The invalid line, if any.
+ */
+void report_load_error(const char *file_name, status code, int line) {
+    file_context fc;
+
+    if (code == ERR_OPEN_FILE) {
+        fc.file_name = malloc(strlen(file_name) + FILE_EXT_LEN_OUT);
+        if (!fc.file_name) {
+            handle_error(ERR_MEM_ALLOC);
+            return;
+        }
+        strcat(strcpy(fc.file_name, file_name), OBJECT_EXT);
+        fc.lc = 0;
+        handle_error(ERR_OPEN_FILE, &fc);
+        free(fc.file_name);
+    }
+    else if (code == ERR_MEM_ALLOC)
+        handle_error(ERR_MEM_ALLOC);
+    else
+        handle_error(code, file_name, line);
+}
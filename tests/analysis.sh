@@ -0,0 +1,90 @@
+# Incremental analysis: the diagnostics after edits of a few lines are the ones of the whole edited
+# document analyzed again, with the current line numbers, and an edit of a macro body reaches its calls
+. "$(dirname "$0")/common.sh" "$1"
+
+# send JSON: appends a message framed by its Content-Length header to in.txt
+send() {
+    printf 'Content-Length: %d\r\n\r\n%s' "${#1}" "$1" >> in.txt
+}
+
+# open URI TEXT: opens a document, TEXT is a JSON string without its quotes
+open() {
+    send '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"'"$1"'","languageId":"asm","version":1,"text":"'"$2"'"}}}'
+}
+
+# change URI START_LINE START_CHAR END_LINE END_CHAR TEXT: replaces a range of a document
+change() {
+    send '{"jsonrpc":"2.0","method":"textDocument/didChange","params":{"textDocument":{"uri":"'"$1"'","version":2},"contentChanges":[{"range":{"start":{"line":'"$2"',"character":'"$3"'},"end":{"line":'"$4"',"character":'"$5"'}},"text":"'"$6"'"}]}}'
+}
+
+# published N: the messages of the Nth diagnostics published, one per line, into pub.txt
+published() {
+    sed 's/Content-Length: [0-9]*\r$//' out.txt | grep 'publishDiagnostics' | sed -n "$1p" \
+        | grep -o '"message":"[^"]*"' | sed 's/^"message":"//; s/"$//' > pub.txt
+}
+
+# The macro is called with a label, the label is the first word of the expansion
+DOC='.entry MAIN\nmcro show\nprn K\nendmcro\nMAIN: show\nmov 1\njmp LOOP\nLOOP: stop\nK: .data 1\n'
+open file:///a.as "$DOC"                             # 1
+change file:///a.as 5 5 5 5 ', @r1'                  # 2: fixes line 6
+change file:///a.as 0 0 0 0 'X: .data 1\nX: inc @r2\n'  # 3: two lines above, one of them wrong
+change file:///a.as 10 0 11 0 ''                     # 4: removes the line that defines K
+change file:///a.as 4 4 4 5 'NEW'                    # 5: the macro body uses an undefined label
+change file:///a.as 0 0 2 0 ''                       # 6: removes the two lines again
+change file:///a.as 2 4 2 7 'K'                      # 7: the macro body uses K again
+send '{"jsonrpc":"2.0","id":1,"method":"shutdown"}'
+send '{"jsonrpc":"2.0","method":"exit"}'
+
+"$BIN_DIR/Assembler" --lsp < in.txt > out.txt 2> err.txt
+STATUS=$?
+expect_no_crash "session"
+[ "$STATUS" -eq 0 ] || fail "session: exited with status $STATUS"
+[ ! -s err.txt ] || fail "session: $(cat err.txt)"
+
+published 1
+expect_count . pub.txt 1 "open"
+expect_count "^a.as - Missing operand(s) on line 6.$" pub.txt 1 "open"
+
+published 2
+expect_count . pub.txt 0 "fixed line"
+
+published 3
+expect_count . pub.txt 1 "lines inserted"
+expect_count "^a.as - Duplicate label declaration on line 2.$" pub.txt 1 "lines inserted"
+
+published 4
+expect_count . pub.txt 2 "definition removed"
+expect_count "^a.as - Label (K) does not exist on line 7.$" pub.txt 1 "definition removed: reported on the macro call"
+
+published 5
+expect_count "^a.as - Label (NEW) does not exist on line 7.$" pub.txt 1 "macro body edited"
+
+published 6
+expect_count . pub.txt 1 "lines removed"
+expect_count "^a.as - Label (NEW) does not exist on line 5.$" pub.txt 1 "lines removed"
+
+published 7
+expect_count . pub.txt 1 "macro body restored"
+expect_count "^a.as - Label (K) does not exist on line 5.$" pub.txt 1 "macro body restored"
+cp pub.txt edited.txt
+
+# The edited document, opened as a whole
+: > in.txt
+open file:///a.as '.entry MAIN\nmcro show\nprn K\nendmcro\nMAIN: show\nmov 1, @r1\njmp LOOP\nLOOP: stop\n'
+"$BIN_DIR/Assembler" --lsp < in.txt > out.txt 2> err.txt
+published 1
+cmp -s pub.txt edited.txt || fail "reopened: the diagnostics differ from the edited document"
+
+# A document without diagnostics is one the assembler accepts
+: > in.txt
+open file:///b.as "$DOC"
+change file:///b.as 5 5 5 5 ', @r1'
+"$BIN_DIR/Assembler" --lsp < in.txt > out.txt 2> err.txt
+published 2
+expect_count . pub.txt 0 "valid document"
+printf '.entry MAIN\nmcro show\nprn K\nendmcro\nMAIN: show\nmov 1, @r1\njmp LOOP\nLOOP: stop\nK: .data 1\n' > b.as
+assemble b
+[ "$STATUS" -eq 0 ] && [ -f b.ob ] || fail "valid document: b.as has not been assembled"
+expect_count "^MAIN	100$" b.ent 1 "valid document: labelled macro call"
+
+finish
@@ -0,0 +1,90 @@
+# .aobj: the outputs re-emitted from the state of the first pass are the ones of the assembler,
+# with --debug-info and --xref too, and a cache entry of --aobj restores the .aobj file
+. "$(dirname "$0")/common.sh" "$1"
+
+OUTPUTS="ob ent ext dbg xref"
+
+# round_trip NAME WHAT ARGS...: assembles NAME.as with --aobj, then re-emits its outputs from NAME.aobj
+# and compares them
+round_trip() {
+    name=$1
+    what=$2
+    shift 2
+    assemble --aobj --debug-info --xref "$@" "$name"
+    [ "$STATUS" -eq 0 ] && [ -f "$name.aobj" ] || fail "$what: $name.aobj has not been written"
+    mkdir expected
+    for ext in $OUTPUTS; do
+        mv "$name.$ext" expected/
+    done
+    assemble --from-aobj --debug-info --xref "$@" "$name"
+    expect_no_crash "$what"
+    expect_count "re-emitted from $name.aobj" out.txt 1 "$what"
+    for ext in $OUTPUTS; do
+        cmp -s "$name.$ext" "expected/$name.$ext" || fail "$what: $name.$ext differs from the assembled one"
+    done
+    rm -r expected
+}
+
+cat > prog.as << 'EOF2'
+.extern EXT
+.entry MAIN
+.entry K
+MAIN: mov K, @r1
+lea STR, @r2
+prn K+1
+jsr EXT
+cmp EXT, 3
+HOP: jmp END
+bne MAIN
+.rept 2
+inc K
+.endr
+END: stop
+K: .data 300, 402
+STR: .string "ab"
+V: .data K
+EOF2
+
+round_trip prog "plain"
+round_trip prog "optimized" -O
+round_trip prog "pruned" --prune
+round_trip prog "streamed" --stream
+
+# The largest program the assembler takes, 923 words
+awk 'BEGIN { print "stop"; for (i = 1; i < 923; i++) print ".data " i }' > large.as
+round_trip large "large program"
+
+# A module of 924 words fills the memory up to its last address, 1023
+{
+    printf 'AOBJ\002%016d' 0
+    printf '\234\003\000\000\234\003\000\000\000\000\000\000'
+    i=0
+    while [ $i -lt 924 ]; do
+        printf '\000\000\001\000\001'
+        i=$((i + 1))
+    done
+} > full.aobj
+"$BIN_DIR/Linker" --aobj --output full_linked full > out.txt 2>&1
+STATUS=$?
+expect_no_crash "full memory"
+[ "$STATUS" -eq 0 ] && [ "$(sed -n 1p full_linked.ob)" = "924 0" ] || fail "full memory: full.aobj has been rejected"
+
+# Another source, or another -O, does not use the .aobj file
+assemble --aobj prog
+echo "prn 5" >> prog.as
+assemble --from-aobj prog
+expect_count "re-emitted" out.txt 0 "changed source"
+assemble --from-aobj -O prog
+expect_count "re-emitted" out.txt 0 "other options"
+
+# A cache entry stored with --aobj has the .aobj file
+rm -f prog.aobj
+assemble --aobj --cache-dir cache prog
+rm prog.aobj
+assemble --aobj --cache-dir cache prog
+expect_count "up to date" out.txt 1 "cache hit"
+[ -f prog.aobj ] || fail "cache hit: prog.aobj has not been restored"
+assemble --from-aobj prog
+expect_count "re-emitted from prog.aobj" out.txt 1 "restored .aobj"
+
+finish
@@ -0,0 +1,78 @@
+# --cache-dir: an unchanged source, its included files and its options restore the outputs of the
+# previous assembly, any change of them assembles it again
+. "$(dirname "$0")/common.sh" "$1"
+
+# expect_hit WHAT: the last assembly of prog has been restored from the cache
+expect_hit() {
+    expect_count "Output file(s) for prog.as are up to date" out.txt 1 "$1"
+}
+
+# expect_miss WHAT: the last assembly of prog has assembled it
+expect_miss() {
+    expect_no_crash "$1"
+    expect_count "up to date" out.txt 0 "$1"
+    expect_count "completed without errors" out.txt 1 "$1"
+}
+
+mkdir inc
+printf 'K: .data 5\n' > inc/data.inc
+cat > prog.as << 'EOF2'
+.entry MAIN
+MAIN: prn K
+stop
+.include "inc/data.inc"
+EOF2
+
+assemble --cache-dir cache prog
+expect_miss "first assembly"
+cp prog.ob expected.ob
+
+assemble --cache-dir cache prog
+expect_hit "unchanged source"
+cmp -s prog.ob expected.ob || fail "unchanged source: prog.ob differs"
+
+# A missing output is restored
+rm prog.ob prog.ent
+assemble --cache-dir cache prog
+expect_hit "removed outputs"
+cmp -s prog.ob expected.ob || fail "removed outputs: prog.ob differs"
+[ -f prog.ent ] || fail "removed outputs: prog.ent has not been restored"
+
+# An output option is part of the key
+assemble --cache-dir cache --debug-info prog
+expect_miss "--debug-info"
+[ -f prog.dbg ] || fail "--debug-info: prog.dbg has not been written"
+rm prog.dbg
+assemble --cache-dir cache --debug-info prog
+expect_hit "--debug-info again"
+[ -f prog.dbg ] || fail "--debug-info again: prog.dbg has not been restored"
+
+# A change of the source or of an included file
+printf 'prn 1\n' >> prog.as
+assemble --cache-dir cache prog
+expect_miss "changed source"
+assemble --cache-dir cache prog
+expect_hit "changed source again"
+cp prog.ob expected.ob
+
+printf 'K: .data 6\n' > inc/data.inc
+assemble --cache-dir cache prog
+expect_miss "changed included file"
+! cmp -s prog.ob expected.ob || fail "changed included file: prog.ob has not changed"
+
+# A failed assembly is not stored
+printf 'mov 1\n' >> prog.as
+assemble --cache-dir cache prog
+assemble --cache-dir cache prog
+expect_count "up to date" out.txt 0 "failed assembly"
+expect_count "Missing operand(s)" err.txt 1 "failed assembly"
+
+# The least recently used entries are evicted beyond --cache-size
+rm -r cache
+printf 'stop\n' > small.as
+assemble --cache-dir cache --cache-size 1 small
+[ "$(ls cache | wc -l)" -eq 0 ] || fail "--cache-size 1: $(ls cache | wc -l) entries are left"
+assemble --cache-dir cache small
+[ "$(ls cache | wc -l)" -eq 1 ] || fail "default size: $(ls cache | wc -l) entries"
+
+finish
@@ -0,0 +1,36 @@
+# --check: the diagnostics of a full assembly, without any file written or reported as generated
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > prog.as << 'EOF2'
+.extern USED
+.extern UNUSED
+.entry MAIN
+MAIN: jsr USED
+prn K
+stop
+K: .data 5
+EOF2
+
+assemble --check prog
+expect_no_crash "valid program"
+expect_count "Syntax check for prog.as completed without errors" out.txt 1 "valid program"
+expect_count "successfully generated" out.txt 0 "valid program"
+expect_count "Unused extern label (UNUSED)" err.txt 1 "valid program: unused extern"
+expect_count "(USED)" err.txt 0 "valid program: used extern"
+for ext in am ob ent ext; do
+    [ ! -f "prog.$ext" ] || fail "valid program: prog.$ext has been written"
+done
+
+# The same diagnostics as an assembly
+assemble prog
+expect_count "Unused extern label (UNUSED)" err.txt 1 "assembly: unused extern"
+
+printf 'MAIN: movv 1, @r1\nstop\n' > bad.as
+assemble --check bad
+expect_no_crash "invalid program"
+expect_count "(movv) on line 1" err.txt 1 "invalid program"
+expect_count "completed without errors" out.txt 0 "invalid program"
+expect_count "successfully generated" out.txt 0 "invalid program"
+[ ! -f bad.ob ] || fail "invalid program: bad.ob has been written"
+
+finish
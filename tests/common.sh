@@ -0,0 +1,37 @@
+# Shared helpers of the test scripts, sourced by each of them.
+# Usage of a test script: sh tests/NAME.sh BIN_DIR, BIN_DIR holds the built programs.
+
+BIN_DIR=$(cd "${1:-.}" && pwd)
+WORK_DIR=$(mktemp -d)
+FAILED=0
+trap 'rm -rf "$WORK_DIR"' EXIT
+cd "$WORK_DIR" || exit 1
+
+# fail MESSAGE: reports a failed check, the script exits with 1 once done
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+# assemble ARGS...: runs the assembler, its stdout and stderr go to out.txt and err.txt, sets STATUS
+assemble() {
+    "$BIN_DIR/Assembler" "$@" > out.txt 2> err.txt
+    STATUS=$?
+}
+
+# expect_no_crash WHAT: the last program did not die on a signal
+expect_no_crash() {
+    [ "$STATUS" -lt 128 ] || fail "$1: exited with status $STATUS"
+}
+
+# expect_count PATTERN FILE COUNT WHAT: FILE has COUNT lines that match PATTERN
+expect_count() {
+    count=$(grep -c -- "$1" "$2")
+    [ "$count" -eq "$3" ] || fail "$4: $count line(s) match '$1' in $2, expected $3"
+}
+
+# finish: the exit status of the script
+finish() {
+    [ "$FAILED" -eq 0 ] && echo "PASS"
+    exit "$FAILED"
+}
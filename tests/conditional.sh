@@ -0,0 +1,83 @@
+# .if/.ifdef/.ifndef/.else/.endif and -D: only the lines of the taken branches reach the .am file,
+# the blocks inside a skipped branch are never evaluated, and unbalanced blocks are reported
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > prog.as << 'EOF2'
+.ifdef DEBUG
+prn 1
+.else
+prn 2
+.endif
+.if LEVEL >= 2
+prn 3
+.if LEVEL == 3
+prn 33
+.endif
+.endif
+.ifndef DEBUG
+.if 1 ==
+.endif
+.endif
+mcro show
+.if LEVEL
+prn 4
+.else
+prn 5
+.endif
+endmcro
+show
+stop
+EOF2
+
+assemble -DDEBUG -DLEVEL=3 prog
+[ "$STATUS" -eq 0 ] && [ -f prog.am ] || fail "-DDEBUG -DLEVEL=3: prog.am has not been written"
+printf 'prn 1\nprn 3\nprn 33\nprn 4\nstop\n' | cmp -s - prog.am || fail "-DDEBUG -DLEVEL=3: $(cat prog.am)"
+
+assemble -DDEBUG -DLEVEL=2 prog
+printf 'prn 1\nprn 3\nprn 4\nstop\n' | cmp -s - prog.am || fail "-DLEVEL=2: $(cat prog.am)"
+
+# -DNAME is 1, an undefined name is 0
+assemble -DDEBUG -DLEVEL prog
+printf 'prn 1\nprn 4\nstop\n' | cmp -s - prog.am || fail "-DLEVEL: $(cat prog.am)"
+assemble -DDEBUG prog
+printf 'prn 1\nprn 5\nstop\n' | cmp -s - prog.am || fail "LEVEL undefined: $(cat prog.am)"
+
+# The invalid condition is reached without DEBUG, on its line of the .as file
+rm prog.am
+assemble prog
+expect_count "prog.as - Invalid condition on line 13" err.txt 1 "no -D"
+[ ! -f prog.am ] || fail "no -D: prog.am has been written"
+
+# The definitions are part of the cache key
+assemble --cache-dir cache -DDEBUG -DLEVEL=3 prog
+assemble --cache-dir cache -DDEBUG -DLEVEL=2 prog
+expect_count "up to date" out.txt 0 "cache: another -D"
+printf 'prn 1\nprn 3\nprn 4\nstop\n' | cmp -s - prog.am || fail "cache: $(cat prog.am)"
+assemble --cache-dir cache -DDEBUG -DLEVEL=3 prog
+expect_count "up to date" out.txt 1 "cache: the same -D"
+
+# expect_error NAME MESSAGE: NAME.as is rejected with MESSAGE
+expect_error() {
+    assemble "$1"
+    expect_no_crash "$1"
+    expect_count "$2" err.txt 1 "$1"
+    [ ! -f "$1.am" ] || fail "$1: $1.am has been written"
+}
+
+printf 'prn 1\n.endif\n' > no_if.as
+expect_error no_if "no_if.as - Missing opening '.if' on line 2"
+printf '.if 1\nprn 1\n' > no_endif.as
+expect_error no_endif "no_endif.as - Missing closing '.endif' for the '.if' on line 1"
+printf '.if 0\n.else\n.else\n.endif\n' > two_else.as
+expect_error two_else "two_else.as - Duplicate '.else' on line 3"
+awk 'BEGIN { for (i = 0; i < 33; i++) print ".if 1"; for (i = 0; i < 33; i++) print ".endif" }' > deep.as
+expect_error deep "deep.as - Conditional blocks are nested too deep on line 33"
+
+# 32 levels are fine, and a skipped block may nest deeper
+awk 'BEGIN { for (i = 0; i < 32; i++) print ".if 1"; print "stop"; for (i = 0; i < 32; i++) print ".endif" }' > ok.as
+awk 'BEGIN { print ".if 0"; for (i = 0; i < 40; i++) print ".if 1"; for (i = 0; i < 40; i++) print ".endif";
+             print ".endif"; print "stop" }' >> ok.as
+assemble ok
+[ "$STATUS" -eq 0 ] && [ -f ok.ob ] || fail "32 levels: $(cat err.txt)"
+
+finish
@@ -0,0 +1,73 @@
+# --debug-info: NAME.dbg maps every word to its line of the .am file and every symbol to its address,
+# the same with --stream, and a damaged one is reported rather than trusted
+. "$(dirname "$0")/common.sh" "$1"
+
+# decode_dbg FILE: prints "word ADDRESS LINE IS_DATA" and "symbol LABEL ADDRESS LINE IS_ENTRY" lines
+decode_dbg() {
+    od -An -tu1 -v "$1" | awk '
+        { for (i = 1; i <= NF; i++) b[n++] = $i }
+        function u8() { return b[p++] }
+        function u16() { p += 2; return b[p - 2] + 256 * b[p - 1] }
+        function text(len,   s) { s = ""; while (len-- > 0) s = s sprintf("%c", u8()); return s }
+        END {
+            p = 0
+            print "magic", text(4), "version", u8()
+            print "source", text(u16())
+            words = u16()
+            for (i = 0; i < words; i++) { line = u16(); print "word", 100 + i, line, u8() }
+            symbols = u16()
+            for (i = 0; i < symbols; i++) { label = text(u8()); address = u16(); line = u16(); print "symbol", label, address, line, u8() }
+            if (p != n) print "trailing", n - p
+        }'
+}
+
+cat > prog.as << 'EOF2'
+.entry MAIN
+mcro show
+prn K
+endmcro
+MAIN: show
+LOOP: dec @r1
+bne LOOP
+stop
+K: .data 4, 5
+S: .string "a"
+EOF2
+
+assemble --debug-info prog
+[ "$STATUS" -eq 0 ] && [ -f prog.dbg ] || fail "assemble: prog.dbg has not been written"
+decode_dbg prog.dbg > dbg.txt
+expect_count "^magic ADBG version 2$" dbg.txt 1 "header"
+expect_count "^source prog.am$" dbg.txt 1 "source"
+expect_count "^word " dbg.txt 11 "one line per word"
+expect_count "^trailing" dbg.txt 0 "file size"
+
+# The lines are the ones of the .am file, where the macro has been expanded on line 2
+expect_count "^word 100 2 0$" dbg.txt 1 "expanded macro"
+expect_count "^word 101 2 0$" dbg.txt 1 "expanded macro operand"
+expect_count "^word 103 3 0$" dbg.txt 1 "register operand"
+expect_count "^word 106 5 0$" dbg.txt 1 "stop"
+expect_count "^word 107 6 1$" dbg.txt 1 ".data"
+expect_count "^word 108 6 1$" dbg.txt 1 ".data"
+expect_count "^word 110 7 1$" dbg.txt 1 ".string end"
+expect_count "^symbol MAIN 100 2 1$" dbg.txt 1 "entry symbol"
+expect_count "^symbol LOOP 102 3 0$" dbg.txt 1 "local symbol"
+expect_count "^symbol K 107 6 0$" dbg.txt 1 "data symbol"
+expect_count "^symbol S 109 7 0$" dbg.txt 1 "string symbol"
+
+cp prog.dbg expected.dbg
+assemble --debug-info --stream prog
+cmp -s prog.dbg expected.dbg || fail "--stream: prog.dbg differs"
+
+# Without --debug-info no .dbg is written
+rm prog.dbg
+assemble prog
+[ ! -f prog.dbg ] || fail "no --debug-info: prog.dbg has been written"
+
+# A truncated .dbg: the profile is written by address only
+head -c 20 expected.dbg > prog.dbg
+"$BIN_DIR/Simulator" --steps 100 --profile prog > sim.txt 2>&1
+expect_count "prog.dbg - Invalid debug file at offset 19" sim.txt 1 "truncated"
+[ -f prog.prof ] || fail "truncated: prog.prof has not been written"
+
+finish
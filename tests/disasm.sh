@@ -0,0 +1,46 @@
+# Disassembler: with the .dbg file every label is named and the .data values are printed as data,
+# even the ones that decode as an instruction; without it the words that do not decode are data
+. "$(dirname "$0")/common.sh" "$1"
+
+# 300 and 402 decode as "jmp 100"
+cat > prog.as << 'EOF2'
+.extern EXT
+.entry MAIN
+MAIN: prn K
+LOOP: prn K+1
+jsr EXT
+bne LOOP
+stop
+K: .data 300, 402
+S: .string "ab"
+EOF2
+
+assemble prog
+"$BIN_DIR/Disassembler" prog > dis.txt 2>&1
+expect_count "^MAIN:$" dis.txt 1 "without .dbg: .ent label"
+expect_count "^LOOP:$" dis.txt 0 "without .dbg: local label"
+expect_count "jsr EXT$" dis.txt 1 "without .dbg: external"
+expect_count "^   111  Bh        .data 97$" dis.txt 1 "without .dbg: .string value"
+expect_count "^   113  AA        .data 0$" dis.txt 1 "without .dbg: .string end"
+
+assemble --debug-info prog
+"$BIN_DIR/Disassembler" prog > dis.txt 2>&1
+expect_count "source prog.am$" dis.txt 1 "with .dbg: header"
+for label in MAIN LOOP K S; do
+    expect_count "^$label:$" dis.txt 1 "with .dbg: label $label"
+done
+expect_count "prn K  ; line 3$" dis.txt 1 "with .dbg: operand label"
+expect_count "bne LOOP  ; line 6$" dis.txt 1 "with .dbg: local operand label"
+expect_count "^   109  Es        .data 300  ; line 8$" dis.txt 1 "with .dbg: .data value"
+expect_count "^   110  GS        .data 402  ; line 8$" dis.txt 1 "with .dbg: .data value"
+expect_count " jmp " dis.txt 0 "with .dbg: .data decoded as an instruction"
+expect_count "^   111  Bh        .data 97  ; line 9$" dis.txt 1 "with .dbg: .string value"
+
+# A .dbg file of another build of the program is ignored
+printf 'stop\n' > prog.as
+assemble prog
+"$BIN_DIR/Disassembler" prog > dis.txt 2>&1
+expect_count "stop$" dis.txt 1 "stale .dbg"
+expect_count "^K:$" dis.txt 0 "stale .dbg: labels"
+
+finish
@@ -0,0 +1,42 @@
+# Operand expressions: a register expression is an error, and so is a value its operand word cannot hold
+. "$(dirname "$0")/common.sh" "$1"
+
+# expect_rejected NAME WHAT: NAME.as is rejected with a single error on its line 2, no .ob is written
+expect_rejected() {
+    assemble "$1"
+    expect_no_crash "$2"
+    expect_count "$1.am - .* on line 2" err.txt 1 "$2"
+    [ ! -f "$1.ob" ] || fail "$2: $1.ob has been written"
+}
+
+printf 'stop\nprn @r1+1\n' > register.as
+expect_rejected register "register expression"
+
+# ARR is at address 100 and FWD at 114, the last address of the memory is 1023
+cat > bounds.as << 'EOF'
+ARR: .data 1
+mov ARR+923, @r1
+mov ARR-100, @r2
+prn 500+11
+prn 0-512
+mov FWD+909, @r3
+FWD: stop
+EOF
+assemble bounds
+[ "$STATUS" -eq 0 ] && [ -f bounds.ob ] || fail "bounds: not assembled"
+"$BIN_DIR/Disassembler" bounds > dis.txt
+expect_count "prn 511$" dis.txt 1 "immediate upper bound"
+expect_count "prn -512$" dis.txt 1 "immediate lower bound"
+
+printf 'ARR: .data 1\nmov ARR+924, @r1\n' > above.as
+expect_rejected above "address past the memory"
+printf 'ARR: .data 1\nmov ARR-101, @r1\n' > below.as
+expect_rejected below "negative address"
+printf 'stop\nmov FWD+922, @r1\nFWD: stop\n' > forward.as
+expect_rejected forward "address of a label further on past the memory"
+printf 'stop\nprn 500+12\n' > immediate_above.as
+expect_rejected immediate_above "immediate above the operand field"
+printf 'stop\nprn 0-513\n' > immediate_below.as
+expect_rejected immediate_below "immediate below the operand field"
+
+finish
@@ -0,0 +1,89 @@
+# .include "file": the file is looked up next to the including file, then in the -I directories,
+# each file is included once per source, and the sources of a batch share the included text and macros
+. "$(dirname "$0")/common.sh" "$1"
+
+mkdir -p lib/sub other
+cat > lib/defs.inc << 'EOF2'
+mcro twice
+inc @r1
+inc @r1
+endmcro
+EOF2
+printf '.include "defs.inc"\n.include "sub/data.inc"\n' > lib/all.inc
+printf 'K: .data 5\n.include "more.inc"\n' > lib/sub/data.inc
+printf 'L: .data 6\n' > lib/sub/more.inc
+printf 'L: .data 7\n' > lib/more.inc
+
+cat > prog.as << 'EOF2'
+.include "all.inc"
+.include "defs.inc"
+MAIN: twice
+prn K
+prn L
+stop
+EOF2
+# the same files, from a second source of the batch
+printf '.include "defs.inc"\nMAIN: twice\nstop\n' > second.as
+
+assemble -Ilib prog second
+[ "$STATUS" -eq 0 ] && [ -f prog.ob ] && [ -f second.ob ] || fail "batch: $(cat err.txt)"
+printf 'K: .data 5\nL: .data 6\nMAIN: inc @r1\ninc @r1\nprn K\nprn L\nstop\n' | cmp -s - prog.am \
+    || fail "nested includes: $(cat prog.am)"
+printf 'MAIN: inc @r1\ninc @r1\nstop\n' | cmp -s - second.am || fail "second source: $(cat second.am)"
+
+# The directory of the source comes first, and -I directories are searched in order
+printf 'K: .data 9\n' > data.inc
+printf 'M: .data 8\n' > other/data.inc
+printf '.include "data.inc"\nstop\n' > local.as
+assemble -Iother local
+expect_count "^K: .data 9$" local.am 1 "source directory first"
+printf '.include "sub/more.inc"\n.include "data.inc"\nstop\n' > order.as
+rm data.inc
+assemble -Iother -Ilib order
+expect_count "^L: .data 6$" order.am 1 "-I order"
+expect_count "^M: .data 8$" order.am 1 "-I order"
+
+# A source that includes itself is not included again
+printf 'stop\n.include "self.as"\n' > self.as
+assemble self
+printf 'stop\n' | cmp -s - self.am || fail "self include: $(cat self.am)"
+
+# An error of an included file is reported on its line of the .am file
+printf 'mov 1\n' > lib/error.inc
+printf 'stop\n.include "error.inc"\n' > error.as
+assemble -Ilib error
+expect_count "error.am - Missing operand(s) on line 2" err.txt 1 "error in an included file"
+
+# expect_error NAME MESSAGE ARGS...: NAME.as is rejected with MESSAGE by the preprocessor
+expect_error() {
+    name=$1
+    message=$2
+    shift 2
+    assemble "$@" "$name"
+    expect_no_crash "$name"
+    expect_count "$message" err.txt 1 "$name"
+    [ ! -f "$name.am" ] || fail "$name: $name.am has been written"
+}
+
+printf 'prn 1\n.include "nope.inc"\n' > lib/sub/missing.inc
+printf 'stop\n.include "sub/missing.inc"\n' > missing.as
+expect_error missing "lib/sub/missing.inc - Included file (nope.inc) cannot be found on line 2" -Ilib
+printf '.include defs.inc\n' > unquoted.as
+expect_error unquoted "unquoted.as - Invalid '.include', expected a quoted file name outside of a macro on line 1" -Ilib
+printf 'mcro m\n.include "defs.inc"\nendmcro\n' > in_macro.as
+expect_error in_macro "in_macro.as - Invalid '.include', expected a quoted file name outside of a macro on line 2" -Ilib
+
+# 16 levels of files that include the next one, then a 17th
+i=1
+while [ $i -le 17 ]; do
+    printf '.include "n%d.inc"\n' $((i + 1)) > "n$i.inc"
+    i=$((i + 1))
+done
+printf 'stop\n' > n18.inc
+printf '.include "n2.inc"\n' > deep.as
+expect_error deep "Included files are nested too deep"
+printf 'stop\n' > n17.inc
+assemble deep
+printf 'stop\n' | cmp -s - deep.am || fail "16 levels: $(cat err.txt)"
+
+finish
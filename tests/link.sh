@@ -0,0 +1,64 @@
+# Linker: a module that is not loaded at address 100 has only its address words moved, its .data
+# values are copied as they are, and the .ext use sites of every module point to the .ent of another
+. "$(dirname "$0")/common.sh" "$1"
+
+# link ARGS...: runs the linker, its stdout and stderr go to out.txt and err.txt, sets STATUS
+link() {
+    "$BIN_DIR/Linker" "$@" > out.txt 2> err.txt
+    STATUS=$?
+}
+
+cat > one.as << 'EOF2'
+.extern SHOW
+.entry MAIN
+MAIN: jsr SHOW
+stop
+EOF2
+
+cat > two.as << 'EOF2'
+.entry SHOW
+SHOW: prn K
+prn K+1
+lea K, @r1
+rts
+K: .data 300, 402
+EOF2
+
+cat > halt.as << 'EOF2'
+stop
+EOF2
+
+assemble --aobj one two halt
+[ "$STATUS" -eq 0 ] && [ -f one.aobj ] && [ -f two.aobj ] && [ -f halt.aobj ] || fail "assemble: no .aobj files"
+
+# 300 and 402 decode as an instruction with an operand inside the program, they are still data
+link --aobj --output data halt two
+expect_no_crash "data"
+expect_count "data.ob has been linked" out.txt 1 "data"
+[ "$(tail -n 2 data.ob)" = "$(tail -n 2 two.ob)" ] || fail "data: the .data values of two have been changed"
+
+# The instructions that use K are moved by the size of halt, 1 word: K is at 109
+"$BIN_DIR/Disassembler" data > dis.txt 2>&1
+expect_count "prn 109$" dis.txt 1 "data: prn K"
+expect_count "prn 110$" dis.txt 1 "data: prn K+1"
+expect_count "lea 109" dis.txt 1 "data: lea K"
+
+# The .ob file does not tell which words are addresses, its module cannot be moved
+rm -f data.ob
+link --output data halt two
+expect_no_crash "no relocations"
+[ "$STATUS" -ne 0 ] || fail "no relocations: two has been linked from its .ob file"
+expect_count "two - Cannot be loaded at address 101 without its relocations" err.txt 1 "no relocations"
+[ ! -f data.ob ] || fail "no relocations: data.ob has been written"
+
+# A single module stays at address 100, its .ob file is enough
+link --output alone two
+[ "$STATUS" -eq 0 ] && cmp -s alone.ob two.ob || fail "single module: alone.ob differs from two.ob"
+
+# one calls SHOW of two, which prints K of two from its new address
+link --aobj --output both one two
+expect_count "both.ob has been linked" out.txt 1 "cross reference"
+"$BIN_DIR/Simulator" both > sim.txt 2>&1
+printf '300\n402\n' | cmp -s - sim.txt || fail "cross reference: the program printed $(cat sim.txt)"
+
+finish
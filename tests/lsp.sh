@@ -0,0 +1,117 @@
+# --lsp: the responses are framed by their Content-Length and nothing else is written to stdout,
+# definitions and references are answered from the open document, errors follow JSON-RPC
+. "$(dirname "$0")/common.sh" "$1"
+
+# send JSON: appends a message framed by its Content-Length header to in.txt
+send() {
+    printf 'Content-Length: %d\r\n\r\n%s' "${#1}" "$1" >> in.txt
+}
+
+# position ID METHOD LINE CHARACTER [EXTRA]: a request about a position of file:///a.as
+position() {
+    send '{"jsonrpc":"2.0","id":'"$1"',"method":"textDocument/'"$2"'","params":{"textDocument":{"uri":"file:///a.as"},"position":{"line":'"$3"',"character":'"$4"'}'"$5"'}}'
+}
+
+# serve: runs the server on in.txt, splits its messages into bodies.txt, one per line, sets STATUS
+serve() {
+    timeout 60 "$BIN_DIR/Assembler" --lsp < in.txt > out.txt 2> err.txt
+    STATUS=$?
+    tr -d '\r' < out.txt | sed 's/Content-Length: /\n&/g' | awk '
+        /^Content-Length: / { len = $2; state = 1; next }
+        state == 1 && $0 == "" { state = 2; next }
+        state == 2 { if (length($0) != len) print "FRAME " len " " length($0); else print; state = 0; next }
+        $0 != "" { print "STRAY " $0 }' > bodies.txt
+}
+
+# response ID: the response to the request ID, into resp.txt
+response() {
+    grep "^{\"jsonrpc\":\"2.0\",\"id\":$1," bodies.txt > resp.txt
+}
+
+cat > a.as << 'EOF2'
+.extern EXT
+.entry MAIN
+mcro twice
+inc @r1
+inc @r1
+endmcro
+MAIN: twice
+jsr EXT
+bne MAIN
+twice
+stop
+EOF2
+TEXT=$(awk '{ printf "%s\\n", $0 }' a.as)
+
+send '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"capabilities":{}}}'
+send '{"jsonrpc":"2.0","method":"initialized","params":{}}'
+send '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///a.as","languageId":"asm","version":1,"text":"'"$TEXT"'"}}}'
+position 2 definition 8 6                                         # MAIN in bne MAIN
+position 3 definition 9 2                                         # the call of twice
+position 4 definition 7 5                                         # EXT in jsr EXT
+position 5 definition 3 0                                         # inc, not a label
+position 6 references 6 8 ',"context":{"includeDeclaration":true}'   # twice, from its call
+position 7 references 1 8 ',"context":{"includeDeclaration":false}'  # MAIN, from its .entry
+send '{"jsonrpc":"2.0","id":"text id","method":"textDocument/hover","params":{}}'
+send '{"jsonrpc":"2.0","id":8,"method":'
+send '{"jsonrpc":"2.0","method":"textDocument/didClose","params":{"textDocument":{"uri":"file:///a.as"}}}'
+position 9 definition 8 6
+send '{"jsonrpc":"2.0","id":10,"method":"shutdown"}'
+send '{"jsonrpc":"2.0","method":"exit"}'
+serve
+
+expect_no_crash "session"
+[ "$STATUS" -eq 0 ] || fail "session: exited with status $STATUS"
+expect_count "^FRAME " bodies.txt 0 "framing"
+expect_count "^STRAY " bodies.txt 0 "stdout"
+[ ! -f a.am ] && [ ! -f a.ob ] || fail "session: the document has been assembled to files"
+
+response 1
+expect_count '"textDocumentSync":{"openClose":true,"change":2}' resp.txt 1 "initialize"
+expect_count '"definitionProvider":true,"referencesProvider":true' resp.txt 1 "initialize"
+
+expect_count '"method":"textDocument/publishDiagnostics","params":{"uri":"file:///a.as","diagnostics":\[\]}' \
+    bodies.txt 2 "diagnostics of didOpen and didClose"
+
+response 2
+expect_count '"result":{"uri":"file:///a.as","range":{"start":{"line":6,"character":0},"end":{"line":6,"character":4}}}' \
+    resp.txt 1 "definition of a label"
+response 3
+expect_count '"result":{"uri":"file:///a.as","range":{"start":{"line":2,"character":5},"end":{"line":2,"character":10}}}' \
+    resp.txt 1 "definition of a macro"
+response 4
+expect_count '"result":{"uri":"file:///a.as","range":{"start":{"line":0,"character":8},"end":{"line":0,"character":11}}}' \
+    resp.txt 1 "definition of an external label"
+response 5
+expect_count '"result":null' resp.txt 1 "definition of an opcode"
+
+response 6
+expect_count '"line":2,"character":5}' resp.txt 1 "references of a macro: declaration"
+expect_count '"line":6,"character":6}' resp.txt 1 "references of a macro: labelled call"
+expect_count '"line":9,"character":0}' resp.txt 1 "references of a macro: call"
+[ "$(grep -o '"uri"' resp.txt | wc -l)" -eq 3 ] || fail "references of a macro: $(cat resp.txt)"
+response 7
+expect_count '"line":1,"character":7}' resp.txt 1 "references of a label: .entry"
+expect_count '"line":8,"character":4}' resp.txt 1 "references of a label: use"
+[ "$(grep -o '"uri"' resp.txt | wc -l)" -eq 2 ] || fail "references of a label: $(cat resp.txt)"
+
+response '"text id"'
+expect_count '"error":{"code":-32601' resp.txt 1 "unknown method"
+expect_count '"id":null,"error":{"code":-32700' bodies.txt 1 "invalid JSON"
+response 9
+expect_count '"result":null' resp.txt 1 "closed document"
+response 10
+expect_count '"result":null' resp.txt 1 "shutdown"
+
+# exit without shutdown, and the end of the input without exit
+: > in.txt
+send '{"jsonrpc":"2.0","method":"exit"}'
+serve
+[ "$STATUS" -ne 0 ] || fail "exit without shutdown: exited with status 0"
+: > in.txt
+send '{"jsonrpc":"2.0","id":1,"method":"shutdown"}'
+serve
+[ "$STATUS" -ne 0 ] || fail "end of input: exited with status 0"
+expect_count '"result":null' bodies.txt 1 "end of input: shutdown"
+
+finish
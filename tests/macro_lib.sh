@@ -0,0 +1,39 @@
+# .mlib files: a library is used as compiled, a corrupt index is rejected rather than probed forever
+. "$(dirname "$0")/common.sh" "$1"
+
+# patch_slots FILE VALUE...: overwrites the first index slots of FILE, one unsigned 32-bit value each
+patch_slots() {
+    file=$1
+    shift
+    for value in "$@"; do printf "\\$(printf '%03o' "$value")\\000\\000\\000"; done > slots.bin
+    dd if=slots.bin of="$file" bs=1 seek=13 conv=notrunc 2> /dev/null
+}
+
+cat > lib.as << 'EOF'
+mcro twice
+inc @r1
+inc @r1
+endmcro
+EOF
+"$BIN_DIR/MacroCompiler" --output lib lib > out.txt 2> err.txt || fail "MacroCompiler: lib.mlib not written"
+
+printf 'twice\nstop\n' > prog.as
+assemble --macro-lib lib.mlib prog
+[ "$STATUS" -eq 0 ] && [ -f prog.ob ] || fail "valid library: prog not assembled"
+
+# one macro and 8 slots: every slot names it, or it is in two slots
+cp lib.mlib full.mlib
+patch_slots full.mlib 1 1 1 1 1 1 1 1
+cp lib.mlib twice.mlib
+patch_slots twice.mlib 1 1 0 0 0 0 0 0
+for lib in full twice; do
+    rm -f prog.ob
+    STATUS=0
+    timeout 10 "$BIN_DIR/Assembler" --macro-lib $lib.mlib prog > out.txt 2> err.txt || STATUS=$?
+    [ "$STATUS" -ne 124 ] || fail "$lib.mlib: the lookup of a missing macro does not end"
+    expect_no_crash "$lib.mlib"
+    expect_count "Invalid or unreadable macro library" err.txt 1 "$lib.mlib"
+    [ ! -f prog.ob ] || fail "$lib.mlib: prog.ob has been written"
+done
+
+finish
@@ -0,0 +1,76 @@
+# Nested macros: a body line that names a macro defined by the first call is expanded, cycles and
+# calls nested deeper than 16 are reported on the call, and --lsp reports the same as the assembler
+. "$(dirname "$0")/common.sh" "$1"
+
+# lsp_diagnostics NAME: the messages --lsp publishes for NAME.as, one per line, into lsp.txt
+lsp_diagnostics() {
+    text=$(awk '{ printf "%s\\n", $0 }' "$1.as")
+    body='{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///'"$1"'.as","languageId":"asm","version":1,"text":"'"$text"'"}}}'
+    printf 'Content-Length: %d\r\n\r\n%s' "${#body}" "$body" | "$BIN_DIR/Assembler" --lsp 2> /dev/null \
+        | grep -o '"message":"[^"]*"' | sed 's/^"message":"//; s/"$//' > lsp.txt
+}
+
+# expect_error NAME MESSAGE: NAME.as is rejected with MESSAGE, by the assembler and by --lsp
+expect_error() {
+    assemble "$1"
+    expect_no_crash "$1"
+    expect_count "$2" err.txt 1 "$1"
+    [ ! -f "$1.am" ] || fail "$1: $1.am has been written"
+    lsp_diagnostics "$1"
+    expect_count "$2" lsp.txt 1 "$1: --lsp"
+    expect_count . lsp.txt 1 "$1: --lsp"
+}
+
+cat > prog.as << 'EOF2'
+mcro inner
+inc @r1
+endmcro
+mcro outer
+inner
+prn @r1
+later
+endmcro
+mcro later
+dec @r2
+endmcro
+MAIN: mov 0, @r1
+outer
+outer
+stop
+EOF2
+
+assemble prog
+[ "$STATUS" -eq 0 ] && [ -f prog.am ] || fail "nested: $(cat err.txt)"
+printf 'MAIN: mov 0, @r1\ninc @r1\nprn @r1\ndec @r2\ninc @r1\nprn @r1\ndec @r2\nstop\n' | cmp -s - prog.am \
+    || fail "nested: $(cat prog.am)"
+lsp_diagnostics prog
+expect_count . lsp.txt 0 "nested: --lsp"
+
+# The macro of a labelled call keeps the label, the lines after the expansion keep their addresses
+printf 'mcro two\ninc @r1\ninc @r1\nendmcro\n.entry L\n.entry S\nL: two\nS: stop\n' > label.as
+assemble label
+expect_count "^L	100$" label.ent 1 "labelled call"
+expect_count "^S	104$" label.ent 1 "labelled call: next line"
+lsp_diagnostics label
+expect_count . lsp.txt 0 "labelled call: --lsp"
+
+printf 'mcro a\nb\nendmcro\nmcro b\na\nendmcro\nprn 1\na\nstop\n' > cycle.as
+expect_error cycle "cycle.as - Macro (a) expands to a call of itself on line 8"
+printf 'mcro self\nself\nendmcro\nself\n' > self.as
+expect_error self "self.as - Macro (self) expands to a call of itself on line 4"
+
+# chain N: m0 calls m1 ... which calls mN, mN has an instruction
+chain() {
+    awk -v n="$1" 'BEGIN { printf "mcro m%d\ninc @r1\nendmcro\n", n
+                           for (i = n - 1; i >= 0; i--) printf "mcro m%d\nm%d\nendmcro\n", i, i + 1
+                           print "m0\nstop" }'
+}
+chain 15 > deep.as
+assemble deep
+printf 'inc @r1\nstop\n' | cmp -s - deep.am || fail "16 levels: $(cat err.txt)"
+lsp_diagnostics deep
+expect_count . lsp.txt 0 "16 levels: --lsp"
+chain 16 > too_deep.as
+expect_error too_deep "too_deep.as - Macro (m16) calls are nested too deep on line 52"
+
+finish
@@ -0,0 +1,38 @@
+# --max-errors: a file with more errors than the limit stops at the limit, and reports it once
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > chk.as << 'EOF'
+MAIN: prn 2
+foo 1
+bar 2
+baz 3
+mov @r9, @r1
+stop
+EOF
+
+for limit in 1 2 3; do
+    assemble --max-errors $limit chk
+    expect_no_crash "--max-errors $limit"
+    expect_count "Too many errors" err.txt 1 "--max-errors $limit"
+    expect_count "chk.am - " err.txt $((limit + 1)) "--max-errors $limit"
+    [ ! -f chk.ob ] || fail "--max-errors $limit: chk.ob has been written"
+done
+
+assemble --max-errors 2 --diag-json diag.json chk
+expect_no_crash "--max-errors 2 --diag-json"
+expect_count '"file":"chk.am"' diag.json 3 "--max-errors 2 --diag-json"
+
+# The same request through --serve, a worker that died would leave the client without a response
+"$BIN_DIR/Assembler" --serve "$WORK_DIR/as.sock" > serve.txt 2>&1 &
+server=$!
+tries=0
+while [ ! -S "$WORK_DIR/as.sock" ] && [ $tries -lt 50 ]; do sleep 0.1; tries=$((tries + 1)); done
+"$BIN_DIR/asclient" --socket "$WORK_DIR/as.sock" --max-errors 2 chk > out.txt 2> err.txt
+STATUS=$?
+kill $server
+wait $server 2> /dev/null
+expect_no_crash "asclient --max-errors 2"
+expect_count "Too many errors" err.txt 1 "asclient --max-errors 2"
+expect_count "Socket operation failed" err.txt 0 "asclient --max-errors 2"
+
+finish
@@ -0,0 +1,33 @@
+# -O: the peephole pass threads jumps, removes the no-op ones and encodes the moved addresses again,
+# label expressions included, and the optimized program prints what the plain one does
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > opt.as << 'EOF2'
+MAIN: mov @r1, @r1
+jmp HOP
+HOP: jmp END
+NEXT: prn 1
+jmp AFTER
+AFTER: prn ARR+1
+END: prn 2
+stop
+ARR: .data 5, 7
+EOF2
+
+assemble opt
+[ "$STATUS" -eq 0 ] && [ -f opt.ob ] || fail "plain: not assembled"
+"$BIN_DIR/Simulator" opt > plain.txt 2>&1
+
+assemble -O opt
+expect_no_crash "optimized"
+[ "$STATUS" -eq 0 ] && [ -f opt.ob ] || fail "optimized: not assembled"
+"$BIN_DIR/Disassembler" opt > dis.txt
+expect_count "IC 9, DC 2" dis.txt 1 "optimized size"
+expect_count "mov @r1, @r1" dis.txt 0 "mov of a register to itself"
+expect_count "^   100 .* jmp 106$" dis.txt 1 "jump to a jump"
+expect_count " jmp " dis.txt 1 "jump to the next instruction"
+expect_count "^   104 .* prn 110$" dis.txt 1 "label expression"
+"$BIN_DIR/Simulator" opt > optimized.txt 2>&1
+diff plain.txt optimized.txt > /dev/null || fail "optimized: the program prints something else"
+
+finish
@@ -0,0 +1,58 @@
+# Simulator --profile and --folded: the executions of every address, rolled up into opcodes, labels
+# and source lines with the .dbg file, into the .ent labels and addresses without it
+. "$(dirname "$0")/common.sh" "$1"
+
+# simulate ARGS...: runs the simulator for at most a minute, its output goes to sim.txt, sets STATUS
+simulate() {
+    timeout 60 "$BIN_DIR/Simulator" "$@" > sim.txt 2>&1
+    STATUS=$?
+}
+
+cat > prog.as << 'EOF2'
+.entry MAIN
+MAIN: mov 3, @r1
+NEXT: dec @r1
+cmp @r1, 0
+bne NEXT
+jsr SHOW
+stop
+SHOW: prn @r1
+rts
+EOF2
+
+assemble --debug-info prog
+[ "$STATUS" -eq 0 ] || fail "assemble: exited with status $STATUS"
+
+# No profile unless asked for
+simulate prog
+[ ! -f prog.prof ] && [ ! -f prog.folded ] || fail "no option: a profile has been written"
+
+simulate --profile --folded prog
+expect_no_crash "with .dbg"
+expect_count "^0$" sim.txt 1 "with .dbg: program output"
+expect_count "^; prog - 14 instruction(s) executed$" prog.prof 1 "with .dbg: total"
+expect_count "^ *3  21.43%  dec$" prog.prof 1 "with .dbg: opcode"
+expect_count "^ *1   7.14%  stop$" prog.prof 1 "with .dbg: opcode"
+expect_count "^ *11  78.57%  NEXT$" prog.prof 1 "with .dbg: local label"
+expect_count "^ *2  14.29%  SHOW$" prog.prof 1 "with .dbg: local label"
+expect_count "^; Lines of prog.am$" prog.prof 1 "with .dbg: lines"
+expect_count "^ *3  21.43%  line 4$" prog.prof 1 "with .dbg: line"
+expect_count "^ *3  21.43%     105  NEXT+2  line 4$" prog.prof 1 "with .dbg: address"
+expect_count "^prog;NEXT;line 3 3$" prog.folded 1 "with .dbg: folded"
+expect_count "^prog;SHOW;line 9 1$" prog.folded 1 "with .dbg: folded"
+[ "$(awk '{ n += $NF } END { print n }' prog.folded)" -eq 14 ] || fail "with .dbg: the folded counts do not add up"
+
+# Only the .ent labels, and the addresses take the place of the lines
+rm prog.dbg
+simulate --profile --folded prog
+expect_count "^ *14 100.00%  MAIN$" prog.prof 1 "without .dbg: label"
+expect_count "^; Lines" prog.prof 0 "without .dbg: lines"
+expect_count "^ *3  21.43%     105  MAIN+5$" prog.prof 1 "without .dbg: address"
+expect_count "^prog;MAIN;103 3$" prog.folded 1 "without .dbg: folded"
+expect_count ";line " prog.folded 0 "without .dbg: folded"
+
+# A run stopped by the step limit is profiled up to there
+simulate --steps 5 --profile prog
+expect_count "^; prog - 5 instruction(s) executed$" prog.prof 1 "--steps 5"
+
+finish
@@ -0,0 +1,58 @@
+# --project: files that use the .entry symbols of each other are assembled by workers and linked
+# in memory, the same as the Linker links their .aobj files, and their .data values are kept
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > main.as << 'EOF2'
+.extern SHOW
+.entry MAIN
+.entry TOTAL
+MAIN: jsr SHOW
+prn TOTAL
+stop
+TOTAL: .data 7
+EOF2
+
+# 300 and 402 decode as an instruction with an operand inside the program
+cat > show.as << 'EOF2'
+.extern TOTAL
+.entry SHOW
+SHOW: prn K
+prn K+1
+add K, TOTAL
+rts
+K: .data 300, 402
+EOF2
+
+assemble --project prog --workers 2 main show
+expect_no_crash "project"
+[ "$STATUS" -eq 0 ] || fail "project: exited with status $STATUS"
+expect_count "prog.ob has been linked" out.txt 1 "project"
+expect_count "^MAIN	100$" prog.ent 1 "project: prog.ent"
+expect_count "^TOTAL	105$" prog.ent 1 "project: prog.ent"
+expect_count "^SHOW	106$" prog.ent 1 "project: prog.ent"
+for ext in ob ent ext aobj; do
+    [ ! -f "main.$ext" ] && [ ! -f "show.$ext" ] || fail "project: a .$ext file of a module has been written"
+done
+
+"$BIN_DIR/Simulator" prog > sim.txt 2>&1
+printf '300\n402\n307\n' | cmp -s - sim.txt || fail "project: the program printed $(cat sim.txt)"
+
+# The same program as the one linked from the .aobj files
+assemble --aobj main show
+"$BIN_DIR/Linker" --aobj --output linked main show > /dev/null 2>&1
+cmp -s prog.ob linked.ob || fail "project: prog.ob differs from the linked .aobj files"
+
+# A symbol no file has an .entry for
+rm -f prog.ob
+cat > lost.as << 'EOF2'
+.extern NOWHERE
+jsr NOWHERE
+stop
+EOF2
+assemble --project prog main show lost
+expect_no_crash "unresolved"
+[ "$STATUS" -ne 0 ] || fail "unresolved: exited with status 0"
+expect_count "lost - Unresolved external symbol NOWHERE" err.txt 1 "unresolved"
+[ ! -f prog.ob ] || fail "unresolved: prog.ob has been written"
+
+finish
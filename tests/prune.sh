@@ -0,0 +1,80 @@
+# --prune: the instructions no path of the program reaches and the data nothing uses are removed, the
+# first word and the .entry labels are the roots, and the pruned program prints what the plain one does
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > prog.as << 'EOF2'
+.entry ENTRY
+.extern EXT
+MAIN: mov K, @r1
+prn @r1
+jsr SUB
+stop
+DEAD: prn 99
+inc @r2
+SUB: prn L
+rts
+ENTRY: prn P
+jsr EXT
+stop
+K: .data 4
+UNUSED: .data 8, 9
+L: .data 6, 7
+P: .data Q
+Q: .data 3
+S: .string "ab"
+EOF2
+
+assemble prog
+[ "$STATUS" -eq 0 ] && [ -f prog.ob ] || fail "plain: not assembled"
+expect_count "^20 10$" prog.ob 1 "plain size"
+"$BIN_DIR/Simulator" prog > plain.txt 2>&1
+
+assemble --prune --xref prog
+expect_no_crash "pruned"
+[ "$STATUS" -eq 0 ] && [ -f prog.ob ] || fail "pruned: not assembled"
+"$BIN_DIR/Disassembler" prog > dis.txt
+# DEAD and its inc, UNUSED and S are gone
+expect_count "IC 16, DC 5" dis.txt 1 "pruned size"
+expect_count "prn 99" dis.txt 0 "unreachable instruction"
+expect_count "inc @r2" dis.txt 0 "unreachable instruction after it"
+expect_count "\.data [89]$" dis.txt 0 "unused .data"
+expect_count "\.string" dis.txt 0 "unused .string"
+# a label that is used keeps its whole block, and the code of an .entry label is kept
+expect_count "^   117 .* \.data 6$" dis.txt 1 "used .data"
+expect_count "^   118 .* \.data 7$" dis.txt 1 "rest of a used .data"
+expect_count "^   111 .* prn 119$" dis.txt 1 ".entry code"
+expect_count "^   105 .* jsr 108$" dis.txt 1 "moved jump"
+expect_count "^ENTRY	111$" prog.ent 1 "moved .entry"
+expect_count "^EXT	114$" prog.ext 1 "moved .extern use"
+expect_count "^SUB	5	106	dest$" prog.xref 1 "moved label use"
+expect_count "^L	9	109	dest$" prog.xref 1 "moved label use"
+"$BIN_DIR/Simulator" prog > pruned.txt 2>&1
+diff plain.txt pruned.txt > /dev/null || fail "pruned: the program prints something else"
+
+cp prog.ob expected.ob
+assemble --prune --stream prog
+cmp -s prog.ob expected.ob || fail "--stream: prog.ob differs"
+
+# --prune is part of the cache key
+assemble --cache-dir cache prog
+assemble --cache-dir cache --prune prog
+expect_count "up to date" out.txt 0 "cache: --prune"
+cmp -s prog.ob expected.ob || fail "cache: prog.ob is not the pruned one"
+
+# A jump through a register may go to any instruction, they are all kept
+printf 'MAIN: lea F, @r1\njmp @r1\nprn 9\nF: prn 1\nstop\n' > indirect.as
+assemble --prune indirect
+"$BIN_DIR/Disassembler" indirect > dis.txt
+expect_count "IC 10, DC 0" dis.txt 1 "jump through a register"
+
+# With -O, a jump over the removed words goes to the next instruction and is removed too
+printf 'MAIN: jmp X\nprn 9\ninc @r1\nX: stop\n' > over.as
+assemble --prune over
+"$BIN_DIR/Disassembler" over > dis.txt
+expect_count "IC 3, DC 0" dis.txt 1 "jump over removed words"
+assemble --prune -O over
+"$BIN_DIR/Disassembler" over > dis.txt
+expect_count "IC 1, DC 0" dis.txt 1 "-O --prune"
+expect_count "^   100 .* stop$" dis.txt 1 "-O --prune"
+
+finish
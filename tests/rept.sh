@@ -0,0 +1,78 @@
+# .rept N / .endr: the words of the body are assembled N times, nested blocks multiply, a count of 0
+# drops the body, and the label uses are replicated with the words
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > prog.as << 'EOF2'
+.define N 2
+MAIN: mov 0, @r1
+.rept N + 1
+inc @r1
+.rept 2
+prn @r1
+.endr
+.endr
+.rept 0
+prn 99
+.endr
+stop
+K: .data 1
+.rept 2
+.data K
+.endr
+EOF2
+
+assemble --xref prog
+[ "$STATUS" -eq 0 ] && [ -f prog.ob ] || fail "assemble: $(cat err.txt)"
+# mov: 3 words, 3 x inc: 6 words, 6 x prn: 12 words, stop
+expect_count "^22 3$" prog.ob 1 "IC and DC"
+"$BIN_DIR/Simulator" prog > sim.txt 2>&1
+printf '1\n1\n2\n2\n3\n3\n' | cmp -s - sim.txt || fail "Simulator: the program printed $(cat sim.txt)"
+expect_count "^K	15	123	data$" prog.xref 1 "label use of the first copy"
+expect_count "^K	15	124	data$" prog.xref 1 "label use of the second copy"
+
+cp prog.ob expected.ob
+assemble --stream prog
+cmp -s prog.ob expected.ob || fail "--stream: prog.ob differs"
+
+# The same words as the body written out
+awk 'BEGIN { print "MAIN: mov 0, @r1"
+             for (i = 0; i < 3; i++) print "inc @r1\nprn @r1\nprn @r1"
+             print "stop\nK: .data 1\n.data K\n.data K" }' > flat.as
+assemble flat
+cmp -s flat.ob expected.ob || fail "written out: flat.ob differs"
+
+# 8 levels of 2 are 256 copies
+awk 'BEGIN { for (i = 0; i < 8; i++) print ".rept 2"; print "prn 1"; for (i = 0; i < 8; i++) print ".endr"
+             print "stop" }' > deep.as
+assemble deep
+expect_count "^513 0$" deep.ob 1 "8 levels"
+
+# expect_error NAME MESSAGE: NAME.as is rejected with MESSAGE
+expect_error() {
+    assemble "$1"
+    expect_no_crash "$1"
+    expect_count "$2" err.txt 1 "$1"
+    [ ! -f "$1.ob" ] || fail "$1: $1.ob has been written"
+}
+
+printf 'prn 1\n.endr\nstop\n' > no_rept.as
+expect_error no_rept "no_rept.am - Missing opening '.rept' on line 2"
+printf '.rept 2\nprn 1\nstop\n' > no_endr.as
+expect_error no_endr "no_endr.am - Missing closing '.endr' for the '.rept' on line 1"
+printf '.rept -1\nprn 1\n.endr\nstop\n' > negative.as
+expect_error negative "negative.am - Invalid repeat count on line 1"
+printf '.rept\nprn 1\n.endr\nstop\n' > no_count.as
+expect_error no_count "no_count.am - Invalid repeat count on line 1"
+printf '.rept 2\nL: prn 1\n.endr\nstop\n' > label.as
+expect_error label "label.am - Label declaration inside a '.rept' block on line 2"
+awk 'BEGIN { for (i = 0; i < 9; i++) print ".rept 1"; print "prn 1"; for (i = 0; i < 9; i++) print ".endr" }' > too_deep.as
+expect_error too_deep "too_deep.am - Repeat blocks are nested too deep on line 9"
+
+# More words than the memory holds
+printf '.rept 600\nprn 1\n.endr\nstop\n' > big.as
+assemble big
+expect_no_crash "memory limit"
+expect_count "requires too much memory" err.txt 1 "memory limit"
+[ ! -f big.ob ] || fail "memory limit: big.ob has been written"
+
+finish
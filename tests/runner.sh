@@ -0,0 +1,79 @@
+# Runner: the jobs of the manifests run on worker threads that steal from each other, each one on a
+# freshly reset machine, and are reported in manifest order whatever the number of threads
+. "$(dirname "$0")/common.sh" "$1"
+
+# run_batch ARGS...: runs the runner for at most a minute, its output goes to run.txt, sets STATUS
+run_batch() {
+    timeout 60 "$BIN_DIR/Runner" "$@" > run.txt 2>&1
+    STATUS=$?
+}
+
+cat > echo.as << 'EOF2'
+red @r1
+prn @r1
+red @r1
+prn @r1
+stop
+EOF2
+
+cat > loop.as << 'EOF2'
+LOOP: jmp LOOP
+EOF2
+
+assemble echo loop
+[ "$STATUS" -eq 0 ] || fail "assemble: exited with status $STATUS"
+
+printf 'AB' > ab.in
+printf '65\n66\n' > ab.out
+printf '65\n67\n' > wrong.out
+printf -- '-1\n-1\n' > empty.out
+
+# Many short jobs, a few of them failing, keep every thread busy
+{
+    echo "# program input expected [steps]"
+    i=0
+    while [ $i -lt 40 ]; do
+        echo "echo ab.in ab.out"
+        echo "echo.ob - empty.out"
+        i=$((i + 1))
+    done
+    echo "echo ab.in wrong.out"
+    echo "loop - - 1000"
+    echo "echo missing.in -"
+} > jobs.txt
+
+run_batch --threads 4 jobs.txt
+expect_no_crash "4 threads"
+[ "$STATUS" -ne 0 ] || fail "4 threads: exited with status 0"
+expect_count "Runner - 80 of 83 job(s) passed" run.txt 1 "4 threads"
+expect_count "^PASS " run.txt 80 "4 threads: passed"
+expect_count "^FAIL .* echo ab.in wrong.out$" run.txt 1 "4 threads: output differs"
+expect_count "^LIMIT .* 1000 .* loop - -$" run.txt 1 "4 threads: step limit"
+expect_count "loop - Step limit reached at address 100" run.txt 1 "4 threads: step limit"
+expect_count "^ERROR .* echo missing.in -$" run.txt 1 "4 threads: missing input"
+
+# The same report, line by line, with a single thread
+grep -E '^(PASS|FAIL|LIMIT|ERROR) ' run.txt | awk '{ print $1, $2, $4, $5, $6 }' > threads4.txt
+run_batch --threads 1 jobs.txt
+grep -E '^(PASS|FAIL|LIMIT|ERROR) ' run.txt | awk '{ print $1, $2, $4, $5, $6 }' > threads1.txt
+cmp -s threads1.txt threads4.txt || fail "1 thread: the report differs from the one of 4 threads"
+
+# --steps is the limit of the jobs without one of their own
+printf 'echo ab.in ab.out\nloop - - 1000\n' > limits.txt
+run_batch --steps 3 limits.txt
+expect_count "Runner - 0 of 2 job(s) passed" run.txt 1 "--steps 3"
+expect_count "^LIMIT .* 3 .* echo ab.in ab.out$" run.txt 1 "--steps 3"
+
+# The jobs of several manifests are run as a single batch
+printf 'echo ab.in ab.out\n' > pass.txt
+run_batch pass.txt limits.txt
+expect_count "Runner - 2 of 3 job(s) passed" run.txt 1 "two manifests"
+
+run_batch pass.txt
+[ "$STATUS" -eq 0 ] || fail "passed: exited with status $STATUS"
+
+printf 'echo ab.in ab.out 10 extra\n' > bad.txt
+run_batch bad.txt
+expect_count "bad.txt - Invalid manifest line 1" run.txt 1 "invalid manifest"
+
+finish
@@ -0,0 +1,69 @@
+# --serve: the options of a request apply on top of the server's, but the server keeps its own modes and paths,
+# and a request includes files from its own directory and the server's -I directories only
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > lib.as << 'EOF2'
+mcro twice
+inc @r1
+inc @r1
+endmcro
+EOF2
+"$BIN_DIR/MacroCompiler" --output lib lib > out.txt 2> err.txt || fail "MacroCompiler: lib.mlib not written"
+printf 'twice\nstop\n' > prog.as
+
+"$BIN_DIR/Assembler" --macro-lib lib.mlib --serve "$WORK_DIR/as.sock" > serve.txt 2>&1 &
+server=$!
+tries=0
+while [ ! -S "$WORK_DIR/as.sock" ] && [ $tries -lt 50 ]; do sleep 0.1; tries=$((tries + 1)); done
+
+# the library of the request is not opened, the macros come from the server's
+timeout 10 "$BIN_DIR/asclient" --socket "$WORK_DIR/as.sock" --lsp --macro-lib missing.mlib prog > out.txt 2> err.txt
+STATUS=$?
+kill $server
+wait $server 2> /dev/null
+expect_no_crash "asclient --lsp --macro-lib"
+[ "$STATUS" -ne 124 ] || fail "asclient --lsp --macro-lib: no response"
+expect_count "macro library" err.txt 0 "asclient --macro-lib missing.mlib"
+[ -f prog.ob ] || fail "asclient --lsp --macro-lib: prog.ob not written"
+
+mkdir inc inc/sub secret
+printf 'inc @r1\n' > inc/ok.inc
+printf 'dec @r1\n' > inc/sub/deep.inc
+printf 'clr @r1\n' > secret/secret.inc
+ln -s "$WORK_DIR/secret/secret.inc" inc/link.inc
+
+"$BIN_DIR/Assembler" -I"$WORK_DIR/inc" --serve "$WORK_DIR/inc.sock" > serve.txt 2>&1 &
+server=$!
+tries=0
+while [ ! -S "$WORK_DIR/inc.sock" ] && [ $tries -lt 50 ]; do sleep 0.1; tries=$((tries + 1)); done
+
+# request INCLUDE ARGS...: assembles a program that includes INCLUDE through the server
+request() {
+    include=$1
+    shift
+    rm -f inc_prog.ob
+    printf '.include "%s"\nstop\n' "$include" > inc_prog.as
+    timeout 10 "$BIN_DIR/asclient" --socket "$WORK_DIR/inc.sock" "$@" inc_prog > out.txt 2> err.txt
+    STATUS=$?
+}
+
+request ok.inc
+[ -f inc_prog.ob ] || fail "include from the server -I directory: inc_prog.ob not written"
+request "$WORK_DIR/inc/ok.inc"
+[ -f inc_prog.ob ] || fail "absolute include in the server -I directory: inc_prog.ob not written"
+request deep.inc -I"$WORK_DIR/inc/sub"
+[ -f inc_prog.ob ] || fail "include from a request -I directory inside the server's: inc_prog.ob not written"
+
+request "$WORK_DIR/secret/secret.inc"
+expect_count "cannot be found" err.txt 1 "absolute include outside of the roots"
+[ ! -f inc_prog.ob ] || fail "absolute include outside of the roots: inc_prog.ob written"
+request link.inc
+expect_count "cannot be found" err.txt 1 "include of a link out of the roots"
+[ ! -f inc_prog.ob ] || fail "include of a link out of the roots: inc_prog.ob written"
+request secret.inc -I"$WORK_DIR/secret"
+expect_count "cannot be found" err.txt 1 "request -I directory outside of the roots"
+[ ! -f inc_prog.ob ] || fail "request -I directory outside of the roots: inc_prog.ob written"
+
+kill $server
+wait $server 2> /dev/null
+finish
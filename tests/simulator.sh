@@ -0,0 +1,41 @@
+# Simulator: a program that never stops is stopped by the default step limit, --steps sets another one
+. "$(dirname "$0")/common.sh" "$1"
+
+# simulate ARGS...: runs the simulator for at most a minute, its output goes to sim.txt, sets STATUS
+simulate() {
+    timeout 60 "$BIN_DIR/Simulator" "$@" > sim.txt 2>&1
+    STATUS=$?
+}
+
+cat > loop.as << 'EOF2'
+LOOP: jmp LOOP
+EOF2
+
+cat > count.as << 'EOF2'
+MAIN: mov 3, @r1
+NEXT: dec @r1
+cmp @r1, 0
+bne NEXT
+prn @r1
+stop
+EOF2
+
+assemble loop count
+[ "$STATUS" -eq 0 ] || fail "assemble: exited with status $STATUS"
+
+simulate loop
+[ "$STATUS" -ne 124 ] || fail "default limit: the program has not been stopped"
+expect_count "loop - Step limit reached at address 100" sim.txt 1 "default limit"
+
+simulate --stats count
+expect_count "^0$" sim.txt 1 "default limit: a program that stops"
+expect_count "count - Program stopped after 12 instruction(s)" sim.txt 1 "default limit: a program that stops"
+
+simulate --steps 5 count
+expect_count "count - Step limit reached at address" sim.txt 1 "--steps 5"
+expect_count "^0$" sim.txt 0 "--steps 5"
+
+simulate --steps 12 count
+expect_count "^0$" sim.txt 1 "--steps 12"
+
+finish
@@ -0,0 +1,66 @@
+# --stream: the words spilled while parsing give the same outputs as the image held in memory
+. "$(dirname "$0")/common.sh" "$1"
+
+OUTPUTS="ob ent ext"
+
+# same_outputs NAME WHAT ARGS...: assembles NAME.as without and with --stream, compares the outputs
+same_outputs() {
+    name=$1
+    what=$2
+    shift 2
+    assemble "$@" "$name"
+    [ "$STATUS" -eq 0 ] && [ -f "$name.ob" ] || fail "$what: $name.ob has not been written"
+    mkdir expected
+    for ext in $OUTPUTS; do
+        mv "$name.$ext" expected/ 2> /dev/null
+    done
+    assemble --stream "$@" "$name"
+    expect_no_crash "$what"
+    for ext in $OUTPUTS; do
+        if [ -f "expected/$name.$ext" ]; then
+            cmp -s "$name.$ext" "expected/$name.$ext" || fail "$what: $name.$ext differs with --stream"
+        else
+            [ ! -f "$name.$ext" ] || fail "$what: $name.$ext has been written with --stream only"
+        fi
+    done
+    rm -r expected
+}
+
+# Forward and backward references, externals, data referenced by instructions and by .data
+cat > refs.as << 'EOF2'
+.extern EXT
+.entry MAIN
+.entry K
+MAIN: mov K, @r1
+lea STR, @r2
+jsr EXT
+cmp EXT, 3
+bne MAIN
+jmp END
+K: .data 300, -2
+STR: .string "stream"
+END: prn K+1
+stop
+V: .data K
+EOF2
+same_outputs refs "references"
+same_outputs refs "references, -O" -O
+
+# Most words are complete as soon as they are parsed, they leave the memory right away
+awk 'BEGIN {
+    print ".entry START"
+    print "START: mov 1, @r1"
+    for (i = 0; i < 200; i++) printf "L%d: add 2, @r1\nprn @r1\n", i
+    print "jmp START"
+    print "stop"
+    for (i = 0; i < 100; i++) printf ".data %d\n", i
+}' > large.as
+same_outputs large "large program"
+
+# An error is still reported, and no output is left behind
+printf 'MAIN: prn 1\nmov 1\nstop\n' > bad.as
+assemble --stream bad
+expect_count "Missing operand(s) on line 2" err.txt 1 "error"
+[ ! -f bad.ob ] || fail "error: bad.ob has been written"
+
+finish
@@ -0,0 +1,60 @@
+# --xref: NAME.xref lists every use of a label with its line, the address of the word that holds it
+# and its operand slot, the same with --stream and when re-emitted from the .aobj file
+. "$(dirname "$0")/common.sh" "$1"
+
+cat > prog.as << 'EOF2'
+.extern EXT
+.entry MAIN
+mcro load
+mov K, @r1
+endmcro
+MAIN: load
+jsr EXT
+cmp EXT, K
+lea S, K
+bne MAIN
+stop
+K: .data 4
+V: .data K
+S: .string "x"
+UNUSED: .data 1
+EOF2
+
+assemble --xref prog
+[ "$STATUS" -eq 0 ] && [ -f prog.xref ] || fail "assemble: prog.xref has not been written"
+expect_count "	" prog.xref 8 "one line per use"
+# the lines are the ones of the .am file
+expect_count "^K	3	101	src$" prog.xref 1 "operand of an expanded macro"
+expect_count "^EXT	4	104	dest$" prog.xref 1 "external operand"
+expect_count "^EXT	5	106	src$" prog.xref 1 "external source operand"
+expect_count "^K	5	107	dest$" prog.xref 1 "destination operand"
+expect_count "^S	6	109	src$" prog.xref 1 "lea operand"
+expect_count "^K	6	110	dest$" prog.xref 1 "lea operand"
+expect_count "^MAIN	7	112	dest$" prog.xref 1 "backward reference"
+expect_count "^K	10	115	data$" prog.xref 1 ".data value"
+expect_count "^UNUSED	" prog.xref 0 "unused label"
+expect_count "^[A-Z]*	[0-9]*	[0-9]*	\(src\|dest\|data\)$" prog.xref 8 "format"
+cp prog.xref expected.xref
+
+assemble --xref --stream prog
+cmp -s prog.xref expected.xref || fail "--stream: prog.xref differs"
+
+assemble --aobj prog
+rm prog.xref
+assemble --from-aobj --xref prog
+cmp -s prog.xref expected.xref || fail "--from-aobj: prog.xref differs"
+
+# Without --xref no .xref is written
+rm prog.xref
+assemble prog
+[ ! -f prog.xref ] || fail "no --xref: prog.xref has been written"
+
+# The label of an instruction has no value to copy into .data
+printf 'MAIN: stop\nK: .data 4, MAIN\n' > bad.as
+assemble --xref bad
+expect_no_crash ".data of a code label"
+expect_count "bad.am - Label (MAIN) is being declared/used in a forbidden context on line 2" err.txt 1 \
+    ".data of a code label"
+[ ! -f bad.xref ] || fail ".data of a code label: bad.xref has been written"
+
+finish
@@ -32,6 +32,9 @@ const char *commands[COMMANDS_LEN] = {
     "stop"
 };
 
+/* Command line options, shared by all the assembler stages */
+assembler_options options = {0};
+
 /**
  * Creates a file context object, add extension to file name,
  * and opens the file in the specified mode.
@@ -79,6 +82,7 @@ file_context* create_file_context(const char* file_name, char* ext, size_t ext_l
     fc->file_ptr = NULL;
     fc->tc = 0;
     fc->tc = 0;
+    fc->is_scratch = 0;
 
     copy_n_string(&fc->file_name, file_name_w_ext, len);
     free(file_name_w_ext);
@@ -97,6 +101,50 @@ file_context* create_file_context(const char* file_name, char* ext, size_t ext_l
     return fc;
 }
 
+/**
+ * Creates a file context backed by an anonymous temporary file (tmpfile()) instead of a named file.
+ * The file name is still set, so diagnostics refer to the file that would have been generated.
+ *
+ * @param file_name The name of the file, without extension.
+ * @param ext The extension to append to the file name.
+ * @param report Pointer to the status report variable.
+ * @return A pointer to the created file context object if successful, NULL otherwise.
+ */
+file_context* create_scratch_context(const char* file_name, char* ext, status *report) {
+    file_context* fc = malloc(sizeof(file_context));
+
+    if (!fc) {
+        *report = ERR_MEM_ALLOC;
+        return NULL;
+    }
+
+    fc->file_ptr = NULL;
+    fc->file_name = malloc(strlen(file_name) + strlen(ext) + 1);
+    fc->file_name_wout_ext = strdup(file_name);
+
+    if (!fc->file_name || !fc->file_name_wout_ext) {
+        *report = ERR_MEM_ALLOC;
+        free_file_context(&fc);
+        return NULL;
+    }
+
+    strcpy(fc->file_name, file_name);
+    strcat(fc->file_name, ext);
+    fc->lc = 1; /* line starts from 1 */
+    fc->tc = fc->fc = 0;
+    fc->is_scratch = 1;
+
+    if (!(fc->file_ptr = tmpfile())) {
+        handle_error(ERR_OPEN_FILE, fc);
+        *report = ERR_OPEN_FILE;
+        free_file_context(&fc);
+        return NULL;
+    }
+
+    *report = NO_ERROR;
+    return fc;
+}
+
 /**
  * Finds the length of the consecutive characters in a word, skipping leading white spaces.
  * Updates the pointer to point to the start of the word.
@@ -207,6 +255,21 @@ int safe_atoi(const char *str) {
     return result * sign;
 }
 
+/**
+ * Checks that a canonical path is a directory or is inside it, at any depth.
+ *
+ * @param path  The canonical path, see realpath().
+ * @param dir   The canonical path of the directory.
+ * @return 1 if the path is within the directory, 0 otherwise.
+ */
+int is_path_within(const char *path, const char *dir) {
+    size_t len = strlen(dir);
+
+    while (len > 1 && dir[len - 1] == '/')
+        len--;
+    return strncmp(path, dir, len) == 0 && (path[len] == '/' || !path[len] || len == 1);
+}
+
 /**
  * Validates if the given string is a valid register.
  *
@@ -306,12 +369,16 @@ status is_valid_label(const char *label) {
  * @param word The string to validate as a data value.
  * @param length The length of the word.
  * @param report Pointer to the status report.
- * @return The type of the data value (LBL, NUM, STR, or INV) if valid, or INV if invalid.
+ * @return The type of the data value (LBL, NUM, EXP, or INV) if valid, or INV if invalid.
  */
 Value validate_data(file_context *src, char *word, size_t length, status *report) {
     char *p_word = NULL;
     status temp_report;
 
+    if (*word == '(' || strpbrk(word + 1, EXPRESSION_OPERATORS)
+        || ((*word == '+' || *word == '-') && !isdigit(word[1])))
+        return EXP; /* checked by evaluate_expression() */
+
     if (*word == '+' || *word == '-')
         word++;
 
@@ -550,6 +617,42 @@ Command is_command(const char* src) {
     return INV_CMD;
 }
 
+/**
+ * Hashes a label (FNV-1a), for the open addressing symbol tables.
+ *
+ * @param label The label.
+ * @return The hash value.
+ */
+unsigned long hash_label(const char *label) {
+    unsigned long hash = FNV_OFFSET_BASIS;
+
+    for (; *label; label++)
+        hash = ((hash ^ (unsigned char)*label) * FNV_PRIME) & HASH_MASK;
+    return hash;
+}
+
+/**
+ * Probes an open addressing table of labels, linearly from the hash_label() of the label.
+ * The tables keep at most half of their slots full, a probe ends at the label or at an empty slot;
+ * a table read from a file may be full, the probe then ends once every slot has been visited.
+ *
+ * @param table     The table, passed to label_of.
+ * @param cap       The number of slots, a power of 2.
+ * @param label     The label.
+ * @param label_of  Reads the label of a slot.
+ * @return The slot that holds the label, or the empty slot it would be inserted at,
+ *         cap if the table is full and does not hold it.
+ */
+size_t find_label_slot(const void *table, size_t cap, const char *label, slot_label_reader label_of) {
+    const char *held = NULL;
+    size_t slot = hash_label(label) & (cap - 1), probes;
+
+    for (probes = 0; probes < cap; probes++, slot = (slot + 1) & (cap - 1))
+        if (!(held = label_of(table, slot)) || strcmp(held, label) == 0)
+            return slot;
+    return cap;
+}
+
 /**
  * Duplicates a string by allocating memory and copying the contents of the original string.
  *
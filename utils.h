@@ -10,6 +10,20 @@
 #define DIRECTIVE_LEN 4
 #define COMMANDS_LEN 16
 #define MAX_BUFFER_LENGTH 256
+#define ASSEMBLER_VERSION "1.1"
+#define OPTION_PREFIX '-'
+#define DEFINE_PREFIX "-D"
+#define MAX_DEFINES 64
+#define INCLUDE_PREFIX "-I"
+#define MAX_INCLUDE_DIRS 16
+#define MAX_INCLUDE_ROOTS (MAX_INCLUDE_DIRS + 1)
+#define OPTIMIZE_OPTION "-O"
+#define PRUNE_OPTION "--prune"
+#define EXPRESSION_OPERATORS "+-*/()"
+
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+#define HASH_MASK 0xFFFFFFFFUL
 
 #define FILE_MODE_READ "r"
 #define FILE_MODE_WRITE_PLUS "w+"
@@ -18,6 +32,8 @@
 #define OBJECT_EXT  ".ob"
 #define ENTRY_EXT  ".ent"
 #define EXTERNAL_EXT ".ext"
+#define DEBUG_EXT ".dbg"
+#define XREF_EXT ".xref"
 
 extern const char *directives[DIRECTIVE_LEN];
 extern const char *commands[COMMANDS_LEN];
@@ -32,7 +48,8 @@ typedef enum {
     LBL,
     NUM,
     STR,
-    INV
+    INV,
+    EXP /* a constant expression, see expr.h */
 } Value;
 
 typedef enum {
@@ -40,7 +57,9 @@ typedef enum {
     STRING,
     ENTRY,
     EXTERN,
-    DEFAULT /* for .obj */
+    DEFAULT, /* for .obj */
+    DEBUG_INFO, /* for .dbg */
+    XREF_INFO /* for .xref */
 } Directive;
 
 typedef enum {
@@ -77,6 +96,32 @@ typedef enum {
     QUOTE
 } Delimiter;
 
+typedef struct {
+    int stream_output; /* --stream: spill complete words while parsing instead of holding the whole image */
+    char *cache_dir; /* --cache-dir: directory of the content-hash build cache (optional - NULL) */
+    long cache_max_size; /* --cache-size: cache size limit in bytes, 0 for the default */
+    int check_only; /* --check: diagnostics only, no intermediate or output file is written */
+    int max_errors; /* --max-errors: stop processing a file after this many errors, 0 for no limit */
+    char *diag_json; /* --diag-json: file that diagnostics are appended to as JSON lines (optional - NULL) */
+    char *serve_path; /* --serve: Unix socket to accept assemble requests on (optional - NULL) */
+    int workers; /* --workers: number of --serve or --project worker processes, 0 for the default */
+    int debug_info; /* --debug-info: also write the .dbg source map of every word and symbol */
+    char *project; /* --project: assemble the files in parallel and link them in memory into NAME.ob (optional) */
+    int write_aobj; /* --aobj: also write the .aobj file, the state of the program after the first pass */
+    int from_aobj; /* --from-aobj: re-emit the outputs from an up to date .aobj file instead of assembling */
+    int lsp; /* --lsp: run as a language server over stdin and stdout */
+    int xref; /* --xref: also write the .xref cross-reference of every label use */
+    char *defines[MAX_DEFINES]; /* -DNAME[=VALUE]: names for conditional assembly, "NAME" or "NAME=VALUE" */
+    int defines_count;
+    char *include_dirs[MAX_INCLUDE_DIRS]; /* -IDIR: directories searched for .include files, in order */
+    int include_dirs_count;
+    char *include_roots[MAX_INCLUDE_ROOTS]; /* --serve: canonical directories an included file must be in */
+    int include_roots_count; /* 0 for no restriction */
+    char *macro_lib; /* --macro-lib: precompiled macro library (.mlib) mapped into memory (optional - NULL) */
+    int optimize; /* -O: peephole pass over the whole image before the outputs are written, see optimizer.h */
+    int prune; /* --prune: remove the unreachable instructions and the unused data, see optimizer.h */
+} assembler_options;
+
 typedef struct {
     FILE* file_ptr;
     char* file_name;
@@ -84,13 +129,22 @@ typedef struct {
     int lc; /* Line counter */
     int tc; /* total num of files counter */
     int fc; /* file counter (x out of tc) */
+    int is_scratch; /* backed by tmpfile(), there is nothing to remove from the disk */
 } file_context;
 
+/* The label held by a slot of an open addressing table, NULL for an empty slot (see find_label_slot()) */
+typedef const char *(*slot_label_reader)(const void *table, size_t slot);
+
+extern assembler_options options;
+
 
 char *strdup(const char *s);
 char* has_spaces_string(char **line, size_t *word_len, status *report);
 
 int safe_atoi(const char *str);
+int is_path_within(const char *path, const char *dir);
+unsigned long hash_label(const char *label);
+size_t find_label_slot(const void *table, size_t cap, const char *label, slot_label_reader label_of);
 int is_valid_register(file_context *src, const char* str, status *report);
 
 void free_file_context(file_context** context);
@@ -111,4 +165,5 @@ Command is_command(const char* src);
 Directive is_directive(const char* src);
 
 file_context* create_file_context(const char* file_name, char* ext, size_t ext_len, char* mode, status *report);
+file_context* create_scratch_context(const char* file_name, char* ext, status *report);
 #endif